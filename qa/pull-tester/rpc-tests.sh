@@ -36,6 +36,10 @@ testScripts=(
     'nodehandling.py'
     'reindex.py'
     'decodescript.py'
+    'notifications.py'
+    'addressindex.py'
+    'blockfilters.py'
+    'rpcbatch.py'
 );
 testScriptsExt=(
     'bipdersig-p2p.py'
@@ -0,0 +1,108 @@
+#!/usr/bin/env python2
+# Copyright (c) 2015 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the address and spent indexes, and getindexinfo
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+class AddressIndexTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self, split=False):
+        self.nodes = []
+        self.nodes.append(start_node(0, self.options.tmpdir, ["-debug", "-addressindex", "-spentindex"]))
+        self.nodes.append(start_node(1, self.options.tmpdir, ["-debug"]))
+        connect_nodes_bi(self.nodes,0,1)
+        self.is_network_split=False
+        self.sync_all()
+
+    def wait_for_index(self, node):
+        tip = node.getbestblockhash()
+        for i in range(100):
+            info = node.getindexinfo()["address"]
+            if info["synced"] and info["bestblock"] == tip:
+                return info
+            time.sleep(0.1)
+        raise AssertionError("address index did not sync: %s" % str(node.getindexinfo()))
+
+    def run_test(self):
+        node = self.nodes[0]
+
+        print "Blocks are indexed in the background"
+        self.nodes[1].generate(101)
+        self.sync_all()
+        info = self.wait_for_index(node)
+        assert_equal(info["height"], 101)
+        assert("error" not in info)
+
+        print "Outputs and the inputs spending them are indexed"
+        address = node.getnewaddress()
+        unspent = self.nodes[1].listunspent()[0]
+        txid = self.nodes[1].sendtoaddress(address, 10)
+        self.sync_all()
+        self.nodes[1].generate(1)
+        self.sync_all()
+        self.wait_for_index(node)
+        deltas = node.getaddressdeltas(address)
+        assert_equal(len(deltas), 1)
+        assert_equal(deltas[0]["txid"], txid)
+        assert_equal(deltas[0]["height"], 102)
+        assert_equal(deltas[0]["amount"], 10)
+        assert_equal(deltas[0]["spending"], False)
+        spent = node.getspentinfo(unspent["txid"], unspent["vout"])
+        assert_equal(spent["txid"], txid)
+        assert_equal(spent["height"], 102)
+
+        vout = [u["vout"] for u in node.listunspent() if u["txid"] == txid][0]
+        spendtxid = node.sendtoaddress(self.nodes[1].getnewaddress(), 5)
+        node.generate(1)
+        self.sync_all()
+        self.wait_for_index(node)
+        deltas = node.getaddressdeltas(address)
+        assert_equal(len(deltas), 2)
+        assert_equal(deltas[1]["txid"], spendtxid)
+        assert_equal(deltas[1]["amount"], -10)
+        assert_equal(deltas[1]["spending"], True)
+        assert_equal(len(node.getaddressdeltas(address, 103)), 1)
+        assert_equal(len(node.getaddressdeltas(address, 0, 102)), 1)
+        balance = node.getaddressbalance(address)
+        assert_equal(balance["balance"], 0)
+        assert_equal(balance["received"], 10)
+        assert_equal(node.getspentinfo(txid, vout)["txid"], spendtxid)
+
+        print "Disconnected blocks are removed from the index"
+        spendblock = node.getbestblockhash()
+        node.invalidateblock(spendblock)
+        info = self.wait_for_index(node)
+        assert_equal(info["height"], 102)
+        assert_equal(len(node.getaddressdeltas(address)), 1)
+        assert_equal(node.getaddressbalance(address)["balance"], 10)
+        assert_raises(JSONRPCException, node.getspentinfo, txid, vout)
+
+        print "A reorg to a longer chain is followed"
+        node.reconsiderblock(spendblock)
+        self.sync_all()
+        self.nodes[1].invalidateblock(spendblock)
+        self.nodes[1].generate(3)
+        sync_blocks(self.nodes)
+        info = self.wait_for_index(node)
+        assert_equal(info["height"], 105)
+        for delta in node.getaddressdeltas(address):
+            assert(delta["height"] <= 105)
+            assert(node.getblockhash(delta["height"]) != spendblock)
+        assert_equal(node.getspentinfo(unspent["txid"], unspent["vout"])["txid"], txid)
+
+        print "Invalid height ranges are rejected"
+        assert_raises(JSONRPCException, node.getaddressdeltas, address, 10, 5)
+        assert_raises(JSONRPCException, node.getaddressdeltas, address, -1)
+
+if __name__ == '__main__':
+    AddressIndexTest().main()
@@ -0,0 +1,193 @@
+#!/usr/bin/env python2
+# Copyright (c) 2015 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the block filter index: the getcfilters, getcfheaders and getcfcheckpt
+# p2p messages, the getblockfilter RPC and the REST interface
+#
+
+from test_framework.mininode import *
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+import binascii
+import json
+import time
+
+try:
+    import http.client as httplib
+except ImportError:
+    import httplib
+try:
+    import urllib.parse as urlparse
+except ImportError:
+    import urlparse
+
+CFCHECKPT_INTERVAL = 1000
+
+def http_get_call(host, port, path):
+    conn = httplib.HTTPConnection(host, port)
+    conn.request('GET', path)
+    return conn.getresponse().read()
+
+def filter_header(filter_data, prev_header):
+    filter_hash = uint256_from_str(hash256(filter_data))
+    return uint256_from_str(hash256(ser_uint256(filter_hash) + ser_uint256(prev_header)))
+
+# Collects the block filter messages the node sends
+class FilterNode(NodeConnCB):
+    def __init__(self):
+        NodeConnCB.__init__(self)
+        self.create_callback_map()
+        self.connection = None
+        self.ping_counter = 1
+        self.last_pong = msg_pong()
+        self.cfilters = []
+        self.last_cfheaders = None
+        self.last_cfcheckpt = None
+        self.closed = False
+
+    def add_connection(self, conn):
+        self.connection = conn
+
+    def wait_for_verack(self):
+        while True:
+            with mininode_lock:
+                if self.verack_received:
+                    return
+            time.sleep(0.05)
+
+    def send_message(self, message):
+        self.connection.send_message(message)
+
+    def on_pong(self, conn, message):
+        self.last_pong = message
+
+    def on_cfilter(self, conn, message):
+        self.cfilters.append(message)
+
+    def on_cfheaders(self, conn, message):
+        self.last_cfheaders = message
+
+    def on_cfcheckpt(self, conn, message):
+        self.last_cfcheckpt = message
+
+    def on_close(self, conn):
+        self.closed = True
+
+    # The node answers in order, so everything asked before the ping has
+    # arrived once the pong has
+    def sync_with_ping(self, timeout=30):
+        self.connection.send_message(msg_ping(nonce=self.ping_counter))
+        received_pong = False
+        sleep_time = 0.05
+        while not received_pong and timeout > 0:
+            time.sleep(sleep_time)
+            timeout -= sleep_time
+            with mininode_lock:
+                if self.last_pong.nonce == self.ping_counter:
+                    received_pong = True
+        self.ping_counter += 1
+        return received_pong
+
+class BlockFiltersTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self, split=False):
+        self.nodes = []
+        self.nodes.append(start_node(0, self.options.tmpdir, ["-debug", "-blockfilterindex", "-peerblockfilters"]))
+        self.is_network_split=False
+
+    def wait_for_index(self, node):
+        tip = node.getbestblockhash()
+        for i in range(300):
+            info = node.getindexinfo()["basicfilter"]
+            if info["synced"] and info["bestblock"] == tip:
+                return info
+            time.sleep(0.1)
+        raise AssertionError("block filter index did not sync: %s" % str(node.getindexinfo()))
+
+    def run_test(self):
+        node = self.nodes[0]
+        url = urlparse.urlparse(node.url)
+
+        print "Mining blocks..."
+        node.generate(CFCHECKPT_INTERVAL + 10)
+        info = self.wait_for_index(node)
+        assert_equal(info["height"], CFCHECKPT_INTERVAL + 10)
+        hashes = [node.getblockhash(i) for i in range(CFCHECKPT_INTERVAL + 11)]
+        stop_hash = int(hashes[CFCHECKPT_INTERVAL], 16)
+
+        print "The filter headers chain up from the genesis block"
+        filters = {}
+        prev_header = 0
+        for i in range(CFCHECKPT_INTERVAL + 11):
+            result = node.getblockfilter(hashes[i])
+            filters[i] = binascii.unhexlify(result["filter"])
+            prev_header = filter_header(filters[i], prev_header)
+            assert_equal(prev_header, int(result["header"], 16))
+        assert_raises(JSONRPCException, node.getblockfilter, hashes[0], "unknown")
+
+        test_node = FilterNode()
+        connection = NodeConn('127.0.0.1', p2p_port(0), node, test_node)
+        test_node.add_connection(connection)
+        NetworkThread().start()
+        test_node.wait_for_verack()
+
+        print "getcfcheckpt returns a header every %d blocks" % CFCHECKPT_INTERVAL
+        test_node.send_message(msg_getcfcheckpt(0, stop_hash))
+        assert(test_node.sync_with_ping())
+        with mininode_lock:
+            checkpt = test_node.last_cfcheckpt
+        assert_equal(checkpt.stop_hash, stop_hash)
+        assert_equal(checkpt.headers, [int(node.getblockfilter(hashes[CFCHECKPT_INTERVAL])["header"], 16)])
+
+        print "getcfheaders returns the filter hashes after the previous header"
+        test_node.send_message(msg_getcfheaders(0, 1, stop_hash))
+        assert(test_node.sync_with_ping())
+        with mininode_lock:
+            cfheaders = test_node.last_cfheaders
+        assert_equal(cfheaders.stop_hash, stop_hash)
+        assert_equal(cfheaders.prev_header, int(node.getblockfilter(hashes[0])["header"], 16))
+        assert_equal(len(cfheaders.hashes), CFCHECKPT_INTERVAL)
+        header = cfheaders.prev_header
+        for i in range(CFCHECKPT_INTERVAL):
+            assert_equal(cfheaders.hashes[i], uint256_from_str(hash256(filters[i + 1])))
+            header = uint256_from_str(hash256(ser_uint256(cfheaders.hashes[i]) + ser_uint256(header)))
+        assert_equal(header, checkpt.headers[0])
+
+        print "getcfilters returns the stored filters as they are"
+        start_height = CFCHECKPT_INTERVAL - 100
+        test_node.send_message(msg_getcfilters(0, start_height, stop_hash))
+        assert(test_node.sync_with_ping())
+        with mininode_lock:
+            cfilters = test_node.cfilters
+        assert_equal(len(cfilters), 101)
+        for i in range(len(cfilters)):
+            assert_equal(cfilters[i].filter_type, 0)
+            assert_equal(cfilters[i].block_hash, int(hashes[start_height + i], 16))
+            assert_equal(cfilters[i].filter_data, filters[start_height + i])
+
+        print "The REST interface returns the same filters and headers"
+        json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/blockfilter/basic/'+hashes[5]+'.json'))
+        assert_equal(json_obj, node.getblockfilter(hashes[5]))
+        hex_string = http_get_call(url.hostname, url.port, '/rest/blockfilter/basic/'+hashes[5]+'.hex')
+        assert_equal(binascii.unhexlify(hex_string.strip()), filters[5])
+        json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/blockfilterheaders/basic/5/'+hashes[1]+'.json'))
+        assert_equal(json_obj, [node.getblockfilter(hashes[i])["header"] for i in range(1, 6)])
+
+        print "A request for an unknown filter type disconnects the peer"
+        test_node.send_message(msg_getcfilters(1, 0, stop_hash))
+        for i in range(100):
+            with mininode_lock:
+                if test_node.closed:
+                    break
+            time.sleep(0.1)
+        assert(test_node.closed)
+
+if __name__ == '__main__':
+    BlockFiltersTest().main()
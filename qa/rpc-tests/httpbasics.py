@@ -98,5 +98,20 @@ class HTTPBasicsTest (BitcoinTestFramework):
         assert_equal('"error":null' in out1, True)
         assert_equal(conn.sock!=None, True) #connection must be closed because bitcoind should use keep-alive by default
 
+        #########################################
+        # RPC statistics served at /metrics     #
+        #########################################
+        conn = httplib.HTTPConnection(urlNode2.hostname, urlNode2.port)
+        conn.request('GET', '/metrics')
+        assert_equal(conn.getresponse().status, 401) #the RPC credentials are required
+
+        conn = httplib.HTTPConnection(urlNode2.hostname, urlNode2.port)
+        conn.request('GET', '/metrics', '', headers)
+        response = conn.getresponse()
+        assert_equal(response.status, 200)
+        out1 = response.read()
+        assert_equal('bitcoind_rpc_calls_total{method="getbestblockhash"} ' in out1, True)
+        assert_equal('bitcoind_rpc_duration_seconds_count{method="getbestblockhash"} ' in out1, True)
+
 if __name__ == '__main__':
     HTTPBasicsTest ().main ()
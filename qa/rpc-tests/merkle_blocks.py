@@ -83,6 +83,8 @@ class MerkleBlockTest(BitcoinTestFramework):
         except JSONRPCException:
             assert_equal(self.nodes[2].verifytxoutproof(self.nodes[2].gettxoutproof([txid2, txid1])), txlist)
         # ...or if we have a -txindex
+        while not self.nodes[3].getindexinfo()["tx"]["synced"]:
+            time.sleep(0.1)
         assert_equal(self.nodes[2].verifytxoutproof(self.nodes[3].gettxoutproof([txid_spent])), [txid_spent])
 
 if __name__ == '__main__':
@@ -0,0 +1,103 @@
+#!/usr/bin/env python2
+# Copyright (c) 2015 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test waitfornotifications and the REST notification stream
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+import json
+
+try:
+    import http.client as httplib
+except ImportError:
+    import httplib
+try:
+    import urllib.parse as urlparse
+except ImportError:
+    import urlparse
+
+def read_line(response):
+    line = b""
+    while not line.endswith(b"\n"):
+        c = response.read(1)
+        if not c:
+            raise AssertionError("notification stream closed")
+        line += c
+    return line.decode("utf-8").strip()
+
+class NotificationsTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(1, self.options.tmpdir, [["-rest", "-rpcnotifyqueue=4", "-rpcservertimeout=5"]])
+        self.is_network_split=False
+
+    def run_test(self):
+        node = self.nodes[0]
+
+        print "Blocks are reported as they are connected"
+        result = node.waitfornotifications(0, 0)
+        assert_equal(result["missed"], False)
+        assert_equal(len(result["events"]), 1)
+        assert_equal(result["events"][0]["type"], "block")
+        hashes = node.generate(2)
+        result = node.waitfornotifications(result["sequence"], 0)
+        assert_equal([e["hash"] for e in result["events"]], hashes)
+        assert_equal([e["height"] for e in result["events"]], [1, 2])
+        sequence = result["sequence"]
+
+        print "Nothing new: the timeout is capped to -rpcservertimeout"
+        start = time.time()
+        result = node.waitfornotifications(sequence, 3600)
+        assert(time.time() - start < 30)
+        assert_equal(result["sequence"], sequence)
+        assert_equal(result["events"], [])
+
+        print "Disconnected blocks are reported too"
+        node.invalidateblock(hashes[1])
+        result = node.waitfornotifications(sequence, 0)
+        assert_equal(len(result["events"]), 1)
+        assert_equal(result["events"][0]["type"], "blockdisconnected")
+        assert_equal(result["events"][0]["hash"], hashes[1])
+        assert_equal(result["events"][0]["height"], 2)
+        sequence = result["sequence"]
+
+        print "Old events are dropped"
+        result = node.waitfornotifications(0, 0)
+        assert_equal(result["missed"], True)
+        assert_equal(len(result["events"]), 4)
+
+        print "The REST stream sends one event per line"
+        url = urlparse.urlparse(node.url)
+        conn = httplib.HTTPConnection(url.hostname, url.port)
+        conn.request('GET', '/rest/notifications/' + str(sequence) + '.json')
+        response = conn.getresponse()
+        assert_equal(response.status, 200)
+        assert_equal(read_line(response), "")
+        hashes = node.generate(1)
+        line = ""
+        while line == "":
+            line = read_line(response)
+        event = json.loads(line)
+        assert_equal(event["type"], "block")
+        assert_equal(event["hash"], hashes[0])
+        assert_equal(event["sequence"], sequence + 1)
+        conn.close()
+
+        print "Unknown formats and sequence numbers are rejected"
+        conn = httplib.HTTPConnection(url.hostname, url.port)
+        conn.request('GET', '/rest/notifications/x.json')
+        assert_equal(conn.getresponse().status, 400)
+        conn = httplib.HTTPConnection(url.hostname, url.port)
+        conn.request('GET', '/rest/notifications.bin')
+        assert_equal(conn.getresponse().status, 404)
+
+if __name__ == '__main__':
+    NotificationsTest().main()
@@ -271,6 +271,32 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(response_header_json_str)
         assert_equal(len(json_obj), 5) #now we should have 5 header objects
 
+        #####################
+        # /rest/blockrange/ #
+        #####################
+
+        bb_height = self.nodes[0].getblock(bb_hash)['height']
+        raw_blocks = [self.nodes[0].getblock(self.nodes[0].getblockhash(bb_height+i), False) for i in range(0, 6)]
+
+        # binary format is the plain concatenation of the serialized blocks
+        response = http_get_call(url.hostname, url.port, '/rest/blockrange/'+str(bb_height)+'/5'+self.FORMAT_SEPARATOR+"bin", "", True)
+        assert_equal(response.status, 200)
+        assert_equal(response.read(), binascii.unhexlify("".join(raw_blocks[0:5])))
+
+        # hex format has one block per line; the range stops at the tip
+        response = http_get_call(url.hostname, url.port, '/rest/blockrange/'+str(bb_height)+'/100'+self.FORMAT_SEPARATOR+"hex", "", True)
+        assert_equal(response.status, 200)
+        assert_equal(response.read().split("\n")[0:-1], raw_blocks)
+
+        response = http_get_call(url.hostname, url.port, '/rest/blockrange/'+str(bb_height+6)+'/1'+self.FORMAT_SEPARATOR+"bin", "", True)
+        assert_equal(response.status, 404) #height beyond the tip
+
+        response = http_get_call(url.hostname, url.port, '/rest/blockrange/'+str(bb_height)+'/2001'+self.FORMAT_SEPARATOR+"bin", "", True)
+        assert_equal(response.status, 400) #count out of range
+
+        response = http_get_call(url.hostname, url.port, '/rest/blockrange/'+str(bb_height)+'/1'+self.FORMAT_SEPARATOR+"json", "", True)
+        assert_equal(response.status, 404) #json is not supported
+
         # do tx test
         tx_hash = block_json_obj['tx'][0]['txid'];
         json_string = http_get_call(url.hostname, url.port, '/rest/tx/'+tx_hash+self.FORMAT_SEPARATOR+"json")
@@ -0,0 +1,100 @@
+#!/usr/bin/env python2
+# Copyright (c) 2015 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test JSON-RPC batch requests: runs of okParallel calls are executed
+# concurrently, other calls act as barriers, and the replies come back in
+# request order with their ids and per-element errors
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+def call(method, params, id):
+    return {'version': '1.1', 'method': method, 'params': params, 'id': id}
+
+class RPCBatchTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(1, self.options.tmpdir, [["-rpcbatchthreads=4"]])
+        self.is_network_split = False
+
+    def run_test(self):
+        node = self.nodes[0]
+        node.generate(10)
+        hashes = [node.getblockhash(i) for i in range(11)]
+
+        print "Replies to a run of parallel calls are in request order"
+        batch = [call('getblockhash', [i % 11], 'hash%d' % i) for i in range(100)]
+        replies = node._batch(batch)
+        assert_equal(len(replies), len(batch))
+        for i in range(len(batch)):
+            assert_equal(replies[i]['id'], 'hash%d' % i)
+            assert_equal(replies[i]['error'], None)
+            assert_equal(replies[i]['result'], hashes[i % 11])
+
+        print "Calls that are not okParallel act as barriers"
+        batch = []
+        for i in range(10):
+            batch.append(call('listbanned', [], len(batch)))
+        batch.append(call('setban', ['127.0.0.2', 'add'], len(batch)))
+        for i in range(10):
+            batch.append(call('listbanned', [], len(batch)))
+        batch.append(call('clearbanned', [], len(batch)))
+        batch.append(call('listbanned', [], len(batch)))
+        replies = node._batch(batch)
+        assert_equal(len(replies), len(batch))
+        for i in range(len(batch)):
+            assert_equal(replies[i]['id'], i)
+            assert_equal(replies[i]['error'], None)
+        for i in range(10):
+            assert_equal(replies[i]['result'], [])
+        for i in range(11, 21):
+            assert_equal(len(replies[i]['result']), 1)
+            assert_equal(replies[i]['result'][0]['address'], '127.0.0.2/255.255.255.255')
+        assert_equal(replies[22]['result'], [])
+
+        print "Errors are reported per element without failing the batch"
+        batch = [
+            call('getblockcount', [], 0),
+            call('nosuchmethod', [], 1),
+            call('getblockhash', [1000], 2),
+            {'version': '1.1', 'params': [], 'id': 3},
+            call('getblockhash', [0], 4),
+            call('getblockcount', 'notanarray', 5),
+            call('ping', [], 6),
+            call('getblockhash', ['notanumber'], 7),
+            call('getbestblockhash', [], 8),
+        ]
+        replies = node._batch(batch)
+        assert_equal(len(replies), len(batch))
+        for i in range(len(batch)):
+            assert_equal(replies[i]['id'], i)
+        assert_equal(replies[0]['result'], 10)
+        assert_equal(replies[1]['error']['code'], -32601)
+        assert_equal(replies[2]['error']['code'], -8)
+        assert_equal(replies[3]['error']['code'], -32600)
+        assert_equal(replies[4]['result'], hashes[0])
+        assert_equal(replies[5]['error']['code'], -32600)
+        assert_equal(replies[6]['error'], None)
+        assert_equal(replies[7]['error']['code'], -1)
+        assert_equal(replies[8]['result'], node.getbestblockhash())
+        for i in [1, 2, 3, 5, 7]:
+            assert_equal(replies[i]['result'], None)
+
+        print "Elements that are not request objects get an error reply"
+        replies = node._batch([call('getblockcount', [], 0), 42, call('getblockcount', [], 2)])
+        assert_equal(len(replies), 3)
+        assert_equal(replies[0]['result'], 10)
+        assert_equal(replies[1]['id'], None)
+        assert_equal(replies[1]['error']['code'], -32600)
+        assert_equal(replies[2]['result'], 10)
+
+if __name__ == '__main__':
+    RPCBatchTest().main()
@@ -984,6 +984,136 @@ class msg_reject(object):
             % (self.message, self.code, self.reason, self.data)
 
 
+# getcfilters and getcfheaders messages have
+# filter type, start height, hash of the last block
+class msg_getcfilters(object):
+    command = "getcfilters"
+
+    def __init__(self, filter_type=0, start_height=0, stop_hash=0L):
+        self.filter_type = filter_type
+        self.start_height = start_height
+        self.stop_hash = stop_hash
+
+    def deserialize(self, f):
+        self.filter_type = struct.unpack("<B", f.read(1))[0]
+        self.start_height = struct.unpack("<I", f.read(4))[0]
+        self.stop_hash = deser_uint256(f)
+
+    def serialize(self):
+        r = struct.pack("<B", self.filter_type)
+        r += struct.pack("<I", self.start_height)
+        r += ser_uint256(self.stop_hash)
+        return r
+
+    def __repr__(self):
+        return "msg_getcfilters(filter_type=%d, start_height=%d, stop_hash=%064x)" \
+            % (self.filter_type, self.start_height, self.stop_hash)
+
+
+class msg_getcfheaders(msg_getcfilters):
+    command = "getcfheaders"
+
+    def __repr__(self):
+        return "msg_getcfheaders(filter_type=%d, start_height=%d, stop_hash=%064x)" \
+            % (self.filter_type, self.start_height, self.stop_hash)
+
+
+class msg_cfilter(object):
+    command = "cfilter"
+
+    def __init__(self, filter_type=0, block_hash=0L, filter_data=""):
+        self.filter_type = filter_type
+        self.block_hash = block_hash
+        self.filter_data = filter_data
+
+    def deserialize(self, f):
+        self.filter_type = struct.unpack("<B", f.read(1))[0]
+        self.block_hash = deser_uint256(f)
+        self.filter_data = deser_string(f)
+
+    def serialize(self):
+        r = struct.pack("<B", self.filter_type)
+        r += ser_uint256(self.block_hash)
+        r += ser_string(self.filter_data)
+        return r
+
+    def __repr__(self):
+        return "msg_cfilter(filter_type=%d, block_hash=%064x, filter_data=%s)" \
+            % (self.filter_type, self.block_hash, binascii.hexlify(self.filter_data))
+
+
+class msg_cfheaders(object):
+    command = "cfheaders"
+
+    def __init__(self, filter_type=0, stop_hash=0L, prev_header=0L, hashes=None):
+        self.filter_type = filter_type
+        self.stop_hash = stop_hash
+        self.prev_header = prev_header
+        self.hashes = hashes if hashes is not None else []
+
+    def deserialize(self, f):
+        self.filter_type = struct.unpack("<B", f.read(1))[0]
+        self.stop_hash = deser_uint256(f)
+        self.prev_header = deser_uint256(f)
+        self.hashes = deser_uint256_vector(f)
+
+    def serialize(self):
+        r = struct.pack("<B", self.filter_type)
+        r += ser_uint256(self.stop_hash)
+        r += ser_uint256(self.prev_header)
+        r += ser_uint256_vector(self.hashes)
+        return r
+
+    def __repr__(self):
+        return "msg_cfheaders(filter_type=%d, stop_hash=%064x, prev_header=%064x, hashes=%d)" \
+            % (self.filter_type, self.stop_hash, self.prev_header, len(self.hashes))
+
+
+class msg_getcfcheckpt(object):
+    command = "getcfcheckpt"
+
+    def __init__(self, filter_type=0, stop_hash=0L):
+        self.filter_type = filter_type
+        self.stop_hash = stop_hash
+
+    def deserialize(self, f):
+        self.filter_type = struct.unpack("<B", f.read(1))[0]
+        self.stop_hash = deser_uint256(f)
+
+    def serialize(self):
+        r = struct.pack("<B", self.filter_type)
+        r += ser_uint256(self.stop_hash)
+        return r
+
+    def __repr__(self):
+        return "msg_getcfcheckpt(filter_type=%d, stop_hash=%064x)" \
+            % (self.filter_type, self.stop_hash)
+
+
+class msg_cfcheckpt(object):
+    command = "cfcheckpt"
+
+    def __init__(self, filter_type=0, stop_hash=0L, headers=None):
+        self.filter_type = filter_type
+        self.stop_hash = stop_hash
+        self.headers = headers if headers is not None else []
+
+    def deserialize(self, f):
+        self.filter_type = struct.unpack("<B", f.read(1))[0]
+        self.stop_hash = deser_uint256(f)
+        self.headers = deser_uint256_vector(f)
+
+    def serialize(self):
+        r = struct.pack("<B", self.filter_type)
+        r += ser_uint256(self.stop_hash)
+        r += ser_uint256_vector(self.headers)
+        return r
+
+    def __repr__(self):
+        return "msg_cfcheckpt(filter_type=%d, stop_hash=%064x, headers=%d)" \
+            % (self.filter_type, self.stop_hash, len(self.headers))
+
+
 # This is what a callback should look like for NodeConn
 # Reimplement the on_* functions to provide handling for events
 class NodeConnCB(object):
@@ -1009,7 +1139,13 @@ class NodeConnCB(object):
             "headers": self.on_headers,
             "getheaders": self.on_getheaders,
             "reject": self.on_reject,
-            "mempool": self.on_mempool
+            "mempool": self.on_mempool,
+            "getcfilters": self.on_getcfilters,
+            "cfilter": self.on_cfilter,
+            "getcfheaders": self.on_getcfheaders,
+            "cfheaders": self.on_cfheaders,
+            "getcfcheckpt": self.on_getcfcheckpt,
+            "cfcheckpt": self.on_cfcheckpt
         }
 
     def deliver(self, conn, message):
@@ -1055,6 +1191,12 @@ class NodeConnCB(object):
     def on_close(self, conn): pass
     def on_mempool(self, conn): pass
     def on_pong(self, conn, message): pass
+    def on_getcfilters(self, conn, message): pass
+    def on_cfilter(self, conn, message): pass
+    def on_getcfheaders(self, conn, message): pass
+    def on_cfheaders(self, conn, message): pass
+    def on_getcfcheckpt(self, conn, message): pass
+    def on_cfcheckpt(self, conn, message): pass
 
 
 # The actual NodeConn class
@@ -1076,7 +1218,13 @@ class NodeConn(asyncore.dispatcher):
         "headers": msg_headers,
         "getheaders": msg_getheaders,
         "reject": msg_reject,
-        "mempool": msg_mempool
+        "mempool": msg_mempool,
+        "getcfilters": msg_getcfilters,
+        "cfilter": msg_cfilter,
+        "getcfheaders": msg_getcfheaders,
+        "cfheaders": msg_cfheaders,
+        "getcfcheckpt": msg_getcfcheckpt,
+        "cfcheckpt": msg_cfcheckpt
     }
     MAGIC_BYTES = {
         "mainnet": "\xf9\xbe\xb4\xd9",   # mainnet
@@ -0,0 +1,119 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+
+#include "chain.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "undo.h"
+
+#include <boost/scoped_ptr.hpp>
+
+static const char DB_ADDRESS = 'a';
+static const char DB_SPENT = 's';
+
+CAddressIndex* paddressindex = NULL;
+
+static std::string GetVersion(bool fAddressIndex, bool fSpentIndex)
+{
+    return strprintf("1%s%s", fAddressIndex ? ",address" : "", fSpentIndex ? ",spent" : "");
+}
+
+static uint160 GetScriptHash(const CScript& script)
+{
+    return Hash160(script.begin(), script.end());
+}
+
+CAddressIndex::CAddressIndex(size_t nCacheSize, bool fAddressIndexIn, bool fSpentIndexIn, bool fWipe) :
+    CChainIndex("address", GetVersion(fAddressIndexIn, fSpentIndexIn), nCacheSize, fWipe),
+    fAddressIndex(fAddressIndexIn), fSpentIndex(fSpentIndexIn)
+{
+}
+
+bool CAddressIndex::WriteBlock(CLevelDBBatch& batch, const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect)
+{
+    // The outputs of the genesis block are not spendable
+    if (pindex->pprev == NULL)
+        return true;
+
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        const uint256& txid = tx.GetHash();
+        if (fAddressIndex) {
+            for (unsigned int j = 0; j < tx.vout.size(); j++) {
+                const CTxOut& out = tx.vout[j];
+                if (out.scriptPubKey.IsUnspendable())
+                    continue;
+                CAddressIndexKey key(GetScriptHash(out.scriptPubKey), pindex->nHeight, txid, j, false);
+                if (fConnect)
+                    batch.Write(std::make_pair(DB_ADDRESS, key), out.nValue);
+                else
+                    batch.Erase(std::make_pair(DB_ADDRESS, key));
+            }
+        }
+        if (tx.IsCoinBase())
+            continue;
+
+        const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            if (fAddressIndex) {
+                const CTxOut& prevout = txundo.vprevout[j].txout;
+                CAddressIndexKey key(GetScriptHash(prevout.scriptPubKey), pindex->nHeight, txid, j, true);
+                if (fConnect)
+                    batch.Write(std::make_pair(DB_ADDRESS, key), -prevout.nValue);
+                else
+                    batch.Erase(std::make_pair(DB_ADDRESS, key));
+            }
+            if (fSpentIndex) {
+                if (fConnect)
+                    batch.Write(std::make_pair(DB_SPENT, tx.vin[j].prevout), CSpentIndexValue(txid, j, pindex->nHeight));
+                else
+                    batch.Erase(std::make_pair(DB_SPENT, tx.vin[j].prevout));
+            }
+        }
+    }
+    return true;
+}
+
+bool CAddressIndex::GetAddressDeltas(const CScript& script, int nStart, int nEnd, size_t nMax, std::vector<std::pair<CAddressIndexKey, CAmount> >& vDeltas)
+{
+    if (!fAddressIndex)
+        return false;
+
+    uint160 hashScript = GetScriptHash(script);
+    boost::scoped_ptr<leveldb::Iterator> pcursor(pdb->NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << std::make_pair(DB_ADDRESS, CAddressIndexKey(hashScript, nStart, uint256(), 0, false));
+    pcursor->Seek(ssKeySet.str());
+
+    for (; pcursor->Valid() && vDeltas.size() < nMax; pcursor->Next()) {
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            CAddressIndexKey key;
+            ssKey >> chType;
+            if (chType != DB_ADDRESS)
+                break;
+            ssKey >> key;
+            if (key.hashScript != hashScript || key.nHeight > nEnd)
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAmount nAmount;
+            ssValue >> nAmount;
+            vDeltas.push_back(std::make_pair(key, nAmount));
+        } catch (const std::exception& e) {
+            return error("%s: deserialize error - %s", __func__, e.what());
+        }
+    }
+    return true;
+}
+
+bool CAddressIndex::GetSpentInfo(const COutPoint& outpoint, CSpentIndexValue& value)
+{
+    return fSpentIndex && pdb->Read(std::make_pair(DB_SPENT, outpoint), value);
+}
@@ -0,0 +1,118 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "chainindex.h"
+#include "crypto/common.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <vector>
+
+class COutPoint;
+class CScript;
+
+/** Default for -addressindex */
+static const bool DEFAULT_ADDRESSINDEX = false;
+/** Default for -spentindex */
+static const bool DEFAULT_SPENTINDEX = false;
+/** Maximum database cache of the address and spent indexes, in MiB */
+static const int64_t MAX_ADDRESS_INDEX_CACHE = 256;
+/** Maximum number of address index entries a single RPC call reads */
+static const unsigned int MAX_ADDRESS_INDEX_RESULTS = 50000;
+
+/** Key of an address index entry: an output paying to a script, or an input spending from it */
+struct CAddressIndexKey
+{
+    //! Hash160 of the scriptPubKey
+    uint160 hashScript;
+    int nHeight;
+    uint256 txid;
+    //! Output index, or input index if fSpending
+    uint32_t nIndex;
+    bool fSpending;
+
+    CAddressIndexKey() : nHeight(0), nIndex(0), fSpending(false) {}
+    CAddressIndexKey(const uint160& hashScriptIn, int nHeightIn, const uint256& txidIn, uint32_t nIndexIn, bool fSpendingIn) :
+        hashScript(hashScriptIn), nHeight(nHeightIn), txid(txidIn), nIndex(nIndexIn), fSpending(fSpendingIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return 20 + 4 + 32 + 4 + 1;
+    }
+
+    // The height is big endian, so that the entries of a script are ordered by height
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        s << hashScript;
+        unsigned char buf[4];
+        WriteBE32(buf, nHeight);
+        s.write((char*)buf, 4);
+        s << txid << nIndex << fSpending;
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        s >> hashScript;
+        unsigned char buf[4];
+        s.read((char*)buf, 4);
+        nHeight = ReadBE32(buf);
+        s >> txid >> nIndex >> fSpending;
+    }
+};
+
+/** The input spending an output, as recorded in the spent index */
+struct CSpentIndexValue
+{
+    uint256 txid;
+    uint32_t nInput;
+    int nHeight;
+
+    CSpentIndexValue() : nInput(0), nHeight(0) {}
+    CSpentIndexValue(const uint256& txidIn, uint32_t nInputIn, int nHeightIn) : txid(txidIn), nInput(nInputIn), nHeight(nHeightIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(txid);
+        READWRITE(nInput);
+        READWRITE(nHeight);
+    }
+};
+
+/**
+ * Optional indexes for block explorers: the address index lists, per
+ * script, the outputs paying to it and the inputs spending them, and the
+ * spent index maps outputs to the inputs spending them.
+ */
+class CAddressIndex : public CChainIndex
+{
+public:
+    CAddressIndex(size_t nCacheSize, bool fAddressIndexIn, bool fSpentIndexIn, bool fWipe);
+
+    bool HasAddressIndex() const { return fAddressIndex; }
+    bool HasSpentIndex() const { return fSpentIndex; }
+
+    /** The first nMax entries for a script between heights nStart and nEnd, with their amounts (negative for spends) */
+    bool GetAddressDeltas(const CScript& script, int nStart, int nEnd, size_t nMax, std::vector<std::pair<CAddressIndexKey, CAmount> >& vDeltas);
+    /** Look up the input spending an output */
+    bool GetSpentInfo(const COutPoint& outpoint, CSpentIndexValue& value);
+
+protected:
+    bool WriteBlock(CLevelDBBatch& batch, const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect);
+
+private:
+    bool fAddressIndex;
+    bool fSpentIndex;
+};
+
+extern CAddressIndex* paddressindex;
+
+#endif // BITCOIN_ADDRESSINDEX_H
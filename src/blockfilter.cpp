@@ -0,0 +1,310 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "crypto/common.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "undo.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+/** Golomb-Rice parameter and false positive rate of basic filters, as chosen by BIP 158 */
+static const unsigned char BASIC_FILTER_P = 19;
+static const uint32_t BASIC_FILTER_M = 784931;
+
+namespace {
+
+/** Writes values bit by bit, most significant bit first */
+class CBitWriter
+{
+private:
+    std::vector<unsigned char>& vch;
+    unsigned char nBuffer;
+    int nOffset;
+
+public:
+    CBitWriter(std::vector<unsigned char>& vchIn) : vch(vchIn), nBuffer(0), nOffset(0) {}
+
+    /** Write the nBits (at most 64) least significant bits of data */
+    void Write(uint64_t data, int nBits)
+    {
+        while (nBits > 0) {
+            int nCount = std::min(8 - nOffset, nBits);
+            nBuffer |= (data << (64 - nBits)) >> (64 - 8 + nOffset);
+            nOffset += nCount;
+            nBits -= nCount;
+            if (nOffset == 8)
+                Flush();
+        }
+    }
+
+    /** Write out the last byte, padded with zero bits */
+    void Flush()
+    {
+        if (nOffset == 0)
+            return;
+        vch.push_back(nBuffer);
+        nBuffer = 0;
+        nOffset = 0;
+    }
+};
+
+/** Reads what CBitWriter wrote */
+class CBitReader
+{
+private:
+    const unsigned char* pbegin;
+    const unsigned char* pend;
+    unsigned char nBuffer;
+    int nOffset;
+
+public:
+    CBitReader(const unsigned char* pbeginIn, const unsigned char* pendIn) : pbegin(pbeginIn), pend(pendIn), nBuffer(0), nOffset(8) {}
+
+    uint64_t Read(int nBits)
+    {
+        uint64_t data = 0;
+        while (nBits > 0) {
+            if (nOffset == 8) {
+                if (pbegin == pend)
+                    throw std::ios_base::failure("CBitReader::Read(): end of data");
+                nBuffer = *pbegin++;
+                nOffset = 0;
+            }
+            int nCount = std::min(8 - nOffset, nBits);
+            data <<= nCount;
+            data |= (unsigned char)(nBuffer << nOffset) >> (8 - nCount);
+            nOffset += nCount;
+            nBits -= nCount;
+        }
+        return data;
+    }
+
+    bool AtEnd() const { return pbegin == pend; }
+};
+
+void GolombRiceEncode(CBitWriter& writer, unsigned char nP, uint64_t x)
+{
+    // The quotient is written in unary: q ones followed by a zero
+    uint64_t q = x >> nP;
+    while (q > 0) {
+        int nBits = q <= 64 ? (int)q : 64;
+        writer.Write(~0ULL, nBits);
+        q -= nBits;
+    }
+    writer.Write(0, 1);
+    writer.Write(x, nP);
+}
+
+uint64_t GolombRiceDecode(CBitReader& reader, unsigned char nP)
+{
+    uint64_t q = 0;
+    while (reader.Read(1) == 1)
+        q++;
+    uint64_t r = reader.Read(nP);
+    return (q << nP) + r;
+}
+
+/** Map x uniformly into [0, n): the high 64 bits of the 128-bit product x * n */
+uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+    uint64_t nXHi = x >> 32, nXLo = x & 0xFFFFFFFF;
+    uint64_t nNHi = n >> 32, nNLo = n & 0xFFFFFFFF;
+    uint64_t ac = nXHi * nNHi;
+    uint64_t ad = nXHi * nNLo;
+    uint64_t bc = nXLo * nNHi;
+    uint64_t bd = nXLo * nNLo;
+    uint64_t mid = (bd >> 32) + (bc & 0xFFFFFFFF) + (ad & 0xFFFFFFFF);
+    return ac + (bc >> 32) + (ad >> 32) + (mid >> 32);
+}
+
+} // anon namespace
+
+CGCSFilter::CGCSFilter(uint64_t nSipHashK0, uint64_t nSipHashK1, unsigned char nPIn, uint32_t nMIn) :
+    k0(nSipHashK0), k1(nSipHashK1), nP(nPIn), nM(nMIn), nN(0), nF(0)
+{
+    vEncoded.push_back(0);
+}
+
+CGCSFilter::CGCSFilter(uint64_t nSipHashK0, uint64_t nSipHashK1, unsigned char nPIn, uint32_t nMIn, const std::vector<unsigned char>& vEncodedIn) :
+    k0(nSipHashK0), k1(nSipHashK1), nP(nPIn), nM(nMIn), vEncoded(vEncodedIn)
+{
+    CDataStream ss(vEncoded, SER_NETWORK, PROTOCOL_VERSION);
+    uint64_t nElements = ReadCompactSize(ss);
+    if (nElements > std::numeric_limits<uint32_t>::max())
+        throw std::ios_base::failure("CGCSFilter(): N must be below 2^32");
+    nN = nElements;
+    nF = (uint64_t)nN * nM;
+
+    // Decode all the deltas, so that a malformed filter is detected right away
+    const unsigned char* pbegin = &vEncoded[0] + GetSizeOfCompactSize(nN);
+    CBitReader reader(pbegin, &vEncoded[0] + vEncoded.size());
+    for (uint32_t i = 0; i < nN; i++)
+        GolombRiceDecode(reader, nP);
+    if (!reader.AtEnd())
+        throw std::ios_base::failure("CGCSFilter(): excess data");
+}
+
+CGCSFilter::CGCSFilter(uint64_t nSipHashK0, uint64_t nSipHashK1, unsigned char nPIn, uint32_t nMIn, const ElementSet& elements) :
+    k0(nSipHashK0), k1(nSipHashK1), nP(nPIn), nM(nMIn)
+{
+    if (elements.size() > std::numeric_limits<uint32_t>::max())
+        throw std::invalid_argument("CGCSFilter(): N must be below 2^32");
+    nN = elements.size();
+    nF = (uint64_t)nN * nM;
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    WriteCompactSize(ss, nN);
+    vEncoded.assign(ss.begin(), ss.end());
+
+    CBitWriter writer(vEncoded);
+    uint64_t nLast = 0;
+    std::vector<uint64_t> vHashed = BuildHashedSet(elements);
+    for (std::vector<uint64_t>::const_iterator it = vHashed.begin(); it != vHashed.end(); ++it) {
+        GolombRiceEncode(writer, nP, *it - nLast);
+        nLast = *it;
+    }
+    writer.Flush();
+}
+
+uint64_t CGCSFilter::HashToRange(const Element& element) const
+{
+    uint64_t nHash = CSipHasher(k0, k1).Write(element.empty() ? NULL : &element[0], element.size()).Finalize();
+    return MapIntoRange(nHash, nF);
+}
+
+std::vector<uint64_t> CGCSFilter::BuildHashedSet(const ElementSet& elements) const
+{
+    std::vector<uint64_t> vHashed;
+    vHashed.reserve(elements.size());
+    for (ElementSet::const_iterator it = elements.begin(); it != elements.end(); ++it)
+        vHashed.push_back(HashToRange(*it));
+    std::sort(vHashed.begin(), vHashed.end());
+    return vHashed;
+}
+
+bool CGCSFilter::MatchInternal(const uint64_t* pElements, size_t nElements) const
+{
+    const unsigned char* pbegin = &vEncoded[0] + GetSizeOfCompactSize(nN);
+    CBitReader reader(pbegin, &vEncoded[0] + vEncoded.size());
+
+    // Walk the set and the sorted query side by side
+    uint64_t nValue = 0;
+    size_t nQuery = 0;
+    for (uint32_t i = 0; i < nN; i++) {
+        nValue += GolombRiceDecode(reader, nP);
+        while (true) {
+            if (nQuery == nElements)
+                return false;
+            if (pElements[nQuery] == nValue)
+                return true;
+            if (pElements[nQuery] > nValue)
+                break;
+            nQuery++;
+        }
+    }
+    return false;
+}
+
+bool CGCSFilter::Match(const Element& element) const
+{
+    if (nN == 0)
+        return false;
+    uint64_t nQuery = HashToRange(element);
+    return MatchInternal(&nQuery, 1);
+}
+
+bool CGCSFilter::MatchAny(const ElementSet& elements) const
+{
+    if (nN == 0 || elements.empty())
+        return false;
+    std::vector<uint64_t> vQueries = BuildHashedSet(elements);
+    return MatchInternal(&vQueries[0], vQueries.size());
+}
+
+std::string BlockFilterTypeName(BlockFilterType filterType)
+{
+    switch (filterType) {
+    case BLOCK_FILTER_BASIC: return "basic";
+    }
+    return "";
+}
+
+bool BlockFilterTypeByName(const std::string& strName, BlockFilterType& filterType)
+{
+    if (strName == "basic") {
+        filterType = BLOCK_FILTER_BASIC;
+        return true;
+    }
+    return false;
+}
+
+/** The scripts created and spent by a block, except the ones nobody can spend */
+static CGCSFilter::ElementSet BasicFilterElements(const CBlock& block, const CBlockUndo& blockundo)
+{
+    CGCSFilter::ElementSet elements;
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        for (unsigned int j = 0; j < tx.vout.size(); j++) {
+            const CScript& script = tx.vout[j].scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN)
+                continue;
+            elements.insert(CGCSFilter::Element(script.begin(), script.end()));
+        }
+    }
+    for (unsigned int i = 0; i < blockundo.vtxundo.size(); i++) {
+        const CTxUndo& txundo = blockundo.vtxundo[i];
+        for (unsigned int j = 0; j < txundo.vprevout.size(); j++) {
+            const CScript& script = txundo.vprevout[j].txout.scriptPubKey;
+            if (script.empty())
+                continue;
+            elements.insert(CGCSFilter::Element(script.begin(), script.end()));
+        }
+    }
+    return elements;
+}
+
+CBlockFilter::CBlockFilter(BlockFilterType filterTypeIn, const CBlock& block, const CBlockUndo& blockundo) :
+    filterType(filterTypeIn), hashBlock(block.GetHash())
+{
+    switch (filterType) {
+    case BLOCK_FILTER_BASIC:
+        filter = CGCSFilter(ReadLE64(hashBlock.begin()), ReadLE64(hashBlock.begin() + 8), BASIC_FILTER_P, BASIC_FILTER_M, BasicFilterElements(block, blockundo));
+        break;
+    default:
+        throw std::invalid_argument("CBlockFilter(): unknown filter type");
+    }
+}
+
+CBlockFilter::CBlockFilter(BlockFilterType filterTypeIn, const uint256& hashBlockIn, const std::vector<unsigned char>& vEncoded) :
+    filterType(filterTypeIn), hashBlock(hashBlockIn), filter(BuildFilter(filterTypeIn, hashBlockIn, vEncoded))
+{
+}
+
+CGCSFilter CBlockFilter::BuildFilter(BlockFilterType filterType, const uint256& hashBlock, const std::vector<unsigned char>& vEncoded)
+{
+    switch (filterType) {
+    case BLOCK_FILTER_BASIC:
+        return CGCSFilter(ReadLE64(hashBlock.begin()), ReadLE64(hashBlock.begin() + 8), BASIC_FILTER_P, BASIC_FILTER_M, vEncoded);
+    }
+    throw std::ios_base::failure("CBlockFilter(): unknown filter type");
+}
+
+uint256 CBlockFilter::GetHash() const
+{
+    const std::vector<unsigned char>& vEncoded = GetEncodedFilter();
+    return Hash(vEncoded.begin(), vEncoded.end());
+}
+
+uint256 CBlockFilter::ComputeHeader(const uint256& hashPrevHeader) const
+{
+    uint256 hashFilter = GetHash();
+    return Hash(hashFilter.begin(), hashFilter.end(), hashPrevHeader.begin(), hashPrevHeader.end());
+}
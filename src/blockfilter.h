@@ -0,0 +1,121 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+
+/**
+ * A Golomb-coded set: a compact probabilistic set of elements, as used by
+ * BIP 158 block filters. The elements are hashed with SipHash into the
+ * range [0, N * M), sorted, and the differences between consecutive values
+ * are Golomb-Rice coded with parameter P. Testing an element for membership
+ * has a false positive rate of about 1/M.
+ */
+class CGCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+    typedef std::set<Element> ElementSet;
+
+    /** An empty filter */
+    CGCSFilter(uint64_t nSipHashK0 = 0, uint64_t nSipHashK1 = 0, unsigned char nPIn = 0, uint32_t nMIn = 1);
+    /** Reconstruct a filter from its encoding; throws std::ios_base::failure if it is malformed */
+    CGCSFilter(uint64_t nSipHashK0, uint64_t nSipHashK1, unsigned char nPIn, uint32_t nMIn, const std::vector<unsigned char>& vEncodedIn);
+    /** Build a filter of a set of elements */
+    CGCSFilter(uint64_t nSipHashK0, uint64_t nSipHashK1, unsigned char nPIn, uint32_t nMIn, const ElementSet& elements);
+
+    uint32_t GetN() const { return nN; }
+    const std::vector<unsigned char>& GetEncoded() const { return vEncoded; }
+
+    /** Whether the element is (probably) in the set */
+    bool Match(const Element& element) const;
+    /** Whether any of the elements is (probably) in the set; faster than matching them one by one */
+    bool MatchAny(const ElementSet& elements) const;
+
+private:
+    uint64_t k0;
+    uint64_t k1;
+    unsigned char nP;
+    uint32_t nM;
+    uint32_t nN;
+    //! N * M, the range the elements are hashed into
+    uint64_t nF;
+    std::vector<unsigned char> vEncoded;
+
+    uint64_t HashToRange(const Element& element) const;
+    std::vector<uint64_t> BuildHashedSet(const ElementSet& elements) const;
+    /** Whether any of the sorted hashed values is in the set */
+    bool MatchInternal(const uint64_t* pElements, size_t nElements) const;
+};
+
+/** The kinds of block filters */
+enum BlockFilterType
+{
+    BLOCK_FILTER_BASIC = 0,
+};
+
+/** Name of a block filter type, as used by the RPC and REST interfaces */
+std::string BlockFilterTypeName(BlockFilterType filterType);
+/** Parse a block filter type name; returns false if it is unknown */
+bool BlockFilterTypeByName(const std::string& strName, BlockFilterType& filterType);
+
+/**
+ * A BIP 158 filter of a block. The basic filter holds every scriptPubKey
+ * created by the block, and every scriptPubKey spent by it, so that a light
+ * client can find out by itself whether a block is of interest to its
+ * wallet instead of asking its peers to test its own filter against the
+ * block.
+ */
+class CBlockFilter
+{
+public:
+    CBlockFilter() : filterType(BLOCK_FILTER_BASIC) {}
+    /** Compute the filter of a block; the undo data provides the scripts spent */
+    CBlockFilter(BlockFilterType filterTypeIn, const CBlock& block, const CBlockUndo& blockundo);
+    /** Reconstruct a filter from its encoding; throws std::ios_base::failure if it is malformed */
+    CBlockFilter(BlockFilterType filterTypeIn, const uint256& hashBlockIn, const std::vector<unsigned char>& vEncoded);
+
+    BlockFilterType GetFilterType() const { return filterType; }
+    const uint256& GetBlockHash() const { return hashBlock; }
+    const CGCSFilter& GetFilter() const { return filter; }
+    const std::vector<unsigned char>& GetEncodedFilter() const { return filter.GetEncoded(); }
+
+    /** The hash of the encoded filter */
+    uint256 GetHash() const;
+    /** The filter header, committing to this filter and to all filters before it */
+    uint256 ComputeHeader(const uint256& hashPrevHeader) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        unsigned char nFilterType = filterType;
+        std::vector<unsigned char> vEncoded = filter.GetEncoded();
+        READWRITE(nFilterType);
+        READWRITE(hashBlock);
+        READWRITE(vEncoded);
+        if (ser_action.ForRead())
+            *this = CBlockFilter((BlockFilterType)nFilterType, hashBlock, vEncoded);
+    }
+
+private:
+    BlockFilterType filterType;
+    uint256 hashBlock;
+    CGCSFilter filter;
+
+    static CGCSFilter BuildFilter(BlockFilterType filterType, const uint256& hashBlock, const std::vector<unsigned char>& vEncoded);
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
@@ -0,0 +1,106 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilterindex.h"
+
+#include "chain.h"
+#include "primitives/block.h"
+#include "util.h"
+
+static const char DB_FILTER = 'f';
+static const char DB_FILTER_HASH = 'h';
+
+CBlockFilterIndex* pblockfilterindex = NULL;
+
+/** Hash of a filter and the filter header, kept apart from the filter itself so ranges of them can be read cheaply */
+struct CFilterHashEntry
+{
+    uint256 hashFilter;
+    uint256 hashHeader;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashFilter);
+        READWRITE(hashHeader);
+    }
+};
+
+CBlockFilterIndex::CBlockFilterIndex(BlockFilterType filterTypeIn, size_t nCacheSize, bool fWipe) :
+    CChainIndex(BlockFilterTypeName(filterTypeIn) + "filter", "1", nCacheSize, fWipe), filterType(filterTypeIn)
+{
+}
+
+bool CBlockFilterIndex::WriteBlock(CLevelDBBatch& batch, const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect)
+{
+    // The filter of a block does not depend on the chain it is in
+    if (!fConnect)
+        return true;
+
+    CFilterHashEntry entryPrev;
+    if (pindex->pprev && !pdb->Read(std::make_pair(DB_FILTER_HASH, pindex->pprev->GetBlockHash()), entryPrev))
+        return error("%s: no filter header for block %s", __func__, pindex->pprev->GetBlockHash().ToString());
+
+    CBlockFilter filter(filterType, block, blockundo);
+    CFilterHashEntry entry;
+    entry.hashFilter = filter.GetHash();
+    entry.hashHeader = filter.ComputeHeader(entryPrev.hashHeader);
+    batch.Write(std::make_pair(DB_FILTER, pindex->GetBlockHash()), filter.GetEncodedFilter());
+    batch.Write(std::make_pair(DB_FILTER_HASH, pindex->GetBlockHash()), entry);
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilter(const CBlockIndex* pindex, CBlockFilter& filter)
+{
+    std::vector<unsigned char> vEncoded;
+    if (!LookupEncodedFilter(pindex, vEncoded))
+        return false;
+    try {
+        filter = CBlockFilter(filterType, pindex->GetBlockHash(), vEncoded);
+    } catch (const std::exception& e) {
+        return error("%s: invalid filter of block %s: %s", __func__, pindex->GetBlockHash().ToString(), e.what());
+    }
+    return true;
+}
+
+bool CBlockFilterIndex::LookupEncodedFilter(const CBlockIndex* pindex, std::vector<unsigned char>& vEncoded)
+{
+    return pdb->Read(std::make_pair(DB_FILTER, pindex->GetBlockHash()), vEncoded);
+}
+
+bool CBlockFilterIndex::LookupFilterHeader(const CBlockIndex* pindex, uint256& hashHeader)
+{
+    CFilterHashEntry entry;
+    if (!pdb->Read(std::make_pair(DB_FILTER_HASH, pindex->GetBlockHash()), entry))
+        return false;
+    hashHeader = entry.hashHeader;
+    return true;
+}
+
+bool CBlockFilterIndex::LookupEncodedFilterRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<std::vector<unsigned char> >& vEncoded)
+{
+    if (nStartHeight < 0 || nStartHeight > pindexStop->nHeight)
+        return false;
+    vEncoded.resize(pindexStop->nHeight - nStartHeight + 1);
+    for (const CBlockIndex* pindex = pindexStop; pindex && pindex->nHeight >= nStartHeight; pindex = pindex->pprev) {
+        if (!LookupEncodedFilter(pindex, vEncoded[pindex->nHeight - nStartHeight]))
+            return false;
+    }
+    return true;
+}
+
+bool CBlockFilterIndex::LookupFilterHashRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<uint256>& vHashes)
+{
+    if (nStartHeight < 0 || nStartHeight > pindexStop->nHeight)
+        return false;
+    vHashes.resize(pindexStop->nHeight - nStartHeight + 1);
+    for (const CBlockIndex* pindex = pindexStop; pindex && pindex->nHeight >= nStartHeight; pindex = pindex->pprev) {
+        CFilterHashEntry entry;
+        if (!pdb->Read(std::make_pair(DB_FILTER_HASH, pindex->GetBlockHash()), entry))
+            return false;
+        vHashes[pindex->nHeight - nStartHeight] = entry.hashFilter;
+    }
+    return true;
+}
@@ -0,0 +1,60 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTERINDEX_H
+#define BITCOIN_BLOCKFILTERINDEX_H
+
+#include "blockfilter.h"
+#include "chainindex.h"
+
+#include <vector>
+
+class uint256;
+
+/** Default for -blockfilterindex */
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+/** Default for -peerblockfilters */
+static const bool DEFAULT_PEERBLOCKFILTERS = false;
+/** Maximum database cache of the block filter index, in MiB */
+static const int64_t MAX_BLOCK_FILTER_INDEX_CACHE = 64;
+
+/**
+ * Optional index of the BIP 158 filters of blocks, and of their filter
+ * headers, for serving light clients.
+ *
+ * Entries are keyed by block hash, so the filters of blocks that leave the
+ * active chain remain valid and are kept.
+ */
+class CBlockFilterIndex : public CChainIndex
+{
+public:
+    CBlockFilterIndex(BlockFilterType filterTypeIn, size_t nCacheSize, bool fWipe);
+
+    BlockFilterType GetFilterType() const { return filterType; }
+
+    /** Look up the filter of a block */
+    bool LookupFilter(const CBlockIndex* pindex, CBlockFilter& filter);
+    /** Look up the encoded filter of a block, as stored, without decoding it */
+    bool LookupEncodedFilter(const CBlockIndex* pindex, std::vector<unsigned char>& vEncoded);
+    /** Look up the filter header of a block */
+    bool LookupFilterHeader(const CBlockIndex* pindex, uint256& hashHeader);
+    /**
+     * Look up the encoded filters of the ancestors of pindexStop from height
+     * nStartHeight up to pindexStop. The filters were checked when they were
+     * written, so they are passed on to peers as they are.
+     */
+    bool LookupEncodedFilterRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<std::vector<unsigned char> >& vEncoded);
+    /** Look up the filter hashes of the ancestors of pindexStop from height nStartHeight up to pindexStop */
+    bool LookupFilterHashRange(int nStartHeight, const CBlockIndex* pindexStop, std::vector<uint256>& vHashes);
+
+protected:
+    bool WriteBlock(CLevelDBBatch& batch, const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect);
+
+private:
+    BlockFilterType filterType;
+};
+
+extern CBlockFilterIndex* pblockfilterindex;
+
+#endif // BITCOIN_BLOCKFILTERINDEX_H
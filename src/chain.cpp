@@ -107,3 +107,45 @@ void CBlockIndex::BuildSkip()
     if (pprev)
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
+
+/**
+ * CBlockIndexArena implementation
+ */
+CBlockIndex* CBlockIndexArena::Allocate(const CBlockIndex& index) {
+    if (pnext == pend) {
+        vChunks.push_back(new CBlockIndex[CHUNK_SIZE]);
+        pnext = vChunks.back();
+        pend = pnext + CHUNK_SIZE;
+    }
+    *pnext = index;
+    nAllocated++;
+    return pnext++;
+}
+
+CBlockIndex* CBlockIndexArena::AllocateArray(size_t n) {
+    if ((size_t)(pend - pnext) < n) {
+        // Give the array a chunk of its own; what is left of the current one stays in use
+        vChunks.push_back(new CBlockIndex[n]);
+        nAllocated += n;
+        return vChunks.back();
+    }
+    CBlockIndex* parray = pnext;
+    pnext += n;
+    nAllocated += n;
+    return parray;
+}
+
+void CBlockIndexArena::Clear() {
+    for (std::vector<CBlockIndex*>::iterator it = vChunks.begin(); it != vChunks.end(); it++)
+        delete[] *it;
+    std::vector<CBlockIndex*>().swap(vChunks);
+    pnext = pend = NULL;
+    nAllocated = 0;
+}
+
+void CBlockIndexArena::swap(CBlockIndexArena& other) {
+    vChunks.swap(other.vChunks);
+    std::swap(pnext, other.pnext);
+    std::swap(pend, other.pend);
+    std::swap(nAllocated, other.nAllocated);
+}
@@ -403,4 +403,45 @@ public:
     const CBlockIndex *FindFork(const CBlockIndex *pindex) const;
 };
 
+/**
+ * Allocator for block index entries. Entries are carved out of large
+ * chunks in the order they are created, and have no per-allocation heap
+ * overhead. The index loaded at startup is laid out in height order (see
+ * LoadBlockIndexDB), so that walks along a chain stay within a few pages.
+ * Entries are never freed individually; they all go away with Clear().
+ */
+class CBlockIndexArena
+{
+private:
+    std::vector<CBlockIndex*> vChunks;
+    //! next free and end of the current chunk
+    CBlockIndex* pnext;
+    CBlockIndex* pend;
+    size_t nAllocated;
+
+    CBlockIndexArena(const CBlockIndexArena&);
+    void operator=(const CBlockIndexArena&);
+
+public:
+    //! Number of entries per chunk
+    static const size_t CHUNK_SIZE = 4096;
+
+    CBlockIndexArena() : pnext(NULL), pend(NULL), nAllocated(0) {}
+    ~CBlockIndexArena() { Clear(); }
+
+    /** Allocate an entry, initialized like the given one */
+    CBlockIndex* Allocate(const CBlockIndex& index = CBlockIndex());
+
+    /** Allocate n default-initialized entries that are adjacent in memory */
+    CBlockIndex* AllocateArray(size_t n);
+
+    /** Free all entries */
+    void Clear();
+
+    /** Exchange the entries of two arenas */
+    void swap(CBlockIndexArena& other);
+
+    size_t Size() const { return nAllocated; }
+};
+
 #endif // BITCOIN_CHAIN_H
@@ -0,0 +1,159 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainindex.h"
+
+#include "chain.h"
+#include "main.h"
+#include "undo.h"
+#include "util.h"
+
+#include <boost/thread.hpp>
+
+static const char DB_BEST_BLOCK = 'B';
+static const char DB_VERSION = 'V';
+
+static boost::filesystem::path GetIndexPath(const std::string& strName)
+{
+    TryCreateDirectory(GetDataDir() / "indexes");
+    return GetDataDir() / "indexes" / strName;
+}
+
+CChainIndex::CChainIndex(const std::string& strNameIn, const std::string& strVersion, size_t nCacheSize, bool fWipe) :
+    strName(strNameIn), pindexBest(NULL), fTipChanged(false)
+{
+    pdb.reset(new CLevelDBWrapper(GetIndexPath(strName), nCacheSize, false, fWipe));
+
+    // Start over if the index was built with other options, or up to a block we don't know
+    std::string strVersionOld;
+    uint256 hashBest;
+    pdb->Read(DB_VERSION, strVersionOld);
+    pdb->Read(DB_BEST_BLOCK, hashBest);
+    if (!hashBest.IsNull()) {
+        if (strVersionOld != strVersion) {
+            LogPrintf("%s index: built with different options, rebuilding\n", strName);
+            fWipe = true;
+        } else if ((pindexBest = LookupBlockIndex(hashBest)) == NULL) {
+            LogPrintf("%s index: best block %s is unknown, rebuilding\n", strName, hashBest.ToString());
+            fWipe = true;
+        }
+        if (fWipe) {
+            pdb.reset();
+            pdb.reset(new CLevelDBWrapper(GetIndexPath(strName), nCacheSize, false, true));
+        }
+    }
+    if (fWipe || strVersionOld != strVersion)
+        pdb->Write(DB_VERSION, strVersion, true);
+    LogPrintf("%s index: up to height %d\n", strName, pindexBest ? pindexBest->nHeight : -1);
+}
+
+const CBlockIndex* CChainIndex::GetBestBlock()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    return pindexBest;
+}
+
+std::string CChainIndex::GetError()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    return strError;
+}
+
+bool CChainIndex::IsSynced()
+{
+    AssertLockHeld(cs_main);
+    return GetBestBlock() == chainActive.Tip();
+}
+
+void CChainIndex::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    fTipChanged = true;
+    cond.notify_all();
+}
+
+bool CChainIndex::Step(const CBlockIndex* pindex, bool fConnect, const CDiskBlockPos& posBlock, const CDiskBlockPos& posUndo)
+{
+    CBlock block;
+    if (!ReadBlockFromDisk(block, posBlock) || block.GetHash() != pindex->GetBlockHash())
+        return error("%s: failed to read block %s", __func__, pindex->GetBlockHash().ToString());
+    CBlockUndo blockundo;
+    if (NeedsUndo() && pindex->pprev) {
+        if (posUndo.IsNull() || !UndoReadFromDisk(blockundo, posUndo, pindex->pprev->GetBlockHash()))
+            return error("%s: failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    CLevelDBBatch batch;
+    if (!WriteBlock(batch, block, blockundo, pindex, fConnect))
+        return error("%s: failed to index block %s", __func__, pindex->GetBlockHash().ToString());
+    return WriteBestBlock(batch, fConnect ? pindex : pindex->pprev);
+}
+
+bool CChainIndex::WriteBestBlock(CLevelDBBatch& batch, const CBlockIndex* pindex)
+{
+    batch.Write(DB_BEST_BLOCK, pindex ? pindex->GetBlockHash() : uint256());
+    try {
+        pdb->WriteBatch(batch);
+    } catch (const leveldb_error& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+
+    boost::unique_lock<boost::mutex> lock(cs);
+    pindexBest = pindex;
+    strError.clear();
+    return true;
+}
+
+void CChainIndex::ThreadSync()
+{
+    Prepare();
+
+    bool fSynced = false;
+    while (true) {
+        boost::this_thread::interruption_point();
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fTipChanged = false;
+        }
+
+        const CBlockIndex* pindex = NULL;
+        bool fConnect = true;
+        CDiskBlockPos posBlock, posUndo;
+        {
+            LOCK(cs_main);
+            const CBlockIndex* pindexLast = GetBestBlock();
+            if (pindexLast == NULL) {
+                pindex = chainActive.Genesis();
+            } else if (chainActive.Contains(pindexLast)) {
+                pindex = chainActive.Next(pindexLast);
+            } else {
+                pindex = pindexLast;
+                fConnect = false;
+            }
+            if (pindex) {
+                posBlock = pindex->GetBlockPos();
+                posUndo = pindex->GetUndoPos();
+            }
+        }
+
+        if (pindex == NULL) {
+            if (!fSynced) {
+                const CBlockIndex* pindexLast = GetBestBlock();
+                LogPrintf("%s index: synced up to height %d\n", strName, pindexLast ? pindexLast->nHeight : -1);
+                fSynced = true;
+            }
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (!fTipChanged)
+                cond.wait(lock);
+            continue;
+        }
+
+        if (!Step(pindex, fConnect, posBlock, posUndo)) {
+            LogPrintf("%s index: failed to %s block %s, retrying in %d seconds\n", strName, fConnect ? "index" : "unindex", pindex->GetBlockHash().ToString(), CHAIN_INDEX_RETRY_INTERVAL);
+            boost::unique_lock<boost::mutex> lock(cs);
+            strError = strprintf("Failed to %s block %s at height %d, see debug.log", fConnect ? "index" : "unindex", pindex->GetBlockHash().ToString(), pindex->nHeight);
+            cond.timed_wait(lock, boost::posix_time::seconds(CHAIN_INDEX_RETRY_INTERVAL));
+        }
+    }
+}
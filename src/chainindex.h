@@ -0,0 +1,82 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CHAININDEX_H
+#define BITCOIN_CHAININDEX_H
+
+#include "leveldbwrapper.h"
+#include "validationinterface.h"
+
+#include <string>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/** Seconds to wait before retrying a block that failed to be indexed */
+static const int64_t CHAIN_INDEX_RETRY_INTERVAL = 60;
+
+class CBlock;
+class CBlockIndex;
+class CBlockUndo;
+struct CDiskBlockPos;
+
+/**
+ * Base of the optional indexes that are kept in a LevelDB database of their
+ * own and built by a background thread following the active chain, so that
+ * maintaining them never slows down block validation.
+ *
+ * The thread connects the blocks of the active chain one by one, and when
+ * the block the index was last updated to leaves the active chain it is
+ * disconnected again, using the undo data of the block. Each step is a
+ * single batch that also records the new best block, so the index stays
+ * consistent across crashes. A block that fails to be indexed, for example
+ * because the disk is full, is retried periodically; GetError reports why
+ * the index is stuck meanwhile.
+ */
+class CChainIndex : public CValidationInterface
+{
+public:
+    CChainIndex(const std::string& strNameIn, const std::string& strVersion, size_t nCacheSize, bool fWipe);
+    virtual ~CChainIndex() {}
+
+    /** Index blocks until interrupted; to be run in a thread of its own */
+    void ThreadSync();
+
+    const std::string& GetName() const { return strName; }
+    /** The block the index is up to date with, or NULL if it is empty */
+    const CBlockIndex* GetBestBlock();
+    /** Whether the index is up to date with the tip of the active chain (requires cs_main) */
+    bool IsSynced();
+    /** Why the last block failed to be indexed, or an empty string if it did not */
+    std::string GetError();
+
+protected:
+    boost::scoped_ptr<CLevelDBWrapper> pdb;
+
+    /** Add the entries for a block to the batch, or remove them if !fConnect; returns false on failure */
+    virtual bool WriteBlock(CLevelDBBatch& batch, const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect) = 0;
+    /** Whether WriteBlock needs the undo data of the block */
+    virtual bool NeedsUndo() const { return true; }
+    /** Called by the sync thread before it starts indexing blocks */
+    virtual void Prepare() {}
+    /** Write the batch, recording pindex as the new best block */
+    bool WriteBestBlock(CLevelDBBatch& batch, const CBlockIndex* pindex);
+
+    void UpdatedBlockTip(const CBlockIndex* pindex);
+
+private:
+    std::string strName;
+
+    boost::mutex cs;
+    boost::condition_variable cond;
+    //! Protected by cs
+    const CBlockIndex* pindexBest;
+    bool fTipChanged;
+    std::string strError;
+
+    bool Step(const CBlockIndex* pindex, bool fConnect, const CDiskBlockPos& posBlock, const CDiskBlockPos& posUndo);
+};
+
+#endif // BITCOIN_CHAININDEX_H
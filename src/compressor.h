@@ -6,6 +6,8 @@
 #ifndef BITCOIN_COMPRESSOR_H
 #define BITCOIN_COMPRESSOR_H
 
+#include "consensus/consensus.h"
+#include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "script/script.h"
 #include "serialize.h"
@@ -120,4 +122,105 @@ public:
     }
 };
 
+/**
+ * Compact serializer for blocks stored in the block files.
+ *
+ * The header is kept as is, so that the block hash and parent can be read
+ * without decoding the rest. Transactions use variable-length integers for
+ * their version, lock time, prevout indices and sequence numbers (final
+ * sequence numbers take one byte), and CTxOutCompressor for their outputs.
+ * Input scripts are kept as they are. Only blocks whose output amounts are
+ * all within the valid money range are guaranteed to round-trip exactly.
+ */
+class CBlockCompressor
+{
+private:
+    CBlock &block;
+
+    template<typename Stream>
+    static void SerializeTransaction(Stream &s, const CTransaction &tx) {
+        uint32_t nVersion = tx.nVersion;
+        s << VARINT(nVersion);
+        uint64_t nCount = tx.vin.size();
+        s << VARINT(nCount);
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            const CTxIn &txin = tx.vin[i];
+            // The null prevout index of coinbase inputs wraps around to 0
+            uint32_t nIndex = txin.prevout.n + 1;
+            uint32_t nSequence = ~txin.nSequence;
+            s << txin.prevout.hash << VARINT(nIndex) << txin.scriptSig << VARINT(nSequence);
+        }
+        nCount = tx.vout.size();
+        s << VARINT(nCount);
+        for (unsigned int i = 0; i < tx.vout.size(); i++)
+            s << CTxOutCompressor(REF(tx.vout[i]));
+        uint32_t nLockTime = tx.nLockTime;
+        s << VARINT(nLockTime);
+    }
+
+    template<typename Stream>
+    static uint64_t UnserializeCount(Stream &s) {
+        uint64_t nCount = 0;
+        s >> VARINT(nCount);
+        if (nCount > MAX_BLOCK_SIZE)
+            throw std::ios_base::failure("CBlockCompressor: count too large");
+        return nCount;
+    }
+
+    template<typename Stream>
+    static void UnserializeTransaction(Stream &s, CMutableTransaction &tx) {
+        uint32_t nVersion = 0;
+        s >> VARINT(nVersion);
+        tx.nVersion = nVersion;
+        uint64_t nCount = UnserializeCount(s);
+        tx.vin.resize(0);
+        for (uint64_t i = 0; i < nCount; i++) {
+            tx.vin.push_back(CTxIn());
+            CTxIn &txin = tx.vin.back();
+            uint32_t nIndex = 0, nSequence = 0;
+            s >> txin.prevout.hash >> VARINT(nIndex) >> txin.scriptSig >> VARINT(nSequence);
+            txin.prevout.n = nIndex - 1;
+            txin.nSequence = ~nSequence;
+        }
+        nCount = UnserializeCount(s);
+        tx.vout.resize(0);
+        for (uint64_t i = 0; i < nCount; i++) {
+            tx.vout.push_back(CTxOut());
+            s >> REF(CTxOutCompressor(tx.vout.back()));
+        }
+        uint32_t nLockTime = 0;
+        s >> VARINT(nLockTime);
+        tx.nLockTime = nLockTime;
+    }
+
+public:
+    CBlockCompressor(CBlock &blockIn) : block(blockIn) { }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        CSizeComputer s(nType, nVersion);
+        Serialize(s, nType, nVersion);
+        return s.size();
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        s << *(const CBlockHeader*)&block;
+        WriteCompactSize(s, block.vtx.size());
+        for (unsigned int i = 0; i < block.vtx.size(); i++)
+            SerializeTransaction(s, block.vtx[i]);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        block.SetNull();
+        s >> *(CBlockHeader*)&block;
+        uint64_t nCount = ReadCompactSize(s);
+        CMutableTransaction tx;
+        for (uint64_t i = 0; i < nCount; i++) {
+            UnserializeTransaction(s, tx);
+            block.vtx.push_back(CTransaction(tx));
+        }
+    }
+};
+
 #endif // BITCOIN_COMPRESSOR_H
@@ -163,4 +163,23 @@ unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char
 
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64]);
 
+/** SipHash-2-4, a fast keyed hash for data that may be chosen by an attacker */
+class CSipHasher
+{
+private:
+    uint64_t v[4];
+    uint64_t tmp;
+    int count;
+
+public:
+    /** Construct a SipHash calculator initialized with 128-bit key (k0, k1) */
+    CSipHasher(uint64_t k0, uint64_t k1);
+    /** Hash a 64-bit integer worth of data; only allowed after a multiple of 8 bytes were written */
+    CSipHasher& Write(uint64_t data);
+    /** Hash arbitrary bytes */
+    CSipHasher& Write(const unsigned char* data, size_t size);
+    /** Compute the 64-bit SipHash-2-4 of the data written so far; the object remains untouched */
+    uint64_t Finalize() const;
+};
+
 #endif // BITCOIN_HASH_H
@@ -9,6 +9,8 @@
 
 #include "init.h"
 
+#include "addressindex.h"
+#include "blockfilterindex.h"
 #include "addrman.h"
 #include "amount.h"
 #include "chain.h"
@@ -21,10 +23,14 @@
 #include "miner.h"
 #include "net.h"
 #include "policy/policy.h"
+#include "rpccache.h"
+#include "rpcmetrics.h"
+#include "rpcnotify.h"
 #include "rpcserver.h"
 #include "script/standard.h"
 #include "scheduler.h"
 #include "txdb.h"
+#include "txindex.h"
 #include "txmempool.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -66,7 +72,7 @@ bool fFeeEstimatesInitialized = false;
 // anyway.
 #define MIN_CORE_FILEDESCRIPTORS 0
 #else
-#define MIN_CORE_FILEDESCRIPTORS 150
+#define MIN_CORE_FILEDESCRIPTORS (150 + MAX_OPEN_BLOCK_FILES)
 #endif
 
 /** Used to pass flags to the Bind() function */
@@ -141,7 +147,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 
 void Shutdown()
@@ -182,6 +187,7 @@ void Shutdown()
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
             FlushStateToDisk();
+            WriteBlockIndexSnapshot();
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
@@ -204,6 +210,16 @@ void Shutdown()
     }
 #endif
     UnregisterAllValidationInterfaces();
+    delete pRPCNotifier;
+    pRPCNotifier = NULL;
+    delete pRPCResultCache;
+    pRPCResultCache = NULL;
+    delete paddressindex;
+    paddressindex = NULL;
+    delete ptxindex;
+    ptxindex = NULL;
+    delete pblockfilterindex;
+    pblockfilterindex = NULL;
 #ifdef ENABLE_WALLET
     delete pwalletMain;
     pwalletMain = NULL;
@@ -252,6 +268,8 @@ bool static Bind(const CService &addr, unsigned int flags) {
 void OnRPCStopped()
 {
     cvBlockChange.notify_all();
+    if (pRPCNotifier)
+        pRPCNotifier->Interrupt();
     LogPrint("rpc", "RPC stopped.\n");
 }
 
@@ -272,8 +290,11 @@ std::string HelpMessage(HelpMessageMode mode)
     // Do not translate _(...) -help-debug options, Many technical terms, and only a very small audience, so is unnecessary stress to translators.
     string strUsage = HelpMessageGroup(_("Options:"));
     strUsage += HelpMessageOpt("-?", _("This help message"));
+    strUsage += HelpMessageOpt("-addressindex", strprintf(_("Maintain an index of the outputs paying to and spent from each address, built in the background and used by the getaddressdeltas and getaddressbalance rpc calls (default: %u)"), DEFAULT_ADDRESSINDEX));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-blockcompression", strprintf(_("Store new blocks compressed in the block files; these cannot be read by older versions (default: %u)"), DEFAULT_BLOCK_COMPRESSION));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain an index of the BIP 158 filters of blocks, built in the background and used by the getblockfilter rpc call and the REST interface (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 288));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), 3));
@@ -297,10 +318,11 @@ std::string HelpMessage(HelpMessageMode mode)
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild block chain index from current blk000??.dat files on startup"));
+    strUsage += HelpMessageOpt("-spentindex", strprintf(_("Maintain an index of the inputs spending each output, built in the background and used by the getspentinfo rpc call (default: %u)"), DEFAULT_SPENTINDEX));
 #if !defined(WIN32)
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
-    strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, built in the background and used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open"));
@@ -319,6 +341,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), 1000));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
+    strUsage += HelpMessageOpt("-peerblockfilters", strprintf(_("Serve compact block filters to peers per BIP 157; requires -blockfilterindex (default: %u)"), DEFAULT_PEERBLOCKFILTERS));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), 1));
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), 8333, 18333));
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
@@ -372,8 +395,12 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-fuzzmessagestest=<n>", "Randomly fuzz 1 of every <n> network messages");
         strUsage += HelpMessageOpt("-flushwallet", strprintf("Run a thread to flush wallet periodically (default: %u)", 1));
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf("Stop running after importing blocks from disk (default: %u)", 0));
+        strUsage += HelpMessageOpt("-<db>maxopenfiles=<n>", strprintf("Keep at most <n> table files of database <db> (blockindex or chainstate) open (default: %u)", DEFAULT_LEVELDB_MAX_OPEN_FILES));
+        strUsage += HelpMessageOpt("-<db>blocksize=<n>", strprintf("Size of the table blocks of database <db> in kilobytes, for tables written from now on (default: %u)", DEFAULT_LEVELDB_BLOCK_SIZE >> 10));
+        strUsage += HelpMessageOpt("-<db>compression", strprintf("Compress the table blocks of database <db>, if LevelDB was built with Snappy (default: %u)", 0));
+        strUsage += HelpMessageOpt("-<db>writebuffer=<n>", "Give database <db> a write buffer of <n> megabytes and the rest of its -dbcache share as block cache (default: a quarter of its share)");
     }
-    string debugCategories = "addrman, alert, bench, coindb, db, lock, rand, rpc, selectcoins, mempool, mempoolrej, net, proxy, prune"; // Don't translate these and qt below
+    string debugCategories = "addrman, alert, bench, coindb, db, leveldb, lock, rand, rpc, selectcoins, mempool, mempoolrej, net, proxy, prune"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         debugCategories += ", qt";
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
@@ -423,7 +450,12 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), 8332, 18332));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
-    strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), 4));
+    strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_RPC_THREADS));
+    strUsage += HelpMessageOpt("-rpcbatchthreads=<n>", strprintf(_("Set the number of threads executing JSON-RPC batch requests in parallel (0 = number of cores, default: %d)"), DEFAULT_RPC_BATCH_THREADS));
+    strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf(_("Set the depth of the work queue to service RPC calls; further requests are refused with HTTP 503 (default: %d)"), DEFAULT_RPC_WORK_QUEUE));
+    strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf(_("Timeout in seconds for idle RPC connections, and for clients that stop reading a reply (default: %d)"), DEFAULT_RPC_SERVER_TIMEOUT));
+    strUsage += HelpMessageOpt("-rpccachesize=<n>", strprintf(_("Keep up to <n> MiB of recent getblock and getrawtransaction results in memory, 0 to disable (default: %u)"), DEFAULT_RPC_CACHE_SIZE));
+    strUsage += HelpMessageOpt("-rpcnotifyqueue=<n>", strprintf(_("Keep up to <n> recent block and transaction events for waitfornotifications and the REST notification stream, 0 to disable (default: %u)"), DEFAULT_RPC_NOTIFY_QUEUE));
     strUsage += HelpMessageOpt("-rpckeepalive", strprintf(_("RPC support for HTTP persistent connections (default: %d)"), 1));
 
     strUsage += HelpMessageGroup(_("RPC SSL options: (see the Bitcoin Wiki for SSL setup instructions)"));
@@ -533,18 +565,7 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
     // -reindex
     if (fReindex) {
         CImportingNow imp;
-        int nFile = 0;
-        while (true) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!boost::filesystem::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(file, &pos);
-            nFile++;
-        }
+        ReindexBlockFiles();
         pblocktree->WriteReindexing(false);
         fReindex = false;
         LogPrintf("Reindexing finished\n");
@@ -602,6 +623,17 @@ bool InitSanityCheck(void)
     return true;
 }
 
+/** Read the options of a LevelDB database from -<strName>maxopenfiles and friends */
+static CLevelDBOptions GetLevelDBOptions(const std::string& strName)
+{
+    CLevelDBOptions dbOptions;
+    dbOptions.nMaxOpenFiles = std::max((int)GetArg("-" + strName + "maxopenfiles", DEFAULT_LEVELDB_MAX_OPEN_FILES), 1);
+    dbOptions.nBlockSize = std::max(GetArg("-" + strName + "blocksize", DEFAULT_LEVELDB_BLOCK_SIZE >> 10), (int64_t)1) << 10;
+    dbOptions.fCompression = GetBoolArg("-" + strName + "compression", false);
+    dbOptions.nWriteBufferSize = std::max(GetArg("-" + strName + "writebuffer", 0), (int64_t)0) << 20;
+    return dbOptions;
+}
+
 /** Initialize bitcoin.
  *  @pre Parameters should be parsed and config file should be read.
  */
@@ -741,8 +773,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // if using block pruning, then disable txindex
     if (GetArg("-prune", 0)) {
-        if (GetBoolArg("-txindex", false))
+        if (GetBoolArg("-txindex", DEFAULT_TXINDEX))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX) || GetBoolArg("-spentindex", DEFAULT_SPENTINDEX))
+            return InitError(_("Prune mode is incompatible with -addressindex and -spentindex."));
+        if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("Prune mode is incompatible with -blockfilterindex."));
 #ifdef ENABLE_WALLET
         if (GetBoolArg("-rescan", false)) {
             return InitError(_("Rescans are not possible in pruned mode. You will need to use -reindex which will download the whole blockchain again."));
@@ -750,8 +786,15 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 #endif
     }
     
+    CLevelDBOptions blockTreeDBOptions = GetLevelDBOptions("blockindex");
+    CLevelDBOptions coinsDBOptions = GetLevelDBOptions("chainstate");
+
     // Make sure enough file descriptors are available
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
+    // MIN_CORE_FILEDESCRIPTORS accounts for the default number of open table files
+    int nDBFileDescriptors = std::max(blockTreeDBOptions.nMaxOpenFiles - DEFAULT_LEVELDB_MAX_OPEN_FILES, 0) +
+                             std::max(coinsDBOptions.nMaxOpenFiles - DEFAULT_LEVELDB_MAX_OPEN_FILES, 0);
+    int nMinFileDescriptors = MIN_CORE_FILEDESCRIPTORS + nDBFileDescriptors;
     int nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
     int nUserWhiteConnections = GetArg("-whiteconnections", 0);
@@ -775,11 +818,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
 
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
-    int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
-    if (nFD < MIN_CORE_FILEDESCRIPTORS)
+    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - nMinFileDescriptors)), 0);
+    int nFD = RaiseFileDescriptorLimit(nMaxConnections + nMinFileDescriptors);
+    if (nFD < nMinFileDescriptors)
         return InitError(_("Not enough file descriptors available."));
-    nMaxConnections = std::min(nFD - MIN_CORE_FILEDESCRIPTORS, nMaxConnections);
+    nMaxConnections = std::min(nFD - nMinFileDescriptors, nMaxConnections);
 
     if (nMaxConnections < nUserMaxConnections)
         InitWarning(strprintf(_("Reducing -maxconnections from %d to %d, because of system limitations."), nUserMaxConnections, nMaxConnections));
@@ -798,6 +841,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     const vector<string>& categories = mapMultiArgs["-debug"];
     if (GetBoolArg("-nodebug", false) || find(categories.begin(), categories.end(), string("0")) != categories.end())
         fDebug = false;
+    fMeasureLockWait = LogAcceptCategory("lock");
 
     // Check for -debugnet
     if (GetBoolArg("-debugnet", false))
@@ -816,6 +860,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     mempool.setSanityCheck(GetBoolArg("-checkmempool", chainparams.DefaultConsistencyChecks()));
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", true);
+    fBlockCompression = GetBoolArg("-blockcompression", DEFAULT_BLOCK_COMPRESSION);
 
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
@@ -978,6 +1023,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             threadGroup.create_thread(&ThreadScriptCheck);
     }
 
+    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "blockcheck", &ThreadBlockPrevalidation));
+
     // Start the lightweight task scheduler thread
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
@@ -992,6 +1039,19 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         uiInterface.InitMessage.connect(SetRPCWarmupStatus);
         RPCServer::OnStopped(&OnRPCStopped);
         RPCServer::OnPreCommand(&OnRPCPreCommand);
+        // After the safe mode check, so that refused calls are not counted
+        RPCServer::OnPreCommand(boost::bind(&CRPCMetrics::PreCommand, &rpcMetrics, _1));
+        RPCServer::OnPostCommand(boost::bind(&CRPCMetrics::PostCommand, &rpcMetrics, _1, _2));
+        int nNotifyQueue = GetArg("-rpcnotifyqueue", DEFAULT_RPC_NOTIFY_QUEUE);
+        if (nNotifyQueue > 0) {
+            pRPCNotifier = new CRPCNotifier(nNotifyQueue);
+            RegisterValidationInterface(pRPCNotifier);
+        }
+        int64_t nResultCacheSize = GetArg("-rpccachesize", DEFAULT_RPC_CACHE_SIZE);
+        if (nResultCacheSize > 0) {
+            pRPCResultCache = new CRPCResultCache(nResultCacheSize << 20);
+            RegisterValidationInterface(pRPCResultCache);
+        }
         StartRPCThreads();
     }
 
@@ -1027,6 +1087,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             strSubVersion.size(), MAX_SUBVERSION_LENGTH));
     }
 
+    if (GetBoolArg("-peerblockfilters", DEFAULT_PEERBLOCKFILTERS)) {
+        if (!GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("Cannot set -peerblockfilters without -blockfilterindex."));
+        nLocalServices |= NODE_COMPACT_FILTERS;
+    }
+
     if (mapArgs.count("-onlynet")) {
         std::set<enum Network> nets;
         BOOST_FOREACH(const std::string& snet, mapMultiArgs["-onlynet"]) {
@@ -1163,16 +1229,32 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nTotalCache = (GetArg("-dbcache", nDefaultDbCache) << 20);
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greated than nMaxDbcache
-    int64_t nBlockTreeDBCache = nTotalCache / 8;
-    if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", false))
-        nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
+    int64_t nBlockTreeDBCache = std::min(nTotalCache / 8, (int64_t)(1 << 21)); // block tree db cache shouldn't be larger than 2 MiB
     nTotalCache -= nBlockTreeDBCache;
+    bool fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
+    int64_t nTxIndexCache = fTxIndex ? nTotalCache / 8 : 0;
+    nTotalCache -= nTxIndexCache;
+    bool fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
+    bool fSpentIndex = GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
+    int64_t nAddressIndexCache = 0;
+    if (fAddressIndex || fSpentIndex)
+        nAddressIndexCache = std::min(nTotalCache / 8, MAX_ADDRESS_INDEX_CACHE << 20);
+    nTotalCache -= nAddressIndexCache;
+    bool fBlockFilterIndex = GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX);
+    int64_t nBlockFilterIndexCache = fBlockFilterIndex ? std::min(nTotalCache / 8, MAX_BLOCK_FILTER_INDEX_CACHE << 20) : 0;
+    nTotalCache -= nBlockFilterIndexCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
+    if (nTxIndexCache)
+        LogPrintf("* Using %.1fMiB for transaction index database\n", nTxIndexCache * (1.0 / 1024 / 1024));
+    if (nAddressIndexCache)
+        LogPrintf("* Using %.1fMiB for address index database\n", nAddressIndexCache * (1.0 / 1024 / 1024));
+    if (nBlockFilterIndexCache)
+        LogPrintf("* Using %.1fMiB for block filter index database\n", nBlockFilterIndexCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
     bool fLoaded = false;
@@ -1191,8 +1273,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 delete pcoinscatcher;
                 delete pblocktree;
 
-                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
-                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
+                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex, blockTreeDBOptions);
+                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex, coinsDBOptions);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
@@ -1219,12 +1301,6 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
-                // Check for changed -txindex state
-                if (fTxIndex != GetBoolArg("-txindex", false)) {
-                    strLoadError = _("You need to rebuild the database using -reindex to change -txindex");
-                    break;
-                }
-
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
                 // in the past, but is now trying to run unpruned.
                 if (fHavePruned && !fPruneMode) {
@@ -1292,6 +1368,40 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    // Older versions kept the transaction index in the block index database.
+    // Clear their flag first, so that they ask for a reindex instead of using
+    // it while its entries are moved over or erased.
+    const CBlockIndex* pindexLegacyTxIndex = NULL;
+    bool fLegacyTxIndex = false;
+    if (pblocktree->ReadFlag("txindex", fLegacyTxIndex) && fLegacyTxIndex) {
+        pindexLegacyTxIndex = chainActive.Tip();
+        pblocktree->WriteFlag("txindex", false);
+    }
+    if (fTxIndex) {
+        try {
+            ptxindex = new CTxIndex(nTxIndexCache, fReindex, pindexLegacyTxIndex);
+        } catch (const std::exception& e) {
+            return InitError(strprintf(_("Error opening transaction index database: %s"), e.what()));
+        }
+        RegisterValidationInterface(ptxindex);
+    }
+    if (fAddressIndex || fSpentIndex) {
+        try {
+            paddressindex = new CAddressIndex(nAddressIndexCache, fAddressIndex, fSpentIndex, fReindex);
+        } catch (const std::exception& e) {
+            return InitError(strprintf(_("Error opening address index database: %s"), e.what()));
+        }
+        RegisterValidationInterface(paddressindex);
+    }
+    if (fBlockFilterIndex) {
+        try {
+            pblockfilterindex = new CBlockFilterIndex(BLOCK_FILTER_BASIC, nBlockFilterIndexCache, fReindex);
+        } catch (const std::exception& e) {
+            return InitError(strprintf(_("Error opening block filter index database: %s"), e.what()));
+        }
+        RegisterValidationInterface(pblockfilterindex);
+    }
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1484,6 +1594,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             vImportFiles.push_back(strFile);
     }
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
+    if (ptxindex)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "txindex", boost::function<void()>(boost::bind(&CChainIndex::ThreadSync, ptxindex))));
+    else if (pblocktree->HaveLegacyTxIndex())
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "txindexclean", &ThreadEraseLegacyTxIndex));
+    if (paddressindex)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "addrindex", boost::function<void()>(boost::bind(&CChainIndex::ThreadSync, paddressindex))));
+    if (pblockfilterindex)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "filterindex", boost::function<void()>(boost::bind(&CChainIndex::ThreadSync, pblockfilterindex))));
     if (chainActive.Tip() == NULL) {
         LogPrintf("Waiting for genesis block to be imported...\n");
         while (!fRequestShutdown && chainActive.Tip() == NULL)
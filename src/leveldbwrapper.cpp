@@ -6,6 +6,8 @@
 
 #include "util.h"
 
+#include <algorithm>
+
 #include <boost/filesystem.hpp>
 
 #include <leveldb/cache.h>
@@ -27,14 +29,21 @@ void HandleError(const leveldb::Status& status) throw(leveldb_error)
     throw leveldb_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+static leveldb::Options GetOptions(size_t nCacheSize, const CLevelDBOptions& dbOptions)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    if (dbOptions.nWriteBufferSize) {
+        // up to two write buffers may be held in memory simultaneously; the rest goes to the block cache
+        options.write_buffer_size = dbOptions.nWriteBufferSize;
+        options.block_cache = leveldb::NewLRUCache(std::max(nCacheSize > 2 * options.write_buffer_size ? nCacheSize - 2 * options.write_buffer_size : 0, (size_t)1 << 20));
+    } else {
+        options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
+        options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    }
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.compression = dbOptions.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = dbOptions.nMaxOpenFiles;
+    options.block_size = dbOptions.nBlockSize;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -43,14 +52,15 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSizeIn, bool fMemory, bool fWipe, const CLevelDBOptions& dbOptionsIn)
+    : dbOptions(dbOptionsIn), nCacheSize(nCacheSizeIn)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, dbOptions);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -66,6 +76,18 @@ CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCa
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     HandleError(status);
     LogPrintf("Opened LevelDB successfully\n");
+    LogPrint("leveldb", "LevelDB options: max open files %d, block size %u, compression %d, write buffer %u, cache %u\n",
+        options.max_open_files, options.block_size, options.compression != leveldb::kNoCompression, options.write_buffer_size, nCacheSize);
+}
+
+uint64_t CLevelDBWrapper::GetApproximateSize() const
+{
+    // Keys are serialized with a leading type byte, so this covers all of them
+    std::string strEnd(16, '\xff');
+    leveldb::Range range("", strEnd);
+    uint64_t nSize = 0;
+    pdb->GetApproximateSizes(&range, 1, &nSize);
+    return nSize;
 }
 
 CLevelDBWrapper::~CLevelDBWrapper()
@@ -24,6 +24,28 @@ public:
 
 void HandleError(const leveldb::Status& status) throw(leveldb_error);
 
+//! Default maximum number of table files a database keeps open
+static const int DEFAULT_LEVELDB_MAX_OPEN_FILES = 64;
+//! Default approximate size of the data in a table block, in bytes
+static const int DEFAULT_LEVELDB_BLOCK_SIZE = 4096;
+
+/** Options tunable per database */
+struct CLevelDBOptions
+{
+    //! Maximum number of table files kept open
+    int nMaxOpenFiles;
+    //! Approximate size of the data in a table block, before compression
+    size_t nBlockSize;
+    //! Compress table blocks with Snappy, if LevelDB was built with it
+    bool fCompression;
+    //! Size of the in-memory write buffer; 0 to take a quarter of the cache
+    size_t nWriteBufferSize;
+
+    CLevelDBOptions() :
+        nMaxOpenFiles(DEFAULT_LEVELDB_MAX_OPEN_FILES), nBlockSize(DEFAULT_LEVELDB_BLOCK_SIZE),
+        fCompression(false), nWriteBufferSize(0) {}
+};
+
 /** Batch of changes queued to be written to a CLevelDBWrapper */
 class CLevelDBBatch
 {
@@ -85,10 +107,27 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
+    //! options the database was opened with
+    CLevelDBOptions dbOptions;
+    size_t nCacheSize;
+
 public:
-    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSizeIn, bool fMemory = false, bool fWipe = false, const CLevelDBOptions& dbOptionsIn = CLevelDBOptions());
     ~CLevelDBWrapper();
 
+    const CLevelDBOptions& GetDBOptions() const { return dbOptions; }
+    size_t GetCacheSize() const { return nCacheSize; }
+    size_t GetWriteBufferSize() const { return options.write_buffer_size; }
+
+    /** Get a LevelDB property such as "leveldb.stats" */
+    bool GetProperty(const std::string& strProperty, std::string& strValue) const
+    {
+        return pdb->GetProperty(strProperty, &strValue);
+    }
+
+    /** Approximate size of all data on disk, in bytes */
+    uint64_t GetApproximateSize() const;
+
     template <typename K, typename V>
     bool Read(const K& key, V& value) const throw(leveldb_error)
     {
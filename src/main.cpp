@@ -8,13 +8,17 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockfilterindex.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "compressor.h"
 #include "consensus/consensus.h"
+#include "crypto/common.h"
 #include "consensus/validation.h"
 #include "hash.h"
 #include "init.h"
+#include "mappedfile.h"
 #include "merkleblock.h"
 #include "net.h"
 #include "policy/policy.h"
@@ -26,6 +30,7 @@
 #include "script/standard.h"
 #include "tinyformat.h"
 #include "txdb.h"
+#include "txindex.h"
 #include "txmempool.h"
 #include "ui_interface.h"
 #include "undo.h"
@@ -34,12 +39,15 @@
 #include "utilstrencodings.h"
 #include "validationinterface.h"
 
+#include <list>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/math/distributions/poisson.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -55,6 +63,8 @@ using namespace std;
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+/** Storage of the entries of mapBlockIndex */
+static CBlockIndexArena blockIndexArena;
 CChain chainActive;
 CBlockIndex *pindexBestHeader = NULL;
 int64_t nTimeBestReceived = 0;
@@ -63,7 +73,7 @@ CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
-bool fTxIndex = false;
+bool fBlockCompression = DEFAULT_BLOCK_COMPRESSION;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = true;
@@ -192,6 +202,7 @@ namespace {
         int64_t nTime;  //! Time of "getdata" request in microseconds.
         bool fValidatedHeaders;  //! Whether this block has validated headers at the time of request.
         int64_t nTimeDisconnect; //! The timeout for this block request (for disconnecting a slow peer)
+        NodeId nodeStalled;  //! The peer this request was moved away from because it stalled the download window, or -1.
     };
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
@@ -206,6 +217,15 @@ namespace {
 
     /** Dirty block file entries. */
     set<int> setDirtyFileInfo;
+
+    /**
+     * The complete "block" message for the most recently requested tip block,
+     * so that the burst of getdata requests following an announcement is
+     * served without re-reading and re-serializing the block for each peer.
+     * Released as soon as the tip changes. Protected by cs_main.
+     */
+    CSendBufferRef msgTipBlock;
+    uint256 hashTipBlockMsg;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -253,6 +273,14 @@ struct CNodeState {
     list<QueuedBlock> vBlocksInFlight;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! How many blocks we currently allow to be in flight from this peer.
+    int nBlocksInFlightLimit;
+    //! When (in microseconds) this peer last delivered a block we requested from it, or 0.
+    int64_t nLastBlockDelivery;
+    //! Moving average of the time (in microseconds) this peer takes to deliver one requested block, or 0 if unknown.
+    int64_t nAvgBlockDeliveryTime;
+    //! Blocks that were moved to other peers because this peer stalled on them; they are not requested from it again.
+    std::set<uint256> setBlocksStalled;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
 
@@ -267,6 +295,9 @@ struct CNodeState {
         nStallingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nBlocksInFlightLimit = DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER;
+        nLastBlockDelivery = 0;
+        nAvgBlockDeliveryTime = 0;
         fPreferredDownload = false;
     }
 };
@@ -311,6 +342,8 @@ void InitializeNode(NodeId nodeid, const CNode *pnode) {
     state.address = pnode->addr;
 }
 
+void AbandonBlockPrevalidation(NodeId nodeid);
+
 void FinalizeNode(NodeId nodeid) {
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
@@ -322,9 +355,13 @@ void FinalizeNode(NodeId nodeid) {
         AddressCurrentlyConnected(state->address);
     }
 
-    BOOST_FOREACH(const QueuedBlock& entry, state->vBlocksInFlight)
+    BOOST_FOREACH(const QueuedBlock& entry, state->vBlocksInFlight) {
+        if (entry.nodeStalled != -1 && State(entry.nodeStalled) != NULL)
+            State(entry.nodeStalled)->setBlocksStalled.erase(entry.hash);
         mapBlocksInFlight.erase(entry.hash);
+    }
     EraseOrphansFor(nodeid);
+    AbandonBlockPrevalidation(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
 
     mapNodeState.erase(nodeid);
@@ -332,10 +369,23 @@ void FinalizeNode(NodeId nodeid) {
 
 // Requires cs_main.
 // Returns a bool indicating whether we requested this block.
-bool MarkBlockAsReceived(const uint256& hash) {
+// nodeFrom is the peer that delivered the block, if any; it is used to
+// measure that peer's download rate.
+bool MarkBlockAsReceived(const uint256& hash, NodeId nodeFrom = -1) {
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState *state = State(itInFlight->second.first);
+        if (itInFlight->second.first == nodeFrom) {
+            // The peer could only start on this block once both the request
+            // was made and its previous delivery was done.
+            int64_t nNow = GetTimeMicros();
+            int64_t nDeliveryTime = nNow - std::max(state->nLastBlockDelivery, itInFlight->second.second->nTime);
+            state->nAvgBlockDeliveryTime = UpdateBlockDeliveryTime(state->nAvgBlockDeliveryTime, nDeliveryTime);
+            state->nLastBlockDelivery = nNow;
+        }
+        NodeId nodeStalled = itInFlight->second.second->nodeStalled;
+        if (nodeStalled != -1 && State(nodeStalled) != NULL)
+            State(nodeStalled)->setBlocksStalled.erase(hash);
         nQueuedValidatedHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->nBlocksInFlightValidHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->vBlocksInFlight.erase(itInFlight->second.second);
@@ -348,15 +398,18 @@ bool MarkBlockAsReceived(const uint256& hash) {
 }
 
 // Requires cs_main.
-void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL) {
+// nodeStalled is the peer the block is taken away from because it stalled on it, if any.
+void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL, NodeId nodeStalled = -1) {
     CNodeState *state = State(nodeid);
     assert(state != NULL);
 
     // Make sure it's not listed somewhere already.
     MarkBlockAsReceived(hash);
+    if (nodeStalled != -1)
+        State(nodeStalled)->setBlocksStalled.insert(hash);
 
     int64_t nNow = GetTimeMicros();
-    QueuedBlock newentry = {hash, pindex, nNow, pindex != NULL, GetBlockTimeout(nNow, nQueuedValidatedHeaders, consensusParams)};
+    QueuedBlock newentry = {hash, pindex, nNow, pindex != NULL, GetBlockTimeout(nNow, nQueuedValidatedHeaders, consensusParams), nodeStalled};
     nQueuedValidatedHeaders += newentry.fValidatedHeaders;
     list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), newentry);
     state->nBlocksInFlight++;
@@ -417,8 +470,9 @@ CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller) {
+ *  at most count entries. If nothing can be added because the download window is full, nodeStaller
+ *  and pindexStalled are set to the peer and the in-flight block the window is waiting for. */
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller, CBlockIndex*& pindexStalled) {
     if (count == 0)
         return;
 
@@ -454,6 +508,8 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    CBlockIndex* pindexWaitingFor = NULL;
+    CBlockIndex* pindexSkipped = NULL;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -485,9 +541,20 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
+                        pindexStalled = pindexWaitingFor;
+                    }
+                    if (vBlocks.size() == 0 && waitingfor == -1 && pindexSkipped != NULL) {
+                        // Nobody else is downloading anything in the window; better this peer than no one.
+                        vBlocks.push_back(pindexSkipped);
                     }
                     return;
                 }
+                if (state->setBlocksStalled.count(pindex->GetBlockHash())) {
+                    // This peer stalled on the block before; leave it to the others.
+                    if (pindexSkipped == NULL)
+                        pindexSkipped = pindex;
+                    continue;
+                }
                 vBlocks.push_back(pindex);
                 if (vBlocks.size() == count) {
                     return;
@@ -495,13 +562,42 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
+    if (vBlocks.size() == 0 && waitingfor == -1 && pindexSkipped != NULL)
+        vBlocks.push_back(pindexSkipped);
 }
 
 } // anon namespace
 
+int64_t UpdateBlockDeliveryTime(int64_t nAvgBlockDeliveryTime, int64_t nDeliveryTime)
+{
+    nDeliveryTime = std::max<int64_t>(nDeliveryTime, 1);
+    if (nAvgBlockDeliveryTime == 0)
+        return nDeliveryTime;
+    return (nAvgBlockDeliveryTime * 7 + nDeliveryTime) / 8;
+}
+
+/**
+ * Enough blocks to cover one round trip plus BLOCK_DOWNLOAD_QUEUE_TIME at the
+ * rate the peer has been delivering, so fast peers are kept busy and slow ones
+ * don't sit on blocks everyone else is waiting for.
+ */
+int GetBlocksInFlightLimit(int64_t nAvgBlockDeliveryTime, int64_t nPingUsecTime)
+{
+    if (nAvgBlockDeliveryTime == 0)
+        return DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER;
+    int64_t nLimit = (std::max<int64_t>(nPingUsecTime, 0) + BLOCK_DOWNLOAD_QUEUE_TIME) / nAvgBlockDeliveryTime;
+    return std::max<int64_t>(MIN_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(MAX_BLOCKS_IN_TRANSIT_PER_PEER, nLimit));
+}
+
+int64_t GetBlockReassignTimeout(int64_t nAvgBlockDeliveryTime)
+{
+    return std::max(2 * nAvgBlockDeliveryTime, BLOCK_REASSIGN_MIN_TIME);
+}
+
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
@@ -514,6 +610,8 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nBlocksInFlightLimit = state->nBlocksInFlightLimit;
+    stats.nAvgBlockDeliveryTime = state->nAvgBlockDeliveryTime;
     return true;
 }
 
@@ -551,6 +649,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -950,6 +1049,136 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return true;
 }
 
+namespace {
+
+/**
+ * Block and undo files opened for reading, kept open between reads so that
+ * reading many blocks from the same files does not open and close them each
+ * time. A handle is used by one reader at a time.
+ *
+ * A handle may have read ahead into its buffer, so it is not reused once its
+ * file has been written to: the buffer could hold what was there before.
+ * Writers report their writes with Changed().
+ */
+class CBlockFilePool
+{
+private:
+    typedef std::pair<int, bool> Key; // file number, undo file
+    struct Entry
+    {
+        Key key;
+        uint64_t nChangeCount;
+        FILE* file;
+    };
+
+    boost::mutex cs;
+    //! Idle handles, most recently used first
+    std::list<Entry> idle;
+    //! Bumped whenever a file is written to or deleted
+    std::map<Key, uint64_t> mapChangeCount;
+
+public:
+    ~CBlockFilePool()
+    {
+        BOOST_FOREACH(const Entry& entry, idle)
+            fclose(entry.file);
+    }
+
+    /** Get a handle positioned at pos, to be given back with Release */
+    FILE* Acquire(const CDiskBlockPos& pos, bool fUndo, uint64_t& nChangeCountOut)
+    {
+        FILE* file = NULL;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            Key key(pos.nFile, fUndo);
+            nChangeCountOut = mapChangeCount[key];
+            for (std::list<Entry>::iterator it = idle.begin(); it != idle.end(); it++) {
+                if (it->key == key) {
+                    assert(it->nChangeCount == nChangeCountOut);
+                    file = it->file;
+                    idle.erase(it);
+                    break;
+                }
+            }
+        }
+        if (!file)
+            return fUndo ? OpenUndoFile(pos, true) : OpenBlockFile(pos, true);
+
+        if (fseek(file, pos.nPos, SEEK_SET)) {
+            LogPrintf("Unable to seek to position %u of %s%05u.dat\n", pos.nPos, fUndo ? "rev" : "blk", pos.nFile);
+            fclose(file);
+            return NULL;
+        }
+        return file;
+    }
+
+    void Release(FILE* file, int nFile, bool fUndo, uint64_t nChangeCountIn)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        Key key(nFile, fUndo);
+        if (ferror(file) || nChangeCountIn != mapChangeCount[key]) {
+            fclose(file);
+            return;
+        }
+        clearerr(file);
+        Entry entry = {key, nChangeCountIn, file};
+        idle.push_front(entry);
+        if (idle.size() > (size_t)MAX_OPEN_BLOCK_FILES) {
+            fclose(idle.back().file);
+            idle.pop_back();
+        }
+    }
+
+    /** Close the idle handles of a file that was written to, and keep the ones in use from coming back */
+    void Changed(int nFile, bool fUndo)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        Key key(nFile, fUndo);
+        mapChangeCount[key]++;
+        for (std::list<Entry>::iterator it = idle.begin(); it != idle.end(); ) {
+            if (it->key == key) {
+                fclose(it->file);
+                it = idle.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+
+    /** Close the handles of a block file and its undo file */
+    void Erase(int nFile)
+    {
+        Changed(nFile, false);
+        Changed(nFile, true);
+    }
+};
+
+CBlockFilePool blockFilePool;
+
+/** A block or undo file opened for reading, borrowed from blockFilePool */
+class CBlockFileReader
+{
+private:
+    int nFile;
+    bool fUndo;
+    uint64_t nChangeCount;
+    CAutoFile file;
+
+public:
+    CBlockFileReader(const CDiskBlockPos& pos, bool fUndoIn) :
+        nFile(pos.nFile), fUndo(fUndoIn), file(blockFilePool.Acquire(pos, fUndoIn, nChangeCount), SER_DISK, CLIENT_VERSION) {}
+
+    ~CBlockFileReader()
+    {
+        if (!file.IsNull())
+            blockFilePool.Release(file.release(), nFile, fUndo, nChangeCount);
+    }
+
+    CAutoFile& operator*() { return file; }
+};
+
+} // anon namespace
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -963,17 +1192,33 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
             }
         }
 
-        if (fTxIndex) {
+        if (ptxindex) {
             CDiskTxPos postx;
-            if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+            if (ptxindex->FindTx(hash, postx)) {
+                CBlockFileReader reader(CDiskBlockPos(postx.nFile, postx.nPos - sizeof(unsigned int)), false);
+                CAutoFile& file = *reader;
                 if (file.IsNull())
                     return error("%s: OpenBlockFile failed", __func__);
                 CBlockHeader header;
                 try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
+                    unsigned int nSize;
+                    file >> nSize;
+                    if (nSize & BLOCK_RECORD_COMPRESSED) {
+                        // The offset is into the uncompressed block, so look for the transaction in all of it
+                        CBlock block;
+                        file >> REF(CBlockCompressor(block));
+                        header = block.GetBlockHeader();
+                        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+                            if (tx.GetHash() == hash) {
+                                txOut = tx;
+                                break;
+                            }
+                        }
+                    } else {
+                        file >> header;
+                        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                        file >> txOut;
+                    }
                 } catch (const std::exception& e) {
                     return error("%s: Deserialize or I/O error - %s", __func__, e.what());
                 }
@@ -1023,6 +1268,26 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
 // CBlock and CBlockIndex
 //
 
+/** Whether a block is written to the block files compressed */
+static bool IsBlockStoredCompressed(const CBlock& block)
+{
+    if (!fBlockCompression)
+        return false;
+    // Amounts outside of the money range may not survive amount compression
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        BOOST_FOREACH(const CTxOut& txout, tx.vout)
+            if (!MoneyRange(txout.nValue))
+                return false;
+    return true;
+}
+
+unsigned int GetBlockDiskSize(const CBlock& block)
+{
+    if (IsBlockStoredCompressed(block))
+        return ::GetSerializeSize(CBlockCompressor(REF(block)), SER_DISK, CLIENT_VERSION);
+    return ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+}
+
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
@@ -1031,34 +1296,184 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
         return error("WriteBlockToDisk: OpenBlockFile failed");
 
     // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(block);
-    fileout << FLATDATA(messageStart) << nSize;
+    bool fCompressed = IsBlockStoredCompressed(block);
+    unsigned int nSize = GetBlockDiskSize(block);
+    fileout << FLATDATA(messageStart) << (fCompressed ? nSize | BLOCK_RECORD_COMPRESSED : nSize);
 
     // Write block
     long fileOutPos = ftell(fileout.Get());
     if (fileOutPos < 0)
         return error("WriteBlockToDisk: ftell failed");
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+    if (fCompressed)
+        fileout << CBlockCompressor(REF(block));
+    else
+        fileout << block;
+    fileout.fclose();
+    blockFilePool.Changed(pos.nFile, false);
 
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+//! Maximum number of block and undo files kept memory-mapped for reading
+static const unsigned int MAX_MAPPED_BLOCK_FILES = 64;
+
+namespace {
+
+/**
+ * Read-only memory mappings of the block and undo files that are no longer
+ * appended to, so that reading blocks and undo data from them needs no system
+ * calls and deserializes straight from the page cache. A mapping is shared
+ * with the readers using it, so it can be replaced or dropped at any time.
+ */
+class CBlockFileMaps
 {
-    block.SetNull();
+private:
+    struct Entry
+    {
+        boost::shared_ptr<CMappedFile> file;
+        uint64_t nLastUsed;
+    };
+    typedef std::pair<int, bool> Key; // file number, undo file
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    boost::mutex cs;
+    std::map<Key, Entry> mapFiles;
+    uint64_t nUseCounter;
+
+public:
+    CBlockFileMaps() : nUseCounter(0) {}
+
+    /** Get a mapping of a file that is at least nMinSize bytes long */
+    boost::shared_ptr<CMappedFile> Get(int nFile, bool fUndo, size_t nMinSize)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        Entry& entry = mapFiles[Key(nFile, fUndo)];
+        entry.nLastUsed = ++nUseCounter;
+        if (entry.file && entry.file->size() >= nMinSize)
+            return entry.file;
+
+        // Map the file anew; readers of the old mapping keep it alive
+        entry.file.reset(new CMappedFile());
+        if (!entry.file->Open(GetBlockPosFilename(CDiskBlockPos(nFile, 0), fUndo ? "rev" : "blk").string()) ||
+            entry.file->size() < nMinSize) {
+            mapFiles.erase(Key(nFile, fUndo));
+            return boost::shared_ptr<CMappedFile>();
+        }
+        boost::shared_ptr<CMappedFile> file = entry.file;
+        if (mapFiles.size() > MAX_MAPPED_BLOCK_FILES) {
+            std::map<Key, Entry>::iterator itOldest = mapFiles.begin();
+            for (std::map<Key, Entry>::iterator it = mapFiles.begin(); it != mapFiles.end(); it++)
+                if (it->second.nLastUsed < itOldest->second.nLastUsed)
+                    itOldest = it;
+            mapFiles.erase(itOldest);
+        }
+        return file;
+    }
+
+    /** Drop the mappings of a block file and its undo file */
+    void Erase(int nFile)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        mapFiles.erase(Key(nFile, false));
+        mapFiles.erase(Key(nFile, true));
+    }
+};
+
+CBlockFileMaps blockFileMaps;
+
+/**
+ * Map the block or undo file that pos points into, if it is no longer
+ * appended to. Sets nEnd to the end of the data written to it, beyond which
+ * the file may have been truncated since and must not be read.
+ */
+bool MapDiskFile(const CDiskBlockPos& pos, bool fUndo, boost::shared_ptr<CMappedFile>& file, unsigned int& nEnd)
+{
+    // Leave the address space of 32-bit systems alone
+    if (sizeof(void*) < 8)
+        return false;
+    {
+        LOCK(cs_LastBlockFile);
+        if (pos.IsNull() || pos.nFile >= (int)vinfoBlockFile.size() || pos.nFile == nLastBlockFile)
+            return false;
+        nEnd = fUndo ? vinfoBlockFile[pos.nFile].nUndoSize : vinfoBlockFile[pos.nFile].nSize;
+    }
+    if (pos.nPos >= nEnd)
+        return false;
+    file = blockFileMaps.Get(pos.nFile, fUndo, nEnd);
+    return file != NULL;
+}
 
-    // Read block
+} // anon namespace
+
+/** Read the size of the block record at pos, as stored in the block file */
+static bool ReadBlockDiskSize(const CDiskBlockPos& pos, unsigned int& nSize)
+{
+    if (pos.nPos < sizeof(unsigned int))
+        return false;
+    CBlockFileReader reader(CDiskBlockPos(pos.nFile, pos.nPos - sizeof(unsigned int)), false);
+    CAutoFile& filein = *reader;
+    if (filein.IsNull())
+        return false;
+    unsigned int nRecordSize;
     try {
-        filein >> block;
+        filein >> nRecordSize;
     }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    catch (const std::exception&) {
+        return false;
+    }
+    nRecordSize &= ~BLOCK_RECORD_COMPRESSED;
+    if (nRecordSize < 80 || nRecordSize > MAX_BLOCK_SIZE)
+        return false;
+    nSize = nRecordSize;
+    return true;
+}
+
+/** Read a block from a stream positioned at the size of its record */
+template<typename Stream>
+static void ReadBlockRecord(Stream& filein, CBlock& block)
+{
+    unsigned int nSize;
+    filein >> nSize;
+    if (nSize & BLOCK_RECORD_COMPRESSED)
+        filein >> REF(CBlockCompressor(block));
+    else
+        filein >> block;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
+{
+    block.SetNull();
+
+    // WriteBlockToDisk put the message start and size right before the block
+    if (pos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("%s: Invalid position %s", __func__, pos.ToString());
+    CDiskBlockPos posSize(pos.nFile, pos.nPos - sizeof(unsigned int));
+
+    boost::shared_ptr<CMappedFile> mapped;
+    unsigned int nEnd;
+    if (MapDiskFile(posSize, false, mapped, nEnd)) {
+        // Read block
+        try {
+            CSpanReader filein(mapped->data() + posSize.nPos, mapped->data() + nEnd, SER_DISK, CLIENT_VERSION);
+            ReadBlockRecord(filein, block);
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    } else {
+        // Open history file to read
+        CBlockFileReader reader(posSize, false);
+        CAutoFile& filein = *reader;
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+
+        // Read block
+        try {
+            ReadBlockRecord(filein, block);
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
 
     // Check the header
@@ -1078,6 +1493,63 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+/** Read a block in network format from a stream positioned at its record */
+template<typename Stream>
+static bool ReadRawBlockRecord(Stream& filein, std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    CMessageHeader::MessageStartChars blkMessageStart;
+    unsigned int nSize;
+    filein >> FLATDATA(blkMessageStart) >> nSize;
+    bool fCompressed = (nSize & BLOCK_RECORD_COMPRESSED) != 0;
+    nSize &= ~BLOCK_RECORD_COMPRESSED;
+
+    if (memcmp(blkMessageStart, messageStart, MESSAGE_START_SIZE))
+        return error("%s: Block magic mismatch at %s", __func__, pos.ToString());
+    if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+        return error("%s: Invalid block size %u at %s", __func__, nSize, pos.ToString());
+
+    if (fCompressed) {
+        CBlock block;
+        filein >> REF(CBlockCompressor(block));
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+        ssBlock << block;
+        vchBlock.assign(ssBlock.begin(), ssBlock.end());
+    } else {
+        vchBlock.resize(nSize);
+        filein.read((char*)&vchBlock[0], nSize);
+    }
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    vchBlock.clear();
+
+    // WriteBlockToDisk put the message start and size right before the block
+    const unsigned int nHeaderSize = MESSAGE_START_SIZE + sizeof(unsigned int);
+    if (pos.nPos < nHeaderSize)
+        return error("%s: Invalid position %s", __func__, pos.ToString());
+    CDiskBlockPos posHeader(pos.nFile, pos.nPos - nHeaderSize);
+
+    try {
+        boost::shared_ptr<CMappedFile> mapped;
+        unsigned int nEnd;
+        if (MapDiskFile(posHeader, false, mapped, nEnd)) {
+            CSpanReader filein(mapped->data() + posHeader.nPos, mapped->data() + nEnd, SER_DISK, CLIENT_VERSION);
+            return ReadRawBlockRecord(filein, vchBlock, pos, messageStart);
+        }
+
+        CBlockFileReader reader(posHeader, false);
+        CAutoFile& filein = *reader;
+        if (filein.IsNull())
+            return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+        return ReadRawBlockRecord(filein, vchBlock, pos, messageStart);
+    }
+    catch (const std::exception& e) {
+        return error("%s: Read or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1420,25 +1892,44 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     hasher << hashBlock;
     hasher << blockundo;
     fileout << hasher.GetHash();
+    fileout.fclose();
+    blockFilePool.Changed(pos.nFile, true);
 
     return true;
 }
 
+} // anon namespace
+
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenBlockFile failed", __func__);
-
-    // Read block
     uint256 hashChecksum;
-    try {
-        filein >> blockundo;
-        filein >> hashChecksum;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    boost::shared_ptr<CMappedFile> mapped;
+    unsigned int nEnd;
+    if (MapDiskFile(pos, true, mapped, nEnd)) {
+        // Read block
+        try {
+            CSpanReader filein(mapped->data() + pos.nPos, mapped->data() + nEnd, SER_DISK, CLIENT_VERSION);
+            filein >> blockundo;
+            filein >> hashChecksum;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+    } else {
+        // Open history file to read
+        CBlockFileReader reader(pos, true);
+        CAutoFile& filein = *reader;
+        if (filein.IsNull())
+            return error("%s: OpenBlockFile failed", __func__);
+
+        // Read block
+        try {
+            filein >> blockundo;
+            filein >> hashChecksum;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
 
     // Verify checksum
@@ -1451,6 +1942,8 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
+namespace {
+
 /** Abort with a message */
 bool AbortNode(const std::string& strMessage, const std::string& userMessage="")
 {
@@ -1584,6 +2077,8 @@ void static FlushBlockFile(bool fFinalize = false)
             TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
         FileCommit(fileOld);
         fclose(fileOld);
+        if (fFinalize)
+            blockFilePool.Changed(nLastBlockFile, false);
     }
 
     fileOld = OpenUndoFile(posOld);
@@ -1592,6 +2087,8 @@ void static FlushBlockFile(bool fFinalize = false)
             TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
         FileCommit(fileOld);
         fclose(fileOld);
+        if (fFinalize)
+            blockFilePool.Changed(nLastBlockFile, true);
     }
 }
 
@@ -1744,9 +2241,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CAmount nFees = 0;
     int nInputs = 0;
     unsigned int nSigOps = 0;
-    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
-    vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
@@ -1789,9 +2283,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             blockundo.vtxundo.push_back(CTxUndo());
         }
         UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
-
-        vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
     int64_t nTime1 = GetTimeMicros(); nTimeConnect += nTime1 - nTimeStart;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs-1), nTimeConnect * 0.000001);
@@ -1830,10 +2321,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
-            return AbortNode(state, "Failed to write transaction index");
-
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -1858,6 +2345,54 @@ enum FlushStateMode {
     FLUSH_STATE_ALWAYS
 };
 
+namespace {
+/** Guards insertions into mapBlockIndex, so that it can be searched without cs_main */
+CCriticalSection cs_mapBlockIndex;
+
+/** The latest chain snapshot; the mutex only guards replacing the pointer */
+boost::mutex csChainSnapshot;
+CChainSnapshotRef chainSnapshot(new CChainSnapshot());
+} // anon namespace
+
+CChainSnapshotRef GetChainSnapshot()
+{
+    boost::unique_lock<boost::mutex> lock(csChainSnapshot);
+    return chainSnapshot;
+}
+
+/**
+ * Publish a new snapshot of chainActive and pindexBestHeader; called wherever
+ * those are changed, under cs_main. fRecomputePruneHeight forces a full walk
+ * for the prune height; otherwise it is carried over whenever the chain only
+ * changed above it.
+ */
+static void PublishChainSnapshot(bool fRecomputePruneHeight = false)
+{
+    CChainSnapshot* snapshot = new CChainSnapshot();
+    snapshot->pindexTip = chainActive.Tip();
+    snapshot->pindexBestHeader = pindexBestHeader;
+    if (snapshot->pindexTip) {
+        snapshot->nMedianTimePast = snapshot->pindexTip->GetMedianTimePast();
+
+        if (fPruneMode) {
+            CChainSnapshotRef previous = GetChainSnapshot();
+            if (!fRecomputePruneHeight && previous->pindexTip && previous->nPruneHeight >= 0 &&
+                LastCommonAncestor(const_cast<CBlockIndex*>(previous->pindexTip), chainActive.Tip())->nHeight >= previous->nPruneHeight) {
+                snapshot->nPruneHeight = previous->nPruneHeight;
+            } else {
+                const CBlockIndex* block = snapshot->pindexTip;
+                while (block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
+                    block = block->pprev;
+                snapshot->nPruneHeight = block->nHeight;
+            }
+        }
+    }
+
+    CChainSnapshotRef ref(snapshot);
+    boost::unique_lock<boost::mutex> lock(csChainSnapshot);
+    chainSnapshot.swap(ref);
+}
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
@@ -1931,8 +2466,10 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
             }
         }
         // Finally remove any pruned files
-        if (fFlushForPrune)
+        if (fFlushForPrune) {
             UnlinkPrunedFiles(setFilesToPrune);
+            PublishChainSnapshot(true);
+        }
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -1975,6 +2512,13 @@ void PruneAndFlush() {
 void static UpdateTip(CBlockIndex *pindexNew) {
     const CChainParams& chainParams = Params();
     chainActive.SetTip(pindexNew);
+    PublishChainSnapshot();
+
+    // The cached message is only worth keeping while its block is the tip
+    if (msgTipBlock && hashTipBlockMsg != pindexNew->GetBlockHash()) {
+        msgTipBlock.reset();
+        hashTipBlockMsg.SetNull();
+    }
 
     // New best block
     nTimeBestReceived = GetTime();
@@ -1986,6 +2530,7 @@ void static UpdateTip(CBlockIndex *pindexNew) {
       Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1<<20)), pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
+    GetMainSignals().UpdatedBlockTip(pindexNew);
 
     // Check the version of the last 100 blocks to see if we need to upgrade:
     static bool fWarned = false;
@@ -2044,6 +2589,7 @@ bool static DisconnectTip(CValidationState &state) {
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
+    GetMainSignals().BlockDisconnected(block);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
     BOOST_FOREACH(const CTransaction &tx, block.vtx) {
@@ -2392,25 +2938,30 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.Allocate(CBlockIndex(block));
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
-    BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
-    pindexNew->phashBlock = &((*mi).first);
-    BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
-    if (miPrev != mapBlockIndex.end())
     {
-        pindexNew->pprev = (*miPrev).second;
-        pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
-        pindexNew->BuildSkip();
+        // The entry must be complete before LookupBlockIndex can find it
+        LOCK(cs_mapBlockIndex);
+        BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+        pindexNew->phashBlock = &((*mi).first);
+        BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
+        if (miPrev != mapBlockIndex.end())
+        {
+            pindexNew->pprev = (*miPrev).second;
+            pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
+            pindexNew->BuildSkip();
+        }
+        pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
+        pindexNew->RaiseValidity(BLOCK_VALID_TREE);
     }
-    pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
-    pindexNew->RaiseValidity(BLOCK_VALID_TREE);
-    if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexNew->nChainWork)
+    if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexNew->nChainWork) {
         pindexBestHeader = pindexNew;
+        PublishChainSnapshot();
+    }
 
     setDirtyBlockIndex.insert(pindexNew);
 
@@ -2565,6 +3116,9 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 {
     // These are checks that are independent of context.
 
+    if (block.fChecked)
+        return true;
+
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
     if (!CheckBlockHeader(block, state, fCheckPOW))
@@ -2620,6 +3174,9 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         return state.DoS(100, error("CheckBlock(): out-of-bounds SigOpCount"),
                          REJECT_INVALID, "bad-blk-sigops", true);
 
+    if (fCheckPOW && fCheckMerkleRoot)
+        block.fChecked = true;
+
     return true;
 }
 
@@ -2779,10 +3336,13 @@ bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockIndex** ppi
 
     // Write block to history file
     try {
-        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        unsigned int nBlockSize = GetBlockDiskSize(block);
         CDiskBlockPos blockPos;
-        if (dbp != NULL)
+        if (dbp != NULL) {
             blockPos = *dbp;
+            // Take the size from the block file, as it may be stored differently than we would store it now
+            ReadBlockDiskSize(blockPos, nBlockSize);
+        }
         if (!FindBlockPos(state, blockPos, nBlockSize+8, nHeight, block.GetBlockTime(), dbp != NULL))
             return error("AcceptBlock(): FindBlockPos failed");
         if (dbp == NULL)
@@ -2820,7 +3380,7 @@ bool ProcessNewBlock(CValidationState &state, const CNode* pfrom, const CBlock*
 
     {
         LOCK(cs_main);
-        bool fRequested = MarkBlockAsReceived(pblock->GetHash());
+        bool fRequested = MarkBlockAsReceived(pblock->GetHash(), pfrom ? pfrom->GetId() : -1);
         fRequested |= fForceProcessing;
         if (!checked) {
             return error("%s: CheckBlock FAILED", __func__);
@@ -2921,6 +3481,8 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockFileMaps.Erase(*it);
+        blockFilePool.Erase(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -3033,55 +3595,264 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex(): new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
+    LOCK(cs_mapBlockIndex);
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
     return pindexNew;
 }
 
-bool static LoadBlockIndexDB()
+CBlockIndex* LookupBlockIndex(const uint256& hash)
 {
-    const CChainParams& chainparams = Params();
-    if (!pblocktree->LoadBlockIndexGuts())
-        return false;
+    LOCK(cs_mapBlockIndex);
+    BlockMap::const_iterator it = mapBlockIndex.find(hash);
+    return it == mapBlockIndex.end() ? NULL : it->second;
+}
 
-    boost::this_thread::interruption_point();
+/** Version of the block index snapshot format */
+static const int BLOCK_INDEX_SNAPSHOT_VERSION = 2;
+/** Serialized size of an entry in the block index snapshot */
+static const size_t BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE = 3 * 32 + 12 * 4;
 
-    // Calculate nChainWork
+/** Whether mapBlockIndex is complete, rather than interrupted while loading */
+static bool fBlockIndexInitialized = false;
+
+static boost::filesystem::path GetBlockIndexSnapshotPath()
+{
+    return GetDataDir() / "blocks" / "index.snapshot";
+}
+
+static bool SameBlockFileInfo(const CBlockFileInfo& a, const CBlockFileInfo& b)
+{
+    return a.nBlocks == b.nBlocks && a.nSize == b.nSize && a.nUndoSize == b.nUndoSize &&
+           a.nHeightFirst == b.nHeightFirst && a.nHeightLast == b.nHeightLast &&
+           a.nTimeFirst == b.nTimeFirst && a.nTimeLast == b.nTimeLast;
+}
+
+/**
+ * Snapshot layout: version, snapshot id, the last block file with its info,
+ * the coins tip, entry count, the entries ordered by height (so predecessors
+ * and skip targets, stored as positions, come first) and a checksum of
+ * everything before it.
+ *
+ * The snapshot is only used if the block tree database holds its id. The id
+ * is erased as soon as the snapshot is loaded and only written back at
+ * shutdown, so a node that crashes, or an older version that does not know
+ * about snapshots, never leaves a stale snapshot behind that looks current.
+ * The last block file and the coins tip are checked on top of that, as both
+ * move whenever a block is connected.
+ */
+bool WriteBlockIndexSnapshot()
+{
+    LOCK(cs_main);
+    if (!fBlockIndexInitialized || pblocktree == NULL || pcoinsTip == NULL || (size_t)nLastBlockFile >= vinfoBlockFile.size() ||
+        !setDirtyBlockIndex.empty() || !setDirtyFileInfo.empty())
+        return false; // out of sync with the database
+
+    int64_t nStart = GetTimeMillis();
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
-    }
+        vSortedByHeight.push_back(make_pair(item.second->nHeight, item.second));
     sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
-    {
-        CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
-        // We can link the chain of blocks for which we've received transactions at some point.
-        // Pruned nodes may have deleted the block.
-        if (pindex->nTx > 0) {
-            if (pindex->pprev) {
-                if (pindex->pprev->nChainTx) {
-                    pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
-                } else {
-                    pindex->nChainTx = 0;
-                    mapBlocksUnlinked.insert(std::make_pair(pindex->pprev, pindex));
-                }
-            } else {
-                pindex->nChainTx = pindex->nTx;
+
+    uint256 id = GetRandHash();
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.reserve(vSortedByHeight.size() * BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE + 128);
+    ss << BLOCK_INDEX_SNAPSHOT_VERSION << id << nLastBlockFile << vinfoBlockFile[nLastBlockFile] << pcoinsTip->GetBestBlock();
+    ss << (uint32_t)vSortedByHeight.size();
+    std::map<const CBlockIndex*, int32_t> mapPosition;
+    for (size_t i = 0; i < vSortedByHeight.size(); i++) {
+        const CBlockIndex* pindex = vSortedByHeight[i].second;
+        int32_t nPrev = pindex->pprev ? mapPosition[pindex->pprev] : -1;
+        int32_t nSkip = pindex->pskip ? mapPosition[pindex->pskip] : -1;
+        ss << pindex->GetBlockHash() << nPrev << nSkip << pindex->nHeight << pindex->nFile << pindex->nDataPos << pindex->nUndoPos;
+        ss << pindex->nVersion << pindex->hashMerkleRoot << pindex->nTime << pindex->nBits << pindex->nNonce;
+        ss << pindex->nStatus << pindex->nTx << ArithToUint256(pindex->nChainWork);
+        mapPosition[pindex] = i;
+    }
+    ss << Hash(ss.begin(), ss.end());
+
+    boost::filesystem::path path = GetBlockIndexSnapshotPath();
+    boost::filesystem::path pathTmp = path.string() + ".new";
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    if (!file)
+        return error("%s: failed to open %s", __func__, pathTmp.string());
+    bool fWritten = fwrite(&ss[0], 1, ss.size(), file) == ss.size();
+    if (fWritten)
+        FileCommit(file);
+    fclose(file);
+    if (!fWritten || !RenameOver(pathTmp, path))
+        return error("%s: failed to write %s", __func__, path.string());
+    if (!pblocktree->WriteIndexSnapshotId(id))
+        return error("%s: failed to record the snapshot in the block tree database", __func__);
+    LogPrintf("%s: wrote %u block index entries (%u bytes) in %dms\n", __func__, vSortedByHeight.size(), ss.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+/** Load mapBlockIndex from the snapshot, if it matches the block tree database */
+static bool LoadBlockIndexSnapshot(vector<pair<int, CBlockIndex*> >& vSortedByHeight)
+{
+    uint256 id;
+    if (!mapBlockIndex.empty() || blockIndexArena.Size() != 0 || !pblocktree->ReadIndexSnapshotId(id))
+        return false;
+    // Whatever happens below, the snapshot is only good for this one startup
+    if (!pblocktree->EraseIndexSnapshotId())
+        return error("%s: failed to erase the snapshot id", __func__);
+
+    int64_t nStart = GetTimeMillis();
+    boost::filesystem::path path = GetBlockIndexSnapshotPath();
+    std::vector<char> vData;
+    try {
+        vData.resize(boost::filesystem::file_size(path));
+    } catch (const boost::filesystem::filesystem_error& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+    FILE* file = fopen(path.string().c_str(), "rb");
+    if (!file)
+        return error("%s: failed to open %s", __func__, path.string());
+    bool fRead = vData.size() > 32 && fread(&vData[0], 1, vData.size(), file) == vData.size();
+    fclose(file);
+    if (!fRead)
+        return error("%s: failed to read %s", __func__, path.string());
+    const char* pbegin = &vData[0];
+    const char* pend = pbegin + vData.size() - 32;
+    if (memcmp(Hash(pbegin, pend).begin(), pend, 32) != 0)
+        return error("%s: checksum mismatch", __func__);
+
+    CBlockIndex* pblocks = NULL;
+    std::vector<uint256> vHashes;
+    try {
+        CSpanReader s(pbegin, pend, SER_DISK, CLIENT_VERSION);
+        int nVersion;
+        uint256 idFile;
+        s >> nVersion >> idFile;
+        if (nVersion != BLOCK_INDEX_SNAPSHOT_VERSION || idFile != id)
+            return error("%s: snapshot does not match the block tree database", __func__);
+
+        int nLastFile, nLastFileDB;
+        CBlockFileInfo info, infoDB;
+        uint256 hashCoinsTip;
+        uint32_t nCount;
+        s >> nLastFile >> info >> hashCoinsTip >> nCount;
+        if (!pblocktree->ReadLastBlockFile(nLastFileDB) || nLastFileDB != nLastFile ||
+            !pblocktree->ReadBlockFileInfo(nLastFile, infoDB) || !SameBlockFileInfo(info, infoDB))
+            return error("%s: the block files changed since the snapshot was written", __func__);
+        if (hashCoinsTip != pcoinsTip->GetBestBlock())
+            return error("%s: the coins tip changed since the snapshot was written", __func__);
+        if (s.size() % BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE != 0 || s.size() / BLOCK_INDEX_SNAPSHOT_ENTRY_SIZE != nCount)
+            return error("%s: snapshot is truncated", __func__);
+
+        pblocks = blockIndexArena.AllocateArray(nCount);
+        vHashes.resize(nCount);
+        for (uint32_t i = 0; i < nCount; i++) {
+            CBlockIndex* pindex = &pblocks[i];
+            int32_t nPrev, nSkip;
+            uint256 nChainWork;
+            s >> vHashes[i] >> nPrev >> nSkip >> pindex->nHeight >> pindex->nFile >> pindex->nDataPos >> pindex->nUndoPos;
+            s >> pindex->nVersion >> pindex->hashMerkleRoot >> pindex->nTime >> pindex->nBits >> pindex->nNonce;
+            s >> pindex->nStatus >> pindex->nTx >> nChainWork;
+            if (nPrev >= (int32_t)i || nSkip >= (int32_t)i)
+                throw std::ios_base::failure("entry precedes its predecessor");
+            pindex->pprev = nPrev < 0 ? NULL : &pblocks[nPrev];
+            pindex->pskip = nSkip < 0 ? NULL : &pblocks[nSkip];
+            pindex->nChainWork = UintToArith256(nChainWork);
+        }
+    } catch (const std::exception& e) {
+        blockIndexArena.Clear();
+        return error("%s: deserialize error - %s", __func__, e.what());
+    }
+
+    LOCK(cs_mapBlockIndex);
+    mapBlockIndex.rehash(vHashes.size());
+    vSortedByHeight.reserve(vHashes.size());
+    for (size_t i = 0; i < vHashes.size(); i++) {
+        std::pair<BlockMap::iterator, bool> ret = mapBlockIndex.insert(make_pair(vHashes[i], &pblocks[i]));
+        if (!ret.second) {
+            mapBlockIndex.clear();
+            vSortedByHeight.clear();
+            blockIndexArena.Clear();
+            return error("%s: duplicate entry %s", __func__, vHashes[i].ToString());
+        }
+        pblocks[i].phashBlock = &ret.first->first;
+        vSortedByHeight.push_back(make_pair(pblocks[i].nHeight, &pblocks[i]));
+    }
+    LogPrintf("%s: loaded %u block index entries in %dms\n", __func__, vHashes.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+/**
+ * Move the entries loaded from the block tree database, which come out in
+ * hash order, into one array in height order, so that walking a chain
+ * touches adjacent entries. Must run before anything but mapBlockIndex and
+ * the entries' pprev pointers refers to them.
+ */
+static void RelocateBlockIndex(vector<pair<int, CBlockIndex*> >& vSortedByHeight)
+{
+    CBlockIndexArena arena;
+    CBlockIndex* pblocks = arena.AllocateArray(vSortedByHeight.size());
+    LOCK(cs_mapBlockIndex);
+    for (size_t i = 0; i < vSortedByHeight.size(); i++) {
+        CBlockIndex* pindexOld = vSortedByHeight[i].second;
+        CBlockIndex* pindexNew = &pblocks[i];
+        *pindexNew = *pindexOld;
+        // Predecessors have a lower height, so their map entry already points at the new copy
+        if (pindexOld->pprev)
+            pindexNew->pprev = mapBlockIndex.find(pindexOld->pprev->GetBlockHash())->second;
+        mapBlockIndex.find(pindexOld->GetBlockHash())->second = pindexNew;
+        vSortedByHeight[i].second = pindexNew;
+    }
+    blockIndexArena.swap(arena);
+}
+
+bool static LoadBlockIndexDB()
+{
+    const CChainParams& chainparams = Params();
+    vector<pair<int, CBlockIndex*> > vSortedByHeight;
+    // The snapshot also holds the chain work and skip pointers computed below
+    bool fSnapshot = LoadBlockIndexSnapshot(vSortedByHeight);
+    if (!fSnapshot) {
+        if (!pblocktree->LoadBlockIndexGuts())
+            return false;
+
+        vSortedByHeight.reserve(mapBlockIndex.size());
+        BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        {
+            CBlockIndex* pindex = item.second;
+            vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+        }
+        sort(vSortedByHeight.begin(), vSortedByHeight.end());
+        RelocateBlockIndex(vSortedByHeight);
+    }
+
+    boost::this_thread::interruption_point();
+
+    // Calculate nChainWork
+    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+    {
+        CBlockIndex* pindex = item.second;
+        if (!fSnapshot)
+            pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        // We can link the chain of blocks for which we've received transactions at some point.
+        // Pruned nodes may have deleted the block.
+        if (pindex->nTx > 0) {
+            if (pindex->pprev) {
+                if (pindex->pprev->nChainTx) {
+                    pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+                } else {
+                    pindex->nChainTx = 0;
+                    mapBlocksUnlinked.insert(std::make_pair(pindex->pprev, pindex));
+                }
+            } else {
+                pindex->nChainTx = pindex->nTx;
             }
         }
         if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == NULL))
             setBlockIndexCandidates.insert(pindex);
         if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
             pindexBestInvalid = pindex;
-        if (pindex->pprev)
+        if (pindex->pprev && !fSnapshot)
             pindex->BuildSkip();
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
@@ -3132,15 +3903,12 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadReindexing(fReindexing);
     fReindex |= fReindexing;
 
-    // Check whether we have a transaction index
-    pblocktree->ReadFlag("txindex", fTxIndex);
-    LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
-
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
         return true;
     chainActive.SetTip(it->second);
+    PublishChainSnapshot(true);
 
     PruneBlockIndexCandidates();
 
@@ -3247,6 +4015,7 @@ void UnloadBlockIndex()
     chainActive.SetTip(NULL);
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
+    PublishChainSnapshot();
     mempool.clear();
     mapOrphanTransactions.clear();
     mapOrphanTransactionsByPrev.clear();
@@ -3261,13 +4030,17 @@ void UnloadBlockIndex()
     nPreferredDownload = 0;
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
+    msgTipBlock.reset();
+    hashTipBlockMsg.SetNull();
     mapNodeState.clear();
     recentRejects.reset(NULL);
+    fBlockIndexInitialized = false;
 
-    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
+    {
+        LOCK(cs_mapBlockIndex);
+        mapBlockIndex.clear();
+        blockIndexArena.Clear();
     }
-    mapBlockIndex.clear();
     fHavePruned = false;
 }
 
@@ -3286,14 +4059,12 @@ bool InitBlockIndex() {
 
     // Initialize global variables that cannot be constructed at startup.
     recentRejects.reset(new CRollingBloomFilter(120000, 0.000001));
+    fBlockIndexInitialized = true;
 
     // Check whether we're already initialized
     if (chainActive.Genesis() != NULL)
         return true;
 
-    // Use the provided setting for -txindex in the new database
-    fTxIndex = GetBoolArg("-txindex", false);
-    pblocktree->WriteFlag("txindex", fTxIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -3301,7 +4072,7 @@ bool InitBlockIndex() {
         try {
             CBlock &block = const_cast<CBlock&>(Params().GenesisBlock());
             // Start new block file
-            unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+            unsigned int nBlockSize = GetBlockDiskSize(block);
             CDiskBlockPos blockPos;
             CValidationState state;
             if (!FindBlockPos(state, blockPos, nBlockSize+8, 0, block.GetBlockTime()))
@@ -3344,6 +4115,7 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
             nRewind++; // start one byte further next time, in case of failure
             blkdat.SetLimit(); // remove former limit
             unsigned int nSize = 0;
+            bool fCompressed = false;
             try {
                 // locate a header
                 unsigned char buf[MESSAGE_START_SIZE];
@@ -3354,6 +4126,8 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
                     continue;
                 // read size
                 blkdat >> nSize;
+                fCompressed = (nSize & BLOCK_RECORD_COMPRESSED) != 0;
+                nSize &= ~BLOCK_RECORD_COMPRESSED;
                 if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
                     continue;
             } catch (const std::exception&) {
@@ -3368,7 +4142,10 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
                 blkdat.SetLimit(nBlockPos + nSize);
                 blkdat.SetPos(nBlockPos);
                 CBlock block;
-                blkdat >> block;
+                if (fCompressed)
+                    blkdat >> REF(CBlockCompressor(block));
+                else
+                    blkdat >> block;
                 nRewind = blkdat.GetPos();
 
                 // detect out of order blocks, and store them for later
@@ -3428,6 +4205,222 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
     return nLoaded > 0;
 }
 
+/** A block found in the block files by the -reindex scan */
+struct CReindexBlock
+{
+    uint256 hash;
+    uint256 hashPrev;
+    CDiskBlockPos pos;
+};
+
+//! Maximum number of threads scanning block files in parallel during -reindex
+static const int MAX_REINDEX_SCAN_THREADS = 8;
+
+/** Position fileIn at the next candidate message start at or after nPos, if any */
+static bool FindNextMessageStart(FILE* fileIn, unsigned int& nPos)
+{
+    unsigned char buf[65536];
+    while (true) {
+        boost::this_thread::interruption_point();
+        if (fseek(fileIn, nPos, SEEK_SET))
+            return false;
+        size_t nRead = fread(buf, 1, sizeof(buf), fileIn);
+        if (nRead == 0)
+            return false;
+        const unsigned char* pfound = (const unsigned char*)memchr(buf, Params().MessageStart()[0], nRead);
+        if (pfound) {
+            nPos += pfound - buf;
+            return true;
+        }
+        nPos += nRead;
+    }
+}
+
+/**
+ * Find the blocks stored in one block file, with their parents and positions.
+ * Consecutive blocks are skipped over after reading just their header; only
+ * after a gap or damaged data is the file searched for the next message start,
+ * and a block found that way, or one whose size does not lead to the next
+ * block, is only accepted if it deserializes completely.
+ */
+static void ScanBlockFile(int nFile, std::vector<CReindexBlock>& vBlocks)
+{
+    FILE* fileIn = OpenBlockFile(CDiskBlockPos(nFile, 0), true);
+    if (!fileIn)
+        return; // This error is logged in OpenBlockFile
+    CAutoFile filein(fileIn, SER_DISK, CLIENT_VERSION);
+
+    unsigned int nPos = 0;
+    bool fSearch = false;
+    std::vector<unsigned char> vchBlock;
+    while (true) {
+        boost::this_thread::interruption_point();
+        if (fSearch && !FindNextMessageStart(fileIn, nPos))
+            break;
+        unsigned char header[MESSAGE_START_SIZE + 4];
+        if (fseek(fileIn, nPos, SEEK_SET) || fread(header, 1, sizeof(header), fileIn) != sizeof(header))
+            break;
+        unsigned int nSize = ReadLE32(header + MESSAGE_START_SIZE);
+        bool fCompressed = (nSize & BLOCK_RECORD_COMPRESSED) != 0;
+        nSize &= ~BLOCK_RECORD_COMPRESSED;
+        if (memcmp(header, Params().MessageStart(), MESSAGE_START_SIZE) || nSize < 80 || nSize > MAX_BLOCK_SIZE) {
+            nPos++;
+            fSearch = true;
+            continue;
+        }
+
+        // Trust the size if it leads to another message start or to the end
+        // of the file. The last block before the space preallocated for later
+        // blocks is verified too, as zeroes are common inside blocks.
+        bool fVerify = fSearch;
+        if (!fVerify) {
+            unsigned char next[MESSAGE_START_SIZE];
+            if (fseek(fileIn, nPos + sizeof(header) + nSize, SEEK_SET))
+                fVerify = true;
+            else if (fread(next, 1, sizeof(next), fileIn) == sizeof(next))
+                fVerify = memcmp(next, Params().MessageStart(), MESSAGE_START_SIZE) != 0;
+            if (fseek(fileIn, nPos + sizeof(header), SEEK_SET))
+                break;
+        }
+
+        CReindexBlock entry;
+        entry.pos = CDiskBlockPos(nFile, nPos + sizeof(header));
+        try {
+            vchBlock.resize(fVerify ? nSize : 80);
+            if (fread(&vchBlock[0], 1, vchBlock.size(), fileIn) != vchBlock.size())
+                throw std::ios_base::failure("end of file");
+            CDataStream ss(vchBlock, SER_DISK, CLIENT_VERSION);
+            if (fVerify) {
+                CBlock block;
+                if (fCompressed)
+                    ss >> REF(CBlockCompressor(block));
+                else
+                    ss >> block;
+                if (!ss.empty())
+                    throw std::ios_base::failure("size mismatch");
+                entry.hash = block.GetHash();
+                entry.hashPrev = block.hashPrevBlock;
+            } else {
+                CBlockHeader block;
+                ss >> block;
+                entry.hash = block.GetHash();
+                entry.hashPrev = block.hashPrevBlock;
+            }
+        } catch (const std::exception&) {
+            nPos++;
+            fSearch = true;
+            continue;
+        }
+        vBlocks.push_back(entry);
+        nPos += sizeof(header) + nSize;
+        fSearch = false;
+    }
+}
+
+/** Work shared by the threads scanning block files */
+struct CReindexScan
+{
+    boost::mutex cs;
+    int nNextFile;
+    std::vector<std::vector<CReindexBlock> > vFileBlocks;
+};
+
+static void ThreadScanBlockFiles(CReindexScan* scan)
+{
+    RenameThread("bitcoin-reindex");
+    while (true) {
+        int nFile;
+        {
+            boost::unique_lock<boost::mutex> lock(scan->cs);
+            if (scan->nNextFile >= (int)scan->vFileBlocks.size())
+                return;
+            nFile = scan->nNextFile++;
+        }
+        ScanBlockFile(nFile, scan->vFileBlocks[nFile]);
+    }
+}
+
+bool ReindexBlockFiles()
+{
+    const CChainParams& chainparams = Params();
+    int64_t nStart = GetTimeMillis();
+
+    // Find the blocks in all block files in parallel. The files are
+    // independent, and only the headers need to be read and hashed.
+    CReindexScan scan;
+    scan.nNextFile = 0;
+    int nFiles = 0;
+    while (boost::filesystem::exists(GetBlockPosFilename(CDiskBlockPos(nFiles, 0), "blk")))
+        nFiles++;
+    scan.vFileBlocks.resize(nFiles);
+    int nThreads = std::max(1, std::min(std::min(GetNumCores(), MAX_REINDEX_SCAN_THREADS), nFiles));
+    LogPrintf("Reindexing %d block files using %d threads...\n", nFiles, nThreads);
+    boost::thread_group scanThreads;
+    try {
+        for (int i = 0; i < nThreads; i++)
+            scanThreads.create_thread(boost::bind(&ThreadScanBlockFiles, &scan));
+        scanThreads.join_all();
+    } catch (const boost::thread_interrupted&) {
+        scanThreads.interrupt_all();
+        scanThreads.join_all();
+        throw;
+    }
+
+    // Blocks whose parent is known can be connected right away, the others
+    // wait for their parent. Processing in breadth-first order from there
+    // connects the blocks in order of height, reading each of them once.
+    std::deque<const CReindexBlock*> queue;
+    std::multimap<uint256, const CReindexBlock*> mapBlocksUnknownParent;
+    size_t nFound = 0;
+    for (int nFile = 0; nFile < nFiles; nFile++) {
+        BOOST_FOREACH(const CReindexBlock& entry, scan.vFileBlocks[nFile]) {
+            if (entry.hash == chainparams.GetConsensus().hashGenesisBlock || LookupBlockIndex(entry.hashPrev))
+                queue.push_back(&entry);
+            else
+                mapBlocksUnknownParent.insert(std::make_pair(entry.hashPrev, &entry));
+        }
+        nFound += scan.vFileBlocks[nFile].size();
+    }
+    LogPrintf("Found %u blocks in %dms\n", nFound, GetTimeMillis() - nStart);
+
+    int nLoaded = 0;
+    CBlock block;
+    try {
+        while (!queue.empty()) {
+            boost::this_thread::interruption_point();
+            const CReindexBlock* pentry = queue.front();
+            queue.pop_front();
+
+            // process in case the block isn't known yet
+            CBlockIndex* pindex = LookupBlockIndex(pentry->hash);
+            if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
+                CDiskBlockPos pos = pentry->pos;
+                if (!ReadBlockFromDisk(block, pos))
+                    continue;
+                CValidationState state;
+                bool fAccepted = ProcessNewBlock(state, NULL, &block, true, &pos);
+                if (state.IsError())
+                    break;
+                if (!fAccepted)
+                    continue;
+                if (++nLoaded % 10000 == 0)
+                    LogPrintf("Reindex: connected %d of %u blocks\n", nLoaded, nFound);
+            }
+
+            std::pair<std::multimap<uint256, const CReindexBlock*>::iterator, std::multimap<uint256, const CReindexBlock*>::iterator> range = mapBlocksUnknownParent.equal_range(pentry->hash);
+            for (std::multimap<uint256, const CReindexBlock*>::iterator it = range.first; it != range.second; it++)
+                queue.push_back(it->second);
+            mapBlocksUnknownParent.erase(range.first, range.second);
+        }
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
+    if (!mapBlocksUnknownParent.empty())
+        LogPrintf("Reindex: ignored %u blocks not connected to the genesis block\n", mapBlocksUnknownParent.size());
+    LogPrintf("Reindexed %i blocks in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    return nLoaded > 0;
+}
+
 void static CheckBlockIndex()
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
@@ -3755,32 +4748,45 @@ void static ProcessGetData(CNode* pfrom)
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
-                    {
-                        LOCK(pfrom->cs_filter);
-                        if (pfrom->pfilter)
+                    if (inv.type == MSG_BLOCK && inv.hash == hashTipBlockMsg) {
+                        // Most peers ask for the block we just announced; hand
+                        // them all the same serialized message.
+                        pfrom->PushSerializedMessage(msgTipBlock);
+                    } else {
+                        // Send block from disk
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
+                        if (inv.type == MSG_BLOCK) {
+                            if (mi->second == chainActive.Tip()) {
+                                msgTipBlock = MakeSerializedMessage("block", block);
+                                hashTipBlockMsg = inv.hash;
+                                pfrom->PushSerializedMessage(msgTipBlock);
+                            } else {
+                                pfrom->PushMessage("block", block);
+                            }
+                        }
+                        else // MSG_FILTERED_BLOCK)
                         {
-                            CMerkleBlock merkleBlock(block, *pfrom->pfilter);
-                            pfrom->PushMessage("merkleblock", merkleBlock);
-                            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                            // This avoids hurting performance by pointlessly requiring a round-trip
-                            // Note that there is currently no way for a node to request any single transactions we didn't send here -
-                            // they must either disconnect and retry or request the full block.
-                            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                            // however we MUST always provide at least what the remote peer needs
-                            typedef std::pair<unsigned int, uint256> PairType;
-                            BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
-                                    pfrom->PushMessage("tx", block.vtx[pair.first]);
+                            LOCK(pfrom->cs_filter);
+                            if (pfrom->pfilter)
+                            {
+                                CMerkleBlock merkleBlock(block, *pfrom->pfilter);
+                                pfrom->PushMessage("merkleblock", merkleBlock);
+                                // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+                                // This avoids hurting performance by pointlessly requiring a round-trip
+                                // Note that there is currently no way for a node to request any single transactions we didn't send here -
+                                // they must either disconnect and retry or request the full block.
+                                // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+                                // however we MUST always provide at least what the remote peer needs
+                                typedef std::pair<unsigned int, uint256> PairType;
+                                BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
+                                    if (!pfrom->filterInventoryKnown.contains(pair.second))
+                                        pfrom->PushMessage("tx", block.vtx[pair.first]);
+                            }
+                            // else
+                                // no response
                         }
-                        // else
-                            // no response
                     }
 
                     // Trigger the peer node to send a getblocks request for the next batch of inventory
@@ -3802,9 +4808,9 @@ void static ProcessGetData(CNode* pfrom)
                 bool pushed = false;
                 {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                    map<CInv, CSendBufferRef>::iterator mi = mapRelay.find(inv);
                     if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
+                        pfrom->PushSerializedMessage((*mi).second);
                         pushed = true;
                     }
                 }
@@ -3845,6 +4851,231 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+/**
+ * Hand a received block to ProcessNewBlock, unless it already failed
+ * CheckBlock, and punish the peer if it is invalid. Runs on the message
+ * handler thread, so blocks and the other messages of a peer are processed in
+ * the order they arrived.
+ */
+static void ProcessBlockMessage(CNode* pfrom, const CBlock& block, CValidationState& state, bool fChecked)
+{
+    CInv inv(MSG_BLOCK, block.GetHash());
+    LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
+
+    pfrom->AddInventoryKnown(inv);
+
+    if (fChecked) {
+        // Process all blocks from whitelisted peers, even if not requested,
+        // unless we're still syncing with the network.
+        // Such an unrequested block may still be processed, subject to the
+        // conditions in AcceptBlock().
+        bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
+        ProcessNewBlock(state, pfrom, &block, forceProcessing, NULL);
+    } else {
+        // What ProcessNewBlock does with a block failing CheckBlock
+        LOCK(cs_main);
+        MarkBlockAsReceived(inv.hash, pfrom->GetId());
+    }
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        assert (state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
+        pfrom->PushMessage("reject", string("block"), state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
+        if (nDoS > 0) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+    }
+}
+
+namespace {
+
+/**
+ * A block message of a peer, deserialized and run through CheckBlock on the
+ * prevalidation thread. Everything else, from ProcessNewBlock to scoring the
+ * peer, happens when the message handler picks up the result.
+ */
+struct CBlockPrevalidationEntry {
+    CDataStream vRecv;
+    CBlock block;
+    CValidationState state;
+    //! Why the message could not be deserialized, if it could not
+    std::string strError;
+    //! Whether the block passed CheckBlock
+    bool fChecked;
+    //! Picked up by the prevalidation thread
+    bool fStarted;
+    //! Waiting for the message handler
+    bool fDone;
+    //! The peer went away while its block was being checked
+    bool fAbandoned;
+
+    CBlockPrevalidationEntry() : vRecv(SER_NETWORK, PROTOCOL_VERSION), fChecked(false), fStarted(false), fDone(false), fAbandoned(false) {}
+};
+
+boost::mutex csBlockPrevalidation;
+boost::condition_variable condBlockPrevalidation;
+/** Blocks being checked or waiting for the message handler, at most one per peer */
+std::map<NodeId, CBlockPrevalidationEntry> mapBlockPrevalidation;
+/** Peers whose block the prevalidation thread has yet to pick up, in arrival order */
+std::deque<NodeId> queueBlockPrevalidation;
+bool fBlockPrevalidationRunning = false;
+
+/** Whether a block message would have to wait for room in the prevalidation queue */
+bool BlockPrevalidationQueueFull()
+{
+    boost::unique_lock<boost::mutex> lock(csBlockPrevalidation);
+    return fBlockPrevalidationRunning && queueBlockPrevalidation.size() >= MAX_BLOCK_PREVALIDATION_QUEUE;
+}
+
+/**
+ * Queue a block message for the prevalidation thread, taking ownership of the
+ * contents of vRecv. The caller makes sure there is room and that the peer has
+ * no other block queued. Returns false if the thread is not running and the
+ * caller must process the block itself.
+ */
+bool QueueBlockMessage(CNode* pfrom, CDataStream& vRecv)
+{
+    boost::unique_lock<boost::mutex> lock(csBlockPrevalidation);
+    if (!fBlockPrevalidationRunning)
+        return false;
+    assert(!mapBlockPrevalidation.count(pfrom->GetId()));
+    mapBlockPrevalidation[pfrom->GetId()].vRecv.swap(vRecv);
+    queueBlockPrevalidation.push_back(pfrom->GetId());
+    condBlockPrevalidation.notify_all();
+    return true;
+}
+
+/**
+ * Process the peer's block once the prevalidation thread is done with it.
+ * Returns false if it is still being checked, in which case the peer's other
+ * messages have to wait.
+ */
+bool FinishBlockPrevalidation(CNode* pfrom)
+{
+    std::map<NodeId, CBlockPrevalidationEntry>::iterator it;
+    {
+        boost::unique_lock<boost::mutex> lock(csBlockPrevalidation);
+        it = mapBlockPrevalidation.find(pfrom->GetId());
+        if (it == mapBlockPrevalidation.end())
+            return true;
+        if (!it->second.fDone)
+            return false;
+    }
+    // Nobody else touches a finished entry, and the peer can't be finalized while we handle its messages
+    CBlockPrevalidationEntry& entry = it->second;
+    if (!entry.strError.empty()) {
+        pfrom->PushMessage("reject", string("block"), REJECT_MALFORMED, string("error parsing message"));
+        LogPrintf("%s: Exception '%s' caught while parsing block from peer=%d\n", __func__, entry.strError, pfrom->id);
+    } else {
+        ProcessBlockMessage(pfrom, entry.block, entry.state, entry.fChecked);
+    }
+    boost::unique_lock<boost::mutex> lock(csBlockPrevalidation);
+    mapBlockPrevalidation.erase(it);
+    return true;
+}
+
+/** Forget the block of a peer that disconnected */
+void AbandonBlockPrevalidation(NodeId nodeid)
+{
+    boost::unique_lock<boost::mutex> lock(csBlockPrevalidation);
+    std::map<NodeId, CBlockPrevalidationEntry>::iterator it = mapBlockPrevalidation.find(nodeid);
+    if (it == mapBlockPrevalidation.end())
+        return;
+    if (it->second.fStarted && !it->second.fDone) {
+        it->second.fAbandoned = true;
+        return;
+    }
+    if (!it->second.fStarted)
+        queueBlockPrevalidation.erase(std::find(queueBlockPrevalidation.begin(), queueBlockPrevalidation.end(), nodeid));
+    mapBlockPrevalidation.erase(it);
+}
+
+} // anon namespace
+
+void ThreadBlockPrevalidation()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csBlockPrevalidation);
+        fBlockPrevalidationRunning = true;
+    }
+    try {
+        while (true) {
+            NodeId nodeid;
+            CBlockPrevalidationEntry* pentry;
+            {
+                boost::unique_lock<boost::mutex> lock(csBlockPrevalidation);
+                while (queueBlockPrevalidation.empty())
+                    condBlockPrevalidation.wait(lock);
+                nodeid = queueBlockPrevalidation.front();
+                queueBlockPrevalidation.pop_front();
+                pentry = &mapBlockPrevalidation[nodeid];
+                pentry->fStarted = true;
+            }
+            // The entry stays put until we mark it done, so it can be worked on without the lock
+            try {
+                pentry->vRecv >> pentry->block;
+                pentry->fChecked = CheckBlock(pentry->block, pentry->state);
+            } catch (const std::ios_base::failure& e) {
+                pentry->strError = e.what();
+            } catch (const std::exception& e) {
+                PrintExceptionContinue(&e, "ThreadBlockPrevalidation()");
+                pentry->strError = e.what();
+            }
+            {
+                boost::unique_lock<boost::mutex> lock(csBlockPrevalidation);
+                CDataStream(SER_NETWORK, PROTOCOL_VERSION).swap(pentry->vRecv);
+                if (pentry->fAbandoned)
+                    mapBlockPrevalidation.erase(nodeid);
+                else
+                    pentry->fDone = true;
+            }
+            WakeMessageHandler();
+            boost::this_thread::interruption_point();
+        }
+    } catch (const boost::thread_interrupted&) {
+        // Blocks waiting for the message handler are left to it
+        boost::unique_lock<boost::mutex> lock(csBlockPrevalidation);
+        fBlockPrevalidationRunning = false;
+        BOOST_FOREACH(NodeId nodeid, queueBlockPrevalidation)
+            mapBlockPrevalidation.erase(nodeid);
+        queueBlockPrevalidation.clear();
+        throw;
+    }
+}
+
+/**
+ * Check a BIP 157 request for the filters of the blocks from height
+ * nStartHeight up to hashStop, and find the stop block. Peers asking for
+ * filters we don't serve, or for too many of them, are disconnected.
+ */
+static bool PrepareBlockFilterRequest(CNode* pfrom, unsigned char nFilterType, uint32_t nStartHeight, const uint256& hashStop, uint32_t nMaxCount, const CBlockIndex*& pindexStop)
+{
+    AssertLockHeld(cs_main);
+
+    if (!(nLocalServices & NODE_COMPACT_FILTERS) || pblockfilterindex == NULL || nFilterType != pblockfilterindex->GetFilterType()) {
+        LogPrint("net", "peer %d requested unsupported block filter type %d\n", pfrom->id, nFilterType);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    BlockMap::iterator mi = mapBlockIndex.find(hashStop);
+    if (mi == mapBlockIndex.end() || !mi->second->IsValid(BLOCK_VALID_SCRIPTS)) {
+        LogPrint("net", "peer %d requested block filters up to unknown block %s\n", pfrom->id, hashStop.ToString());
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    pindexStop = mi->second;
+
+    uint32_t nStopHeight = pindexStop->nHeight;
+    if (nStartHeight > nStopHeight || nStopHeight - nStartHeight >= nMaxCount) {
+        LogPrint("net", "peer %d requested invalid block filter range %d to %d\n", pfrom->id, nStartHeight, nStopHeight);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    return true;
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     const CChainParams& chainparams = Params();
@@ -4108,7 +5339,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
                     CNodeState *nodestate = State(pfrom->GetId());
                     if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - chainparams.GetConsensus().nPowTargetSpacing * 20 &&
-                        nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                        nodestate->nBlocksInFlight < nodestate->nBlocksInFlightLimit) {
                         vToFetch.push_back(inv);
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
@@ -4412,35 +5643,21 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
     else if (strCommand == "block" && !fImporting && !fReindex) // Ignore blocks received while importing
     {
-        CBlock block;
-        vRecv >> block;
-
-        CInv inv(MSG_BLOCK, block.GetHash());
-        LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
-
-        pfrom->AddInventoryKnown(inv);
-
-        CValidationState state;
-        // Process all blocks from whitelisted peers, even if not requested,
-        // unless we're still syncing with the network.
-        // Such an unrequested block may still be processed, subject to the
-        // conditions in AcceptBlock().
-        bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
-        ProcessNewBlock(state, pfrom, &block, forceProcessing, NULL);
-        int nDoS;
-        if (state.IsInvalid(nDoS)) {
-            assert (state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
-            pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-            if (nDoS > 0) {
-                LOCK(cs_main);
-                Misbehaving(pfrom->GetId(), nDoS);
-            }
+        // Deserialization and CheckBlock happen on the prevalidation thread;
+        // ProcessMessages picks up the result before the peer's next message.
+        if (QueueBlockMessage(pfrom, vRecv)) {
+            pfrom->fPauseRecvProcessing = true;
+        } else {
+            CBlock block;
+            vRecv >> block;
+            CValidationState state;
+            bool fChecked = CheckBlock(block, state);
+            ProcessBlockMessage(pfrom, block, state, fChecked);
         }
-
     }
 
 
+
     // This asymmetric behavior for inbound and outbound connections was introduced
     // to prevent a fingerprinting attack: an attacker can send specific fake addresses
     // to users' AddrMan and later request them by sending getaddr messages.
@@ -4638,6 +5855,83 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
+    // Filters are read from the index without holding cs_main. Requests the
+    // index can't answer yet, because it is still catching up, are ignored.
+    else if (strCommand == "getcfilters")
+    {
+        unsigned char nFilterType;
+        uint32_t nStartHeight;
+        uint256 hashStop;
+        vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+        const CBlockIndex* pindexStop = NULL;
+        {
+            LOCK(cs_main);
+            if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, hashStop, MAX_GETCFILTERS_SIZE, pindexStop))
+                return true;
+        }
+
+        // The stored encodings are sent as they are, in the layout of a
+        // serialized CBlockFilter, without decoding them first
+        std::vector<std::vector<unsigned char> > vEncoded;
+        if (!pblockfilterindex->LookupEncodedFilterRange(nStartHeight, pindexStop, vEncoded)) {
+            LogPrint("net", "no block filters for heights %d to %d, peer=%d\n", nStartHeight, pindexStop->nHeight, pfrom->id);
+            return true;
+        }
+        for (unsigned int i = 0; i < vEncoded.size(); i++)
+            pfrom->PushMessage("cfilter", nFilterType, pindexStop->GetAncestor(nStartHeight + i)->GetBlockHash(), vEncoded[i]);
+    }
+
+
+    else if (strCommand == "getcfheaders")
+    {
+        unsigned char nFilterType;
+        uint32_t nStartHeight;
+        uint256 hashStop;
+        vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+        const CBlockIndex* pindexStop = NULL;
+        {
+            LOCK(cs_main);
+            if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, hashStop, MAX_GETCFHEADERS_SIZE, pindexStop))
+                return true;
+        }
+
+        uint256 hashPrevHeader;
+        std::vector<uint256> vHashes;
+        if ((nStartHeight > 0 && !pblockfilterindex->LookupFilterHeader(pindexStop->GetAncestor(nStartHeight - 1), hashPrevHeader)) ||
+            !pblockfilterindex->LookupFilterHashRange(nStartHeight, pindexStop, vHashes)) {
+            LogPrint("net", "no block filter headers for heights %d to %d, peer=%d\n", nStartHeight, pindexStop->nHeight, pfrom->id);
+            return true;
+        }
+        pfrom->PushMessage("cfheaders", nFilterType, hashStop, hashPrevHeader, vHashes);
+    }
+
+
+    else if (strCommand == "getcfcheckpt")
+    {
+        unsigned char nFilterType;
+        uint256 hashStop;
+        vRecv >> nFilterType >> hashStop;
+
+        const CBlockIndex* pindexStop = NULL;
+        {
+            LOCK(cs_main);
+            if (!PrepareBlockFilterRequest(pfrom, nFilterType, 0, hashStop, std::numeric_limits<uint32_t>::max(), pindexStop))
+                return true;
+        }
+
+        std::vector<uint256> vHeaders(pindexStop->nHeight / CFCHECKPT_INTERVAL);
+        for (unsigned int i = 0; i < vHeaders.size(); i++) {
+            if (!pblockfilterindex->LookupFilterHeader(pindexStop->GetAncestor((i + 1) * CFCHECKPT_INTERVAL), vHeaders[i])) {
+                LogPrint("net", "no block filter header at height %d, peer=%d\n", (i + 1) * CFCHECKPT_INTERVAL, pfrom->id);
+                return true;
+            }
+        }
+        pfrom->PushMessage("cfcheckpt", nFilterType, hashStop, vHeaders);
+    }
+
+
     else if (strCommand == "reject")
     {
         if (fDebug) {
@@ -4689,6 +5983,11 @@ bool ProcessMessages(CNode* pfrom)
     //
     bool fOk = true;
 
+    // Messages received after a block wait until the block has been checked
+    pfrom->fPauseRecvProcessing = !FinishBlockPrevalidation(pfrom);
+    if (pfrom->fPauseRecvProcessing)
+        return fOk;
+
     if (!pfrom->vRecvGetData.empty())
         ProcessGetData(pfrom);
 
@@ -4713,6 +6012,14 @@ bool ProcessMessages(CNode* pfrom)
         if (!msg.complete())
             break;
 
+        // Leave a block where it is while the prevalidation thread is busy,
+        // instead of blocking the message handler. The socket handler stops
+        // reading from the peer until the block has been queued.
+        if (msg.hdr.GetCommand() == "block" && BlockPrevalidationQueueFull()) {
+            pfrom->fPauseRecvProcessing = true;
+            break;
+        }
+
         // at this point, any failure means we can delete the current message
         it++;
 
@@ -4925,53 +6232,62 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         // Message: inventory
         //
+        int64_t nNow = GetTimeMicros();
         vector<CInv> vInv;
-        vector<CInv> vInvWait;
         {
             LOCK(pto->cs_inventory);
-            vInv.reserve(pto->vInventoryToSend.size());
-            vInvWait.reserve(pto->vInventoryToSend.size());
-            BOOST_FOREACH(const CInv& inv, pto->vInventoryToSend)
-            {
-                if (pto->setInventoryKnown.count(inv))
-                    continue;
-
-                // trickle out tx inv to protect privacy
-                if (inv.type == MSG_TX && !fSendTrickle)
-                {
-                    // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt.IsNull())
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = ArithToUint256(UintToArith256(inv.hash) ^ UintToArith256(hashSalt));
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    bool fTrickleWait = ((UintToArith256(hashRand) & 3) != 0);
 
-                    if (fTrickleWait)
-                    {
-                        vInvWait.push_back(inv);
+            // Blocks are announced right away
+            vInv.reserve(std::max<size_t>(pto->vInventoryBlockToSend.size(), INVENTORY_BROADCAST_MAX));
+            BOOST_FOREACH(const uint256& hash, pto->vInventoryBlockToSend) {
+                if (pto->filterInventoryKnown.contains(hash))
+                    continue;
+                pto->filterInventoryKnown.insert(hash);
+                vInv.push_back(CInv(MSG_BLOCK, hash));
+                if (vInv.size() == MAX_INV_SZ) {
+                    pto->PushMessage("inv", vInv);
+                    vInv.clear();
+                }
+            }
+            pto->vInventoryBlockToSend.clear();
+
+            // Transactions go out in batches on a randomized timer, which
+            // both protects the origin of our own transactions and lets each
+            // batch be deduplicated and ordered by fee rate.
+            bool fSendTxInv = pto->fWhitelisted;
+            if (pto->nNextInvSend < nNow) {
+                fSendTxInv = true;
+                // Use half the delay for outbound peers, as there is less privacy concern for them.
+                pto->nNextInvSend = PoissonNextSend(nNow, INVENTORY_BROADCAST_INTERVAL >> !pto->fInbound);
+            }
+            if (fSendTxInv && !pto->setInventoryTxToSend.empty()) {
+                vector<uint256> vInvTx(pto->setInventoryTxToSend.begin(), pto->setInventoryTxToSend.end());
+                pto->setInventoryTxToSend.clear();
+                // Drops anything that has left the mempool in the meantime
+                mempool.SortForRelay(vInvTx);
+                unsigned int nRelayedTransactions = 0;
+                BOOST_FOREACH(const uint256& hash, vInvTx) {
+                    if (nRelayedTransactions >= INVENTORY_BROADCAST_MAX) {
+                        // Keep the rest for the next batch
+                        pto->setInventoryTxToSend.insert(hash);
                         continue;
                     }
-                }
-
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second)
-                {
-                    vInv.push_back(inv);
-                    if (vInv.size() >= 1000)
-                    {
+                    if (pto->filterInventoryKnown.contains(hash))
+                        continue;
+                    pto->filterInventoryKnown.insert(hash);
+                    vInv.push_back(CInv(MSG_TX, hash));
+                    nRelayedTransactions++;
+                    if (vInv.size() == MAX_INV_SZ) {
                         pto->PushMessage("inv", vInv);
                         vInv.clear();
                     }
                 }
             }
-            pto->vInventoryToSend = vInvWait;
         }
         if (!vInv.empty())
             pto->PushMessage("inv", vInv);
 
         // Detect whether we're stalling
-        int64_t nNow = GetTimeMicros();
         if (!pto->fDisconnect && state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
             // Stalling only triggers when the block download window cannot move. During normal steady state,
             // the download window should be much larger than the to-be-downloaded set of blocks, so disconnection
@@ -5006,10 +6322,12 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        state.nBlocksInFlightLimit = GetBlocksInFlightLimit(state.nAvgBlockDeliveryTime, pto->nPingUsecTime);
+        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < state.nBlocksInFlightLimit) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+            CBlockIndex *pindexStalled = NULL;
+            FindNextBlocksToDownload(pto->GetId(), state.nBlocksInFlightLimit - state.nBlocksInFlight, vToDownload, staller, pindexStalled);
             BOOST_FOREACH(CBlockIndex *pindex, vToDownload) {
                 vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), consensusParams, pindex);
@@ -5017,8 +6335,19 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     pindex->nHeight, pto->id);
             }
             if (state.nBlocksInFlight == 0 && staller != -1) {
-                if (State(staller)->nStallingSince == 0) {
-                    State(staller)->nStallingSince = nNow;
+                // The window can't move until the staller delivers pindexStalled. If it
+                // is taking much longer than its own track record suggests, ask this
+                // idle peer for the block instead of waiting out the stall. A block is
+                // only moved once; if the new peer stalls too, it times out as usual.
+                CNodeState *stallerState = State(staller);
+                const QueuedBlock &queued = *mapBlocksInFlight[pindexStalled->GetBlockHash()].second;
+                if (queued.nodeStalled == -1 && queued.nTime < nNow - GetBlockReassignTimeout(stallerState->nAvgBlockDeliveryTime)) {
+                    LogPrint("net", "Reassigning block %s (%d) from peer=%d to peer=%d\n", pindexStalled->GetBlockHash().ToString(),
+                        pindexStalled->nHeight, staller, pto->id);
+                    vGetData.push_back(CInv(MSG_BLOCK, pindexStalled->GetBlockHash()));
+                    MarkBlockAsInFlight(pto->GetId(), pindexStalled->GetBlockHash(), consensusParams, pindexStalled, staller);
+                } else if (stallerState->nStallingSince == 0) {
+                    stallerState->nStallingSince = nNow;
                     LogPrint("net", "Stall started peer=%d\n", staller);
                 }
             }
@@ -5062,10 +6391,8 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
 
         // orphan transactions
         mapOrphanTransactions.clear();
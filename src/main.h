@@ -26,11 +26,14 @@
 #include <utility>
 #include <vector>
 
+#include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CBloomFilter;
+class CCoinsViewDB;
 class CInv;
 class CScriptCheck;
 class CTxMemPool;
@@ -49,17 +52,38 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** Maximum number of block and undo files kept open for reading between reads */
+static const int MAX_OPEN_BLOCK_FILES = 8;
+/** Set in the size of a block record in the block files if the block is stored compressed */
+static const unsigned int BLOCK_RECORD_COMPRESSED = 0x80000000;
+/** Default for -blockcompression, storing new blocks compressed */
+static const bool DEFAULT_BLOCK_COMPRESSION = false;
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
-static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Maximum number of received blocks waiting for deserialization and context-free checks */
+static const unsigned int MAX_BLOCK_PREVALIDATION_QUEUE = 8;
+/** Number of blocks that can be requested at any given time from a single peer, until its download rate is known. */
+static const int DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Lower and upper bound on the number of blocks in flight from a single peer, once its download rate is known. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 128;
+/** Time (in microseconds) worth of block deliveries to keep queued at each peer, on top of one round trip. */
+static const int64_t BLOCK_DOWNLOAD_QUEUE_TIME = 1000000;
+/** Minimum time (in microseconds) a block must be in flight before the download window moves it to another peer. */
+static const int64_t BLOCK_REASSIGN_MIN_TIME = 1000000;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached its tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 2000;
+/** Maximum number of filters sent in reply to a getcfilters message (BIP 157). */
+static const unsigned int MAX_GETCFILTERS_SIZE = 1000;
+/** Maximum number of filter hashes sent in reply to a getcfheaders message (BIP 157). */
+static const unsigned int MAX_GETCFHEADERS_SIZE = 2000;
+/** Interval between the filter headers sent in reply to a getcfcheckpt message (BIP 157). */
+static const int CFCHECKPT_INTERVAL = 1000;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
@@ -71,6 +95,12 @@ static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
+/** Average delay between batched transaction announcements in seconds.
+ *  Blocks and whitelisted receivers bypass this, outbound peers get half this delay. */
+static const unsigned int INVENTORY_BROADCAST_INTERVAL = 5;
+/** Maximum number of transactions to announce per batch, best fee rate first.
+ *  Limits the impact of low-fee transaction floods. */
+static const unsigned int INVENTORY_BROADCAST_MAX = 7 * INVENTORY_BROADCAST_INTERVAL;
 
 struct BlockHasher
 {
@@ -90,7 +120,7 @@ extern CConditionVariable cvBlockChange;
 extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
-extern bool fTxIndex;
+extern bool fBlockCompression;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
@@ -153,12 +183,16 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp = NULL);
+/** Rebuild the block index from the block files (blk?????.dat), for -reindex */
+bool ReindexBlockFiles();
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex();
 /** Load the block tree and coins database from disk */
 bool LoadBlockIndex();
 /** Unload database information */
 void UnloadBlockIndex();
+/** Write the block index to a snapshot that is loaded instead of the database at the next startup */
+bool WriteBlockIndexSnapshot();
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom);
 /**
@@ -170,6 +204,8 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run the thread that deserializes and prechecks blocks received from peers */
+void ThreadBlockPrevalidation();
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -181,6 +217,12 @@ bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock, b
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(CValidationState &state, const CBlock *pblock = NULL);
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
+/** Fold the time (in microseconds) a peer took to deliver a block into its average, 0 if still unknown. */
+int64_t UpdateBlockDeliveryTime(int64_t nAvgBlockDeliveryTime, int64_t nDeliveryTime);
+/** How many blocks may be in flight from a peer, given its average delivery time (0 if unknown) and ping. */
+int GetBlocksInFlightLimit(int64_t nAvgBlockDeliveryTime, int64_t nPingUsecTime);
+/** How long (in microseconds) a block may be in flight from a peer before the download window moves it to another one. */
+int64_t GetBlockReassignTimeout(int64_t nAvgBlockDeliveryTime);
 
 /**
  * Prune block and undo files (blk???.dat and undo???.dat) so that the disk space used is less than a user-defined target.
@@ -225,6 +267,8 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nBlocksInFlightLimit;
+    int64_t nAvgBlockDeliveryTime;
 };
 
 struct CDiskTxPos : public CDiskBlockPos
@@ -334,10 +378,40 @@ public:
 };
 
 
+/**
+ * An immutable summary of the active chain, republished under cs_main whenever
+ * the tip, the best header or the prune height changes. Readers that only
+ * need the tip, its ancestors and their header fields (which never change
+ * once an entry is linked into mapBlockIndex) can use it without cs_main.
+ */
+struct CChainSnapshot
+{
+    /** Tip of the active chain, NULL until the block index is loaded */
+    const CBlockIndex* pindexTip;
+    /** Best header known, which may be ahead of the tip */
+    const CBlockIndex* pindexBestHeader;
+    int64_t nMedianTimePast;
+    /** Height of the lowest block from which on all block data is stored, -1 if not pruning */
+    int nPruneHeight;
+
+    CChainSnapshot() : pindexTip(NULL), pindexBestHeader(NULL), nMedianTimePast(0), nPruneHeight(-1) {}
+};
+typedef boost::shared_ptr<const CChainSnapshot> CChainSnapshotRef;
+
+/** Return the latest chain snapshot; does not require cs_main */
+CChainSnapshotRef GetChainSnapshot();
+/** Find a block index entry by hash; does not require cs_main */
+CBlockIndex* LookupBlockIndex(const uint256& hash);
+
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
+/** Size a block takes up in the block files, without the message start and size */
+unsigned int GetBlockDiskSize(const CBlock& block);
+/** Read the serialized bytes of the block at pos, only deserializing them if the block is stored compressed */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -445,6 +519,9 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** Global variable that points to the coin database backing pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
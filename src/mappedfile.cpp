@@ -0,0 +1,99 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mappedfile.h"
+
+#include <stdint.h>
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#ifdef WIN32
+#ifdef _WIN32_WINNT
+#undef _WIN32_WINNT
+#endif
+#define _WIN32_WINNT 0x0501
+#define WIN32_LEAN_AND_MEAN 1
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::CMappedFile() : pdata(NULL), nSize(0)
+{
+#ifdef WIN32
+    hMapping = NULL;
+#endif
+}
+
+CMappedFile::~CMappedFile()
+{
+    Close();
+}
+
+bool CMappedFile::Open(const std::string& strPath)
+{
+    Close();
+#ifdef WIN32
+    HANDLE hFile = CreateFileA(strPath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                               NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER nFileSize;
+    if (!GetFileSizeEx(hFile, &nFileSize) || nFileSize.QuadPart == 0 || (uint64_t)nFileSize.QuadPart > (size_t)-1) {
+        CloseHandle(hFile);
+        return false;
+    }
+    HANDLE hMap = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(hFile);
+    if (hMap == NULL)
+        return false;
+    void* p = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+    if (p == NULL) {
+        CloseHandle(hMap);
+        return false;
+    }
+    hMapping = hMap;
+    pdata = (const char*)p;
+    nSize = nFileSize.QuadPart;
+#else
+    int fd = open(strPath.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || (uint64_t)st.st_size > (size_t)-1) {
+        close(fd);
+        return false;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+    pdata = (const char*)p;
+    nSize = st.st_size;
+#endif
+    return true;
+}
+
+void CMappedFile::Close()
+{
+    if (!pdata)
+        return;
+#ifdef WIN32
+    UnmapViewOfFile(pdata);
+    CloseHandle(hMapping);
+    hMapping = NULL;
+#else
+    munmap(const_cast<char*>(pdata), nSize);
+#endif
+    pdata = NULL;
+    nSize = 0;
+}
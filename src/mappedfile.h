@@ -0,0 +1,44 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_MAPPEDFILE_H
+#define BITCOIN_MAPPEDFILE_H
+
+#include <stddef.h>
+#include <string>
+
+/**
+ * Read-only memory mapping of a whole file, unmapped on destruction.
+ *
+ * Reading past the end of a file that has been truncated after it was mapped
+ * is fatal, so callers must only read the parts of the file that are known
+ * to stay in place.
+ */
+class CMappedFile
+{
+private:
+    // Disallow copies
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+
+    const char* pdata;
+    size_t nSize;
+#ifdef WIN32
+    void* hMapping;
+#endif
+
+public:
+    CMappedFile();
+    ~CMappedFile();
+
+    /** Map the file at strPath, replacing any previous mapping */
+    bool Open(const std::string& strPath);
+    void Close();
+
+    bool IsNull() const { return pdata == NULL; }
+    const char* data() const { return pdata; }
+    size_t size() const { return nSize; }
+};
+
+#endif // BITCOIN_MAPPEDFILE_H
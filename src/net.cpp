@@ -25,6 +25,8 @@
 #include <fcntl.h>
 #endif
 
+#include <math.h>
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -87,7 +89,7 @@ std::string strSubVersion;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CSendBufferRef> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -733,10 +735,10 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CSendBufferRef>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
+        const CSendBuffer &data = **it;
         assert(data.size() > pnode->nSendOffset);
         int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
         if (nBytes > 0) {
@@ -747,6 +749,7 @@ void SocketSendData(CNode *pnode)
             if (pnode->nSendOffset == data.size()) {
                 pnode->nSendOffset = 0;
                 pnode->nSendSize -= data.size();
+                pnode->ReleaseSendBuffer(*it);
                 it++;
             } else {
                 // could not send full message; stop sending more
@@ -883,7 +886,9 @@ void ThreadSocketHandler()
                 //   needlessly queueing received data, if the remote peer is not themselves
                 //   receiving data. This means properly utilizing TCP flow control signalling.
                 // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
+                //   or there is space left in the buffer and the message handler is not
+                //   holding the peer's messages back (e.g. behind a full block
+                //   prevalidation queue), select() for receiving data.
                 // * (if neither of the above applies, there is certainly one message
                 //   in the receiver buffer ready to be processed).
                 // Together, that means that at least one of the following is always possible,
@@ -902,7 +907,7 @@ void ThreadSocketHandler()
                     TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                     if (lockRecv && (
                         pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+                        (!pnode->fPauseRecvProcessing && pnode->GetTotalRecvSize() <= ReceiveFloodSize())))
                         FD_SET(pnode->hSocket, &fdsetRecv);
                 }
             }
@@ -1516,11 +1521,21 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 }
 
 
-void ThreadMessageHandler()
+/** Set by WakeMessageHandler so a wake-up that comes while the handler is busy isn't lost */
+static boost::mutex csMessageHandlerWake;
+static bool fMessageHandlerWake = false;
+
+void WakeMessageHandler()
 {
-    boost::mutex condition_mutex;
-    boost::unique_lock<boost::mutex> lock(condition_mutex);
+    {
+        boost::unique_lock<boost::mutex> lock(csMessageHandlerWake);
+        fMessageHandlerWake = true;
+    }
+    messageHandlerCondition.notify_one();
+}
 
+void ThreadMessageHandler()
+{
     SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
     while (true)
     {
@@ -1553,7 +1568,7 @@ void ThreadMessageHandler()
                     if (!g_signals.ProcessMessages(pnode))
                         pnode->CloseSocketDisconnect();
 
-                    if (pnode->nSendSize < SendBufferSize())
+                    if (pnode->nSendSize < SendBufferSize() && !pnode->fPauseRecvProcessing)
                     {
                         if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
                         {
@@ -1579,8 +1594,10 @@ void ThreadMessageHandler()
                 pnode->Release();
         }
 
-        if (fSleep)
+        boost::unique_lock<boost::mutex> lock(csMessageHandlerWake);
+        if (fSleep && !fMessageHandlerWake)
             messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+        fMessageHandlerWake = false;
     }
 }
 
@@ -1868,6 +1885,8 @@ void RelayTransaction(const CTransaction& tx)
 void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
 {
     CInv inv(MSG_TX, tx.GetHash());
+    // Frame and checksum the message once; every peer that asks for it gets the same buffer
+    CSendBufferRef msg = MakeSerializedMessage(inv.GetCommand(), ss);
     {
         LOCK(cs_mapRelay);
         // Expire old relay messages
@@ -1878,7 +1897,7 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
         }
 
         // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
+        mapRelay.insert(std::make_pair(inv, msg));
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
     LOCK(cs_vNodes);
@@ -1896,6 +1915,11 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
     }
 }
 
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds)
+{
+    return nNow + (int64_t)(log1p(GetRand(1ULL << 48) * -0.0000000000000035527136788 /* -1/2^48 */) * average_interval_seconds * -1000000.0 + 0.5);
+}
+
 void CNode::RecordBytesRecv(uint64_t bytes)
 {
     LOCK(cs_totalBytesRecv);
@@ -2062,7 +2086,7 @@ unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
 CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNameIn, bool fInboundIn) :
     ssSend(SER_NETWORK, INIT_PROTO_VERSION),
     addrKnown(5000, 0.001),
-    setInventoryKnown(SendBufferSize() / 1000)
+    filterInventoryKnown(5000, 0.000001)
 {
     nServices = 0;
     hSocket = hSocketIn;
@@ -2084,9 +2108,11 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fPauseRecvProcessing = false;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    vSendBufferPool.reserve(MAX_POOLED_SEND_BUFFERS);
     hashContinue = uint256();
     nStartingHeight = -1;
     fGetAddr = false;
@@ -2096,6 +2122,7 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nPingUsecStart = 0;
     nPingUsecTime = 0;
     fPingQueued = false;
+    nNextInvSend = 0;
 
     {
         LOCK(cs_nLastNodeId);
@@ -2154,6 +2181,71 @@ void CNode::AskFor(const CInv& inv)
     mapAskFor.insert(std::make_pair(nRequestTime, inv));
 }
 
+/**
+ * Fill in the payload size and checksum of a message that begins with a
+ * CMessageHeader. Returns the payload size.
+ */
+static unsigned int FinalizeMessageHeader(char* pch, size_t nMessageSize)
+{
+    assert(nMessageSize >= CMessageHeader::HEADER_SIZE);
+
+    // Set the size
+    unsigned int nSize = nMessageSize - CMessageHeader::HEADER_SIZE;
+    WriteLE32((uint8_t*)&pch[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
+
+    // Set the checksum
+    uint256 hash = Hash(pch + CMessageHeader::HEADER_SIZE, pch + nMessageSize);
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    memcpy(&pch[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+
+    return nSize;
+}
+
+CSendBufferRef MakeSerializedMessage(const char* pszCommand, const CDataStream& payload)
+{
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    ssHeader << CMessageHeader(Params().MessageStart(), pszCommand, 0);
+
+    CSendBufferRef msg(new CSendBuffer());
+    msg->reserve(ssHeader.size() + payload.size());
+    msg->insert(msg->end(), ssHeader.begin(), ssHeader.end());
+    msg->insert(msg->end(), payload.begin(), payload.end());
+    FinalizeMessageHeader(&(*msg)[0], msg->size());
+    return msg;
+}
+
+void CNode::ReleaseSendBuffer(CSendBufferRef& buf)
+{
+    // Keep small buffers for reuse by EndMessage; big ones (blocks, large
+    // inv/addr batches) are rare enough that holding on to them isn't worth
+    // the memory. Buffers still queued to other peers are left alone.
+    if (buf.unique() && vSendBufferPool.size() < MAX_POOLED_SEND_BUFFERS && buf->capacity() <= MAX_POOLED_SEND_BUFFER_SIZE) {
+        buf->clear();
+        vSendBufferPool.push_back(CSendBufferRef());
+        vSendBufferPool.back().swap(buf);
+    }
+}
+
+void CNode::PushSerializedMessage(const CSendBufferRef& msg)
+{
+    assert(msg && msg->size() >= CMessageHeader::HEADER_SIZE);
+    LOCK(cs_vSend);
+    LogPrint("net", "sending: %s (%d bytes) peer=%d\n", SanitizeString(std::string(&(*msg)[MESSAGE_START_SIZE], CMessageHeader::COMMAND_SIZE)), msg->size() - CMessageHeader::HEADER_SIZE, id);
+    if (mapArgs.count("-dropmessagestest") && GetRand(GetArg("-dropmessagestest", 2)) == 0)
+    {
+        LogPrint("net", "dropmessages DROPPING SEND MESSAGE\n");
+        return;
+    }
+
+    vSendMsg.push_back(msg);
+    nSendSize += msg->size();
+
+    // If write queue empty, attempt "optimistic write"
+    if (vSendMsg.size() == 1)
+        SocketSendData(this);
+}
+
 void CNode::BeginMessage(const char* pszCommand) EXCLUSIVE_LOCK_FUNCTION(cs_vSend)
 {
     ENTER_CRITICAL_SECTION(cs_vSend);
@@ -2190,22 +2282,30 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
         LEAVE_CRITICAL_SECTION(cs_vSend);
         return;
     }
-    // Set the size
-    unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-    WriteLE32((uint8_t*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
-
-    // Set the checksum
-    uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
-    unsigned int nChecksum = 0;
-    memcpy(&nChecksum, &hash, sizeof(nChecksum));
-    assert(ssSend.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
-    memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+    unsigned int nSize = FinalizeMessageHeader(&ssSend[0], ssSend.size());
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+    // Small messages are copied into a recycled buffer so that steady-state
+    // relay does not hit the allocator at all, and ssSend keeps its capacity
+    // for the next one. Large messages (blocks) would not be pooled anyway:
+    // their storage is swapped out of ssSend instead, which also leaves
+    // ssSend small again rather than holding a block-sized buffer per peer.
+    std::deque<CSendBufferRef>::iterator it = vSendMsg.insert(vSendMsg.end(), CSendBufferRef());
+    if (ssSend.size() > MAX_POOLED_SEND_BUFFER_SIZE) {
+        it->reset(new CSendBuffer());
+        ssSend.SwapAndClear(**it);
+    } else {
+        if (!vSendBufferPool.empty()) {
+            it->swap(vSendBufferPool.back());
+            vSendBufferPool.pop_back();
+        } else {
+            it->reset(new CSendBuffer());
+        }
+        (*it)->assign(ssSend.begin(), ssSend.end());
+        ssSend.clear();
+    }
+    nSendSize += (*it)->size();
 
     // If write queue empty, attempt "optimistic write"
     if (it == vSendMsg.begin())
@@ -9,7 +9,6 @@
 #include "bloom.h"
 #include "compat.h"
 #include "limitedmap.h"
-#include "mruset.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
@@ -26,6 +25,7 @@
 
 #include <boost/filesystem/path.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
 
 class CAddrMan;
@@ -60,6 +60,10 @@ static const bool DEFAULT_UPNP = false;
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
+/** The maximum number of spent send buffers each peer keeps around for reuse. */
+static const unsigned int MAX_POOLED_SEND_BUFFERS = 8;
+/** Send buffers with a larger capacity than this (in bytes) are freed instead of pooled. */
+static const size_t MAX_POOLED_SEND_BUFFER_SIZE = 16 * 1024;
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
@@ -78,6 +82,34 @@ bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhite
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode *pnode);
+/** Have the message handler look at all peers again, e.g. when a peer's paused messages can be processed */
+void WakeMessageHandler();
+/** Return a time (in microseconds) after nNow for an event with exponentially distributed intervals. */
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds);
+
+/**
+ * A fully serialized outgoing message, header included. It has the storage
+ * type of CDataStream, so EndMessage can swap a large message out of
+ * CNode::ssSend instead of copying it.
+ */
+typedef CSerializeData CSendBuffer;
+/**
+ * Shared handle to a queued message. A buffer may sit in the send queues of
+ * many peers at once and must not be modified while it does.
+ */
+typedef boost::shared_ptr<CSendBuffer> CSendBufferRef;
+
+/** Build a complete message (header, size and checksum) around an already serialized payload. */
+CSendBufferRef MakeSerializedMessage(const char* pszCommand, const CDataStream& payload);
+
+/** Serialize a message once so it can be queued to any number of peers with CNode::PushSerializedMessage. */
+template<typename T>
+CSendBufferRef MakeSerializedMessage(const char* pszCommand, const T& payload)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << payload;
+    return MakeSerializedMessage(pszCommand, ss);
+}
 
 typedef int NodeId;
 
@@ -159,7 +191,7 @@ extern int nWhiteConnections;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+extern std::map<CInv, CSendBufferRef> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
@@ -317,7 +349,8 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSendBufferRef> vSendMsg;
+    std::vector<CSendBufferRef> vSendBufferPool; // spent vSendMsg buffers, reused by EndMessage
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
@@ -346,6 +379,10 @@ public:
     bool fNetworkNode;
     bool fSuccessfullyConnected;
     bool fDisconnect;
+    //! The next received message has to wait for something else to finish
+    //! first; set and cleared by the message handler (cs_vRecvMsg). No more
+    //! data is read from the peer while a complete message is held back.
+    bool fPauseRecvProcessing;
     // We use fRelayTxes for two purposes -
     // a) it allows us to not relay tx invs before receiving the peer's version message
     // b) the peer may tell us in its version message that we should not relay tx invs
@@ -383,10 +420,16 @@ public:
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
-    std::vector<CInv> vInventoryToSend;
+    CRollingBloomFilter filterInventoryKnown;
+    // Transaction ids waiting for the next batched announcement. They are
+    // sorted by the mempool when flushed, so the set only deduplicates.
+    std::set<uint256> setInventoryTxToSend;
+    // Block ids to announce. These are sent at the next opportunity, in the
+    // order they were pushed.
+    std::vector<uint256> vInventoryBlockToSend;
     CCriticalSection cs_inventory;
     std::multimap<int64_t, CInv> mapAskFor;
+    int64_t nNextInvSend;
 
     // Ping time measurement:
     // The pong reply we're expecting, or 0 if no pong expected.
@@ -480,21 +523,29 @@ public:
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(inv.hash);
         }
     }
 
     void PushInventory(const CInv& inv)
     {
-        {
-            LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
-                vInventoryToSend.push_back(inv);
+        LOCK(cs_inventory);
+        if (inv.type == MSG_TX) {
+            if (!filterInventoryKnown.contains(inv.hash))
+                setInventoryTxToSend.insert(inv.hash);
+        } else if (inv.type == MSG_BLOCK) {
+            vInventoryBlockToSend.push_back(inv.hash);
         }
     }
 
     void AskFor(const CInv& inv);
 
+    // requires LOCK(cs_vSend)
+    void ReleaseSendBuffer(CSendBufferRef& buf);
+
+    // Queue a message built by MakeSerializedMessage. The buffer is shared, not copied.
+    void PushSerializedMessage(const CSendBufferRef& msg);
+
     // TODO: Document the postcondition of this function.  Is cs_vSend locked?
     void BeginMessage(const char* pszCommand) EXCLUSIVE_LOCK_FUNCTION(cs_vSend);
 
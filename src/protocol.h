@@ -75,6 +75,10 @@ enum {
     // Bitcoin Core does not support this but a patch set called Bitcoin XT does.
     // See BIP 64 for details on how this is implemented.
     NODE_GETUTXO = (1 << 1),
+    // NODE_COMPACT_FILTERS means the node will answer requests for the BIP 158 filters of blocks
+    // and their filter headers, with the getcfilters, getcfheaders and getcfcheckpt messages.
+    // See BIP 157 for details on how this is implemented.
+    NODE_COMPACT_FILTERS = (1 << 6),
 
     // Bits 24-31 are reserved for temporary experiments. Just pick a bit that
     // isn't getting used, or one not being used much, and notify the
@@ -3,14 +3,18 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "blockfilterindex.h"
 #include "chain.h"
+#include "chainparams.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "main.h"
+#include "rpcnotify.h"
 #include "rpcserver.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
+#include "util.h"
 #include "utilstrencodings.h"
 #include "version.h"
 
@@ -22,6 +26,9 @@
 using namespace std;
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const long MAX_REST_BLOCKRANGE = 2000; //allow a max of 2000 blocks to be streamed at once
+static const int REST_NOTIFY_HEARTBEAT = 15; //seconds between keepalive lines on an idle notification stream
+static const size_t REST_HEX_CHUNK_SIZE = 4096; //bytes hex-encoded at a time when writing hex replies
 
 enum RetFormat {
     RF_UNDEF,
@@ -65,6 +72,7 @@ public:
 
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
 extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, JSONStreamWriter& writer);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 
@@ -113,6 +121,15 @@ static bool ParseHashStr(const string& strReq, uint256& v)
     return true;
 }
 
+/** Hex-encode data straight into a stream, a chunk at a time, instead of building the whole string */
+static void WriteHex(std::ostream& os, const std::vector<unsigned char>& vch)
+{
+    for (size_t nPos = 0; nPos < vch.size(); nPos += REST_HEX_CHUNK_SIZE) {
+        size_t nEnd = std::min(nPos + REST_HEX_CHUNK_SIZE, vch.size());
+        os << HexStr(vch.begin() + nPos, vch.begin() + nEnd);
+    }
+}
+
 static bool rest_headers(AcceptedConnection* conn,
                          const std::string& strURIPart,
                          const std::string& strRequest,
@@ -203,6 +220,7 @@ static bool rest_block(AcceptedConnection* conn,
         throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
     CBlock block;
+    std::vector<unsigned char> vchBlock;
     CBlockIndex* pblockindex = NULL;
     {
         LOCK(cs_main);
@@ -213,30 +231,38 @@ static bool rest_block(AcceptedConnection* conn,
         if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             throw RESTERR(HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
-        if (!ReadBlockFromDisk(block, pblockindex))
+        // Binary and hex replies are the serialized block; unless it is
+        // stored compressed, it is copied from disk without deserializing it.
+        if (rf == RF_BINARY || rf == RF_HEX) {
+            if (!ReadRawBlockFromDisk(vchBlock, pblockindex->GetBlockPos(), Params().MessageStart()))
+                throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
+        } else if (!ReadBlockFromDisk(block, pblockindex))
             throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-    ssBlock << block;
-
     switch (rf) {
     case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
-        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryBlock.size(), "application/octet-stream") << binaryBlock << std::flush;
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, vchBlock.size(), "application/octet-stream");
+        conn->stream().write((const char*)&vchBlock[0], vchBlock.size());
+        conn->stream() << std::flush;
         return true;
     }
 
     case RF_HEX: {
-        string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
-        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, vchBlock.size() * 2 + 1, "text/plain");
+        WriteHex(conn->stream(), vchBlock);
+        conn->stream() << "\n" << std::flush;
         return true;
     }
 
     case RF_JSON: {
-        UniValue objBlock = blockToJSON(block, pblockindex, showTxDetails);
-        string strJSON = objBlock.write() + "\n";
-        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        // Block details with verbose transactions can be many times the
+        // block size; write them out as they are produced.
+        std::ostream& os = conn->BeginStreamingReply(HTTP_OK, fRun, "application/json");
+        JSONStreamWriter writer(os);
+        blockToJSON(block, pblockindex, showTxDetails, writer);
+        os << "\n";
+        conn->EndStreamingReply();
         return true;
     }
 
@@ -267,6 +293,125 @@ static bool rest_block_notxdetails(AcceptedConnection* conn,
     return rest_block(conn, strURIPart, strRequest, mapHeaders, fRun, false);
 }
 
+static bool rest_blockrange(AcceptedConnection* conn,
+                            const std::string& strURIPart,
+                            const std::string& strRequest,
+                            const std::map<std::string, std::string>& mapHeaders,
+                            bool fRun)
+{
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        throw RESTERR(HTTP_BAD_REQUEST, "No block count specified. Use /rest/blockrange/<height>/<count>.<ext>.");
+
+    int32_t nStartHeight;
+    if (!ParseInt32(path[0], &nStartHeight) || nStartHeight < 0)
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid height: " + path[0]);
+
+    long count = strtol(path[1].c_str(), NULL, 10);
+    if (count < 1 || count > MAX_REST_BLOCKRANGE)
+        throw RESTERR(HTTP_BAD_REQUEST, "Block count out of range: " + path[1]);
+
+    if (rf != RF_BINARY && rf != RF_HEX)
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+
+    // Only the disk positions are collected under cs_main. Block data is
+    // never rewritten in place, so it can be read afterwards without the lock.
+    std::vector<CDiskBlockPos> vPos;
+    vPos.reserve(count);
+    {
+        LOCK(cs_main);
+        if (nStartHeight > chainActive.Height())
+            throw RESTERR(HTTP_NOT_FOUND, "Block height out of range: " + path[0]);
+
+        for (int nHeight = nStartHeight; nHeight <= chainActive.Height() && vPos.size() < (unsigned long)count; nHeight++) {
+            const CBlockIndex* pindex = chainActive[nHeight];
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                throw RESTERR(HTTP_NOT_FOUND, strprintf("Block at height %d not available (pruned data)", nHeight));
+            vPos.push_back(pindex->GetBlockPos());
+        }
+    }
+
+    // Blocks are written one after another: the binary reply is the
+    // concatenation of serialized blocks, the hex reply has one block per
+    // line. Blocks stored uncompressed are copied from disk as they are. A read error once data has gone out (e.g. the file was
+    // pruned meanwhile) can only be signalled by closing the connection early.
+    std::vector<unsigned char> vchBlock;
+    std::ostream& os = conn->BeginStreamingReply(HTTP_OK, fRun, rf == RF_BINARY ? "application/octet-stream" : "text/plain");
+    for (unsigned int i = 0; i < vPos.size(); i++) {
+        if (!ReadRawBlockFromDisk(vchBlock, vPos[i], Params().MessageStart())) {
+            if (conn->AbortStreamingReply())
+                throw RESTERR(HTTP_NOT_FOUND, strprintf("Block at height %d not found", nStartHeight + i));
+            return false;
+        }
+        if (rf == RF_BINARY)
+            os.write((const char*)&vchBlock[0], vchBlock.size());
+        else {
+            WriteHex(os, vchBlock);
+            os << "\n";
+        }
+    }
+    conn->EndStreamingReply();
+    return true;
+}
+
+static bool rest_notifications(AcceptedConnection* conn,
+                               const std::string& strURIPart,
+                               const std::string& strRequest,
+                               const std::map<std::string, std::string>& mapHeaders,
+                               bool fRun)
+{
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+
+    if (rf != RF_JSON)
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: json)");
+    if (!pRPCNotifier)
+        throw RESTERR(HTTP_NOT_FOUND, "Notifications are disabled (-rpcnotifyqueue=0)");
+
+    uint64_t nSequence;
+    if (params[0].empty()) {
+        nSequence = pRPCNotifier->GetSequence();
+    } else {
+        int64_t n;
+        if (params[0][0] != '/' || !ParseInt64(params[0].substr(1), &n) || n < 0)
+            throw RESTERR(HTTP_BAD_REQUEST, "Invalid sequence: " + params[0]);
+        nSequence = n;
+    }
+
+    CNotifyWaitSlot slot;
+    if (!slot.Acquire())
+        throw RESTERR(HTTP_SERVICE_UNAVAILABLE, "Too many clients waiting for notifications");
+
+    // One JSON object per line, as in waitfornotifications, until the client
+    // disconnects or the server shuts down. Empty lines are sent when idle, so
+    // that both sides notice a dead connection.
+    std::ostream& os = conn->BeginStreamingReply(HTTP_OK, false, "application/json");
+    os << "\n" << std::flush;
+    std::vector<CRPCNotification> vEvents;
+    while (os && IsRPCRunning()) {
+        vEvents.clear();
+        bool fComplete = pRPCNotifier->Wait(nSequence, boost::get_system_time() + boost::posix_time::seconds(REST_NOTIFY_HEARTBEAT), vEvents, MAX_RPC_NOTIFY_BATCH);
+        if (!fComplete) {
+            os << "{\"type\":\"missed\"}\n";
+            if (vEvents.empty())
+                nSequence = pRPCNotifier->GetSequence();
+        }
+        for (unsigned int i = 0; i < vEvents.size(); i++)
+            os << vEvents[i].ToJSON().write() << "\n";
+        if (!vEvents.empty())
+            nSequence = vEvents.back().nSequence;
+        else if (fComplete)
+            os << "\n";
+        os << std::flush;
+    }
+    conn->EndStreamingReply();
+    return false;
+}
+
 static bool rest_chaininfo(AcceptedConnection* conn,
                            const std::string& strURIPart,
                            const std::string& strRequest,
@@ -541,6 +686,166 @@ static bool rest_getutxos(AcceptedConnection* conn,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+/** Find the block filter index serving the filter type named in a request */
+static CBlockFilterIndex* GetBlockFilterIndex(const std::string& strType)
+{
+    BlockFilterType filterType;
+    if (!BlockFilterTypeByName(strType, filterType))
+        throw RESTERR(HTTP_BAD_REQUEST, "Unknown filter type: " + strType);
+    if (!pblockfilterindex || pblockfilterindex->GetFilterType() != filterType)
+        throw RESTERR(HTTP_NOT_FOUND, "Block filter index not enabled, use -blockfilterindex");
+    return pblockfilterindex;
+}
+
+static bool rest_blockfilter(AcceptedConnection* conn,
+                             const std::string& strURIPart,
+                             const std::string& strRequest,
+                             const std::map<std::string, std::string>& mapHeaders,
+                             bool fRun)
+{
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/blockfilter/<filtertype>/<blockhash>.<ext>");
+
+    CBlockFilterIndex* pindexFilter = GetBlockFilterIndex(path[0]);
+    string hashStr = path[1];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    const CBlockIndex* pindex = LookupBlockIndex(hash);
+    if (pindex == NULL)
+        throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
+
+    CBlockFilter filter;
+    uint256 hashHeader;
+    if (!pindexFilter->LookupFilter(pindex, filter) || !pindexFilter->LookupFilterHeader(pindex, hashHeader))
+        throw RESTERR(HTTP_NOT_FOUND, "Filter of " + hashStr + " not found, or not indexed yet");
+    const std::vector<unsigned char>& vEncoded = filter.GetEncodedFilter();
+
+    switch (rf) {
+    case RF_BINARY: {
+        CDataStream ssFilter(SER_NETWORK, PROTOCOL_VERSION);
+        ssFilter << vEncoded;
+        string binaryFilter = ssFilter.str();
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryFilter.size(), "application/octet-stream") << binaryFilter << std::flush;
+        return true;
+    }
+
+    case RF_HEX: {
+        string strHex = HexStr(vEncoded.begin(), vEncoded.end()) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        return true;
+    }
+
+    case RF_JSON: {
+        UniValue ret(UniValue::VOBJ);
+        ret.push_back(Pair("filter", HexStr(vEncoded.begin(), vEncoded.end())));
+        ret.push_back(Pair("header", hashHeader.GetHex()));
+        string strJSON = ret.write() + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_blockfilterheaders(AcceptedConnection* conn,
+                                    const std::string& strURIPart,
+                                    const std::string& strRequest,
+                                    const std::map<std::string, std::string>& mapHeaders,
+                                    bool fRun)
+{
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 3)
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid URI format. Expected /rest/blockfilterheaders/<filtertype>/<count>/<blockhash>.<ext>");
+
+    CBlockFilterIndex* pindexFilter = GetBlockFilterIndex(path[0]);
+    long count = strtol(path[1].c_str(), NULL, 10);
+    if (count < 1 || count > (long)MAX_GETCFHEADERS_SIZE)
+        throw RESTERR(HTTP_BAD_REQUEST, "Header count out of range: " + path[1]);
+
+    string hashStr = path[2];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    // Like /rest/headers/, follow the active chain from the given block
+    std::vector<const CBlockIndex*> vIndex;
+    vIndex.reserve(count);
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        const CBlockIndex* pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
+        while (pindex != NULL && chainActive.Contains(pindex)) {
+            vIndex.push_back(pindex);
+            if (vIndex.size() == (unsigned long)count)
+                break;
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    std::vector<uint256> vHeaders;
+    vHeaders.reserve(vIndex.size());
+    BOOST_FOREACH(const CBlockIndex* pindex, vIndex) {
+        uint256 hashHeader;
+        // Stop at the first block that is not indexed yet
+        if (!pindexFilter->LookupFilterHeader(pindex, hashHeader))
+            break;
+        vHeaders.push_back(hashHeader);
+    }
+
+    CDataStream ssHeaders(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_FOREACH(const uint256& hashHeader, vHeaders) {
+        ssHeaders << hashHeader;
+    }
+
+    switch (rf) {
+    case RF_BINARY: {
+        string binaryHeaders = ssHeaders.str();
+        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryHeaders.size(), "application/octet-stream") << binaryHeaders << std::flush;
+        return true;
+    }
+
+    case RF_HEX: {
+        string strHex = HexStr(ssHeaders.begin(), ssHeaders.end()) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        return true;
+    }
+
+    case RF_JSON: {
+        UniValue jsonHeaders(UniValue::VARR);
+        BOOST_FOREACH(const uint256& hashHeader, vHeaders) {
+            jsonHeaders.push_back(hashHeader.GetHex());
+        }
+        string strJSON = jsonHeaders.write() + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(AcceptedConnection* conn,
@@ -552,8 +857,12 @@ static const struct {
       {"/rest/tx/", rest_tx},
       {"/rest/block/notxdetails/", rest_block_notxdetails},
       {"/rest/block/", rest_block_extended},
+      {"/rest/blockrange/", rest_blockrange},
+      {"/rest/blockfilter/", rest_blockfilter},
+      {"/rest/blockfilterheaders/", rest_blockfilterheaders},
       {"/rest/chaininfo", rest_chaininfo},
       {"/rest/headers/", rest_headers},
+      {"/rest/notifications", rest_notifications},
       {"/rest/getutxos", rest_getutxos},
 };
 
@@ -3,22 +3,32 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "addressindex.h"
 #include "amount.h"
+#include "base58.h"
+#include "blockfilterindex.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "coins.h"
 #include "consensus/validation.h"
+#include "leveldbwrapper.h"
 #include "main.h"
 #include "primitives/transaction.h"
+#include "rpccache.h"
 #include "rpcserver.h"
+#include "script/standard.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
+#include "txindex.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
 
 #include <stdint.h>
+#include <stdio.h>
+#include <sstream>
 
 #include "univalue/univalue.h"
 
@@ -58,14 +68,35 @@ double GetDifficulty(const CBlockIndex* blockindex)
     return dDiff;
 }
 
+/**
+ * Return the published chain snapshot, for calls that are answered without
+ * cs_main. It only lacks a tip before the block index has been loaded.
+ */
+static CChainSnapshotRef GetTipSnapshot()
+{
+    CChainSnapshotRef snapshot = GetChainSnapshot();
+    if (!snapshot->pindexTip)
+        throw JSONRPCError(RPC_IN_WARMUP, "Block index not loaded yet");
+    return snapshot;
+}
+
 UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 {
+    // Main chain membership is judged against the chain snapshot, so that
+    // this does not need cs_main.
+    CChainSnapshotRef snapshot = GetTipSnapshot();
+    const CBlockIndex* pindexTip = snapshot->pindexTip;
+
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", blockindex->GetBlockHash().GetHex()));
     int confirmations = -1;
+    const CBlockIndex *pnext = NULL;
     // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    if (blockindex->nHeight <= pindexTip->nHeight && pindexTip->GetAncestor(blockindex->nHeight) == blockindex) {
+        confirmations = pindexTip->nHeight - blockindex->nHeight + 1;
+        if (blockindex != pindexTip)
+            pnext = pindexTip->GetAncestor(blockindex->nHeight + 1);
+    }
     result.push_back(Pair("confirmations", confirmations));
     result.push_back(Pair("height", blockindex->nHeight));
     result.push_back(Pair("version", blockindex->nVersion));
@@ -78,52 +109,135 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 
     if (blockindex->pprev)
         result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex *pnext = chainActive.Next(blockindex);
     if (pnext)
         result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+/**
+ * The fields blockToJSON reports before and after the transaction list, which
+ * is left out so that it can be either built in place or streamed.
+ */
+static void blockToJSONFields(const CBlock& block, const CBlockIndex* blockindex, UniValue& before, UniValue& after)
 {
-    UniValue result(UniValue::VOBJ);
-    result.push_back(Pair("hash", block.GetHash().GetHex()));
+    before.push_back(Pair("hash", block.GetHash().GetHex()));
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
     if (chainActive.Contains(blockindex))
         confirmations = chainActive.Height() - blockindex->nHeight + 1;
-    result.push_back(Pair("confirmations", confirmations));
-    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
-    result.push_back(Pair("height", blockindex->nHeight));
-    result.push_back(Pair("version", block.nVersion));
-    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+    before.push_back(Pair("confirmations", confirmations));
+    before.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
+    before.push_back(Pair("height", blockindex->nHeight));
+    before.push_back(Pair("version", block.nVersion));
+    before.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+    after.push_back(Pair("time", block.GetBlockTime()));
+    after.push_back(Pair("nonce", (uint64_t)block.nNonce));
+    after.push_back(Pair("bits", strprintf("%08x", block.nBits)));
+    after.push_back(Pair("difficulty", GetDifficulty(blockindex)));
+    after.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
+
+    if (blockindex->pprev)
+        after.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
+    CBlockIndex *pnext = chainActive.Next(blockindex);
+    if (pnext)
+        after.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
+}
+
+static UniValue blockTxToJSON(const CTransaction& tx, bool txDetails)
+{
+    if (!txDetails)
+        return tx.GetHash().GetHex();
+    UniValue objTx(UniValue::VOBJ);
+    TxToJSON(tx, uint256(), objTx);
+    return objTx;
+}
+
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+{
+    UniValue result(UniValue::VOBJ);
+    UniValue after(UniValue::VOBJ);
+    blockToJSONFields(block, blockindex, result, after);
     UniValue txs(UniValue::VARR);
     BOOST_FOREACH(const CTransaction&tx, block.vtx)
+        txs.push_back(blockTxToJSON(tx, txDetails));
+    result.push_back(Pair("tx", txs));
+    result.pushKVs(after);
+    return result;
+}
+
+/**
+ * The same as blockToJSON, except that the transaction list is already
+ * serialized: "tx" holds the JSON text of the array as a string. cs_main is
+ * only taken while looking up the chain context.
+ */
+static UniValue blockToJSONSerialized(const CBlock& block, const CBlockIndex* blockindex)
+{
+    UniValue result(UniValue::VOBJ);
+    UniValue after(UniValue::VOBJ);
     {
-        if(txDetails)
-        {
-            UniValue objTx(UniValue::VOBJ);
-            TxToJSON(tx, uint256(), objTx);
-            txs.push_back(objTx);
-        }
-        else
-            txs.push_back(tx.GetHash().GetHex());
+        LOCK(cs_main);
+        blockToJSONFields(block, blockindex, result, after);
     }
-    result.push_back(Pair("tx", txs));
-    result.push_back(Pair("time", block.GetBlockTime()));
-    result.push_back(Pair("nonce", (uint64_t)block.nNonce));
-    result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
-    result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
+    std::string strTxs = "[";
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        if (i > 0)
+            strTxs += ",";
+        strTxs += blockTxToJSON(block.vtx[i], false).write();
+    }
+    strTxs += "]";
+    result.push_back(Pair("tx", strTxs));
+    result.pushKVs(after);
+    return result;
+}
 
-    if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex *pnext = chainActive.Next(blockindex);
+/**
+ * Copy of a blockToJSON or blockToJSONSerialized result, taken from the result cache, with the fields
+ * that depend on the active chain brought up to date; cs_main must be held.
+ */
+static UniValue blockToJSONUpdate(const UniValue& cached, const CBlockIndex* blockindex)
+{
+    int confirmations = -1;
+    if (chainActive.Contains(blockindex))
+        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+    const CBlockIndex *pnext = chainActive.Next(blockindex);
+
+    UniValue result(UniValue::VOBJ);
+    const std::vector<std::string>& keys = cached.getKeys();
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (keys[i] == "confirmations")
+            result.push_back(Pair("confirmations", confirmations));
+        else if (keys[i] != "nextblockhash")
+            result.push_back(Pair(keys[i], cached[i]));
+    }
     if (pnext)
         result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
     return result;
 }
 
+/**
+ * Write the same as blockToJSON to a stream, one transaction at a time.
+ * cs_main is only taken while looking up the chain context, so it must not be
+ * held by the caller: writing may block on a slow client.
+ */
+void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, JSONStreamWriter& writer)
+{
+    UniValue before(UniValue::VOBJ);
+    UniValue after(UniValue::VOBJ);
+    {
+        LOCK(cs_main);
+        blockToJSONFields(block, blockindex, before, after);
+    }
+    writer.BeginObject();
+    writer.Members(before);
+    writer.Key("tx");
+    writer.BeginArray();
+    BOOST_FOREACH(const CTransaction&tx, block.vtx)
+        writer.Value(blockTxToJSON(tx, txDetails));
+    writer.EndArray();
+    writer.Members(after);
+    writer.EndObject();
+}
+
 UniValue getblockcount(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -137,8 +251,7 @@ UniValue getblockcount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    return GetTipSnapshot()->pindexTip->nHeight;
 }
 
 UniValue getbestblockhash(const UniValue& params, bool fHelp)
@@ -154,8 +267,7 @@ UniValue getbestblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    return GetTipSnapshot()->pindexTip->GetBlockHash().GetHex();
 }
 
 UniValue getdifficulty(const UniValue& params, bool fHelp)
@@ -171,11 +283,38 @@ UniValue getdifficulty(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getdifficulty", "")
         );
 
-    LOCK(cs_main);
-    return GetDifficulty();
+    return GetDifficulty(GetTipSnapshot()->pindexTip);
 }
 
 
+/** Describe a mempool entry for getrawmempool; cs_main and mempool.cs must be held */
+static UniValue mempoolEntryToJSON(const CTxMemPoolEntry& e)
+{
+    UniValue info(UniValue::VOBJ);
+    info.push_back(Pair("size", (int)e.GetTxSize()));
+    info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
+    info.push_back(Pair("time", e.GetTime()));
+    info.push_back(Pair("height", (int)e.GetHeight()));
+    info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
+    info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+    const CTransaction& tx = e.GetTx();
+    set<string> setDepends;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        if (mempool.exists(txin.prevout.hash))
+            setDepends.insert(txin.prevout.hash.ToString());
+    }
+
+    UniValue depends(UniValue::VARR);
+    BOOST_FOREACH(const string& dep, setDepends)
+    {
+        depends.push_back(dep);
+    }
+
+    info.push_back(Pair("depends", depends));
+    return info;
+}
+
 UniValue getrawmempool(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -219,33 +358,7 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
         LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
         BOOST_FOREACH(const PAIRTYPE(uint256, CTxMemPoolEntry)& entry, mempool.mapTx)
-        {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
-            UniValue info(UniValue::VOBJ);
-            info.push_back(Pair("size", (int)e.GetTxSize()));
-            info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
-            info.push_back(Pair("time", e.GetTime()));
-            info.push_back(Pair("height", (int)e.GetHeight()));
-            info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
-            info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
-            const CTransaction& tx = e.GetTx();
-            set<string> setDepends;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                if (mempool.exists(txin.prevout.hash))
-                    setDepends.insert(txin.prevout.hash.ToString());
-            }
-
-            UniValue depends(UniValue::VARR);
-            BOOST_FOREACH(const string& dep, setDepends)
-            {
-                depends.push_back(dep);
-            }
-
-            info.push_back(Pair("depends", depends));
-            o.push_back(Pair(hash.ToString(), info));
-        }
+            o.push_back(Pair(entry.first.ToString(), mempoolEntryToJSON(entry.second)));
         return o;
     }
     else
@@ -261,6 +374,146 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
     }
 }
 
+//! Number of mempool entries described per lock acquisition when streaming getrawmempool
+static const size_t MEMPOOL_STREAM_BATCH = 1000;
+
+void getrawmempool_stream(const UniValue& params, JSONStreamWriter& result)
+{
+    if (params.size() > 1)
+        getrawmempool(params, true); // throws the usage message
+
+    bool fVerbose = false;
+    if (params.size() > 0)
+        fVerbose = params[0].get_bool();
+
+    if (!fVerbose) {
+        vector<uint256> vtxid;
+        mempool.queryHashes(vtxid);
+        result.BeginArray();
+        BOOST_FOREACH(const uint256& hash, vtxid)
+            result.Value(hash.ToString());
+        result.EndArray();
+        return;
+    }
+
+    // Describe the pool a batch of entries at a time, and only write them
+    // out after releasing the locks, so a slow client cannot stall the node.
+    // Iteration resumes after the last hash written, so entries that are
+    // added or removed meanwhile may or may not be included.
+    result.BeginObject();
+    uint256 hashLast;
+    bool fFirst = true;
+    while (true) {
+        std::vector<std::pair<uint256, UniValue> > vBatch;
+        {
+            LOCK2(cs_main, mempool.cs);
+            std::map<uint256, CTxMemPoolEntry>::const_iterator it = fFirst ? mempool.mapTx.begin() : mempool.mapTx.upper_bound(hashLast);
+            for (; it != mempool.mapTx.end() && vBatch.size() < MEMPOOL_STREAM_BATCH; it++)
+                vBatch.push_back(std::make_pair(it->first, mempoolEntryToJSON(it->second)));
+        }
+        if (vBatch.empty())
+            break;
+        for (size_t i = 0; i < vBatch.size(); i++)
+            result.KeyValue(vBatch[i].first.ToString(), vBatch[i].second);
+        hashLast = vBatch.back().first;
+        fFirst = false;
+    }
+    result.EndObject();
+}
+
+//! Maximum number of changes returned by one getmempoolchanges call
+static const int64_t MAX_MEMPOOL_CHANGES = 100000;
+
+UniValue getmempoolchanges(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 4)
+        throw runtime_error(
+            "getmempoolchanges ( sequence count verbose listingsequence )\n"
+            "\nReturns the transactions added to and removed from the memory pool after the given mempool sequence number.\n"
+            "Every addition and removal increments the sequence number, so a copy of the pool can be kept up to date by\n"
+            "starting with sequence 0, then passing the returned sequence to the next call and applying the removals before\n"
+            "the additions. Sequence numbers start at 0 again when the node restarts.\n"
+            "\nArguments:\n"
+            "1. sequence          (numeric, optional, default=0) Return changes after this sequence number; 0 lists the whole pool\n"
+            "2. count             (numeric, optional, default=" + strprintf("%d", MAX_MEMPOOL_CHANGES) + ") Maximum number of changes to return\n"
+            "3. verbose           (boolean, optional, default=false) Describe added transactions as getrawmempool does\n"
+            "4. listingsequence   (numeric, optional, default=sequence) The listingsequence returned with sequence, if any\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"sequence\" : n,        (numeric) The sequence number the result is up to date with\n"
+            "  \"listingsequence\" : n, (numeric, optional) While paging through the whole pool, the sequence number the listing\n"
+            "                         began at; pass it on together with sequence for the next page\n"
+            "  \"complete\" : true|false, (boolean) False if there are more changes; call again with the returned sequence\n"
+            "  \"added\" : [            (array, or object for verbose = true) Transactions added and still in the pool\n"
+            "    \"transactionid\"    (string) The transaction id\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"removed\" : [          (array) Transactions removed; they may not have been listed as added before\n"
+            "    \"transactionid\"    (string) The transaction id\n"
+            "    ,...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples\n"
+            + HelpExampleCli("getmempoolchanges", "")
+            + HelpExampleCli("getmempoolchanges", "1234 1000")
+            + HelpExampleRpc("getmempoolchanges", "1234, 1000")
+        );
+
+    uint64_t nSince = 0;
+    if (params.size() > 0) {
+        int64_t n = params[0].get_int64();
+        if (n < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative sequence");
+        nSince = n;
+    }
+    int64_t nCount = MAX_MEMPOOL_CHANGES;
+    if (params.size() > 1) {
+        nCount = params[1].get_int64();
+        if (nCount < 1 || nCount > MAX_MEMPOOL_CHANGES)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Count out of range");
+    }
+    bool fVerbose = false;
+    if (params.size() > 2)
+        fVerbose = params[2].get_bool();
+    uint64_t nRemovedSince = nSince;
+    if (params.size() > 3) {
+        int64_t n = params[3].get_int64();
+        if (n < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative listing sequence");
+        nRemovedSince = n;
+    }
+
+    vector<uint256> vAdded, vRemoved;
+    uint64_t nLast, nRemovedLast;
+    bool fComplete;
+    UniValue added(fVerbose ? UniValue::VOBJ : UniValue::VARR);
+    {
+        // Transactions cannot leave the pool before they are described
+        LOCK2(cs_main, mempool.cs);
+        if (!mempool.GetChangesSince(nSince, nRemovedSince, nCount, vAdded, vRemoved, nLast, nRemovedLast, fComplete))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Changes after this sequence number are not available; start again from 0");
+        BOOST_FOREACH(const uint256& hash, vAdded) {
+            if (fVerbose)
+                added.push_back(Pair(hash.ToString(), mempoolEntryToJSON(mempool.mapTx[hash])));
+            else
+                added.push_back(hash.ToString());
+        }
+    }
+
+    UniValue removed(UniValue::VARR);
+    BOOST_FOREACH(const uint256& hash, vRemoved)
+        removed.push_back(hash.ToString());
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("sequence", nLast));
+    if (nRemovedLast != nLast)
+        ret.push_back(Pair("listingsequence", nRemovedLast));
+    ret.push_back(Pair("complete", fComplete));
+    ret.push_back(Pair("added", added));
+    ret.push_back(Pair("removed", removed));
+    return ret;
+}
+
 UniValue getblockhash(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -317,8 +570,6 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockheader", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
         );
 
-    LOCK(cs_main);
-
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
 
@@ -326,11 +577,11 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = params[1].get_bool();
 
-    if (mapBlockIndex.count(hash) == 0)
+    // Header fields never change once the entry is in the index, so no cs_main is needed
+    CBlockIndex* pblockindex = LookupBlockIndex(hash);
+    if (!pblockindex)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
     if (!fVerbose)
     {
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
@@ -393,6 +644,11 @@ UniValue getblock(const UniValue& params, bool fHelp)
     CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
+    CRPCResultCache::Kind kind = fVerbose ? CRPCResultCache::BLOCK_JSON : CRPCResultCache::BLOCK_HEX;
+    UniValue cached;
+    if (pRPCResultCache && pRPCResultCache->Get(hash, kind, cached))
+        return fVerbose ? blockToJSONUpdate(cached, pblockindex) : cached;
+
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
@@ -404,10 +660,86 @@ UniValue getblock(const UniValue& params, bool fHelp)
         CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
         ssBlock << block;
         std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
+        if (pRPCResultCache)
+            pRPCResultCache->Put(hash, kind, strHex);
         return strHex;
     }
 
-    return blockToJSON(block, pblockindex);
+    UniValue result = blockToJSON(block, pblockindex);
+    if (pRPCResultCache)
+        pRPCResultCache->Put(hash, kind, result);
+    return result;
+}
+
+void getblock_stream(const UniValue& params, JSONStreamWriter& result)
+{
+    if (params.size() < 1 || params.size() > 2)
+        getblock(params, true); // throws the usage message
+
+    bool fVerbose = true;
+    if (params.size() > 1)
+        fVerbose = params[1].get_bool();
+    // The hex of a block is small enough to build in memory
+    if (!fVerbose) {
+        result.Value(getblock(params, false));
+        return;
+    }
+
+    std::string strHash = params[0].get_str();
+    uint256 hash(uint256S(strHash));
+
+    CBlock block;
+    CBlockIndex* pblockindex;
+    UniValue cached;
+    bool fCached = false;
+    {
+        LOCK(cs_main);
+        if (mapBlockIndex.count(hash) == 0)
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+        pblockindex = mapBlockIndex[hash];
+
+        // Either form of a cached reply will do
+        if (pRPCResultCache && (pRPCResultCache->Get(hash, CRPCResultCache::BLOCK_JSON_SERIALIZED, cached) ||
+                                pRPCResultCache->Get(hash, CRPCResultCache::BLOCK_JSON, cached))) {
+            cached = blockToJSONUpdate(cached, pblockindex);
+            fCached = true;
+        } else {
+            if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+
+            if(!ReadBlockFromDisk(block, pblockindex))
+                throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        }
+    }
+
+    if (!fCached && pRPCResultCache) {
+        // Render the reply once, keeping the transaction list serialized,
+        // so that the cache holds it and later requests only write it out
+        cached = blockToJSONSerialized(block, pblockindex);
+        pRPCResultCache->Put(hash, CRPCResultCache::BLOCK_JSON_SERIALIZED, cached);
+        fCached = true;
+    }
+
+    if (!fCached) {
+        blockToJSON(block, pblockindex, false, result);
+        return;
+    }
+    if (!cached["tx"].isStr()) {
+        result.Value(cached);
+        return;
+    }
+    result.BeginObject();
+    const std::vector<std::string>& keys = cached.getKeys();
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (keys[i] == "tx") {
+            result.Key(keys[i]);
+            result.RawValue(cached[i].get_str());
+        } else {
+            result.KeyValue(keys[i], cached[i]);
+        }
+    }
+    result.EndObject();
 }
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
@@ -448,6 +780,317 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+/** Options and per-level table statistics of a LevelDB database */
+static UniValue DBStatsToJSON(const CLevelDBWrapper& db)
+{
+    const CLevelDBOptions& dbOptions = db.GetDBOptions();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("cache", (uint64_t)db.GetCacheSize()));
+    ret.push_back(Pair("writebuffer", (uint64_t)db.GetWriteBufferSize()));
+    ret.push_back(Pair("maxopenfiles", dbOptions.nMaxOpenFiles));
+    ret.push_back(Pair("blocksize", (uint64_t)dbOptions.nBlockSize));
+    ret.push_back(Pair("compression", dbOptions.fCompression));
+    ret.push_back(Pair("size", db.GetApproximateSize()));
+
+    // "leveldb.stats" is a table with a row per non-empty level:
+    // level, files, size (MB), compaction time (sec), read (MB), written (MB)
+    UniValue levels(UniValue::VARR);
+    std::string strStats;
+    if (db.GetProperty("leveldb.stats", strStats)) {
+        std::istringstream stream(strStats);
+        std::string strLine;
+        while (std::getline(stream, strLine)) {
+            int nLevel, nFiles;
+            double dSize, dTime, dRead, dWrite;
+            if (sscanf(strLine.c_str(), "%d %d %lf %lf %lf %lf", &nLevel, &nFiles, &dSize, &dTime, &dRead, &dWrite) != 6)
+                continue;
+            UniValue level(UniValue::VOBJ);
+            level.push_back(Pair("level", nLevel));
+            level.push_back(Pair("files", nFiles));
+            level.push_back(Pair("size", dSize));
+            level.push_back(Pair("compactiontime", dTime));
+            level.push_back(Pair("read", dRead));
+            level.push_back(Pair("written", dWrite));
+            levels.push_back(level);
+        }
+    }
+    ret.push_back(Pair("levels", levels));
+    return ret;
+}
+
+UniValue getdbstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbstats\n"
+            "\nReturns the options and table statistics of the block index and chain state databases.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"blockindex\": {           (object) The block index database (blocks/index/)\n"
+            "    \"cache\": n,              (numeric) The cache share of the database, in bytes\n"
+            "    \"writebuffer\": n,        (numeric) The write buffer size, in bytes\n"
+            "    \"maxopenfiles\": n,       (numeric) The maximum number of table files kept open\n"
+            "    \"blocksize\": n,          (numeric) The table block size, in bytes\n"
+            "    \"compression\": true|false, (boolean) Whether Snappy compression was requested\n"
+            "    \"size\": n,               (numeric) The approximate size on disk, in bytes\n"
+            "    \"levels\": [              (array) One entry per non-empty level\n"
+            "      {\n"
+            "        \"level\": n,          (numeric) The level\n"
+            "        \"files\": n,          (numeric) The number of table files\n"
+            "        \"size\": x.x,         (numeric) The size of the tables, in MiB\n"
+            "        \"compactiontime\": x.x, (numeric) Seconds spent compacting into this level\n"
+            "        \"read\": x.x,         (numeric) MiB read by compactions into this level\n"
+            "        \"written\": x.x       (numeric) MiB written by compactions into this level\n"
+            "      }, ...\n"
+            "    ]\n"
+            "  },\n"
+            "  \"chainstate\": { ... }     (object) The chain state database (chainstate/), same fields\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleRpc("getdbstats", "")
+        );
+
+    LOCK(cs_main);
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("blockindex", DBStatsToJSON(*pblocktree)));
+    ret.push_back(Pair("chainstate", DBStatsToJSON(pcoinsdbview->GetDB())));
+    return ret;
+}
+
+static CScript AddressToScript(const std::string& strAddress)
+{
+    CBitcoinAddress address(strAddress);
+    if (!address.IsValid())
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid Bitcoin address");
+    return GetScriptForDestination(address.Get());
+}
+
+UniValue getaddressdeltas(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getaddressdeltas \"address\" ( start end )\n"
+            "\nReturns the outputs paying to an address and the inputs spending from it, ordered by height.\n"
+            "Fails if there are more than " + itostr(MAX_ADDRESS_INDEX_RESULTS) + " of them; use a smaller height range then.\n"
+            "Requires -addressindex. The index is built in the background; see getindexinfo.\n"
+            "\nArguments:\n"
+            "1. \"address\"  (string, required) The Bitcoin address\n"
+            "2. start        (numeric, optional, default=0) The first height to include\n"
+            "3. end          (numeric, optional) The last height to include, the whole chain by default\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\": \"hash\",    (string) The transaction id\n"
+            "    \"index\": n,          (numeric) The output index, or the input index for spends\n"
+            "    \"height\": n,         (numeric) The height of the block containing the transaction\n"
+            "    \"amount\": x.xxx,     (numeric) The amount in " + CURRENCY_UNIT + ", negative for spends\n"
+            "    \"spending\": true|false (boolean) Whether this is an input spending from the address\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressdeltas", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+            + HelpExampleRpc("getaddressdeltas", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\", 300000, 310000")
+        );
+
+    if (!paddressindex || !paddressindex->HasAddressIndex())
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled, use -addressindex");
+    CScript script = AddressToScript(params[0].get_str());
+    int nStart = params.size() > 1 ? params[1].get_int() : 0;
+    int nEnd = params.size() > 2 ? params[2].get_int() : std::numeric_limits<int>::max();
+    if (nStart < 0 || nEnd < nStart)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid height range");
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vDeltas;
+    if (!paddressindex->GetAddressDeltas(script, nStart, nEnd, MAX_ADDRESS_INDEX_RESULTS + 1, vDeltas))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index");
+    if (vDeltas.size() > MAX_ADDRESS_INDEX_RESULTS)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("More than %u entries, use a smaller height range", MAX_ADDRESS_INDEX_RESULTS));
+
+    UniValue ret(UniValue::VARR);
+    for (size_t i = 0; i < vDeltas.size(); i++) {
+        const CAddressIndexKey& key = vDeltas[i].first;
+        UniValue delta(UniValue::VOBJ);
+        delta.push_back(Pair("txid", key.txid.GetHex()));
+        delta.push_back(Pair("index", (int64_t)key.nIndex));
+        delta.push_back(Pair("height", key.nHeight));
+        delta.push_back(Pair("amount", ValueFromAmount(vDeltas[i].second)));
+        delta.push_back(Pair("spending", key.fSpending));
+        ret.push_back(delta);
+    }
+    return ret;
+}
+
+UniValue getaddressbalance(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance \"address\"\n"
+            "\nReturns the balance of an address, and the total amount it received.\n"
+            "Fails for addresses with more than " + itostr(MAX_ADDRESS_INDEX_RESULTS) + " outputs and inputs; use getaddressdeltas with height ranges then.\n"
+            "Requires -addressindex. The index is built in the background; see getindexinfo.\n"
+            "\nArguments:\n"
+            "1. \"address\"  (string, required) The Bitcoin address\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"balance\": x.xxx,   (numeric) The unspent amount in " + CURRENCY_UNIT + "\n"
+            "  \"received\": x.xxx   (numeric) The total amount received in " + CURRENCY_UNIT + "\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalance", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+            + HelpExampleRpc("getaddressbalance", "\"1PSSGeFHDnKNxiEyFrD1wcEaHr9hrQDDWc\"")
+        );
+
+    if (!paddressindex || !paddressindex->HasAddressIndex())
+        throw JSONRPCError(RPC_MISC_ERROR, "Address index not enabled, use -addressindex");
+    CScript script = AddressToScript(params[0].get_str());
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vDeltas;
+    if (!paddressindex->GetAddressDeltas(script, 0, std::numeric_limits<int>::max(), MAX_ADDRESS_INDEX_RESULTS + 1, vDeltas))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index");
+    if (vDeltas.size() > MAX_ADDRESS_INDEX_RESULTS)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("More than %u entries, use getaddressdeltas with height ranges", MAX_ADDRESS_INDEX_RESULTS));
+
+    CAmount nBalance = 0;
+    CAmount nReceived = 0;
+    for (size_t i = 0; i < vDeltas.size(); i++) {
+        nBalance += vDeltas[i].second;
+        if (vDeltas[i].second > 0)
+            nReceived += vDeltas[i].second;
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("balance", ValueFromAmount(nBalance)));
+    ret.push_back(Pair("received", ValueFromAmount(nReceived)));
+    return ret;
+}
+
+UniValue getspentinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "getspentinfo \"txid\" n\n"
+            "\nReturns the input spending a transaction output.\n"
+            "Requires -spentindex. The index is built in the background; see getindexinfo.\n"
+            "\nArguments:\n"
+            "1. \"txid\"  (string, required) The transaction id\n"
+            "2. n         (numeric, required) The output index\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\": \"hash\",  (string) The id of the spending transaction\n"
+            "  \"index\": n,        (numeric) The index of the spending input\n"
+            "  \"height\": n        (numeric) The height of the block containing the spending transaction\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getspentinfo", "\"txid\" 1")
+            + HelpExampleRpc("getspentinfo", "\"txid\", 1")
+        );
+
+    if (!paddressindex || !paddressindex->HasSpentIndex())
+        throw JSONRPCError(RPC_MISC_ERROR, "Spent index not enabled, use -spentindex");
+    uint256 hash = ParseHashV(params[0], "txid");
+    int n = params[1].get_int();
+    if (n < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid output index");
+
+    CSpentIndexValue value;
+    if (!paddressindex->GetSpentInfo(COutPoint(hash, n), value))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Output not spent, or not indexed yet");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("txid", value.txid.GetHex()));
+    ret.push_back(Pair("index", (int64_t)value.nInput));
+    ret.push_back(Pair("height", value.nHeight));
+    return ret;
+}
+
+UniValue getblockfilter(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getblockfilter \"hash\" ( \"filtertype\" )\n"
+            "\nReturns the BIP 158 filter of a block, and its filter header.\n"
+            "Requires -blockfilterindex. The index is built in the background; see getindexinfo.\n"
+            "\nArguments:\n"
+            "1. \"hash\"        (string, required) The block hash\n"
+            "2. \"filtertype\"  (string, optional, default=\"basic\") The type of filter\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\": \"hex\",  (string) The hex-encoded filter\n"
+            "  \"header\": \"hash\"  (string) The filter header\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
+            + HelpExampleRpc("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\"")
+        );
+
+    uint256 hash = ParseHashV(params[0], "hash");
+    BlockFilterType filterType = BLOCK_FILTER_BASIC;
+    if (params.size() > 1 && !BlockFilterTypeByName(params[1].get_str(), filterType))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown filter type");
+    if (!pblockfilterindex || pblockfilterindex->GetFilterType() != filterType)
+        throw JSONRPCError(RPC_MISC_ERROR, "Block filter index not enabled, use -blockfilterindex");
+
+    const CBlockIndex* pindex = LookupBlockIndex(hash);
+    if (pindex == NULL)
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+    CBlockFilter filter;
+    uint256 hashHeader;
+    if (!pblockfilterindex->LookupFilter(pindex, filter) || !pblockfilterindex->LookupFilterHeader(pindex, hashHeader))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block filter not found, or not indexed yet");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("filter", HexStr(filter.GetEncodedFilter())));
+    ret.push_back(Pair("header", hashHeader.GetHex()));
+    return ret;
+}
+
+static UniValue ChainIndexToJSON(CChainIndex& index)
+{
+    AssertLockHeld(cs_main);
+    const CBlockIndex* pindex = index.GetBestBlock();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("synced", index.IsSynced()));
+    ret.push_back(Pair("height", pindex ? pindex->nHeight : -1));
+    ret.push_back(Pair("bestblock", pindex ? pindex->GetBlockHash().GetHex() : uint256().GetHex()));
+    std::string strError = index.GetError();
+    if (!strError.empty())
+        ret.push_back(Pair("error", strError));
+    return ret;
+}
+
+UniValue getindexinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getindexinfo\n"
+            "\nReturns the progress of the optional indexes that are built in the background.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"name\": {              (object) One entry per enabled index\n"
+            "    \"synced\": true|false, (boolean) Whether the index is up to date with the active chain\n"
+            "    \"height\": n,          (numeric) The height of the last block indexed\n"
+            "    \"bestblock\": \"hash\", (string) The hash of the last block indexed\n"
+            "    \"error\": \"...\"     (string, optional) Why the index is stuck; the block is retried every " + i64tostr(CHAIN_INDEX_RETRY_INTERVAL) + " seconds\n"
+            "  }, ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getindexinfo", "")
+            + HelpExampleRpc("getindexinfo", "")
+        );
+
+    LOCK(cs_main);
+    UniValue ret(UniValue::VOBJ);
+    if (ptxindex)
+        ret.push_back(Pair(ptxindex->GetName(), ChainIndexToJSON(*ptxindex)));
+    if (pblockfilterindex)
+        ret.push_back(Pair(pblockfilterindex->GetName(), ChainIndexToJSON(*pblockfilterindex)));
+    if (paddressindex)
+        ret.push_back(Pair(paddressindex->GetName(), ChainIndexToJSON(*paddressindex)));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -557,10 +1200,10 @@ UniValue verifychain(const UniValue& params, bool fHelp)
 }
 
 /** Implementation of IsSuperMajority with better feedback */
-static UniValue SoftForkMajorityDesc(int minVersion, CBlockIndex* pindex, int nRequired, const Consensus::Params& consensusParams)
+static UniValue SoftForkMajorityDesc(int minVersion, const CBlockIndex* pindex, int nRequired, const Consensus::Params& consensusParams)
 {
     int nFound = 0;
-    CBlockIndex* pstart = pindex;
+    const CBlockIndex* pstart = pindex;
     for (int i = 0; i < consensusParams.nMajorityWindow && pstart != NULL; i++)
     {
         if (pstart->nVersion >= minVersion)
@@ -576,7 +1219,7 @@ static UniValue SoftForkMajorityDesc(int minVersion, CBlockIndex* pindex, int nR
     return rv;
 }
 
-static UniValue SoftForkDesc(const std::string &name, int version, CBlockIndex* pindex, const Consensus::Params& consensusParams)
+static UniValue SoftForkDesc(const std::string &name, int version, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
     UniValue rv(UniValue::VOBJ);
     rv.push_back(Pair("id", name));
@@ -599,6 +1242,7 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "  \"headers\": xxxxxx,        (numeric) the current number of headers we have validated\n"
             "  \"bestblockhash\": \"...\", (string) the hash of the currently best block\n"
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
+            "  \"mediantime\": xxxxxx,       (numeric) median time for the current best block\n"
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
             "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
@@ -622,33 +1266,30 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockchaininfo", "")
         );
 
-    LOCK(cs_main);
+    // Everything below is derived from the chain snapshot and the immutable
+    // fields of the tip and its ancestors; no cs_main needed.
+    CChainSnapshotRef snapshot = GetTipSnapshot();
+    const CBlockIndex* tip = snapshot->pindexTip;
 
     UniValue obj(UniValue::VOBJ);
     obj.push_back(Pair("chain",                 Params().NetworkIDString()));
-    obj.push_back(Pair("blocks",                (int)chainActive.Height()));
-    obj.push_back(Pair("headers",               pindexBestHeader ? pindexBestHeader->nHeight : -1));
-    obj.push_back(Pair("bestblockhash",         chainActive.Tip()->GetBlockHash().GetHex()));
-    obj.push_back(Pair("difficulty",            (double)GetDifficulty()));
-    obj.push_back(Pair("verificationprogress",  Checkpoints::GuessVerificationProgress(Params().Checkpoints(), chainActive.Tip())));
-    obj.push_back(Pair("chainwork",             chainActive.Tip()->nChainWork.GetHex()));
+    obj.push_back(Pair("blocks",                (int)tip->nHeight));
+    obj.push_back(Pair("headers",               snapshot->pindexBestHeader ? snapshot->pindexBestHeader->nHeight : -1));
+    obj.push_back(Pair("bestblockhash",         tip->GetBlockHash().GetHex()));
+    obj.push_back(Pair("difficulty",            (double)GetDifficulty(tip)));
+    obj.push_back(Pair("mediantime",            snapshot->nMedianTimePast));
+    obj.push_back(Pair("verificationprogress",  Checkpoints::GuessVerificationProgress(Params().Checkpoints(), tip)));
+    obj.push_back(Pair("chainwork",             tip->nChainWork.GetHex()));
     obj.push_back(Pair("pruned",                fPruneMode));
 
     const Consensus::Params& consensusParams = Params().GetConsensus();
-    CBlockIndex* tip = chainActive.Tip();
     UniValue softforks(UniValue::VARR);
     softforks.push_back(SoftForkDesc("bip34", 2, tip, consensusParams));
     softforks.push_back(SoftForkDesc("bip66", 3, tip, consensusParams));
     obj.push_back(Pair("softforks",             softforks));
 
     if (fPruneMode)
-    {
-        CBlockIndex *block = chainActive.Tip();
-        while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA))
-            block = block->pprev;
-
-        obj.push_back(Pair("pruneheight",        block->nHeight));
-    }
+        obj.push_back(Pair("pruneheight",        snapshot->nPruneHeight));
     return obj;
 }
 
@@ -768,16 +1409,20 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"sequence\": xxxxx            (numeric) Number of additions and removals so far, see getmempoolchanges\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
             + HelpExampleRpc("getmempoolinfo", "")
         );
 
+    // Only the mempool lock, held once so that the counters are consistent
+    LOCK(mempool.cs);
     UniValue ret(UniValue::VOBJ);
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
     ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    ret.push_back(Pair("sequence", mempool.GetSequence()));
 
     return ret;
 }
@@ -0,0 +1,79 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpccache.h"
+
+#include "primitives/transaction.h"
+
+CRPCResultCache* pRPCResultCache = NULL;
+
+/** Rough memory usage of a UniValue tree */
+static size_t EstimateUsage(const UniValue& val)
+{
+    size_t nUsage = sizeof(UniValue) + val.getValStr().size();
+    if (val.isObject()) {
+        const std::vector<std::string>& keys = val.getKeys();
+        for (size_t i = 0; i < keys.size(); i++)
+            nUsage += sizeof(std::string) + keys[i].size();
+    }
+    for (size_t i = 0; i < val.size(); i++)
+        nUsage += EstimateUsage(val[i]);
+    return nUsage;
+}
+
+CRPCResultCache::CRPCResultCache(size_t nMaxSizeIn) : nSize(0), nMaxSize(nMaxSizeIn)
+{
+}
+
+bool CRPCResultCache::Get(const uint256& hash, Kind kind, UniValue& result, uint256* hashBlock)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    std::map<Key, std::list<Entry>::iterator>::iterator it = mapEntries.find(Key(hash, kind));
+    if (it == mapEntries.end())
+        return false;
+    entries.splice(entries.begin(), entries, it->second);
+    result = it->second->result;
+    if (hashBlock)
+        *hashBlock = it->second->hashBlock;
+    return true;
+}
+
+void CRPCResultCache::Put(const uint256& hash, Kind kind, const UniValue& result, const uint256& hashBlock)
+{
+    size_t nEntrySize = EstimateUsage(result) + sizeof(Entry) + 64;
+    if (nEntrySize > nMaxSize / 4)
+        return;
+
+    boost::unique_lock<boost::mutex> lock(cs);
+    Key key(hash, kind);
+    Erase(key);
+    entries.push_front(Entry());
+    Entry& entry = entries.front();
+    entry.key = key;
+    entry.result = result;
+    entry.hashBlock = hashBlock;
+    entry.nSize = nEntrySize;
+    mapEntries[key] = entries.begin();
+    nSize += nEntrySize;
+    while (nSize > nMaxSize)
+        Erase(entries.back().key);
+}
+
+void CRPCResultCache::Erase(const Key& key)
+{
+    std::map<Key, std::list<Entry>::iterator>::iterator it = mapEntries.find(key);
+    if (it == mapEntries.end())
+        return;
+    nSize -= it->second->nSize;
+    entries.erase(it->second);
+    mapEntries.erase(it);
+}
+
+void CRPCResultCache::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    const uint256& hash = tx.GetHash();
+    Erase(Key(hash, TX_JSON));
+    Erase(Key(hash, TX_HEX));
+}
@@ -0,0 +1,75 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPCCACHE_H
+#define BITCOIN_RPCCACHE_H
+
+#include "uint256.h"
+#include "validationinterface.h"
+
+#include <list>
+#include <map>
+#include <stdint.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include "univalue/univalue.h"
+
+/** Default size of the cache of rendered block and transaction results, in MiB */
+static const unsigned int DEFAULT_RPC_CACHE_SIZE = 16;
+
+/**
+ * Size-bounded LRU cache of getblock and getrawtransaction results, so that
+ * repeated queries for the same recent blocks and transactions skip reading
+ * them from disk and rendering them again.
+ *
+ * Results are cached without the fields that depend on the active chain
+ * (confirmations, next block), which callers fill in on every hit. Entries
+ * for a transaction are dropped whenever it is connected, disconnected or
+ * conflicted, as the block it is reported in may have changed.
+ */
+class CRPCResultCache : public CValidationInterface
+{
+public:
+    enum Kind {
+        BLOCK_HEX,
+        BLOCK_JSON,
+        //! BLOCK_JSON with the transaction list as pre-serialized JSON, for streamed replies
+        BLOCK_JSON_SERIALIZED,
+        TX_HEX,
+        TX_JSON,
+    };
+
+    CRPCResultCache(size_t nMaxSizeIn);
+
+    /** Look up a result; hashBlock is the block a cached transaction was found in */
+    bool Get(const uint256& hash, Kind kind, UniValue& result, uint256* hashBlock = NULL);
+    void Put(const uint256& hash, Kind kind, const UniValue& result, const uint256& hashBlock = uint256());
+
+protected:
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+
+private:
+    typedef std::pair<uint256, Kind> Key;
+    struct Entry
+    {
+        Key key;
+        UniValue result;
+        uint256 hashBlock;
+        size_t nSize;
+    };
+
+    boost::mutex cs;
+    //! Most recently used first
+    std::list<Entry> entries;
+    std::map<Key, std::list<Entry>::iterator> mapEntries;
+    size_t nSize;
+    size_t nMaxSize;
+
+    void Erase(const Key& key);
+};
+
+extern CRPCResultCache* pRPCResultCache;
+
+#endif // BITCOIN_RPCCACHE_H
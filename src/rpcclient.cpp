@@ -83,14 +83,23 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "gettxout", 1 },
     { "gettxout", 2 },
     { "gettxoutproof", 0 },
+    { "getaddressdeltas", 1 },
+    { "getaddressdeltas", 2 },
+    { "getspentinfo", 1 },
     { "lockunspent", 0 },
     { "lockunspent", 1 },
     { "importprivkey", 2 },
     { "importaddress", 2 },
     { "verifychain", 0 },
     { "verifychain", 1 },
+    { "waitfornotifications", 0 },
+    { "waitfornotifications", 1 },
     { "keypoolrefill", 0 },
     { "getrawmempool", 0 },
+    { "getmempoolchanges", 0 },
+    { "getmempoolchanges", 1 },
+    { "getmempoolchanges", 2 },
+    { "getmempoolchanges", 3 },
     { "estimatefee", 0 },
     { "estimatepriority", 0 },
     { "prioritisetransaction", 1 },
@@ -0,0 +1,166 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpcmetrics.h"
+
+#include "rpcserver.h"
+#include "sync.h"
+#include "tinyformat.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+
+#include <boost/foreach.hpp>
+
+#include "univalue/univalue.h"
+
+using namespace std;
+
+CRPCMetrics rpcMetrics;
+
+CRPCMetrics::MethodStats::MethodStats() :
+    nCalls(0), nErrors(0), nInFlight(0), nTotalMicros(0), nLockWaitMicros(0)
+{
+    for (int i = 0; i < RPC_LATENCY_BUCKETS; i++)
+        vHistogram[i] = 0;
+}
+
+void CRPCMetrics::PreCommand(const CRPCCommand& cmd)
+{
+    if (!callState.get())
+        callState.reset(new CallState());
+    callState->pcmd = &cmd;
+    callState->nStart = GetTimeMicros();
+    callState->nLockWaitStart = GetThreadLockWait();
+
+    boost::unique_lock<boost::mutex> lock(cs);
+    mapStats[cmd.name].nInFlight++;
+}
+
+void CRPCMetrics::PostCommand(const CRPCCommand& cmd, bool fSuccess)
+{
+    // Only calls seen by PreCommand, which may not have run if an earlier
+    // pre-command hook refused the call
+    CallState* state = callState.get();
+    if (!state || state->pcmd != &cmd)
+        return;
+    state->pcmd = NULL;
+    int64_t nMicros = GetTimeMicros() - state->nStart;
+    int64_t nLockWait = GetThreadLockWait() - state->nLockWaitStart;
+
+    int nBucket = 0;
+    while (nBucket < RPC_LATENCY_BUCKETS - 1 && nMicros > RPC_LATENCY_BOUNDS[nBucket])
+        nBucket++;
+
+    boost::unique_lock<boost::mutex> lock(cs);
+    MethodStats& stats = mapStats[cmd.name];
+    stats.nInFlight--;
+    stats.nCalls++;
+    if (!fSuccess)
+        stats.nErrors++;
+    stats.nTotalMicros += nMicros;
+    stats.nLockWaitMicros += nLockWait;
+    stats.vHistogram[nBucket]++;
+}
+
+std::map<std::string, CRPCMetrics::MethodStats> CRPCMetrics::GetStats()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    return mapStats;
+}
+
+static std::string FormatSeconds(int64_t nMicros)
+{
+    return strprintf("%d.%06d", nMicros / 1000000, nMicros % 1000000);
+}
+
+std::string CRPCMetrics::ToText()
+{
+    std::map<std::string, MethodStats> mapCopy = GetStats();
+    typedef std::pair<const std::string, MethodStats> MethodEntry;
+
+    std::string strText;
+    strText += "# HELP bitcoind_rpc_calls_total Completed RPC calls.\n";
+    strText += "# TYPE bitcoind_rpc_calls_total counter\n";
+    BOOST_FOREACH(const MethodEntry& entry, mapCopy)
+        strText += strprintf("bitcoind_rpc_calls_total{method=\"%s\"} %u\n", entry.first, entry.second.nCalls);
+    strText += "# HELP bitcoind_rpc_errors_total RPC calls that returned an error.\n";
+    strText += "# TYPE bitcoind_rpc_errors_total counter\n";
+    BOOST_FOREACH(const MethodEntry& entry, mapCopy)
+        strText += strprintf("bitcoind_rpc_errors_total{method=\"%s\"} %u\n", entry.first, entry.second.nErrors);
+    strText += "# HELP bitcoind_rpc_in_flight RPC calls in progress.\n";
+    strText += "# TYPE bitcoind_rpc_in_flight gauge\n";
+    BOOST_FOREACH(const MethodEntry& entry, mapCopy)
+        strText += strprintf("bitcoind_rpc_in_flight{method=\"%s\"} %d\n", entry.first, entry.second.nInFlight);
+    strText += "# HELP bitcoind_rpc_lock_wait_seconds_total Time completed RPC calls spent waiting for locks such as cs_main, measured with -debug=lock.\n";
+    strText += "# TYPE bitcoind_rpc_lock_wait_seconds_total counter\n";
+    BOOST_FOREACH(const MethodEntry& entry, mapCopy)
+        strText += strprintf("bitcoind_rpc_lock_wait_seconds_total{method=\"%s\"} %s\n", entry.first, FormatSeconds(entry.second.nLockWaitMicros));
+    strText += "# HELP bitcoind_rpc_duration_seconds Duration of completed RPC calls.\n";
+    strText += "# TYPE bitcoind_rpc_duration_seconds histogram\n";
+    BOOST_FOREACH(const MethodEntry& entry, mapCopy) {
+        const MethodStats& stats = entry.second;
+        uint64_t nCumulative = 0;
+        for (int i = 0; i < RPC_LATENCY_BUCKETS; i++) {
+            nCumulative += stats.vHistogram[i];
+            std::string strBound = i < RPC_LATENCY_BUCKETS - 1 ? FormatSeconds(RPC_LATENCY_BOUNDS[i]) : "+Inf";
+            strText += strprintf("bitcoind_rpc_duration_seconds_bucket{method=\"%s\",le=\"%s\"} %u\n", entry.first, strBound, nCumulative);
+        }
+        strText += strprintf("bitcoind_rpc_duration_seconds_sum{method=\"%s\"} %s\n", entry.first, FormatSeconds(stats.nTotalMicros));
+        strText += strprintf("bitcoind_rpc_duration_seconds_count{method=\"%s\"} %u\n", entry.first, stats.nCalls);
+    }
+    return strText;
+}
+
+UniValue getrpcstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcstats\n"
+            "\nReturns call statistics for each RPC method called since the node started.\n"
+            "The same statistics are served in the Prometheus text format at /metrics, with the RPC credentials.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"buckets\": [ n, ... ],  (array) Upper bounds of the latency histogram buckets in microseconds; the last bucket is unbounded\n"
+            "  \"methods\": {\n"
+            "    \"method\": {\n"
+            "      \"calls\": n,          (numeric) Number of completed calls\n"
+            "      \"errors\": n,         (numeric) Number of calls that returned an error\n"
+            "      \"inflight\": n,       (numeric) Number of calls in progress\n"
+            "      \"time\": n,           (numeric) Total duration of completed calls in microseconds\n"
+            "      \"lockwait\": n,       (numeric) Part of it spent waiting for locks such as cs_main, in microseconds; only measured with -debug=lock\n"
+            "      \"histogram\": [ n, ... ] (array) Number of completed calls per latency bucket\n"
+            "    }, ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcstats", "")
+            + HelpExampleRpc("getrpcstats", "")
+        );
+
+    UniValue buckets(UniValue::VARR);
+    for (int i = 0; i < RPC_LATENCY_BUCKETS - 1; i++)
+        buckets.push_back(RPC_LATENCY_BOUNDS[i]);
+
+    std::map<std::string, CRPCMetrics::MethodStats> mapStats = rpcMetrics.GetStats();
+    UniValue methods(UniValue::VOBJ);
+    BOOST_FOREACH(const PAIRTYPE(std::string, CRPCMetrics::MethodStats)& entry, mapStats) {
+        const CRPCMetrics::MethodStats& stats = entry.second;
+        UniValue histogram(UniValue::VARR);
+        for (int i = 0; i < RPC_LATENCY_BUCKETS; i++)
+            histogram.push_back(stats.vHistogram[i]);
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("calls", stats.nCalls));
+        obj.push_back(Pair("errors", stats.nErrors));
+        obj.push_back(Pair("inflight", stats.nInFlight));
+        obj.push_back(Pair("time", stats.nTotalMicros));
+        obj.push_back(Pair("lockwait", stats.nLockWaitMicros));
+        obj.push_back(Pair("histogram", histogram));
+        methods.push_back(Pair(entry.first, obj));
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("buckets", buckets));
+    ret.push_back(Pair("methods", methods));
+    return ret;
+}
@@ -0,0 +1,72 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPCMETRICS_H
+#define BITCOIN_RPCMETRICS_H
+
+#include <map>
+#include <stdint.h>
+#include <string>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+class CRPCCommand;
+class UniValue;
+
+/** Number of latency histogram buckets, the last of which is unbounded */
+static const int RPC_LATENCY_BUCKETS = 17;
+/** Upper bounds of the bounded latency histogram buckets, in microseconds */
+static const int64_t RPC_LATENCY_BOUNDS[RPC_LATENCY_BUCKETS - 1] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+
+/**
+ * Per-method RPC call statistics, recorded from the RPC server's pre- and
+ * post-command hooks: call and error counts, calls in progress, and the
+ * distribution of call durations, including the part spent waiting for
+ * locks such as cs_main.
+ */
+class CRPCMetrics
+{
+public:
+    struct MethodStats
+    {
+        uint64_t nCalls;
+        uint64_t nErrors;
+        int nInFlight;
+        int64_t nTotalMicros;
+        int64_t nLockWaitMicros;
+        uint64_t vHistogram[RPC_LATENCY_BUCKETS];
+
+        MethodStats();
+    };
+
+    void PreCommand(const CRPCCommand& cmd);
+    void PostCommand(const CRPCCommand& cmd, bool fSuccess);
+
+    /** Statistics of all methods called so far, by method name */
+    std::map<std::string, MethodStats> GetStats();
+
+    /** Statistics in the Prometheus text exposition format */
+    std::string ToText();
+
+private:
+    //! The call in progress on the current thread
+    struct CallState
+    {
+        const CRPCCommand* pcmd;
+        int64_t nStart;
+        int64_t nLockWaitStart;
+    };
+
+    boost::mutex cs;
+    std::map<std::string, MethodStats> mapStats;
+    boost::thread_specific_ptr<CallState> callState;
+};
+
+extern CRPCMetrics rpcMetrics;
+
+#endif // BITCOIN_RPCMETRICS_H
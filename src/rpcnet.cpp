@@ -107,7 +107,9 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"inflightlimit\": n,        (numeric) How many blocks we allow in flight from this peer, based on its download rate\n"
+            "    \"blockdeliverytime\": n,    (numeric) Average time in seconds this peer takes to deliver a requested block, if known\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -157,6 +159,9 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("inflightlimit", statestats.nBlocksInFlightLimit));
+            if (statestats.nAvgBlockDeliveryTime)
+                obj.push_back(Pair("blockdeliverytime", statestats.nAvgBlockDeliveryTime / 1e6));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
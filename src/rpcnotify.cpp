@@ -0,0 +1,233 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpcnotify.h"
+
+#include "core_io.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "rpcserver.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <boost/foreach.hpp>
+
+#include "univalue/univalue.h"
+
+using namespace std;
+
+CRPCNotifier* pRPCNotifier = NULL;
+
+UniValue CRPCNotification::ToJSON() const
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("sequence", nSequence));
+    if (type == BLOCK || type == BLOCK_DISCONNECTED) {
+        obj.push_back(Pair("type", type == BLOCK ? "block" : "blockdisconnected"));
+        obj.push_back(Pair("hash", hash.GetHex()));
+        obj.push_back(Pair("height", nHeight));
+        obj.push_back(Pair("previousblockhash", hashPrevBlock.GetHex()));
+    } else {
+        obj.push_back(Pair("type", "tx"));
+        obj.push_back(Pair("txid", hash.GetHex()));
+        obj.push_back(Pair("hex", strHex));
+    }
+    return obj;
+}
+
+CRPCNotifier::CRPCNotifier(size_t nMaxEventsIn) :
+    nMaxEvents(nMaxEventsIn), nQueueBytes(0), nLastSequence(0), fInterrupted(false),
+    filterAnnounced(std::max(nMaxEventsIn, (size_t)10000), 0.000001)
+{
+}
+
+uint64_t CRPCNotifier::GetSequence()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    return nLastSequence;
+}
+
+void CRPCNotifier::Push(CRPCNotification& event)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        event.nSequence = ++nLastSequence;
+        nQueueBytes += sizeof(event) + event.strHex.size();
+        queue.push_back(event);
+        while (queue.size() > nMaxEvents || (nQueueBytes > MAX_RPC_NOTIFY_QUEUE_BYTES && queue.size() > 1)) {
+            nQueueBytes -= sizeof(queue.front()) + queue.front().strHex.size();
+            queue.pop_front();
+        }
+    }
+    cond.notify_all();
+}
+
+void CRPCNotifier::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+{
+    CRPCNotification event;
+    if (pblock) {
+        // Called for every transaction of a connected block; report the
+        // block once, with its coinbase.
+        if (pblock->vtx.empty() || &tx != &pblock->vtx[0])
+            return;
+        event.type = CRPCNotification::BLOCK;
+        event.hash = pblock->GetHash();
+        const CBlockIndex* pindex = LookupBlockIndex(event.hash);
+        event.nHeight = pindex ? pindex->nHeight : -1;
+        event.hashPrevBlock = pblock->hashPrevBlock;
+    } else {
+        // Also called for transactions that conflicted with a block, and
+        // again for those returned to the mempool by a reorg. Only report
+        // transactions that are in the mempool, and only once.
+        const uint256& hash = tx.GetHash();
+        if (!mempool.exists(hash) || filterAnnounced.contains(hash))
+            return;
+        filterAnnounced.insert(hash);
+        event.type = CRPCNotification::TX;
+        event.hash = hash;
+        event.nHeight = -1;
+        event.strHex = EncodeHexTx(tx);
+    }
+    Push(event);
+}
+
+void CRPCNotifier::BlockDisconnected(const CBlock& block)
+{
+    CRPCNotification event;
+    event.type = CRPCNotification::BLOCK_DISCONNECTED;
+    event.hash = block.GetHash();
+    const CBlockIndex* pindex = LookupBlockIndex(event.hash);
+    event.nHeight = pindex ? pindex->nHeight : -1;
+    event.hashPrevBlock = block.hashPrevBlock;
+    Push(event);
+}
+
+bool CRPCNotifier::Wait(uint64_t nSequence, const boost::system_time& tDeadline, std::vector<CRPCNotification>& vEvents, size_t nMax)
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    if (nSequence > nLastSequence)
+        return false;
+    while (nLastSequence == nSequence && !fInterrupted) {
+        if (!cond.timed_wait(lock, tDeadline))
+            break;
+    }
+
+    if (queue.empty())
+        return true;
+    // Sequence numbers in the queue are consecutive
+    uint64_t nFirst = queue.front().nSequence;
+    bool fComplete = nSequence + 1 >= nFirst;
+    for (size_t i = fComplete ? nSequence + 1 - nFirst : 0; i < queue.size() && vEvents.size() < nMax; i++)
+        vEvents.push_back(queue[i]);
+    return fComplete;
+}
+
+void CRPCNotifier::Interrupt()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fInterrupted = true;
+    }
+    cond.notify_all();
+}
+
+static boost::mutex csNotifyWaitSlots;
+static int nNotifyWaitSlots = 0;
+
+CNotifyWaitSlot::~CNotifyWaitSlot()
+{
+    if (fAcquired) {
+        boost::unique_lock<boost::mutex> lock(csNotifyWaitSlots);
+        nNotifyWaitSlots--;
+    }
+}
+
+bool CNotifyWaitSlot::Acquire()
+{
+    // Leave at least one worker for other requests
+    boost::unique_lock<boost::mutex> lock(csNotifyWaitSlots);
+    if (nNotifyWaitSlots >= std::max((int)GetArg("-rpcthreads", DEFAULT_RPC_THREADS) - 1, 1))
+        return false;
+    nNotifyWaitSlots++;
+    fAcquired = true;
+    return true;
+}
+
+UniValue waitfornotifications(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "waitfornotifications ( sequence timeout )\n"
+            "\nWait for blocks connected to or disconnected from the active chain and transactions accepted to the mempool.\n"
+            "Returns as soon as there are events after 'sequence', or when the timeout expires.\n"
+            "Pass the returned sequence to the next call to receive each event once.\n"
+            "\nArguments:\n"
+            "1. sequence    (numeric, optional) Return events after this sequence number (default: wait for the next event)\n"
+            "2. timeout     (numeric, optional) Maximum number of seconds to wait (default and maximum: -rpcservertimeout)\n"
+            "               Returns right away if too many clients are waiting already.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"sequence\": n,      (numeric) Sequence number of the last event returned, to pass to the next call\n"
+            "  \"missed\": true|false, (boolean) Whether events after the given sequence were dropped or are from before a restart\n"
+            "  \"events\": [\n"
+            "    {\n"
+            "      \"sequence\": n,  (numeric) Sequence number of the event\n"
+            "      \"type\": \"block\", (string) A block was connected to the active chain\n"
+            "      \"hash\": \"hash\", (string) The block hash\n"
+            "      \"height\": n,    (numeric) The block height\n"
+            "      \"previousblockhash\": \"hash\" (string) The hash of the previous block\n"
+            "    },\n"
+            "    {\n"
+            "      \"sequence\": n,  (numeric) Sequence number of the event\n"
+            "      \"type\": \"blockdisconnected\", (string) A block was disconnected from the active chain\n"
+            "      \"hash\": \"hash\", (string) The block hash\n"
+            "      \"height\": n,    (numeric) The block height\n"
+            "      \"previousblockhash\": \"hash\" (string) The hash of the previous block, the new tip\n"
+            "    },\n"
+            "    {\n"
+            "      \"sequence\": n,  (numeric) Sequence number of the event\n"
+            "      \"type\": \"tx\",  (string) A transaction was accepted to the mempool\n"
+            "      \"txid\": \"hash\", (string) The transaction id\n"
+            "      \"hex\": \"data\"   (string) The serialized, hex-encoded transaction\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("waitfornotifications", "")
+            + HelpExampleCli("waitfornotifications", "120 30")
+            + HelpExampleRpc("waitfornotifications", "120, 30")
+        );
+
+    if (!pRPCNotifier)
+        throw JSONRPCError(RPC_MISC_ERROR, "Notifications are disabled (-rpcnotifyqueue=0)");
+
+    uint64_t nSequence = params.size() > 0 && !params[0].isNull() ? params[0].get_int64() : pRPCNotifier->GetSequence();
+    // Don't hold on to a worker for longer than the server waits for an idle client
+    int64_t nMaxTimeout = GetArg("-rpcservertimeout", DEFAULT_RPC_SERVER_TIMEOUT);
+    int64_t nTimeout = params.size() > 1 ? params[1].get_int64() : nMaxTimeout;
+    if (nTimeout < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative timeout");
+    nTimeout = std::min(nTimeout, nMaxTimeout);
+
+    CNotifyWaitSlot slot;
+    if (nTimeout > 0 && !slot.Acquire())
+        nTimeout = 0; // only return what is there already, leaving the workers to others
+
+    std::vector<CRPCNotification> vEvents;
+    bool fComplete = pRPCNotifier->Wait(nSequence, boost::get_system_time() + boost::posix_time::seconds(nTimeout), vEvents, MAX_RPC_NOTIFY_BATCH);
+
+    UniValue events(UniValue::VARR);
+    BOOST_FOREACH(const CRPCNotification& event, vEvents)
+        events.push_back(event.ToJSON());
+
+    UniValue result(UniValue::VOBJ);
+    if (!vEvents.empty())
+        result.push_back(Pair("sequence", vEvents.back().nSequence));
+    else
+        result.push_back(Pair("sequence", fComplete ? nSequence : pRPCNotifier->GetSequence()));
+    result.push_back(Pair("missed", !fComplete));
+    result.push_back(Pair("events", events));
+    return result;
+}
@@ -0,0 +1,108 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_RPCNOTIFY_H
+#define BITCOIN_RPCNOTIFY_H
+
+#include "bloom.h"
+#include "uint256.h"
+#include "validationinterface.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread_time.hpp>
+
+class UniValue;
+
+/** Default number of recent events kept for notification subscribers; 0 disables them */
+static const unsigned int DEFAULT_RPC_NOTIFY_QUEUE = 1000;
+/** Maximum memory used by queued events, whatever the number of them */
+static const size_t MAX_RPC_NOTIFY_QUEUE_BYTES = 8 * 1024 * 1024;
+/** Maximum number of events returned by one waitfornotifications call */
+static const size_t MAX_RPC_NOTIFY_BATCH = 1000;
+
+/** A block connected to or disconnected from the active chain, or a transaction entering the mempool */
+struct CRPCNotification
+{
+    enum Type { BLOCK, BLOCK_DISCONNECTED, TX };
+
+    uint64_t nSequence;
+    Type type;
+    uint256 hash;
+    //! Blocks only: height and parent
+    int nHeight;
+    uint256 hashPrevBlock;
+    //! Transactions only: the serialized transaction, hex encoded
+    std::string strHex;
+
+    UniValue ToJSON() const;
+};
+
+/**
+ * Keeps the most recent block and transaction events, numbered by a sequence
+ * that starts at 1 each time the node starts, so that RPC clients can
+ * long-poll or stream them instead of polling getbestblockhash/getrawmempool.
+ */
+class CRPCNotifier : public CValidationInterface
+{
+public:
+    CRPCNotifier(size_t nMaxEventsIn);
+
+    /** Sequence number of the latest event, 0 if there was none yet */
+    uint64_t GetSequence();
+
+    /**
+     * Copy up to nMax events following nSequence to vEvents, waiting until
+     * tDeadline for one to arrive if there are none yet. Returns false if
+     * some of the events following nSequence were already dropped from the
+     * queue (or nSequence is from before a restart).
+     */
+    bool Wait(uint64_t nSequence, const boost::system_time& tDeadline, std::vector<CRPCNotification>& vEvents, size_t nMax);
+
+    /** Wake up all waiters; further waits return immediately */
+    void Interrupt();
+
+protected:
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void BlockDisconnected(const CBlock& block);
+
+private:
+    void Push(CRPCNotification& event);
+
+    boost::mutex cs;
+    boost::condition_variable cond;
+    std::deque<CRPCNotification> queue;
+    size_t nMaxEvents;
+    size_t nQueueBytes;
+    uint64_t nLastSequence;
+    bool fInterrupted;
+    //! Transactions already announced, as they are reported again on reorgs
+    CRollingBloomFilter filterAnnounced;
+};
+
+extern CRPCNotifier* pRPCNotifier;
+
+/**
+ * One of the clients waiting for notifications, by waitfornotifications or
+ * /rest/notifications. Each of them keeps an RPC worker busy, so there are
+ * fewer of them than workers.
+ */
+class CNotifyWaitSlot
+{
+public:
+    CNotifyWaitSlot() : fAcquired(false) {}
+    ~CNotifyWaitSlot();
+
+    /** Returns false if all the slots are taken */
+    bool Acquire();
+
+private:
+    bool fAcquired;
+};
+
+#endif // BITCOIN_RPCNOTIFY_H
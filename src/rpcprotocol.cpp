@@ -13,6 +13,7 @@
 #include "utiltime.h"
 #include "version.h"
 
+#include <assert.h>
 #include <stdint.h>
 #include <fstream>
 
@@ -70,6 +71,7 @@ static const char *httpStatusDescription(int nStatus)
         case HTTP_FORBIDDEN: return "Forbidden";
         case HTTP_NOT_FOUND: return "Not Found";
         case HTTP_INTERNAL_SERVER_ERROR: return "Internal Server Error";
+        case HTTP_SERVICE_UNAVAILABLE: return "Service Unavailable";
         default: return "";
     }
 }
@@ -117,6 +119,25 @@ string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength, const
         FormatFullVersion());
 }
 
+string HTTPReplyStreamHeader(int nStatus, bool keepalive, bool chunked, const char *contentType)
+{
+    return strprintf(
+            "HTTP/1.1 %d %s\r\n"
+            "Date: %s\r\n"
+            "Connection: %s\r\n"
+            "%s"
+            "Content-Type: %s\r\n"
+            "Server: bitcoin-json-rpc/%s\r\n"
+            "\r\n",
+        nStatus,
+        httpStatusDescription(nStatus),
+        rfc1123Time(),
+        (keepalive && chunked) ? "keep-alive" : "close",
+        chunked ? "Transfer-Encoding: chunked\r\n" : "",
+        contentType,
+        FormatFullVersion());
+}
+
 string HTTPReply(int nStatus, const string& strMsg, bool keepalive,
                  bool headersOnly, const char *contentType)
 {
@@ -128,12 +149,10 @@ string HTTPReply(int nStatus, const string& strMsg, bool keepalive,
     }
 }
 
-bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
-                         string& http_method, string& http_uri)
+/** Parse an HTTP request line ("METHOD /uri HTTP/1.x"), without trailing CR/LF */
+static bool ParseHTTPRequestLine(const string& str, int &proto,
+                                 string& http_method, string& http_uri)
 {
-    string str;
-    getline(stream, str);
-
     // HTTP request line is space-delimited
     vector<string> vWords;
     boost::split(vWords, str, boost::is_any_of(" "));
@@ -163,6 +182,35 @@ bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
     return true;
 }
 
+/** Parse a "Name: value" header line into mapHeadersRet, with the name lower-cased */
+static void ParseHTTPHeaderLine(const string& str, map<string, string>& mapHeadersRet)
+{
+    string::size_type nColon = str.find(":");
+    if (nColon != string::npos)
+    {
+        string strHeader = str.substr(0, nColon);
+        boost::trim(strHeader);
+        boost::to_lower(strHeader);
+        string strValue = str.substr(nColon+1);
+        boost::trim(strValue);
+        mapHeadersRet[strHeader] = strValue;
+    }
+}
+
+/** Fill in the connection header if the client did not say, based on the protocol version */
+static void SetDefaultConnectionHeader(map<string, string>& mapHeadersRet, int nProto)
+{
+    string sConHdr = mapHeadersRet["connection"];
+
+    if ((sConHdr != "close") && (sConHdr != "keep-alive"))
+    {
+        if (nProto >= 1)
+            mapHeadersRet["connection"] = "keep-alive";
+        else
+            mapHeadersRet["connection"] = "close";
+    }
+}
+
 int ReadHTTPStatus(std::basic_istream<char>& stream, int &proto)
 {
     string str;
@@ -187,19 +235,11 @@ int ReadHTTPHeaders(std::basic_istream<char>& stream, map<string, string>& mapHe
         std::getline(stream, str);
         if (str.empty() || str == "\r")
             break;
-        string::size_type nColon = str.find(":");
-        if (nColon != string::npos)
-        {
-            string strHeader = str.substr(0, nColon);
-            boost::trim(strHeader);
-            boost::to_lower(strHeader);
-            string strValue = str.substr(nColon+1);
-            boost::trim(strValue);
-            mapHeadersRet[strHeader] = strValue;
-            if (strHeader == "content-length")
-                nLen = atoi(strValue.c_str());
-        }
+        ParseHTTPHeaderLine(str, mapHeadersRet);
     }
+    map<string, string>::const_iterator it = mapHeadersRet.find("content-length");
+    if (it != mapHeadersRet.end())
+        nLen = atoi(it->second.c_str());
     return nLen;
 }
 
@@ -217,7 +257,33 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
         return HTTP_INTERNAL_SERVER_ERROR;
 
     // Read message
-    if (nLen > 0)
+    map<string, string>::const_iterator itTE = mapHeadersRet.find("transfer-encoding");
+    if (itTE != mapHeadersRet.end() && boost::icontains(itTE->second, "chunked"))
+    {
+        // Chunked transfer encoding: hex length lines, each followed by that much data
+        while (true)
+        {
+            string str;
+            std::getline(stream, str);
+            if (!stream)
+                return HTTP_INTERNAL_SERVER_ERROR;
+            size_t nChunk = strtoul(str.c_str(), NULL, 16);
+            if (nChunk == 0)
+                break;
+            if (strMessageRet.size() + nChunk > max_size)
+                return HTTP_INTERNAL_SERVER_ERROR;
+            size_t ptr = strMessageRet.size();
+            strMessageRet.resize(ptr + nChunk);
+            stream.read(&strMessageRet[ptr], nChunk);
+            std::getline(stream, str); // CRLF after the chunk data
+            if (!stream) // Connection lost while reading
+                return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        // Skip any trailer headers
+        map<string, string> mapTrailers;
+        ReadHTTPHeaders(stream, mapTrailers);
+    }
+    else if (nLen > 0)
     {
         vector<char> vch;
         size_t ptr = 0;
@@ -233,17 +299,155 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, map<string,
         strMessageRet = string(vch.begin(), vch.end());
     }
 
-    string sConHdr = mapHeadersRet["connection"];
+    SetDefaultConnectionHeader(mapHeadersRet, nProto);
 
-    if ((sConHdr != "close") && (sConHdr != "keep-alive"))
+    return HTTP_OK;
+}
+
+HTTPRequestParser::HTTPRequestParser(size_t nMaxBodySizeIn) : nMaxBodySize(nMaxBodySizeIn)
+{
+    Reset();
+}
+
+void HTTPRequestParser::Reset()
+{
+    state = REQUEST_LINE;
+    strLine.clear();
+    nHeaderBytes = 0;
+    nContentLength = 0;
+    nProto = 0;
+    strMethod.clear();
+    strURI.clear();
+    mapHeaders.clear();
+    strBody.clear();
+}
+
+bool HTTPRequestParser::ProcessLine()
+{
+    if (!strLine.empty() && strLine[strLine.size() - 1] == '\r')
+        strLine.erase(strLine.size() - 1);
+
+    if (state == REQUEST_LINE) {
+        if (!ParseHTTPRequestLine(strLine, nProto, strMethod, strURI))
+            return false;
+        state = HEADERS;
+    } else if (strLine.empty()) {
+        // End of headers
+        map<string, string>::const_iterator it = mapHeaders.find("content-length");
+        if (it != mapHeaders.end()) {
+            int nLen = atoi(it->second.c_str());
+            if (nLen < 0 || (size_t)nLen > nMaxBodySize)
+                return false;
+            nContentLength = nLen;
+        }
+        SetDefaultConnectionHeader(mapHeaders, nProto);
+        strBody.reserve(nContentLength);
+        state = nContentLength > 0 ? BODY : COMPLETE;
+    } else {
+        ParseHTTPHeaderLine(strLine, mapHeaders);
+    }
+    strLine.clear();
+    return true;
+}
+
+size_t HTTPRequestParser::Feed(const char* pch, size_t nBytes)
+{
+    size_t nPos = 0;
+    while (nPos < nBytes && state != COMPLETE && state != FAILED)
     {
-        if (nProto >= 1)
-            mapHeadersRet["connection"] = "keep-alive";
-        else
-            mapHeadersRet["connection"] = "close";
+        if (state == BODY) {
+            size_t nCopy = std::min(nBytes - nPos, nContentLength - strBody.size());
+            strBody.append(pch + nPos, nCopy);
+            nPos += nCopy;
+            if (strBody.size() == nContentLength)
+                state = COMPLETE;
+            continue;
+        }
+
+        const char* pchEnd = (const char*)memchr(pch + nPos, '\n', nBytes - nPos);
+        size_t nLineBytes = pchEnd ? pchEnd - (pch + nPos) : nBytes - nPos;
+        nHeaderBytes += nLineBytes + (pchEnd ? 1 : 0);
+        if (nHeaderBytes > MAX_HTTP_HEADERS_SIZE) {
+            state = FAILED;
+            break;
+        }
+        strLine.append(pch + nPos, nLineBytes);
+        nPos += nLineBytes;
+        if (pchEnd) {
+            nPos++;
+            if (!ProcessLine())
+                state = FAILED;
+        }
     }
+    return nPos;
+}
 
-    return HTTP_OK;
+void JSONStreamWriter::Separator()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (!vFirst.empty()) {
+        if (!vFirst.back())
+            stream << ',';
+        vFirst.back() = false;
+    }
+}
+
+void JSONStreamWriter::BeginObject()
+{
+    Separator();
+    stream << '{';
+    vFirst.push_back(true);
+}
+
+void JSONStreamWriter::EndObject()
+{
+    assert(!vFirst.empty());
+    vFirst.pop_back();
+    stream << '}';
+}
+
+void JSONStreamWriter::BeginArray()
+{
+    Separator();
+    stream << '[';
+    vFirst.push_back(true);
+}
+
+void JSONStreamWriter::EndArray()
+{
+    assert(!vFirst.empty());
+    vFirst.pop_back();
+    stream << ']';
+}
+
+void JSONStreamWriter::Key(const string& key)
+{
+    Separator();
+    stream << UniValue(key).write() << ':';
+    fAfterKey = true;
+}
+
+void JSONStreamWriter::Value(const UniValue& val)
+{
+    Separator();
+    stream << val.write();
+}
+
+void JSONStreamWriter::RawValue(const string& strJSON)
+{
+    Separator();
+    stream << strJSON;
+}
+
+void JSONStreamWriter::Members(const UniValue& obj)
+{
+    const vector<string>& keys = obj.getKeys();
+    const vector<UniValue>& values = obj.getValues();
+    for (size_t i = 0; i < keys.size(); i++)
+        KeyValue(keys[i], values[i]);
 }
 
 /**
@@ -10,6 +10,7 @@
 #include <map>
 #include <stdint.h>
 #include <string>
+#include <vector>
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/asio.hpp>
@@ -152,15 +153,94 @@ std::string HTTPError(int nStatus, bool keepalive,
                       bool headerOnly = false);
 std::string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength,
                       const char *contentType = "application/json");
+/**
+ * Header for a reply whose length is not known up front. HTTP/1.1 clients get
+ * chunked transfer encoding; for HTTP/1.0 the body simply runs until the
+ * connection is closed, so keep-alive is not possible.
+ */
+std::string HTTPReplyStreamHeader(int nStatus, bool keepalive, bool chunked,
+                      const char *contentType = "application/json");
 std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive,
                       bool headerOnly = false,
                       const char *contentType = "application/json");
-bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int &proto,
-                         std::string& http_method, std::string& http_uri);
 int ReadHTTPStatus(std::basic_istream<char>& stream, int &proto);
 int ReadHTTPHeaders(std::basic_istream<char>& stream, std::map<std::string, std::string>& mapHeadersRet);
 int ReadHTTPMessage(std::basic_istream<char>& stream, std::map<std::string, std::string>& mapHeadersRet,
                     std::string& strMessageRet, int nProto, size_t max_size);
+
+//! Maximum size of an HTTP request line plus headers
+static const size_t MAX_HTTP_HEADERS_SIZE = 8192;
+
+/**
+ * Incremental HTTP request parser. Bytes are fed in as they arrive from the
+ * socket, so a request can be assembled without a thread blocking on the
+ * connection. Once IsComplete() the request fields are valid; call Reset()
+ * before parsing the next request on the same connection.
+ */
+class HTTPRequestParser
+{
+public:
+    int nProto;
+    std::string strMethod;
+    std::string strURI;
+    std::map<std::string, std::string> mapHeaders;
+    std::string strBody;
+
+    HTTPRequestParser(size_t nMaxBodySizeIn);
+
+    /**
+     * Consume up to nBytes of input. Stops early once a request is complete
+     * (any remainder belongs to the next request) or the input is malformed.
+     * @return number of bytes consumed
+     */
+    size_t Feed(const char* pch, size_t nBytes);
+    bool IsComplete() const { return state == COMPLETE; }
+    bool IsFailed() const { return state == FAILED; }
+    void Reset();
+
+private:
+    enum State { REQUEST_LINE, HEADERS, BODY, COMPLETE, FAILED };
+    State state;
+    std::string strLine;
+    size_t nHeaderBytes;
+    size_t nContentLength;
+    size_t nMaxBodySize;
+
+    bool ProcessLine();
+};
+
+/**
+ * Writes JSON incrementally to an output stream, so that large replies can be
+ * sent while they are being produced instead of first building a complete
+ * UniValue tree and string. Separators between elements are inserted
+ * automatically; Value() accepts any UniValue for the small parts.
+ */
+class JSONStreamWriter
+{
+public:
+    JSONStreamWriter(std::ostream& streamIn) : stream(streamIn), fAfterKey(false) {}
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    void Key(const std::string& key);
+    void Value(const UniValue& val);
+    /** Write a value that is already serialized JSON */
+    void RawValue(const std::string& strJSON);
+    void KeyValue(const std::string& key, const UniValue& val) { Key(key); Value(val); }
+    /** Write all members of the UniValue object obj into the current object */
+    void Members(const UniValue& obj);
+
+private:
+    std::ostream& stream;
+    //! For each open object or array, whether nothing has been written to it yet
+    std::vector<bool> vFirst;
+    bool fAfterKey;
+
+    void Separator();
+};
+
 std::string JSONRPCRequest(const std::string& strMethod, const UniValue& params, const UniValue& id);
 UniValue JSONRPCReplyObj(const UniValue& result, const UniValue& error, const UniValue& id);
 std::string JSONRPCReply(const UniValue& result, const UniValue& error, const UniValue& id);
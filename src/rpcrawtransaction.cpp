@@ -15,6 +15,7 @@
 #include "net.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
+#include "rpccache.h"
 #include "rpcserver.h"
 #include "script/script.h"
 #include "script/script_error.h"
@@ -59,6 +60,8 @@ void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fInclud
     out.push_back(Pair("addresses", a));
 }
 
+static void TxBlockInfoToJSON(const uint256& hashBlock, UniValue& entry);
+
 void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
 {
     entry.push_back(Pair("txid", tx.GetHash().GetHex()));
@@ -94,6 +97,12 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
     }
     entry.push_back(Pair("vout", vout));
 
+    TxBlockInfoToJSON(hashBlock, entry);
+}
+
+/** Add where the transaction was found to TxToJSON's output; cs_main must be held */
+static void TxBlockInfoToJSON(const uint256& hashBlock, UniValue& entry)
+{
     if (!hashBlock.IsNull()) {
         entry.push_back(Pair("blockhash", hashBlock.GetHex()));
         BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
@@ -117,7 +126,8 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
             "getrawtransaction \"txid\" ( verbose )\n"
             "\nNOTE: By default this function only works sometimes. This is when the tx is in the mempool\n"
             "or there is an unspent output in the utxo for this transaction. To make it always work,\n"
-            "you need to maintain a transaction index, using the -txindex command line option.\n"
+            "you need to maintain a transaction index, using the -txindex command line option. The index is built\n"
+            "in the background, see getindexinfo for its progress.\n"
             "\nReturn the raw transaction data.\n"
             "\nIf verbose=0, returns a string that is serialized, hex-encoded data for 'txid'.\n"
             "If verbose is non-zero, returns an Object with information about 'txid'.\n"
@@ -184,19 +194,34 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
     if (params.size() > 1)
         fVerbose = (params[1].get_int() != 0);
 
-    CTransaction tx;
+    // Entries are dropped under cs_main when the transaction's block changes
+    CRPCResultCache::Kind kind = fVerbose ? CRPCResultCache::TX_JSON : CRPCResultCache::TX_HEX;
+    UniValue result;
     uint256 hashBlock;
+    if (pRPCResultCache && pRPCResultCache->Get(hash, kind, result, &hashBlock)) {
+        if (fVerbose)
+            TxBlockInfoToJSON(hashBlock, result);
+        return result;
+    }
+
+    CTransaction tx;
     if (!GetTransaction(hash, tx, hashBlock, true))
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available about transaction");
 
     string strHex = EncodeHexTx(tx);
 
-    if (!fVerbose)
+    if (!fVerbose) {
+        if (pRPCResultCache)
+            pRPCResultCache->Put(hash, kind, strHex);
         return strHex;
+    }
 
-    UniValue result(UniValue::VOBJ);
+    result.setObject();
     result.push_back(Pair("hex", strHex));
-    TxToJSON(tx, hashBlock, result);
+    TxToJSON(tx, uint256(), result);
+    if (pRPCResultCache)
+        pRPCResultCache->Put(hash, kind, result, hashBlock);
+    TxBlockInfoToJSON(hashBlock, result);
     return result;
 }
 
@@ -8,6 +8,7 @@
 #include "base58.h"
 #include "init.h"
 #include "random.h"
+#include "rpcmetrics.h"
 #include "sync.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -20,6 +21,7 @@
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
 #include <boost/iostreams/concepts.hpp>
@@ -55,7 +57,7 @@ static struct CRPCSignals
     boost::signals2::signal<void ()> Started;
     boost::signals2::signal<void ()> Stopped;
     boost::signals2::signal<void (const CRPCCommand&)> PreCommand;
-    boost::signals2::signal<void (const CRPCCommand&)> PostCommand;
+    boost::signals2::signal<void (const CRPCCommand&, bool)> PostCommand;
 } g_rpcSignals;
 
 void RPCServer::OnStarted(boost::function<void ()> slot)
@@ -73,9 +75,9 @@ void RPCServer::OnPreCommand(boost::function<void (const CRPCCommand&)> slot)
     g_rpcSignals.PreCommand.connect(boost::bind(slot, _1));
 }
 
-void RPCServer::OnPostCommand(boost::function<void (const CRPCCommand&)> slot)
+void RPCServer::OnPostCommand(boost::function<void (const CRPCCommand&, bool)> slot)
 {
-    g_rpcSignals.PostCommand.connect(boost::bind(slot, _1));
+    g_rpcSignals.PostCommand.connect(boost::bind(slot, _1, _2));
 }
 
 void RPCTypeCheck(const UniValue& params,
@@ -267,125 +269,147 @@ UniValue stop(const UniValue& params, bool fHelp)
  * Call Table
  */
 static const CRPCCommand vRPCCommands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
+{ //  category              name                      actor (function)         okSafeMode okParallel
+  //  --------------------- ------------------------  -----------------------  ---------- ----------
     /* Overall control/query calls */
-    { "control",            "getinfo",                &getinfo,                true  }, /* uses wallet if enabled */
-    { "control",            "help",                   &help,                   true  },
-    { "control",            "stop",                   &stop,                   true  },
+    { "control",            "getinfo",                &getinfo,                true,      false }, /* uses wallet if enabled */
+    { "control",            "getrpcstats",            &getrpcstats,            true,      true  },
+    { "control",            "help",                   &help,                   true,      true  },
+    { "control",            "stop",                   &stop,                   true,      false },
 
     /* P2P networking */
-    { "network",            "getnetworkinfo",         &getnetworkinfo,         true  },
-    { "network",            "addnode",                &addnode,                true  },
-    { "network",            "disconnectnode",         &disconnectnode,         true  },
-    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true  },
-    { "network",            "getconnectioncount",     &getconnectioncount,     true  },
-    { "network",            "getnettotals",           &getnettotals,           true  },
-    { "network",            "getpeerinfo",            &getpeerinfo,            true  },
-    { "network",            "ping",                   &ping,                   true  },
-    { "network",            "setban",                 &setban,                 true  },
-    { "network",            "listbanned",             &listbanned,             true  },
-    { "network",            "clearbanned",            &clearbanned,            true  },
+    { "network",            "getnetworkinfo",         &getnetworkinfo,         true,      true  },
+    { "network",            "addnode",                &addnode,                true,      false },
+    { "network",            "disconnectnode",         &disconnectnode,         true,      false },
+    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,      true  },
+    { "network",            "getconnectioncount",     &getconnectioncount,     true,      true  },
+    { "network",            "getnettotals",           &getnettotals,           true,      true  },
+    { "network",            "getpeerinfo",            &getpeerinfo,            true,      true  },
+    { "network",            "ping",                   &ping,                   true,      false },
+    { "network",            "setban",                 &setban,                 true,      false },
+    { "network",            "listbanned",             &listbanned,             true,      true  },
+    { "network",            "clearbanned",            &clearbanned,            true,      false },
 
     /* Block chain and UTXO */
-    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true  },
-    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true  },
-    { "blockchain",         "getblockcount",          &getblockcount,          true  },
-    { "blockchain",         "getblock",               &getblock,               true  },
-    { "blockchain",         "getblockhash",           &getblockhash,           true  },
-    { "blockchain",         "getblockheader",         &getblockheader,         true  },
-    { "blockchain",         "getchaintips",           &getchaintips,           true  },
-    { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
-    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
-    { "blockchain",         "gettxout",               &gettxout,               true  },
-    { "blockchain",         "gettxoutproof",          &gettxoutproof,          true  },
-    { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true  },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
-    { "blockchain",         "verifychain",            &verifychain,            true  },
+    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,      true  },
+    { "blockchain",         "getaddressbalance",      &getaddressbalance,      true,      true  },
+    { "blockchain",         "getaddressdeltas",       &getaddressdeltas,       true,      true  },
+    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,      true  },
+    { "blockchain",         "getblockcount",          &getblockcount,          true,      true  },
+    { "blockchain",         "getblock",               &getblock,               true,      true  },
+    { "blockchain",         "getblockfilter",         &getblockfilter,         true,      true  },
+    { "blockchain",         "getblockhash",           &getblockhash,           true,      true  },
+    { "blockchain",         "getblockheader",         &getblockheader,         true,      true  },
+    { "blockchain",         "getchaintips",           &getchaintips,           true,      true  },
+    { "blockchain",         "getdbstats",             &getdbstats,             true,      true  },
+    { "blockchain",         "getdifficulty",          &getdifficulty,          true,      true  },
+    { "blockchain",         "getindexinfo",           &getindexinfo,           true,      true  },
+    { "blockchain",         "getmempoolchanges",      &getmempoolchanges,      true,      true  },
+    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,      true  },
+    { "blockchain",         "getrawmempool",          &getrawmempool,          true,      true  },
+    { "blockchain",         "getspentinfo",           &getspentinfo,           true,      true  },
+    { "blockchain",         "gettxout",               &gettxout,               true,      true  },
+    { "blockchain",         "gettxoutproof",          &gettxoutproof,          true,      true  },
+    { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true,      true  },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      true  },
+    { "blockchain",         "verifychain",            &verifychain,            true,      false },
+    { "blockchain",         "waitfornotifications",   &waitfornotifications,   true,      false },
 
     /* Mining */
-    { "mining",             "getblocktemplate",       &getblocktemplate,       true  },
-    { "mining",             "getmininginfo",          &getmininginfo,          true  },
-    { "mining",             "getnetworkhashps",       &getnetworkhashps,       true  },
-    { "mining",             "prioritisetransaction",  &prioritisetransaction,  true  },
-    { "mining",             "submitblock",            &submitblock,            true  },
+    { "mining",             "getblocktemplate",       &getblocktemplate,       true,      false },
+    { "mining",             "getmininginfo",          &getmininginfo,          true,      true  },
+    { "mining",             "getnetworkhashps",       &getnetworkhashps,       true,      true  },
+    { "mining",             "prioritisetransaction",  &prioritisetransaction,  true,      false },
+    { "mining",             "submitblock",            &submitblock,            true,      false },
 
     /* Coin generation */
-    { "generating",         "getgenerate",            &getgenerate,            true  },
-    { "generating",         "setgenerate",            &setgenerate,            true  },
-    { "generating",         "generate",               &generate,               true  },
+    { "generating",         "getgenerate",            &getgenerate,            true,      false },
+    { "generating",         "setgenerate",            &setgenerate,            true,      false },
+    { "generating",         "generate",               &generate,               true,      false },
 
     /* Raw transactions */
-    { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true  },
-    { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true  },
-    { "rawtransactions",    "decodescript",           &decodescript,           true  },
-    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true  },
-    { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false },
-    { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false }, /* uses wallet if enabled */
+    { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true,      true  },
+    { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true,      true  },
+    { "rawtransactions",    "decodescript",           &decodescript,           true,      true  },
+    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true,      true  },
+    { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false,     false },
+    { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false,     false }, /* uses wallet if enabled */
 #ifdef ENABLE_WALLET
-    { "rawtransactions",    "fundrawtransaction",     &fundrawtransaction,     false },
+    { "rawtransactions",    "fundrawtransaction",     &fundrawtransaction,     false,     false },
 #endif
 
     /* Utility functions */
-    { "util",               "createmultisig",         &createmultisig,         true  },
-    { "util",               "validateaddress",        &validateaddress,        true  }, /* uses wallet if enabled */
-    { "util",               "verifymessage",          &verifymessage,          true  },
-    { "util",               "estimatefee",            &estimatefee,            true  },
-    { "util",               "estimatepriority",       &estimatepriority,       true  },
+    { "util",               "createmultisig",         &createmultisig,         true,      true  },
+    { "util",               "validateaddress",        &validateaddress,        true,      true  }, /* uses wallet if enabled */
+    { "util",               "verifymessage",          &verifymessage,          true,      true  },
+    { "util",               "estimatefee",            &estimatefee,            true,      true  },
+    { "util",               "estimatepriority",       &estimatepriority,       true,      true  },
 
     /* Not shown in help */
-    { "hidden",             "invalidateblock",        &invalidateblock,        true  },
-    { "hidden",             "reconsiderblock",        &reconsiderblock,        true  },
-    { "hidden",             "setmocktime",            &setmocktime,            true  },
+    { "hidden",             "invalidateblock",        &invalidateblock,        true,      false },
+    { "hidden",             "reconsiderblock",        &reconsiderblock,        true,      false },
+    { "hidden",             "setmocktime",            &setmocktime,            true,      false },
 #ifdef ENABLE_WALLET
-    { "hidden",             "resendwallettransactions", &resendwallettransactions, true},
+    { "hidden",             "resendwallettransactions", &resendwallettransactions, true,      false },
 #endif
 
 #ifdef ENABLE_WALLET
     /* Wallet */
-    { "wallet",             "addmultisigaddress",     &addmultisigaddress,     true  },
-    { "wallet",             "backupwallet",           &backupwallet,           true  },
-    { "wallet",             "dumpprivkey",            &dumpprivkey,            true  },
-    { "wallet",             "dumpwallet",             &dumpwallet,             true  },
-    { "wallet",             "encryptwallet",          &encryptwallet,          true  },
-    { "wallet",             "getaccountaddress",      &getaccountaddress,      true  },
-    { "wallet",             "getaccount",             &getaccount,             true  },
-    { "wallet",             "getaddressesbyaccount",  &getaddressesbyaccount,  true  },
-    { "wallet",             "getbalance",             &getbalance,             false },
-    { "wallet",             "getnewaddress",          &getnewaddress,          true  },
-    { "wallet",             "getrawchangeaddress",    &getrawchangeaddress,    true  },
-    { "wallet",             "getreceivedbyaccount",   &getreceivedbyaccount,   false },
-    { "wallet",             "getreceivedbyaddress",   &getreceivedbyaddress,   false },
-    { "wallet",             "gettransaction",         &gettransaction,         false },
-    { "wallet",             "getunconfirmedbalance",  &getunconfirmedbalance,  false },
-    { "wallet",             "getwalletinfo",          &getwalletinfo,          false },
-    { "wallet",             "importprivkey",          &importprivkey,          true  },
-    { "wallet",             "importwallet",           &importwallet,           true  },
-    { "wallet",             "importaddress",          &importaddress,          true  },
-    { "wallet",             "keypoolrefill",          &keypoolrefill,          true  },
-    { "wallet",             "listaccounts",           &listaccounts,           false },
-    { "wallet",             "listaddressgroupings",   &listaddressgroupings,   false },
-    { "wallet",             "listlockunspent",        &listlockunspent,        false },
-    { "wallet",             "listreceivedbyaccount",  &listreceivedbyaccount,  false },
-    { "wallet",             "listreceivedbyaddress",  &listreceivedbyaddress,  false },
-    { "wallet",             "listsinceblock",         &listsinceblock,         false },
-    { "wallet",             "listtransactions",       &listtransactions,       false },
-    { "wallet",             "listunspent",            &listunspent,            false },
-    { "wallet",             "lockunspent",            &lockunspent,            true  },
-    { "wallet",             "move",                   &movecmd,                false },
-    { "wallet",             "sendfrom",               &sendfrom,               false },
-    { "wallet",             "sendmany",               &sendmany,               false },
-    { "wallet",             "sendtoaddress",          &sendtoaddress,          false },
-    { "wallet",             "setaccount",             &setaccount,             true  },
-    { "wallet",             "settxfee",               &settxfee,               true  },
-    { "wallet",             "signmessage",            &signmessage,            true  },
-    { "wallet",             "walletlock",             &walletlock,             true  },
-    { "wallet",             "walletpassphrasechange", &walletpassphrasechange, true  },
-    { "wallet",             "walletpassphrase",       &walletpassphrase,       true  },
+    { "wallet",             "addmultisigaddress",     &addmultisigaddress,     true,      false },
+    { "wallet",             "backupwallet",           &backupwallet,           true,      false },
+    { "wallet",             "dumpprivkey",            &dumpprivkey,            true,      false },
+    { "wallet",             "dumpwallet",             &dumpwallet,             true,      false },
+    { "wallet",             "encryptwallet",          &encryptwallet,          true,      false },
+    { "wallet",             "getaccountaddress",      &getaccountaddress,      true,      false },
+    { "wallet",             "getaccount",             &getaccount,             true,      false },
+    { "wallet",             "getaddressesbyaccount",  &getaddressesbyaccount,  true,      false },
+    { "wallet",             "getbalance",             &getbalance,             false,     false },
+    { "wallet",             "getnewaddress",          &getnewaddress,          true,      false },
+    { "wallet",             "getrawchangeaddress",    &getrawchangeaddress,    true,      false },
+    { "wallet",             "getreceivedbyaccount",   &getreceivedbyaccount,   false,     false },
+    { "wallet",             "getreceivedbyaddress",   &getreceivedbyaddress,   false,     false },
+    { "wallet",             "gettransaction",         &gettransaction,         false,     false },
+    { "wallet",             "getunconfirmedbalance",  &getunconfirmedbalance,  false,     false },
+    { "wallet",             "getwalletinfo",          &getwalletinfo,          false,     false },
+    { "wallet",             "importprivkey",          &importprivkey,          true,      false },
+    { "wallet",             "importwallet",           &importwallet,           true,      false },
+    { "wallet",             "importaddress",          &importaddress,          true,      false },
+    { "wallet",             "keypoolrefill",          &keypoolrefill,          true,      false },
+    { "wallet",             "listaccounts",           &listaccounts,           false,     false },
+    { "wallet",             "listaddressgroupings",   &listaddressgroupings,   false,     false },
+    { "wallet",             "listlockunspent",        &listlockunspent,        false,     false },
+    { "wallet",             "listreceivedbyaccount",  &listreceivedbyaccount,  false,     false },
+    { "wallet",             "listreceivedbyaddress",  &listreceivedbyaddress,  false,     false },
+    { "wallet",             "listsinceblock",         &listsinceblock,         false,     false },
+    { "wallet",             "listtransactions",       &listtransactions,       false,     false },
+    { "wallet",             "listunspent",            &listunspent,            false,     false },
+    { "wallet",             "lockunspent",            &lockunspent,            true,      false },
+    { "wallet",             "move",                   &movecmd,                false,     false },
+    { "wallet",             "sendfrom",               &sendfrom,               false,     false },
+    { "wallet",             "sendmany",               &sendmany,               false,     false },
+    { "wallet",             "sendtoaddress",          &sendtoaddress,          false,     false },
+    { "wallet",             "setaccount",             &setaccount,             true,      false },
+    { "wallet",             "settxfee",               &settxfee,               true,      false },
+    { "wallet",             "signmessage",            &signmessage,            true,      false },
+    { "wallet",             "walletlock",             &walletlock,             true,      false },
+    { "wallet",             "walletpassphrasechange", &walletpassphrasechange, true,      false },
+    { "wallet",             "walletpassphrase",       &walletpassphrase,       true,      false },
 #endif // ENABLE_WALLET
 };
 
+/**
+ * Calls with potentially very large results, which are streamed to JSON-RPC
+ * clients rather than built in memory first.
+ */
+static const struct {
+    const char* name;
+    rpcstreamfn_type actor;
+} vRPCStreamCommands[] =
+{
+    { "getblock",               &getblock_stream         },
+    { "getrawmempool",          &getrawmempool_stream    },
+};
+
 CRPCTable::CRPCTable()
 {
     unsigned int vcidx;
@@ -396,6 +420,8 @@ CRPCTable::CRPCTable()
         pcmd = &vRPCCommands[vcidx];
         mapCommands[pcmd->name] = pcmd;
     }
+    for (vcidx = 0; vcidx < (sizeof(vRPCStreamCommands) / sizeof(vRPCStreamCommands[0])); vcidx++)
+        mapStreamCommands[vRPCStreamCommands[vcidx].name] = vRPCStreamCommands[vcidx].actor;
 }
 
 const CRPCCommand *CRPCTable::operator[](const std::string& name) const
@@ -459,23 +485,107 @@ bool ClientAllowed(const boost::asio::ip::address& address)
     return false;
 }
 
+/**
+ * Bounded queue of requests waiting for one of the RPC worker threads.
+ * Requests that do not fit are refused rather than queued, so that a
+ * flood of clients results in quick 503 replies instead of unbounded
+ * memory use and ever-growing latency.
+ */
+class RPCWorkQueue
+{
+public:
+    RPCWorkQueue(size_t nMaxDepthIn) : nMaxDepth(nMaxDepthIn), fRunning(true) {}
+
+    /** Enqueue a work item; returns false if the queue is full or shut down */
+    bool Enqueue(const boost::function<void(void)>& item)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!fRunning || queue.size() >= nMaxDepth)
+            return false;
+        queue.push_back(item);
+        cond.notify_one();
+        return true;
+    }
+
+    /** Thread function: run queued items until Interrupt() is called */
+    void Run()
+    {
+        while (true) {
+            boost::function<void(void)> item;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (fRunning && queue.empty())
+                    cond.wait(lock);
+                if (!fRunning)
+                    break;
+                item = queue.front();
+                queue.pop_front();
+            }
+            item();
+        }
+    }
+
+    /** Wake up all workers and make them exit once their current item is done */
+    void Interrupt()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fRunning = false;
+        queue.clear();
+        cond.notify_all();
+    }
+
+private:
+    boost::mutex cs;
+    boost::condition_variable cond;
+    std::deque< boost::function<void(void)> > queue;
+    size_t nMaxDepth;
+    bool fRunning;
+};
+
+//! Size of the buffer in which streaming replies are collected before being sent as one chunk
+static const size_t RPC_STREAM_BUFFER_SIZE = 64 * 1024;
+//! Amount of streaming reply data that may wait to be sent before the producer blocks
+static const size_t MAX_RPC_STREAM_PENDING = 1024 * 1024;
+
+static RPCWorkQueue* rpc_work_queue = NULL;
+//! Helpers for executing batch elements in parallel; separate from rpc_work_queue so batches never delay admission of new requests
+static RPCWorkQueue* rpc_batch_queue = NULL;
+static int nRPCBatchThreads = 0;
+
+static bool ServiceRequest(AcceptedConnection *conn, HTTPRequestParser& request);
+
+/**
+ * An HTTP connection driven entirely by asynchronous I/O on the RPC network
+ * thread. Requests are parsed incrementally as data arrives; once complete,
+ * a request is handed to the work queue and the reply written by the worker
+ * is sent back asynchronously. An idle keep-alive connection therefore costs
+ * a socket and a buffer, but no thread.
+ */
 template <typename Protocol>
-class AcceptedConnectionImpl : public AcceptedConnection
+class HTTPConnection : public AcceptedConnection, public boost::enable_shared_from_this< HTTPConnection<Protocol> >
 {
 public:
-    AcceptedConnectionImpl(
-            boost::asio::io_service& io_service,
+    HTTPConnection(
+            boost::asio::io_service& io_serviceIn,
             ssl::context &context,
-            bool fUseSSL) :
-        sslStream(io_service, context),
-        _d(sslStream, fUseSSL),
-        _stream(_d)
+            bool fUseSSLIn) :
+        sslStream(io_serviceIn, context),
+        io_service(io_serviceIn),
+        fUseSSL(fUseSSLIn),
+        timer(io_serviceIn),
+        request(MAX_SIZE),
+        fStreamedReply(false),
+        fStreamWriting(false),
+        nStreamPending(0),
+        streamBuf(this),
+        streamOut(&streamBuf)
     {
     }
 
+    /** Reply buffer: written by the request handler, sent when it returns */
     virtual std::iostream& stream()
     {
-        return _stream;
+        return reply;
     }
 
     virtual std::string peer_address_to_string() const
@@ -485,25 +595,351 @@ public:
 
     virtual void close()
     {
-        _stream.close();
+        boost::system::error_code ec;
+        timer.cancel(ec);
+        sslStream.lowest_layer().close(ec);
+    }
+
+    /** Start servicing the connection; must be called on the network thread */
+    void Start()
+    {
+        if (fUseSSL) {
+            ArmTimer();
+            sslStream.async_handshake(ssl::stream_base::server,
+                    boost::bind(&HTTPConnection::HandleHandshake, this->shared_from_this(), _1));
+        } else {
+            ProcessInput();
+        }
+    }
+
+    virtual std::ostream& BeginStreamingReply(int nStatus, bool fKeepAlive, const char *contentType)
+    {
+        boost::unique_lock<boost::mutex> lock(csStream);
+        fStreamedReply = true;
+        fStreamChunked = request.nProto >= 1;
+        fStreamKeepAlive = fKeepAlive && fStreamChunked;
+        fStreamHeaderSent = false;
+        fStreamDone = false;
+        fStreamFailed = false;
+        nStreamPending = 0;
+        strStreamHeader = HTTPReplyStreamHeader(nStatus, fKeepAlive, fStreamChunked, contentType);
+        streamBuf.Reset();
+        streamOut.clear();
+        return streamOut;
+    }
+
+    virtual void EndStreamingReply()
+    {
+        streamOut.flush();
+        boost::unique_lock<boost::mutex> lock(csStream);
+        if (!fStreamHeaderSent)
+            QueueStreamData(strStreamHeader);
+        if (fStreamChunked)
+            QueueStreamData("0\r\n\r\n");
+        fStreamDone = true;
+        KickStream();
+    }
+
+    virtual bool AbortStreamingReply()
+    {
+        boost::unique_lock<boost::mutex> lock(csStream);
+        streamBuf.Reset();
+        streamOut.clear();
+        if (!fStreamHeaderSent) {
+            fStreamedReply = false;
+            return true;
+        }
+        // Leave out the terminating chunk so the client can tell the reply is incomplete
+        fStreamKeepAlive = false;
+        fStreamDone = true;
+        KickStream();
+        return false;
+    }
+
+    /** Send a reply without involving a worker thread, then close */
+    void SendImmediate(const std::string& strReply)
+    {
+        reply.str(strReply);
+        WriteReply(false);
     }
 
     typename Protocol::endpoint peer;
     boost::asio::ssl::stream<typename Protocol::socket> sslStream;
 
 private:
-    SSLIOStreamDevice<Protocol> _d;
-    boost::iostreams::stream< SSLIOStreamDevice<Protocol> > _stream;
-};
+    boost::asio::io_service& io_service;
+    bool fUseSSL;
+    deadline_timer timer;
+    HTTPRequestParser request;
+    char vchRead[4096];
+    //! Received bytes that were not consumed by the previous request (pipelining)
+    std::string strPending;
+    std::stringstream reply;
+    std::string strReplyOut;
+
+    /** Output buffer for streaming replies; hands full buffers to the connection */
+    class StreamBuf : public std::streambuf
+    {
+    public:
+        StreamBuf(HTTPConnection* connIn) : conn(connIn), vchBuf(RPC_STREAM_BUFFER_SIZE) { Reset(); }
+        void Reset() { setp(&vchBuf[0], &vchBuf[0] + vchBuf.size()); }
+
+    protected:
+        virtual int_type overflow(int_type ch)
+        {
+            if (sync() != 0)
+                return traits_type::eof();
+            if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+                *pptr() = traits_type::to_char_type(ch);
+                pbump(1);
+            }
+            return traits_type::not_eof(ch);
+        }
+
+        virtual int sync()
+        {
+            bool fOk = true;
+            if (pptr() > pbase())
+                fOk = conn->WriteStreamChunk(pbase(), pptr() - pbase());
+            Reset();
+            // Failing marks the stream bad, so long-running producers notice the client left
+            return fOk ? 0 : -1;
+        }
+
+    private:
+        HTTPConnection* conn;
+        std::vector<char> vchBuf;
+    };
+
+    //! Whether the current request was answered with a streaming reply (worker thread only)
+    bool fStreamedReply;
+    // Streaming reply state, shared between the worker producing the reply
+    // and the network thread sending it; protected by csStream.
+    boost::mutex csStream;
+    boost::condition_variable condStream;
+    bool fStreamChunked;
+    bool fStreamKeepAlive;
+    bool fStreamHeaderSent;
+    bool fStreamDone;
+    bool fStreamFailed;
+    bool fStreamWriting;
+    std::string strStreamHeader;
+    std::deque<std::string> vStreamQueue;
+    size_t nStreamPending;
+    StreamBuf streamBuf;
+    std::ostream streamOut;
+
+    /** Called by StreamBuf on the worker thread with a full buffer of reply data; false if sending failed */
+    bool WriteStreamChunk(const char* pch, size_t nBytes)
+    {
+        boost::unique_lock<boost::mutex> lock(csStream);
+        if (!fStreamHeaderSent) {
+            QueueStreamData(strStreamHeader);
+            fStreamHeaderSent = true;
+        }
+        if (fStreamChunked)
+            QueueStreamData(strprintf("%x\r\n", nBytes) + std::string(pch, nBytes) + "\r\n");
+        else
+            QueueStreamData(std::string(pch, nBytes));
+        KickStream();
+        // Backpressure: don't let a slow client make us buffer the whole reply.
+        // A client that stops reading altogether is dropped by the network
+        // thread after -rpcservertimeout, which fails the stream; the network
+        // thread is gone once the server stops, so give up then too.
+        while (nStreamPending > MAX_RPC_STREAM_PENDING && !fStreamFailed && fRPCRunning)
+            condStream.timed_wait(lock, boost::posix_time::seconds(1));
+        if (!fRPCRunning)
+            fStreamFailed = true;
+        return !fStreamFailed;
+    }
+
+    void QueueStreamData(const std::string& strData)
+    {
+        if (fStreamFailed)
+            return;
+        vStreamQueue.push_back(strData);
+        nStreamPending += strData.size();
+    }
+
+    /** Make sure the network thread is sending queued data; csStream must be held */
+    void KickStream()
+    {
+        if (!fStreamWriting) {
+            fStreamWriting = true;
+            io_service.post(boost::bind(&HTTPConnection::WriteStreamNext, this->shared_from_this()));
+        }
+    }
+
+    void WriteStreamNext()
+    {
+        bool fKeepAlive;
+        {
+            boost::unique_lock<boost::mutex> lock(csStream);
+            if (!vStreamQueue.empty() && !fStreamFailed) {
+                strReplyOut.swap(vStreamQueue.front());
+                vStreamQueue.pop_front();
+                // A client that stops reading gets -rpcservertimeout to make progress
+                ArmTimer();
+                if (fUseSSL)
+                    boost::asio::async_write(sslStream, boost::asio::buffer(strReplyOut),
+                            boost::bind(&HTTPConnection::HandleStreamWrite, this->shared_from_this(), _1));
+                else
+                    boost::asio::async_write(sslStream.next_layer(), boost::asio::buffer(strReplyOut),
+                            boost::bind(&HTTPConnection::HandleStreamWrite, this->shared_from_this(), _1));
+                return;
+            }
+            // Nothing in flight: a stream that is merely idle (waiting for notifications) may stay open
+            boost::system::error_code ec;
+            timer.cancel(ec);
+            fStreamWriting = false;
+            if (!fStreamDone)
+                return;
+            fKeepAlive = fStreamKeepAlive && !fStreamFailed && !ShutdownRequested();
+        }
+        HandleWrite(boost::system::error_code(), fKeepAlive);
+    }
+
+    void HandleStreamWrite(const boost::system::error_code& error)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(csStream);
+            nStreamPending -= strReplyOut.size();
+            strReplyOut.clear();
+            if (error) {
+                fStreamFailed = true;
+                vStreamQueue.clear();
+                nStreamPending = 0;
+            }
+            condStream.notify_all();
+        }
+        WriteStreamNext();
+    }
 
-void ServiceConnection(AcceptedConnection *conn);
+    void ArmTimer()
+    {
+        timer.expires_from_now(boost::posix_time::seconds(GetArg("-rpcservertimeout", DEFAULT_RPC_SERVER_TIMEOUT)));
+        timer.async_wait(boost::bind(&HTTPConnection::HandleTimeout, this->shared_from_this(), _1));
+    }
+
+    void HandleTimeout(const boost::system::error_code& error)
+    {
+        // Re-arming or cancelling the timer aborts the previous wait
+        if (error == boost::asio::error::operation_aborted)
+            return;
+        {
+            // Release a worker blocked on a streaming reply the client no longer reads
+            boost::unique_lock<boost::mutex> lock(csStream);
+            fStreamFailed = true;
+            vStreamQueue.clear();
+            condStream.notify_all();
+        }
+        close();
+    }
+
+    void HandleHandshake(const boost::system::error_code& error)
+    {
+        if (error) {
+            close();
+            return;
+        }
+        ProcessInput();
+    }
+
+    void StartRead()
+    {
+        ArmTimer();
+        if (fUseSSL)
+            sslStream.async_read_some(boost::asio::buffer(vchRead, sizeof(vchRead)),
+                    boost::bind(&HTTPConnection::HandleRead, this->shared_from_this(), _1, _2));
+        else
+            sslStream.next_layer().async_read_some(boost::asio::buffer(vchRead, sizeof(vchRead)),
+                    boost::bind(&HTTPConnection::HandleRead, this->shared_from_this(), _1, _2));
+    }
+
+    void HandleRead(const boost::system::error_code& error, size_t nBytes)
+    {
+        if (error) {
+            close();
+            return;
+        }
+        strPending.append(vchRead, nBytes);
+        ProcessInput();
+    }
+
+    /** Feed buffered input to the parser, dispatching a request when one is complete */
+    void ProcessInput()
+    {
+        size_t nUsed = request.Feed(strPending.data(), strPending.size());
+        strPending.erase(0, nUsed);
+
+        if (request.IsFailed()) {
+            SendImmediate(HTTPError(HTTP_BAD_REQUEST, false));
+        } else if (request.IsComplete()) {
+            boost::system::error_code ec;
+            timer.cancel(ec);
+            if (!rpc_work_queue || !rpc_work_queue->Enqueue(boost::bind(&HTTPConnection::RunRequest, this->shared_from_this()))) {
+                LogPrint("rpc", "RPC work queue full, refusing request from %s\n", peer_address_to_string());
+                SendImmediate(HTTPError(HTTP_SERVICE_UNAVAILABLE, false));
+            }
+        } else {
+            StartRead();
+        }
+    }
+
+    /** Runs on a worker thread */
+    void RunRequest()
+    {
+        bool fKeepAlive = false;
+        fStreamedReply = false;
+        try {
+            fKeepAlive = ServiceRequest(this, request) && !ShutdownRequested();
+        } catch (const std::exception& e) {
+            PrintExceptionContinue(&e, "RunRequest()");
+            if (fStreamedReply)
+                AbortStreamingReply();
+            if (!fStreamedReply) {
+                reply.str("");
+                reply << HTTPError(HTTP_INTERNAL_SERVER_ERROR, false);
+            }
+        }
+        // A streaming reply completes on its own, once everything queued is sent
+        if (fStreamedReply)
+            return;
+        io_service.post(boost::bind(&HTTPConnection::WriteReply, this->shared_from_this(), fKeepAlive));
+    }
+
+    void WriteReply(bool fKeepAlive)
+    {
+        strReplyOut = reply.str();
+        reply.str("");
+        reply.clear();
+        ArmTimer();
+        if (fUseSSL)
+            boost::asio::async_write(sslStream, boost::asio::buffer(strReplyOut),
+                    boost::bind(&HTTPConnection::HandleWrite, this->shared_from_this(), _1, fKeepAlive));
+        else
+            boost::asio::async_write(sslStream.next_layer(), boost::asio::buffer(strReplyOut),
+                    boost::bind(&HTTPConnection::HandleWrite, this->shared_from_this(), _1, fKeepAlive));
+    }
+
+    void HandleWrite(const boost::system::error_code& error, bool fKeepAlive)
+    {
+        strReplyOut.clear();
+        if (error || !fKeepAlive) {
+            close();
+            return;
+        }
+        request.Reset();
+        ProcessInput();
+    }
+};
 
 //! Forward declaration required for RPCListen
 template <typename Protocol, typename SocketAcceptorService>
 static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
                              ssl::context& context,
                              bool fUseSSL,
-                             boost::shared_ptr< AcceptedConnection > conn,
+                             boost::shared_ptr< HTTPConnection<Protocol> > conn,
                              const boost::system::error_code& error);
 
 /**
@@ -515,7 +951,7 @@ static void RPCListen(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketA
                    const bool fUseSSL)
 {
     // Accept connection
-    boost::shared_ptr< AcceptedConnectionImpl<Protocol> > conn(new AcceptedConnectionImpl<Protocol>(acceptor->get_io_service(), context, fUseSSL));
+    boost::shared_ptr< HTTPConnection<Protocol> > conn(new HTTPConnection<Protocol>(acceptor->get_io_service(), context, fUseSSL));
 
     acceptor->async_accept(
             conn->sslStream.lowest_layer(),
@@ -536,33 +972,31 @@ template <typename Protocol, typename SocketAcceptorService>
 static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
                              ssl::context& context,
                              const bool fUseSSL,
-                             boost::shared_ptr< AcceptedConnection > conn,
+                             boost::shared_ptr< HTTPConnection<Protocol> > conn,
                              const boost::system::error_code& error)
 {
     // Immediately start accepting new connections, except when we're cancelled or our socket is closed.
     if (error != boost::asio::error::operation_aborted && acceptor->is_open())
         RPCListen(acceptor, context, fUseSSL);
 
-    AcceptedConnectionImpl<ip::tcp>* tcp_conn = dynamic_cast< AcceptedConnectionImpl<ip::tcp>* >(conn.get());
-
     if (error)
     {
         // TODO: Actually handle errors
         LogPrintf("%s: Error: %s\n", __func__, error.message());
     }
     // Restrict callers by IP.  It is important to
-    // do this before starting client thread, to filter out
+    // do this before reading any data, to filter out
     // certain DoS and misbehaving clients.
-    else if (tcp_conn && !ClientAllowed(tcp_conn->peer.address()))
+    else if (!ClientAllowed(conn->peer.address()))
     {
         // Only send a 403 if we're not using SSL to prevent a DoS during the SSL handshake.
         if (!fUseSSL)
-            conn->stream() << HTTPError(HTTP_FORBIDDEN, false) << std::flush;
-        conn->close();
+            conn->SendImmediate(HTTPError(HTTP_FORBIDDEN, false));
+        else
+            conn->close();
     }
     else {
-        ServiceConnection(conn.get());
-        conn->close();
+        conn->Start();
     }
 }
 
@@ -717,9 +1151,24 @@ void StartRPCThreads()
         return;
     }
 
+    int nWorkQueueDepth = std::max((int)GetArg("-rpcworkqueue", DEFAULT_RPC_WORK_QUEUE), 1);
+    int nRPCThreads = std::max((int)GetArg("-rpcthreads", DEFAULT_RPC_THREADS), 1);
+    LogPrintf("RPC: using %d worker threads, work queue depth %d\n", nRPCThreads, nWorkQueueDepth);
+    rpc_work_queue = new RPCWorkQueue(nWorkQueueDepth);
     rpc_worker_group = new boost::thread_group();
-    for (int i = 0; i < GetArg("-rpcthreads", 4); i++)
-        rpc_worker_group->create_thread(boost::bind(&boost::asio::io_service::run, rpc_io_service));
+    // A single network thread drives all connections; workers only run requests
+    rpc_worker_group->create_thread(boost::bind(&boost::asio::io_service::run, rpc_io_service));
+    for (int i = 0; i < nRPCThreads; i++)
+        rpc_worker_group->create_thread(boost::bind(&RPCWorkQueue::Run, rpc_work_queue));
+
+    nRPCBatchThreads = GetArg("-rpcbatchthreads", DEFAULT_RPC_BATCH_THREADS);
+    if (nRPCBatchThreads <= 0)
+        nRPCBatchThreads += GetNumCores();
+    nRPCBatchThreads = std::max(std::min(nRPCBatchThreads, MAX_RPC_BATCH_THREADS), 1);
+    // Every running batch can queue up to one helper per thread
+    rpc_batch_queue = new RPCWorkQueue(nRPCBatchThreads * nRPCThreads);
+    for (int i = 0; i < nRPCBatchThreads; i++)
+        rpc_worker_group->create_thread(boost::bind(&RPCWorkQueue::Run, rpc_batch_queue));
     fRPCRunning = true;
     g_rpcSignals.Started();
 }
@@ -766,11 +1215,17 @@ void StopRPCThreads()
     DeleteAuthCookie();
 
     rpc_io_service->stop();
+    if (rpc_work_queue != NULL)
+        rpc_work_queue->Interrupt();
+    if (rpc_batch_queue != NULL)
+        rpc_batch_queue->Interrupt();
     g_rpcSignals.Stopped();
     if (rpc_worker_group != NULL)
         rpc_worker_group->join_all();
     delete rpc_dummy_work; rpc_dummy_work = NULL;
     delete rpc_worker_group; rpc_worker_group = NULL;
+    delete rpc_work_queue; rpc_work_queue = NULL;
+    delete rpc_batch_queue; rpc_batch_queue = NULL;
     delete rpc_ssl_context; rpc_ssl_context = NULL;
     delete rpc_io_service; rpc_io_service = NULL;
 }
@@ -886,21 +1341,115 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
+/**
+ * A run of consecutive batch elements that may execute concurrently. The
+ * calling thread and any batch helper threads that pick up the run claim
+ * elements one at a time, so the run completes even if no helper is free.
+ */
+class CRPCBatchRun
+{
+public:
+    CRPCBatchRun(const UniValue& vReqIn, std::vector<UniValue>& vResultIn, size_t nBeginIn, size_t nEndIn) :
+        vReq(vReqIn), vResult(vResultIn), nNext(nBeginIn), nEnd(nEndIn), nRemaining(nEndIn - nBeginIn) {}
+
+    /** Execute elements until none are left to claim */
+    void Work()
+    {
+        while (true) {
+            size_t nIdx;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                if (nNext >= nEnd)
+                    return;
+                nIdx = nNext++;
+            }
+            vResult[nIdx] = JSONRPCExecOne(vReq[nIdx]);
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                if (--nRemaining == 0)
+                    cond.notify_all();
+            }
+        }
+    }
+
+    /** Wait until every element has finished executing */
+    void Wait()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (nRemaining > 0)
+            cond.wait(lock);
+    }
+
+private:
+    // vReq and vResult are only accessed for claimed elements, which the
+    // caller waits for, so late helpers never touch them after Wait() returns.
+    const UniValue& vReq;
+    std::vector<UniValue>& vResult;
+    boost::mutex cs;
+    boost::condition_variable cond;
+    size_t nNext;
+    size_t nEnd;
+    size_t nRemaining;
+};
+
+static void RPCBatchRunWork(boost::shared_ptr<CRPCBatchRun> run)
+{
+    run->Work();
+}
+
+/** Whether a batch element may be executed concurrently with its okParallel neighbours */
+static bool JSONRPCIsParallel(const UniValue& req)
+{
+    if (!req.isObject())
+        return true; // Only produces an error reply
+    const UniValue& valMethod = find_value(req, "method");
+    if (!valMethod.isStr())
+        return true;
+    const CRPCCommand *pcmd = tableRPC[valMethod.get_str()];
+    return !pcmd || pcmd->okParallel;
+}
+
 static string JSONRPCExecBatch(const UniValue& vReq)
 {
+    std::vector<UniValue> vResult(vReq.size());
+
+    // Runs of okParallel calls are spread over the batch helper threads.
+    // Anything else acts as a barrier and runs alone, in order, so that e.g.
+    // a sendrawtransaction is visible to the calls that follow it.
+    size_t nIdx = 0;
+    while (nIdx < vReq.size()) {
+        size_t nEnd = nIdx;
+        while (nEnd < vReq.size() && JSONRPCIsParallel(vReq[nEnd]))
+            nEnd++;
+
+        if (nEnd - nIdx <= 1 || rpc_batch_queue == NULL) {
+            if (nEnd == nIdx)
+                nEnd++;
+            for (; nIdx < nEnd; nIdx++)
+                vResult[nIdx] = JSONRPCExecOne(vReq[nIdx]);
+            continue;
+        }
+
+        boost::shared_ptr<CRPCBatchRun> run(new CRPCBatchRun(vReq, vResult, nIdx, nEnd));
+        size_t nHelpers = std::min(nEnd - nIdx - 1, (size_t)nRPCBatchThreads);
+        for (size_t i = 0; i < nHelpers; i++)
+            if (!rpc_batch_queue->Enqueue(boost::bind(&RPCBatchRunWork, run)))
+                break;
+        run->Work();
+        run->Wait();
+        nIdx = nEnd;
+    }
+
     UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    for (size_t i = 0; i < vResult.size(); i++)
+        ret.push_back(vResult[i]);
 
     return ret.write() + "\n";
 }
 
-static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
-                            string& strRequest,
-                            map<string, string>& mapHeaders,
-                            bool fRun)
+/** Check the request's credentials, replying with an error if they are missing or wrong */
+static bool CheckAuthorization(AcceptedConnection *conn, map<string, string>& mapHeaders)
 {
-    // Check authorization
     if (mapHeaders.count("authorization") == 0)
     {
         conn->stream() << HTTPError(HTTP_UNAUTHORIZED, false) << std::flush;
@@ -918,6 +1467,17 @@ static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
         conn->stream() << HTTPError(HTTP_UNAUTHORIZED, false) << std::flush;
         return false;
     }
+    return true;
+}
+
+static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
+                            string& strRequest,
+                            map<string, string>& mapHeaders,
+                            bool fRun)
+{
+    // Check authorization
+    if (!CheckAuthorization(conn, mapHeaders))
+        return false;
 
     JSONRequest jreq;
     try
@@ -933,6 +1493,27 @@ static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
+            if (tableRPC.canStream(jreq.strMethod)) {
+                std::ostream& os = conn->BeginStreamingReply(HTTP_OK, fRun, "application/json");
+                try {
+                    JSONStreamWriter writer(os);
+                    writer.BeginObject();
+                    writer.Key("result");
+                    tableRPC.executeStreaming(jreq.strMethod, jreq.params, writer);
+                    writer.KeyValue("error", NullUniValue);
+                    writer.KeyValue("id", jreq.id);
+                    writer.EndObject();
+                    os << "\n";
+                } catch (...) {
+                    // Errors can only be reported if no part of the reply was sent yet
+                    if (!conn->AbortStreamingReply())
+                        return false;
+                    throw;
+                }
+                conn->EndStreamingReply();
+                return true;
+            }
+
             UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
 
             // Send reply
@@ -959,41 +1540,38 @@ static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
     return true;
 }
 
-void ServiceConnection(AcceptedConnection *conn)
+/**
+ * Handle a single parsed HTTP request, writing the reply to conn->stream().
+ * Returns whether the connection may be kept alive for further requests.
+ */
+static bool ServiceRequest(AcceptedConnection *conn, HTTPRequestParser& request)
 {
+    // HTTP Keep-Alive is false; close connection immediately
     bool fRun = true;
-    while (fRun && !ShutdownRequested())
-    {
-        int nProto = 0;
-        map<string, string> mapHeaders;
-        string strRequest, strMethod, strURI;
-
-        // Read HTTP request line
-        if (!ReadHTTPRequestLine(conn->stream(), nProto, strMethod, strURI))
-            break;
+    if ((request.mapHeaders["connection"] == "close") || (!GetBoolArg("-rpckeepalive", true)))
+        fRun = false;
 
-        // Read HTTP message headers and body
-        ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto, MAX_SIZE);
+    // Process via JSON-RPC API
+    if (request.strURI == "/") {
+        if (!HTTPReq_JSONRPC(conn, request.strBody, request.mapHeaders, fRun))
+            return false;
 
-        // HTTP Keep-Alive is false; close connection immediately
-        if ((mapHeaders["connection"] == "close") || (!GetBoolArg("-rpckeepalive", true)))
-            fRun = false;
+    // RPC statistics for monitoring systems
+    } else if (request.strURI == "/metrics") {
+        if (!CheckAuthorization(conn, request.mapHeaders))
+            return false;
+        conn->stream() << HTTPReply(HTTP_OK, rpcMetrics.ToText(), fRun, false, "text/plain; version=0.0.4") << std::flush;
 
-        // Process via JSON-RPC API
-        if (strURI == "/") {
-            if (!HTTPReq_JSONRPC(conn, strRequest, mapHeaders, fRun))
-                break;
-
-        // Process via HTTP REST API
-        } else if (strURI.substr(0, 6) == "/rest/" && GetBoolArg("-rest", false)) {
-            if (!HTTPReq_REST(conn, strURI, strRequest, mapHeaders, fRun))
-                break;
+    // Process via HTTP REST API
+    } else if (request.strURI.substr(0, 6) == "/rest/" && GetBoolArg("-rest", false)) {
+        if (!HTTPReq_REST(conn, request.strURI, request.strBody, request.mapHeaders, fRun))
+            return false;
 
-        } else {
-            conn->stream() << HTTPError(HTTP_NOT_FOUND, false) << std::flush;
-            break;
-        }
+    } else {
+        conn->stream() << HTTPError(HTTP_NOT_FOUND, false) << std::flush;
+        return false;
     }
+    return fRun;
 }
 
 UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params) const
@@ -1015,14 +1593,60 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
     try
     {
         // Execute
-        return pcmd->actor(params, false);
+        UniValue result = pcmd->actor(params, false);
+        g_rpcSignals.PostCommand(*pcmd, true);
+        return result;
+    }
+    catch (const std::exception& e)
+    {
+        g_rpcSignals.PostCommand(*pcmd, false);
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+    catch (...)
+    {
+        g_rpcSignals.PostCommand(*pcmd, false);
+        throw;
+    }
+}
+
+bool CRPCTable::canStream(const std::string &strMethod) const
+{
+    return mapStreamCommands.count(strMethod) > 0;
+}
+
+void CRPCTable::executeStreaming(const std::string &strMethod, const UniValue &params, JSONStreamWriter& result) const
+{
+    // Return immediately if in warmup
+    {
+        LOCK(cs_rpcWarmup);
+        if (fRPCInWarmup)
+            throw JSONRPCError(RPC_IN_WARMUP, rpcWarmupStatus);
+    }
+
+    std::map<std::string, rpcstreamfn_type>::const_iterator it = mapStreamCommands.find(strMethod);
+    const CRPCCommand *pcmd = tableRPC[strMethod];
+    if (it == mapStreamCommands.end() || !pcmd)
+        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "Method not found");
+
+    g_rpcSignals.PreCommand(*pcmd);
+
+    try
+    {
+        // Execute
+        it->second(params, result);
     }
     catch (const std::exception& e)
     {
+        g_rpcSignals.PostCommand(*pcmd, false);
         throw JSONRPCError(RPC_MISC_ERROR, e.what());
     }
+    catch (...)
+    {
+        g_rpcSignals.PostCommand(*pcmd, false);
+        throw;
+    }
 
-    g_rpcSignals.PostCommand(*pcmd);
+    g_rpcSignals.PostCommand(*pcmd, true);
 }
 
 std::string HelpExampleCli(const std::string& methodname, const std::string& args)
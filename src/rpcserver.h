@@ -26,20 +26,51 @@ namespace RPCServer
     void OnStarted(boost::function<void ()> slot);
     void OnStopped(boost::function<void ()> slot);
     void OnPreCommand(boost::function<void (const CRPCCommand&)> slot);
-    void OnPostCommand(boost::function<void (const CRPCCommand&)> slot);
+    /** Called after every command that got past OnPreCommand, with whether it succeeded */
+    void OnPostCommand(boost::function<void (const CRPCCommand&, bool)> slot);
 }
 
 class CBlockIndex;
 class CNetAddr;
+class JSONStreamWriter;
+
+//! Default number of RPC worker threads (-rpcthreads)
+static const int DEFAULT_RPC_THREADS = 4;
+//! Default maximum number of requests waiting for a worker (-rpcworkqueue)
+static const int DEFAULT_RPC_WORK_QUEUE = 16;
+//! Default number of threads executing JSON-RPC batch elements in parallel (-rpcbatchthreads, 0 = number of cores)
+static const int DEFAULT_RPC_BATCH_THREADS = 0;
+//! Maximum number of threads executing JSON-RPC batch elements in parallel
+static const int MAX_RPC_BATCH_THREADS = 16;
+//! Default idle timeout in seconds for RPC connections (-rpcservertimeout)
+static const int DEFAULT_RPC_SERVER_TIMEOUT = 30;
 
 class AcceptedConnection
 {
 public:
     virtual ~AcceptedConnection() {}
 
+    /** Stream the reply is written to; it is sent once the request handler returns */
     virtual std::iostream& stream() = 0;
     virtual std::string peer_address_to_string() const = 0;
     virtual void close() = 0;
+
+    /**
+     * Start a reply of unknown length instead of using stream(). Data written
+     * to the returned stream is sent to the client while the handler is still
+     * producing it; the writer blocks if the client falls too far behind.
+     * Nothing is sent until the first buffer fills, so a handler that fails
+     * early can still call AbortStreamingReply() and reply with an error.
+     */
+    virtual std::ostream& BeginStreamingReply(int nStatus, bool fKeepAlive, const char *contentType) = 0;
+    /** Finish a streaming reply */
+    virtual void EndStreamingReply() = 0;
+    /**
+     * Give up on a streaming reply. Returns true if nothing was sent yet and
+     * the handler may reply normally through stream(); otherwise the
+     * connection is closed once the partial reply has been sent.
+     */
+    virtual bool AbortStreamingReply() = 0;
 };
 
 /** Start RPC threads */
@@ -91,6 +122,8 @@ void RPCRunLater(const std::string& name, boost::function<void(void)> func, int6
 extern CNetAddr BoostAsioToCNetAddr(boost::asio::ip::address address);
 
 typedef UniValue(*rpcfn_type)(const UniValue& params, bool fHelp);
+/** Alternative implementation of a call that writes its result incrementally */
+typedef void(*rpcstreamfn_type)(const UniValue& params, JSONStreamWriter& result);
 
 class CRPCCommand
 {
@@ -99,6 +132,8 @@ public:
     std::string name;
     rpcfn_type actor;
     bool okSafeMode;
+    //! Only reads node state, so may run concurrently with other such calls in a batch
+    bool okParallel;
 };
 
 /**
@@ -108,6 +143,7 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, rpcstreamfn_type> mapStreamCommands;
 public:
     CRPCTable();
     const CRPCCommand* operator[](const std::string& name) const;
@@ -121,6 +157,17 @@ public:
      * @throws an exception (UniValue) when an error happens.
      */
     UniValue execute(const std::string &method, const UniValue &params) const;
+
+    /** Whether method has a streaming implementation */
+    bool canStream(const std::string &method) const;
+
+    /**
+     * Execute a method that canStream(), writing its result to a JSON stream
+     * instead of returning it, so that large results need not be held in
+     * memory.
+     * @throws an exception (UniValue) when an error happens.
+     */
+    void executeStreaming(const std::string &method, const UniValue &params, JSONStreamWriter& result) const;
 };
 
 extern const CRPCTable tableRPC;
@@ -232,17 +279,30 @@ extern UniValue getbestblockhash(const UniValue& params, bool fHelp);
 extern UniValue getdifficulty(const UniValue& params, bool fHelp);
 extern UniValue settxfee(const UniValue& params, bool fHelp);
 extern UniValue getmempoolinfo(const UniValue& params, bool fHelp);
+extern UniValue getmempoolchanges(const UniValue& params, bool fHelp);
 extern UniValue getrawmempool(const UniValue& params, bool fHelp);
+extern void getrawmempool_stream(const UniValue& params, JSONStreamWriter& result);
 extern UniValue getblockhash(const UniValue& params, bool fHelp);
 extern UniValue getblockheader(const UniValue& params, bool fHelp);
 extern UniValue getblock(const UniValue& params, bool fHelp);
+extern void getblock_stream(const UniValue& params, JSONStreamWriter& result);
 extern UniValue gettxoutsetinfo(const UniValue& params, bool fHelp);
+extern UniValue getdbstats(const UniValue& params, bool fHelp);
+extern UniValue getaddressdeltas(const UniValue& params, bool fHelp);
+extern UniValue getaddressbalance(const UniValue& params, bool fHelp);
+extern UniValue getspentinfo(const UniValue& params, bool fHelp);
+extern UniValue getindexinfo(const UniValue& params, bool fHelp);
+extern UniValue getblockfilter(const UniValue& params, bool fHelp);
 extern UniValue gettxout(const UniValue& params, bool fHelp);
 extern UniValue verifychain(const UniValue& params, bool fHelp);
 extern UniValue getchaintips(const UniValue& params, bool fHelp);
 extern UniValue invalidateblock(const UniValue& params, bool fHelp);
 extern UniValue reconsiderblock(const UniValue& params, bool fHelp);
 
+extern UniValue waitfornotifications(const UniValue& params, bool fHelp); // in rpcnotify.cpp
+
+extern UniValue getrpcstats(const UniValue& params, bool fHelp); // in rpcmetrics.cpp
+
 // in rest.cpp
 extern bool HTTPReq_REST(AcceptedConnection *conn,
                   const std::string& strURI,
@@ -119,6 +119,13 @@ public:
     const_reference operator[](size_type pos) const  { return vch[pos + nReadPos]; }
     reference operator[](size_type pos)              { return vch[pos + nReadPos]; }
     void clear()                                     { vch.clear(); nReadPos = 0; }
+    void swap(CDataStream& other)
+    {
+        vch.swap(other.vch);
+        std::swap(nReadPos, other.nReadPos);
+        std::swap(nType, other.nType);
+        std::swap(nVersion, other.nVersion);
+    }
     iterator insert(iterator it, const char& x=char()) { return vch.insert(it, x); }
     void insert(iterator it, size_type n, const char& x) { vch.insert(it, n, x); }
 
@@ -296,6 +303,13 @@ public:
         data.insert(data.end(), begin(), end());
         clear();
     }
+
+    /** Move the unread contents into data by swapping storage, replacing whatever data held */
+    void SwapAndClear(CSerializeData &data) {
+        vch.erase(vch.begin(), vch.begin() + nReadPos);
+        vch.swap(data);
+        clear();
+    }
 };
 
 
@@ -307,6 +321,57 @@ public:
 
 
 
+/** Read-only stream over a range of memory it does not own, such as part of
+ * a memory-mapped file. Deserializes in place, without copying the data
+ * into a buffer of its own first.
+ */
+class CSpanReader
+{
+private:
+    const char* pcur;
+    const char* pend;
+    int nType;
+    int nVersion;
+
+public:
+    CSpanReader(const char* pbegin, const char* pendIn, int nTypeIn, int nVersionIn) :
+        pcur(pbegin), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    //
+    // Stream subset
+    //
+    int GetType()                { return nType; }
+    int GetVersion()             { return nVersion; }
+    size_t size() const          { return pend - pcur; }
+    bool empty() const           { return pcur == pend; }
+    const char* data() const     { return pcur; }
+
+    CSpanReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::read(): end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+        return (*this);
+    }
+
+    CSpanReader& ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::ignore(): end of data");
+        pcur += nSize;
+        return (*this);
+    }
+
+    template<typename T>
+    CSpanReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
 /** Non-refcounted RAII wrapper for FILE*
  *
  * Will automatically close the file when it goes out of scope if not null.
@@ -20,6 +20,23 @@ void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 }
 #endif /* DEBUG_LOCKCONTENTION */
 
+bool fMeasureLockWait = false;
+
+//! Per-thread total of time spent waiting for contended locks, allocated on first contention
+static boost::thread_specific_ptr<int64_t> threadLockWait;
+
+void AddThreadLockWait(int64_t nMicros)
+{
+    if (!threadLockWait.get())
+        threadLockWait.reset(new int64_t(0));
+    *threadLockWait += nMicros;
+}
+
+int64_t GetThreadLockWait()
+{
+    return threadLockWait.get() ? *threadLockWait : 0;
+}
+
 #ifdef DEBUG_LOCKORDER
 //
 // Early deadlock detection.
@@ -7,6 +7,7 @@
 #define BITCOIN_SYNC_H
 
 #include "threadsafety.h"
+#include "utiltime.h"
 
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
@@ -99,6 +100,14 @@ void static inline AssertLockHeldInternal(const char* pszName, const char* pszFi
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/** Whether LOCK measures the time spent waiting for contended locks (-debug=lock) */
+extern bool fMeasureLockWait;
+
+/** Add to the time the current thread spent waiting for contended locks */
+void AddThreadLockWait(int64_t nMicros);
+/** Total microseconds the current thread spent waiting for contended locks */
+int64_t GetThreadLockWait();
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class SCOPED_LOCKABLE CMutexLock
@@ -109,6 +118,10 @@ private:
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+        if (fMeasureLockWait) {
+            EnterMeasured(pszName, pszFile, nLine);
+            return;
+        }
 #ifdef DEBUG_LOCKCONTENTION
         if (!lock.try_lock()) {
             PrintLockContention(pszName, pszFile, nLine);
@@ -119,6 +132,18 @@ private:
 #endif
     }
 
+    void EnterMeasured(const char* pszName, const char* pszFile, int nLine)
+    {
+        if (!lock.try_lock()) {
+#ifdef DEBUG_LOCKCONTENTION
+            PrintLockContention(pszName, pszFile, nLine);
+#endif
+            int64_t nWaitStart = GetTimeMicros();
+            lock.lock();
+            AddThreadLockWait(GetTimeMicros() - nWaitStart);
+        }
+    }
+
     bool TryEnter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()), true);
@@ -0,0 +1,127 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "chainparams.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "undo.h"
+#include "utilstrencodings.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+static CGCSFilter::Element MakeElement(unsigned int n, unsigned char nTag)
+{
+    CGCSFilter::Element element(32, nTag);
+    for (unsigned int i = 0; i < 4; i++)
+        element[i] = (n >> (8 * i)) & 0xFF;
+    return element;
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    CGCSFilter::ElementSet included, excluded;
+    for (unsigned int i = 0; i < 100; i++) {
+        included.insert(MakeElement(i, 1));
+        excluded.insert(MakeElement(i, 2));
+    }
+
+    CGCSFilter filter(0, 0, 19, 784931, included);
+    BOOST_CHECK_EQUAL(filter.GetN(), 100U);
+    for (CGCSFilter::ElementSet::const_iterator it = included.begin(); it != included.end(); ++it)
+        BOOST_CHECK(filter.Match(*it));
+    BOOST_CHECK(filter.MatchAny(included));
+    BOOST_CHECK(!filter.MatchAny(excluded));
+    BOOST_CHECK(!filter.MatchAny(CGCSFilter::ElementSet()));
+
+    // A filter decoded from the encoding of another is the same set
+    CGCSFilter filter2(0, 0, 19, 784931, filter.GetEncoded());
+    BOOST_CHECK_EQUAL(filter2.GetN(), filter.GetN());
+    BOOST_CHECK(filter2.GetEncoded() == filter.GetEncoded());
+    BOOST_CHECK(filter2.MatchAny(included));
+    BOOST_CHECK(!filter2.MatchAny(excluded));
+
+    // The elements are keyed, so another key gives another filter
+    CGCSFilter filter3(1, 0, 19, 784931, included);
+    BOOST_CHECK(filter3.GetEncoded() != filter.GetEncoded());
+
+    // Empty filters match nothing
+    CGCSFilter empty(0, 0, 19, 784931, CGCSFilter::ElementSet());
+    BOOST_CHECK_EQUAL(empty.GetN(), 0U);
+    BOOST_CHECK(empty.GetEncoded() == std::vector<unsigned char>(1, 0));
+    BOOST_CHECK(!empty.Match(MakeElement(0, 1)));
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_malformed)
+{
+    CGCSFilter::ElementSet elements;
+    for (unsigned int i = 0; i < 10; i++)
+        elements.insert(MakeElement(i, 1));
+    std::vector<unsigned char> vEncoded = CGCSFilter(0, 0, 19, 784931, elements).GetEncoded();
+
+    std::vector<unsigned char> vTruncated(vEncoded.begin(), vEncoded.end() - 1);
+    BOOST_CHECK_THROW(CGCSFilter(0, 0, 19, 784931, vTruncated), std::ios_base::failure);
+    std::vector<unsigned char> vExcess(vEncoded);
+    vExcess.push_back(0);
+    BOOST_CHECK_THROW(CGCSFilter(0, 0, 19, 784931, vExcess), std::ios_base::failure);
+    BOOST_CHECK_THROW(CGCSFilter(0, 0, 19, 784931, std::vector<unsigned char>()), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
+{
+    // Test vector of BIP 158: the testnet genesis block
+    const CBlock& genesis = Params(CBaseChainParams::TESTNET).GenesisBlock();
+    CBlockFilter filter(BLOCK_FILTER_BASIC, genesis, CBlockUndo());
+    BOOST_CHECK_EQUAL(HexStr(filter.GetEncodedFilter()), "019dfca8");
+    BOOST_CHECK_EQUAL(filter.ComputeHeader(uint256()).GetHex(), "21584579b7eb08997773e5aeff3a7f932700042d0ed2a6129012b7d7ae81b750");
+
+    const CScript& script = genesis.vtx[0].vout[0].scriptPubKey;
+    BOOST_CHECK(filter.GetFilter().Match(CGCSFilter::Element(script.begin(), script.end())));
+
+    // Scripts spent by the block are included, unspendable outputs are not
+    CBlock block(genesis);
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = genesis.vtx[0].GetHash();
+    tx.vout.resize(2);
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    tx.vout[1].scriptPubKey = CScript() << OP_RETURN << std::vector<unsigned char>(4, 0x42);
+    block.vtx.push_back(tx);
+    CBlockUndo blockundo;
+    blockundo.vtxundo.resize(1);
+    CScript scriptSpent = CScript() << OP_2;
+    blockundo.vtxundo[0].vprevout.push_back(CTxInUndo(CTxOut(1, scriptSpent)));
+
+    CBlockFilter filter2(BLOCK_FILTER_BASIC, block, blockundo);
+    const CGCSFilter& gcs = filter2.GetFilter();
+    BOOST_CHECK_EQUAL(gcs.GetN(), 3U);
+    BOOST_CHECK(gcs.Match(CGCSFilter::Element(scriptSpent.begin(), scriptSpent.end())));
+    BOOST_CHECK(gcs.Match(CGCSFilter::Element(tx.vout[0].scriptPubKey.begin(), tx.vout[0].scriptPubKey.end())));
+    BOOST_CHECK(!gcs.Match(CGCSFilter::Element(tx.vout[1].scriptPubKey.begin(), tx.vout[1].scriptPubKey.end())));
+
+    // Round trip through the network serialization of the cfilter message
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << filter2;
+    CBlockFilter filter3;
+    ss >> filter3;
+    BOOST_CHECK(filter3.GetBlockHash() == filter2.GetBlockHash());
+    BOOST_CHECK(filter3.GetEncodedFilter() == filter2.GetEncodedFilter());
+    BOOST_CHECK(filter3.GetHash() == filter2.GetHash());
+
+    // getcfilters sends the stored encoding without decoding it, in the same layout
+    CDataStream ssRaw(SER_NETWORK, PROTOCOL_VERSION);
+    ssRaw << (unsigned char)BLOCK_FILTER_BASIC << filter2.GetBlockHash() << filter2.GetEncodedFilter();
+    CDataStream ss2(SER_NETWORK, PROTOCOL_VERSION);
+    ss2 << filter2;
+    BOOST_CHECK(ssRaw.str() == ss2.str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
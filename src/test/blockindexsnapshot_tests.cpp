@@ -0,0 +1,91 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "main.h"
+#include "pow.h"
+#include "txdb.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+struct RegtestingSetup : public TestingSetup {
+    RegtestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+};
+
+BOOST_FIXTURE_TEST_SUITE(blockindexsnapshot_tests, RegtestingSetup)
+
+static void ReloadBlockIndex()
+{
+    UnloadBlockIndex();
+    BOOST_CHECK(LoadBlockIndex());
+    BOOST_CHECK(InitBlockIndex());
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_load)
+{
+    FlushStateToDisk();
+    const CBlockIndex* pindexGenesis = chainActive.Genesis();
+    uint256 hashGenesis = pindexGenesis->GetBlockHash();
+    arith_uint256 nChainWork = pindexGenesis->nChainWork;
+    unsigned int nStatus = pindexGenesis->nStatus;
+
+    BOOST_CHECK(WriteBlockIndexSnapshot());
+    uint256 id;
+    BOOST_CHECK(pblocktree->ReadIndexSnapshotId(id));
+
+    ReloadBlockIndex();
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), 1U);
+    BOOST_CHECK(chainActive.Tip() && chainActive.Tip()->GetBlockHash() == hashGenesis);
+    BOOST_CHECK(chainActive.Tip()->nChainWork == nChainWork);
+    BOOST_CHECK_EQUAL(chainActive.Tip()->nStatus, nStatus);
+    // The snapshot is used once: a crash from here on leaves nothing to load
+    BOOST_CHECK(!pblocktree->ReadIndexSnapshotId(id));
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_stale)
+{
+    FlushStateToDisk();
+    CBlockIndex* pindexGenesis = chainActive.Genesis();
+    BOOST_CHECK(WriteBlockIndexSnapshot());
+    uint256 id;
+    BOOST_CHECK(pblocktree->ReadIndexSnapshotId(id));
+
+    // A version without snapshot support connects a block: it writes the
+    // entry, the block file info and the coins tip, but keeps the snapshot id
+    CBlockHeader header = Params().GenesisBlock().GetBlockHeader();
+    header.hashPrevBlock = pindexGenesis->GetBlockHash();
+    header.nTime++;
+    while (!CheckProofOfWork(header.GetHash(), header.nBits, Params().GetConsensus()))
+        header.nNonce++;
+    uint256 hash = header.GetHash();
+    CBlockIndex index(header);
+    index.phashBlock = &hash;
+    index.pprev = pindexGenesis;
+    index.nHeight = 1;
+    index.nTx = 1;
+    index.nStatus = BLOCK_VALID_SCRIPTS | BLOCK_HAVE_DATA;
+    CBlockFileInfo info;
+    BOOST_CHECK(pblocktree->ReadBlockFileInfo(0, info));
+    info.AddBlock(1, header.nTime);
+    std::vector<std::pair<int, const CBlockFileInfo*> > vFiles(1, std::make_pair(0, &info));
+    std::vector<const CBlockIndex*> vBlocks(1, &index);
+    BOOST_CHECK(pblocktree->WriteBatchSync(vFiles, 0, vBlocks));
+    BOOST_CHECK(pblocktree->WriteIndexSnapshotId(id));
+    pcoinsTip->SetBestBlock(hash);
+    BOOST_CHECK(pcoinsTip->Flush());
+
+    // The snapshot no longer matches, so the index is read from the database
+    ReloadBlockIndex();
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), 2U);
+    BOOST_CHECK(chainActive.Tip() && chainActive.Tip()->GetBlockHash() == hash);
+    BOOST_CHECK_EQUAL(chainActive.Height(), 1);
+    BOOST_CHECK(!pblocktree->ReadIndexSnapshotId(id));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
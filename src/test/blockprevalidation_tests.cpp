@@ -0,0 +1,164 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "main.h"
+#include "miner.h"
+#include "net.h"
+#include "pow.h"
+#include "streams.h"
+#include "utiltime.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+/** Runs the prevalidation thread for the duration of a test */
+struct BlockPrevalidationSetup : public TestChain100Setup {
+    boost::thread threadPrevalidation;
+
+    BlockPrevalidationSetup() : threadPrevalidation(&ThreadBlockPrevalidation) {}
+    ~BlockPrevalidationSetup()
+    {
+        threadPrevalidation.interrupt();
+        threadPrevalidation.join();
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(blockprevalidation_tests, BlockPrevalidationSetup)
+
+/** A block on top of the tip that is not processed yet; nExtraNonce tells siblings apart */
+static CBlock CreateBlock(unsigned int nExtraNonce)
+{
+    CBlockTemplate *pblocktemplate = CreateNewBlock(CScript() << OP_TRUE);
+    CBlock block = pblocktemplate->block;
+    delete pblocktemplate;
+    block.vtx.resize(1);
+    IncrementExtraNonce(&block, chainActive.Tip(), nExtraNonce);
+    while (!CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus()))
+        ++block.nNonce;
+    return block;
+}
+
+static CAddress PeerAddress(uint32_t i)
+{
+    struct in_addr s;
+    s.s_addr = i;
+    return CAddress(CService(CNetAddr(s), Params().GetDefaultPort()));
+}
+
+static void ReceiveMessage(CNode& node, const char* pszCommand, const CDataStream& payload)
+{
+    CSendBufferRef msg = MakeSerializedMessage(pszCommand, payload);
+    BOOST_CHECK(node.ReceiveMsgBytes(&(*msg)[0], msg->size()));
+}
+
+static void ReceiveBlock(CNode& node, const CBlock& block)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    ReceiveMessage(node, "block", ss);
+}
+
+static bool HaveBlock(const uint256& hash)
+{
+    LOCK(cs_main);
+    BlockMap::iterator it = mapBlockIndex.find(hash);
+    return it != mapBlockIndex.end() && (it->second->nStatus & BLOCK_HAVE_DATA);
+}
+
+/** Run the message handler over the peers until they have nothing left to do */
+static void ProcessUntilIdle(const std::vector<CNode*>& vNodes)
+{
+    int64_t nStart = GetTimeMillis();
+    while (true) {
+        bool fIdle = true;
+        BOOST_FOREACH(CNode* pnode, vNodes) {
+            ProcessMessages(pnode);
+            if (!pnode->vRecvMsg.empty() || pnode->fPauseRecvProcessing)
+                fIdle = false;
+        }
+        if (fIdle)
+            break;
+        BOOST_REQUIRE(GetTimeMillis() - nStart < 60 * 1000);
+        MilliSleep(1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(messages_wait_for_block)
+{
+    CNode node(INVALID_SOCKET, PeerAddress(0xa0b0c001), "", true);
+    node.nVersion = PROTOCOL_VERSION;
+    node.fWhitelisted = true;
+
+    CBlock block = CreateBlock(1);
+    ReceiveBlock(node, block);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << (uint64_t)42;
+    ReceiveMessage(node, "ping", ss);
+
+    // The ping is only answered once the block before it has been processed
+    int64_t nStart = GetTimeMillis();
+    while (!node.vRecvMsg.empty() || node.fPauseRecvProcessing) {
+        ProcessMessages(&node);
+        if (node.nSendSize > 0)
+            BOOST_CHECK(HaveBlock(block.GetHash()));
+        BOOST_REQUIRE(GetTimeMillis() - nStart < 60 * 1000);
+        MilliSleep(1);
+    }
+    BOOST_CHECK(node.nSendSize > 0);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(full_queue_does_not_block)
+{
+    // More peers sending a block at once than the queue holds
+    std::vector<CNode*> vNodes;
+    std::vector<uint256> vHashes;
+    for (unsigned int i = 0; i < 2 * MAX_BLOCK_PREVALIDATION_QUEUE; i++) {
+        CNode* pnode = new CNode(INVALID_SOCKET, PeerAddress(0xa0b0c001 + i), "", true);
+        pnode->nVersion = PROTOCOL_VERSION;
+        pnode->fWhitelisted = true;
+        CBlock block = CreateBlock(i + 1);
+        ReceiveBlock(*pnode, block);
+        vNodes.push_back(pnode);
+        vHashes.push_back(block.GetHash());
+    }
+    ProcessUntilIdle(vNodes);
+    BOOST_FOREACH(const uint256& hash, vHashes)
+        BOOST_CHECK(HaveBlock(hash));
+    BOOST_FOREACH(CNode* pnode, vNodes) {
+        CNodeStateStats stats;
+        BOOST_CHECK(GetNodeStateStats(pnode->GetId(), stats));
+        BOOST_CHECK_EQUAL(stats.nMisbehavior, 0);
+        delete pnode;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(invalid_block_punished)
+{
+    CNode node(INVALID_SOCKET, PeerAddress(0xa0b0c001), "", true);
+    node.nVersion = PROTOCOL_VERSION;
+
+    // Changing a transaction after the fact breaks the merkle root, which CheckBlock catches
+    CBlock block = CreateBlock(1);
+    CMutableTransaction tx(block.vtx[0]);
+    tx.vout[0].nValue--;
+    block.vtx[0] = tx;
+    ReceiveBlock(node, block);
+
+    std::vector<CNode*> vNodes(1, &node);
+    ProcessUntilIdle(vNodes);
+    BOOST_CHECK(!HaveBlock(block.GetHash()));
+    CNodeStateStats stats;
+    BOOST_CHECK(GetNodeStateStats(node.GetId(), stats));
+    BOOST_CHECK_EQUAL(stats.nMisbehavior, 100);
+    // The reject message
+    BOOST_CHECK(node.nSendSize > 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
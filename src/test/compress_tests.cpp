@@ -3,6 +3,10 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "compressor.h"
+#include "key.h"
+#include "random.h"
+#include "script/standard.h"
+#include "streams.h"
 #include "util.h"
 #include "test/test_bitcoin.h"
 
@@ -62,4 +66,69 @@ BOOST_AUTO_TEST_CASE(compress_amounts)
         BOOST_CHECK(TestDecode(i));
 }
 
+BOOST_AUTO_TEST_CASE(compress_blocks)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CKey keyUncompressed;
+    keyUncompressed.MakeNewKey(false);
+
+    CBlock block;
+    block.nVersion = 3;
+    block.nTime = 1234567890;
+    block.nBits = 0x207fffff;
+    block.nNonce = 42;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << 1000 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50 * COIN;
+    coinbase.vout[0].scriptPubKey = CScript() << ToByteVector(keyUncompressed.GetPubKey()) << OP_CHECKSIG;
+    block.vtx.push_back(coinbase);
+
+    CMutableTransaction tx;
+    tx.nVersion = -1;
+    tx.nLockTime = 0xfffffffe;
+    tx.vin.resize(2);
+    tx.vin[0].prevout = COutPoint(block.vtx[0].GetHash(), 0);
+    tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 0x30) << ToByteVector(key.GetPubKey());
+    tx.vin[1].prevout = COutPoint(GetRandHash(), 0xfffffffe);
+    tx.vin[1].nSequence = 0;
+    tx.vout.resize(5);
+    tx.vout[0].nValue = 12345678;
+    tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    tx.vout[1].nValue = 0;
+    tx.vout[1].scriptPubKey = GetScriptForDestination(CScriptID(CScript() << OP_TRUE));
+    tx.vout[2].nValue = MAX_MONEY;
+    tx.vout[2].scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    tx.vout[3].nValue = 1;
+    tx.vout[3].scriptPubKey = CScript() << OP_RETURN << std::vector<unsigned char>(40, 0x01);
+    tx.vout[4].nValue = 2;
+    block.vtx.push_back(tx);
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    CDataStream ss(SER_DISK, 0);
+    ss << CBlockCompressor(block);
+    BOOST_CHECK_EQUAL(ss.size(), ::GetSerializeSize(CBlockCompressor(block), SER_DISK, 0));
+    BOOST_CHECK(ss.size() < ::GetSerializeSize(block, SER_DISK, 0));
+
+    // Decompresses to the same transactions and block
+    CBlock block2;
+    ss >> REF(CBlockCompressor(block2));
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK_EQUAL(block2.GetHash().ToString(), block.GetHash().ToString());
+    BOOST_CHECK_EQUAL(block2.vtx.size(), block.vtx.size());
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        BOOST_CHECK(block2.vtx[i] == block.vtx[i]);
+    BOOST_CHECK(block2.BuildMerkleTree() == block.hashMerkleRoot);
+
+    // Truncated data is rejected
+    CDataStream ssTruncated(SER_DISK, 0);
+    ssTruncated << CBlockCompressor(block);
+    ssTruncated.resize(ssTruncated.size() - 1);
+    BOOST_CHECK_THROW(ssTruncated >> REF(CBlockCompressor(block2)), std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -47,4 +47,28 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(siphash)
+{
+    // Reference vectors of the SipHash paper, key 00 01 02 ... 0f
+    CSipHasher hasher(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL);
+    BOOST_CHECK_EQUAL(hasher.Finalize(), 0x726fdb47dd0e0e31ull);
+    static const unsigned char t0[1] = {0};
+    hasher.Write(t0, 1);
+    BOOST_CHECK_EQUAL(hasher.Finalize(), 0x74f839c593dc67fdull);
+    static const unsigned char t1[7] = {1,2,3,4,5,6,7};
+    hasher.Write(t1, 7);
+    BOOST_CHECK_EQUAL(hasher.Finalize(), 0x93f5f5799a932462ull);
+    hasher.Write(0x0F0E0D0C0B0A0908ULL);
+    BOOST_CHECK_EQUAL(hasher.Finalize(), 0x3f2acc7f57c29bdbull);
+
+    // Writing the bytes in pieces gives the same result as writing them at once
+    std::vector<unsigned char> vData;
+    for (unsigned char i = 0; i < 63; i++)
+        vData.push_back(i);
+    CSipHasher hasher2(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL);
+    hasher2.Write(&vData[0], 10).Write(&vData[10], 53);
+    BOOST_CHECK_EQUAL(hasher2.Finalize(), 0x958a324ceb064572ull);
+    BOOST_CHECK_EQUAL(CSipHasher(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL).Write(&vData[0], vData.size()).Finalize(), 0x958a324ceb064572ull);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 
 #include "chainparams.h"
 #include "main.h"
+#include "util.h"
 
 #include "test/test_bitcoin.h"
 
@@ -56,9 +57,79 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK_EQUAL(nSum, 2099999997690000ULL);
 }
 
+BOOST_AUTO_TEST_CASE(blocks_in_flight_limit_test)
+{
+    // Until a peer has delivered a block, the default applies
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(0, 0), DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(0, 5000000), DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // Enough blocks to cover a round trip plus the queue time
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(100000, 0), BLOCK_DOWNLOAD_QUEUE_TIME / 100000);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(100000, 500000), (BLOCK_DOWNLOAD_QUEUE_TIME + 500000) / 100000);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(100000, -1), GetBlocksInFlightLimit(100000, 0));
+    // A slower peer gets fewer blocks than a faster one
+    BOOST_CHECK(GetBlocksInFlightLimit(200000, 0) < GetBlocksInFlightLimit(100000, 0));
+
+    // Within bounds, however fast or slow the peer is
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(1, 0), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(60000000, 0), MIN_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(1, 60000000), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+}
+
+BOOST_AUTO_TEST_CASE(block_delivery_time_test)
+{
+    // The first delivery sets the average, later ones move it by an eighth
+    BOOST_CHECK_EQUAL(UpdateBlockDeliveryTime(0, 800000), 800000);
+    BOOST_CHECK_EQUAL(UpdateBlockDeliveryTime(800000, 0), 700000);
+    BOOST_CHECK_EQUAL(UpdateBlockDeliveryTime(800000, 1600000), 900000);
+    // Deliveries take at least a microsecond, so the average stays known
+    BOOST_CHECK_EQUAL(UpdateBlockDeliveryTime(0, 0), 1);
+    BOOST_CHECK_EQUAL(UpdateBlockDeliveryTime(0, -5), 1);
+
+    // A steady rate is reached, and gives the matching limit
+    int64_t nAvg = 0;
+    for (int i = 0; i < 100; i++)
+        nAvg = UpdateBlockDeliveryTime(nAvg, 250000);
+    BOOST_CHECK_EQUAL(nAvg, 250000);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(nAvg, 0), BLOCK_DOWNLOAD_QUEUE_TIME / 250000);
+}
+
+BOOST_AUTO_TEST_CASE(block_reassign_timeout_test)
+{
+    // Twice a peer's usual delivery time, but never less than the minimum
+    BOOST_CHECK_EQUAL(GetBlockReassignTimeout(0), BLOCK_REASSIGN_MIN_TIME);
+    BOOST_CHECK_EQUAL(GetBlockReassignTimeout(1), BLOCK_REASSIGN_MIN_TIME);
+    BOOST_CHECK_EQUAL(GetBlockReassignTimeout(BLOCK_REASSIGN_MIN_TIME), 2 * BLOCK_REASSIGN_MIN_TIME);
+    BOOST_CHECK_EQUAL(GetBlockReassignTimeout(5000000), 10000000);
+}
+
 bool ReturnFalse() { return false; }
 bool ReturnTrue() { return true; }
 
+BOOST_AUTO_TEST_CASE(block_file_reread_test)
+{
+    // A block file that is still being appended to, preallocated with zeros
+    const CBlock& genesis = Params().GenesisBlock();
+    CDiskBlockPos pos(1000, 0);
+    FILE* file = OpenBlockFile(pos);
+    BOOST_REQUIRE(file != NULL);
+    AllocateFileRange(file, 0, 65536);
+    fclose(file);
+
+    // Reading a block leaves a handle behind that has read ahead into the
+    // zeros; it must not be used for the block written after it
+    CBlock block;
+    BOOST_CHECK(WriteBlockToDisk(genesis, pos, Params().MessageStart()));
+    BOOST_CHECK(ReadBlockFromDisk(block, pos));
+    BOOST_CHECK(block.GetHash() == genesis.GetHash());
+    CDiskBlockPos pos2(pos.nFile, pos.nPos + ::GetSerializeSize(genesis, SER_DISK, CLIENT_VERSION));
+    BOOST_CHECK(WriteBlockToDisk(genesis, pos2, Params().MessageStart()));
+    BOOST_CHECK(pos2.nPos > pos.nPos);
+    block.SetNull();
+    BOOST_CHECK(ReadBlockFromDisk(block, pos2));
+    BOOST_CHECK(block.GetHash() == genesis.GetHash());
+}
+
 BOOST_AUTO_TEST_CASE(test_combiner_all)
 {
     boost::signals2::signal<bool (), CombinerAll> Test;
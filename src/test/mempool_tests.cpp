@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "random.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -100,4 +101,180 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolSortForRelayTest)
+{
+    // A low fee parent with a high fee child, and an unrelated
+    // transaction with a fee rate in between.
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 33000LL;
+
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vin[0].prevout.hash = txParent.GetHash();
+    txChild.vin[0].prevout.n = 0;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 11000LL;
+
+    CMutableTransaction txOther;
+    txOther.vin.resize(1);
+    txOther.vin[0].scriptSig = CScript() << OP_12;
+    txOther.vout.resize(1);
+    txOther.vout[0].scriptPubKey = CScript() << OP_12 << OP_EQUAL;
+    txOther.vout[0].nValue = 22000LL;
+
+    CTxMemPool testPool(CFeeRate(0));
+    testPool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000LL, 0, 0.0, 1));
+    testPool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 30000LL, 0, 0.0, 1));
+    testPool.addUnchecked(txOther.GetHash(), CTxMemPoolEntry(txOther, 10000LL, 0, 0.0, 1));
+
+    // Fee rate order, but the child's parent is pulled in front of it; the
+    // unknown hash is dropped.
+    std::vector<uint256> vHashes;
+    vHashes.push_back(txOther.GetHash());
+    vHashes.push_back(GetRandHash());
+    vHashes.push_back(txChild.GetHash());
+    vHashes.push_back(txParent.GetHash());
+    testPool.SortForRelay(vHashes);
+    BOOST_CHECK_EQUAL(vHashes.size(), 3);
+    BOOST_CHECK(vHashes[0] == txParent.GetHash());
+    BOOST_CHECK(vHashes[1] == txChild.GetHash());
+    BOOST_CHECK(vHashes[2] == txOther.GetHash());
+
+    // Without the parent listed, the child simply goes first.
+    vHashes.clear();
+    vHashes.push_back(txOther.GetHash());
+    vHashes.push_back(txChild.GetHash());
+    testPool.SortForRelay(vHashes);
+    BOOST_CHECK_EQUAL(vHashes.size(), 2);
+    BOOST_CHECK(vHashes[0] == txChild.GetHash());
+    BOOST_CHECK(vHashes[1] == txOther.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolChangesSinceTest)
+{
+    // Three unrelated transactions
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++)
+    {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << i;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 11000LL;
+    }
+
+    CTxMemPool testPool(CFeeRate(0));
+    std::vector<uint256> vAdded, vRemoved;
+    uint64_t nLast, nRemovedLast;
+    bool fComplete;
+    BOOST_CHECK(testPool.GetChangesSince(0, 0, 10, vAdded, vRemoved, nLast, nRemovedLast, fComplete));
+    BOOST_CHECK(vAdded.empty() && vRemoved.empty() && fComplete);
+    BOOST_CHECK_EQUAL(nLast, 0);
+    BOOST_CHECK(!testPool.GetChangesSince(1, 1, 10, vAdded, vRemoved, nLast, nRemovedLast, fComplete));
+
+    for (int i = 0; i < 3; i++)
+        testPool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], 0, 0, 0.0, 1));
+    BOOST_CHECK_EQUAL(testPool.GetSequence(), 3);
+
+    // Paging through the whole pool
+    BOOST_CHECK(testPool.GetChangesSince(0, 0, 2, vAdded, vRemoved, nLast, nRemovedLast, fComplete));
+    BOOST_CHECK_EQUAL(vAdded.size(), 2);
+    BOOST_CHECK(vAdded[0] == tx[0].GetHash() && vAdded[1] == tx[1].GetHash());
+    BOOST_CHECK_EQUAL(nLast, 2);
+    BOOST_CHECK_EQUAL(nRemovedLast, 3);
+    BOOST_CHECK(!fComplete);
+    vAdded.clear();
+    BOOST_CHECK(testPool.GetChangesSince(nLast, nRemovedLast, 2, vAdded, vRemoved, nLast, nRemovedLast, fComplete));
+    BOOST_CHECK_EQUAL(vAdded.size(), 1);
+    BOOST_CHECK(vAdded[0] == tx[2].GetHash());
+    BOOST_CHECK_EQUAL(nLast, 3);
+    BOOST_CHECK_EQUAL(nRemovedLast, 3);
+    BOOST_CHECK(fComplete);
+
+    // A removal and a re-addition are listed in sequence order
+    std::list<CTransaction> removed;
+    testPool.remove(tx[0], removed);
+    testPool.addUnchecked(tx[0].GetHash(), CTxMemPoolEntry(tx[0], 0, 0, 0.0, 1));
+    testPool.remove(tx[1], removed);
+    vAdded.clear();
+    BOOST_CHECK(testPool.GetChangesSince(3, 3, 10, vAdded, vRemoved, nLast, nRemovedLast, fComplete));
+    BOOST_CHECK_EQUAL(vAdded.size(), 1);
+    BOOST_CHECK(vAdded[0] == tx[0].GetHash());
+    BOOST_CHECK_EQUAL(vRemoved.size(), 2);
+    BOOST_CHECK(vRemoved[0] == tx[0].GetHash() && vRemoved[1] == tx[1].GetHash());
+    BOOST_CHECK_EQUAL(nLast, 6);
+    BOOST_CHECK(fComplete);
+
+    // The full listing has no removals
+    vAdded.clear();
+    vRemoved.clear();
+    BOOST_CHECK(testPool.GetChangesSince(0, 0, 10, vAdded, vRemoved, nLast, nRemovedLast, fComplete));
+    BOOST_CHECK_EQUAL(vAdded.size(), 2);
+    BOOST_CHECK(vAdded[0] == tx[2].GetHash() && vAdded[1] == tx[0].GetHash());
+    BOOST_CHECK(vRemoved.empty());
+
+    // Removals before clearing the pool are forgotten
+    testPool.clear();
+    BOOST_CHECK(!testPool.GetChangesSince(6, 6, 10, vAdded, vRemoved, nLast, nRemovedLast, fComplete));
+    BOOST_CHECK(testPool.GetChangesSince(7, 7, 10, vAdded, vRemoved, nLast, nRemovedLast, fComplete));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolChangesSinceOverflowTest)
+{
+    CMutableTransaction tx[4];
+    for (int i = 0; i < 4; i++)
+    {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << i;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 11000LL;
+    }
+
+    CTxMemPool testPool(CFeeRate(0));
+    for (int i = 0; i < 3; i++)
+        testPool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], 0, 0, 0.0, 1));
+    // Churn until the removal log no longer reaches back to the additions
+    std::list<CTransaction> removed;
+    for (size_t i = 0; i <= MEMPOOL_REMOVED_LOG_SIZE; i++) {
+        testPool.addUnchecked(tx[3].GetHash(), CTxMemPoolEntry(tx[3], 0, 0, 0.0, 1));
+        testPool.remove(tx[3], removed);
+    }
+    uint64_t nStart = testPool.GetSequence();
+
+    // Paging through the whole pool only needs the removals since it began
+    std::vector<uint256> vAdded, vRemoved;
+    uint64_t nLast, nRemovedLast;
+    bool fComplete;
+    BOOST_CHECK(testPool.GetChangesSince(0, 0, 2, vAdded, vRemoved, nLast, nRemovedLast, fComplete));
+    BOOST_CHECK_EQUAL(vAdded.size(), 2);
+    BOOST_CHECK(vAdded[0] == tx[0].GetHash() && vAdded[1] == tx[1].GetHash());
+    BOOST_CHECK(vRemoved.empty());
+    BOOST_CHECK_EQUAL(nLast, 2);
+    BOOST_CHECK_EQUAL(nRemovedLast, nStart);
+    BOOST_CHECK(!fComplete);
+    BOOST_CHECK(!testPool.GetChangesSince(nLast, nLast, 2, vAdded, vRemoved, nLast, nRemovedLast, fComplete));
+
+    // Changes made between the pages are picked up by the next one
+    testPool.remove(tx[0], removed);
+    vAdded.clear();
+    BOOST_CHECK(testPool.GetChangesSince(nLast, nRemovedLast, 2, vAdded, vRemoved, nLast, nRemovedLast, fComplete));
+    BOOST_CHECK_EQUAL(vAdded.size(), 1);
+    BOOST_CHECK(vAdded[0] == tx[2].GetHash());
+    BOOST_CHECK_EQUAL(vRemoved.size(), 1);
+    BOOST_CHECK(vRemoved[0] == tx[0].GetHash());
+    BOOST_CHECK_EQUAL(nLast, nStart + 1);
+    BOOST_CHECK_EQUAL(nRemovedLast, nStart + 1);
+    BOOST_CHECK(fComplete);
+
+    // A cursor that overtakes its removals is rejected
+    BOOST_CHECK(!testPool.GetChangesSince(nStart, 2, 10, vAdded, vRemoved, nLast, nRemovedLast, fComplete));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,10 +3,15 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "rpcserver.h"
+#include "rpccache.h"
 #include "rpcclient.h"
+#include "rpcprotocol.h"
 
 #include "base58.h"
+#include "main.h"
 #include "netbase.h"
+#include "primitives/transaction.h"
+#include "random.h"
 
 #include "test/test_bitcoin.h"
 
@@ -239,6 +244,157 @@ BOOST_AUTO_TEST_CASE(rpc_boostasiotocnetaddr)
     BOOST_CHECK_EQUAL(BoostAsioToCNetAddr(boost::asio::ip::address::from_string("::ffff:127.0.0.1")).ToString(), "127.0.0.1");
 }
 
+BOOST_AUTO_TEST_CASE(rpc_httprequestparser)
+{
+    const string strRequest = "POST / HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: 5\r\n\r\nhello";
+
+    // Byte at a time, as it might trickle in from a slow client
+    HTTPRequestParser parser(MAX_SIZE);
+    for (size_t i = 0; i < strRequest.size(); i++) {
+        BOOST_CHECK(!parser.IsComplete());
+        BOOST_CHECK_EQUAL(parser.Feed(&strRequest[i], 1), 1U);
+    }
+    BOOST_CHECK(parser.IsComplete());
+    BOOST_CHECK_EQUAL(parser.strMethod, "POST");
+    BOOST_CHECK_EQUAL(parser.strURI, "/");
+    BOOST_CHECK_EQUAL(parser.nProto, 1);
+    BOOST_CHECK_EQUAL(parser.mapHeaders["host"], "127.0.0.1");
+    BOOST_CHECK_EQUAL(parser.mapHeaders["connection"], "keep-alive");
+    BOOST_CHECK_EQUAL(parser.strBody, "hello");
+
+    // Pipelined requests: parsing stops at the end of the first one
+    const string strGet = "GET /rest/chaininfo.json HTTP/1.0\r\n\r\n";
+    const string strPipelined = strRequest + strGet;
+    parser.Reset();
+    size_t nUsed = parser.Feed(strPipelined.data(), strPipelined.size());
+    BOOST_CHECK(parser.IsComplete());
+    BOOST_CHECK_EQUAL(nUsed, strRequest.size());
+    parser.Reset();
+    BOOST_CHECK_EQUAL(parser.Feed(strPipelined.data() + nUsed, strPipelined.size() - nUsed), strGet.size());
+    BOOST_CHECK(parser.IsComplete());
+    BOOST_CHECK_EQUAL(parser.strMethod, "GET");
+    BOOST_CHECK_EQUAL(parser.mapHeaders["connection"], "close");
+    BOOST_CHECK(parser.strBody.empty());
+
+    // Malformed request line, oversized body and oversized headers are rejected
+    const string strBadMethod = "PUT / HTTP/1.1\r\n\r\n";
+    parser.Reset();
+    parser.Feed(strBadMethod.data(), strBadMethod.size());
+    BOOST_CHECK(parser.IsFailed());
+
+    HTTPRequestParser small(4);
+    small.Feed(strRequest.data(), strRequest.size());
+    BOOST_CHECK(small.IsFailed());
+
+    const string strLongHeader = "GET / HTTP/1.1\r\nX-Junk: " + string(MAX_HTTP_HEADERS_SIZE, 'a');
+    parser.Reset();
+    parser.Feed(strLongHeader.data(), strLongHeader.size());
+    BOOST_CHECK(parser.IsFailed());
+}
+
+BOOST_AUTO_TEST_CASE(rpc_jsonstreamwriter)
+{
+    UniValue inner(UniValue::VOBJ);
+    inner.push_back(Pair("a", 1));
+    inner.push_back(Pair("b", "two\n"));
+
+    UniValue expected(UniValue::VOBJ);
+    expected.push_back(Pair("first", inner));
+    UniValue arr(UniValue::VARR);
+    arr.push_back(1);
+    arr.push_back(UniValue(UniValue::VARR));
+    arr.push_back(NullUniValue);
+    expected.push_back(Pair("list", arr));
+    expected.push_back(Pair("last", true));
+
+    std::ostringstream os;
+    JSONStreamWriter writer(os);
+    writer.BeginObject();
+    writer.Key("first");
+    writer.BeginObject();
+    writer.Members(inner);
+    writer.EndObject();
+    writer.Key("list");
+    writer.BeginArray();
+    writer.Value(1);
+    writer.BeginArray();
+    writer.EndArray();
+    writer.Value(NullUniValue);
+    writer.EndArray();
+    writer.KeyValue("last", true);
+    writer.EndObject();
+
+    BOOST_CHECK_EQUAL(os.str(), expected.write());
+}
+
+BOOST_AUTO_TEST_CASE(rpc_resultcache)
+{
+    CRPCResultCache cache(100000);
+    UniValue result;
+    uint256 hashBlock;
+    std::vector<uint256> vHashes;
+    for (int i = 0; i < 100; i++) {
+        vHashes.push_back(GetRandHash());
+        cache.Put(vHashes.back(), CRPCResultCache::BLOCK_HEX, std::string(2000, 'a'));
+    }
+    // Bounded in size, and the least recently used are gone
+    BOOST_CHECK(!cache.Get(vHashes[0], CRPCResultCache::BLOCK_HEX, result));
+    BOOST_CHECK(cache.Get(vHashes[99], CRPCResultCache::BLOCK_HEX, result));
+    BOOST_CHECK_EQUAL(result.get_str(), std::string(2000, 'a'));
+    BOOST_CHECK(!cache.Get(vHashes[99], CRPCResultCache::BLOCK_JSON, result));
+
+    // Transactions are dropped when the validation interface reports them
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("txid", tx.GetHash().GetHex()));
+    cache.Put(tx.GetHash(), CRPCResultCache::TX_JSON, obj, vHashes[1]);
+    BOOST_CHECK(cache.Get(tx.GetHash(), CRPCResultCache::TX_JSON, result, &hashBlock));
+    BOOST_CHECK(hashBlock == vHashes[1]);
+    BOOST_CHECK_EQUAL(result.write(), obj.write());
+    RegisterValidationInterface(&cache);
+    SyncWithWallets(tx, NULL);
+    UnregisterValidationInterface(&cache);
+    BOOST_CHECK(!cache.Get(tx.GetHash(), CRPCResultCache::TX_JSON, result));
+}
+
+BOOST_AUTO_TEST_CASE(rpc_resultcache_stream)
+{
+    const uint256 hash = chainActive.Genesis()->GetBlockHash();
+    UniValue params(UniValue::VARR);
+    params.push_back(hash.GetHex());
+    UniValue expected = CallRPC("getblock " + hash.GetHex());
+
+    // A streamed reply that misses the cache fills it
+    pRPCResultCache = new CRPCResultCache(1000000);
+    std::ostringstream os;
+    JSONStreamWriter writer(os);
+    getblock_stream(params, writer);
+    UniValue streamed;
+    BOOST_CHECK(streamed.read(os.str()));
+    BOOST_CHECK_EQUAL(streamed.write(), expected.write());
+    UniValue cached;
+    BOOST_CHECK(pRPCResultCache->Get(hash, CRPCResultCache::BLOCK_JSON_SERIALIZED, cached));
+    BOOST_CHECK(cached["tx"].isStr());
+    BOOST_CHECK(!pRPCResultCache->Get(hash, CRPCResultCache::BLOCK_JSON, cached));
+
+    // and a later one is written from the cache
+    UniValue modified(UniValue::VOBJ);
+    const std::vector<std::string>& keys = cached.getKeys();
+    for (size_t i = 0; i < keys.size(); i++)
+        modified.push_back(Pair(keys[i], keys[i] == "tx" ? UniValue("[\"cached\"]") : cached[i]));
+    pRPCResultCache->Put(hash, CRPCResultCache::BLOCK_JSON_SERIALIZED, modified);
+    std::ostringstream os2;
+    JSONStreamWriter writer2(os2);
+    getblock_stream(params, writer2);
+    BOOST_CHECK(streamed.read(os2.str()));
+    BOOST_CHECK_EQUAL(find_value(streamed, "tx").write(), "[\"cached\"]");
+    BOOST_CHECK_EQUAL(find_value(streamed, "hash").get_str(), hash.GetHex());
+    delete pRPCResultCache;
+    pRPCResultCache = NULL;
+}
+
 BOOST_AUTO_TEST_CASE(rpc_ban)
 {
     BOOST_CHECK_NO_THROW(CallRPC(string("clearbanned")));
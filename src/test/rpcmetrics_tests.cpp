@@ -0,0 +1,138 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpcmetrics.h"
+
+#include "rpcserver.h"
+#include "sync.h"
+#include "utiltime.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(rpcmetrics_tests, BasicTestingSetup)
+
+static CRPCCommand MakeCommand(const std::string& strName)
+{
+    CRPCCommand cmd = {"test", strName, NULL, true, true};
+    return cmd;
+}
+
+BOOST_AUTO_TEST_CASE(rpcmetrics_calls)
+{
+    CRPCMetrics metrics;
+    CRPCCommand cmdA = MakeCommand("a");
+    CRPCCommand cmdB = MakeCommand("b");
+    BOOST_CHECK(metrics.GetStats().empty());
+
+    metrics.PreCommand(cmdA);
+    BOOST_CHECK_EQUAL(metrics.GetStats()["a"].nInFlight, 1);
+    BOOST_CHECK_EQUAL(metrics.GetStats()["a"].nCalls, 0U);
+    metrics.PostCommand(cmdA, true);
+    metrics.PreCommand(cmdA);
+    metrics.PostCommand(cmdA, false);
+    metrics.PreCommand(cmdB);
+    MilliSleep(30);
+    metrics.PostCommand(cmdB, true);
+
+    std::map<std::string, CRPCMetrics::MethodStats> mapStats = metrics.GetStats();
+    BOOST_REQUIRE_EQUAL(mapStats.size(), 2U);
+    const CRPCMetrics::MethodStats& statsA = mapStats["a"];
+    BOOST_CHECK_EQUAL(statsA.nCalls, 2U);
+    BOOST_CHECK_EQUAL(statsA.nErrors, 1U);
+    BOOST_CHECK_EQUAL(statsA.nInFlight, 0);
+    const CRPCMetrics::MethodStats& statsB = mapStats["b"];
+    BOOST_CHECK_EQUAL(statsB.nCalls, 1U);
+    BOOST_CHECK_EQUAL(statsB.nErrors, 0U);
+    BOOST_CHECK(statsB.nTotalMicros >= 30000);
+
+    // Each call lands in the first bucket its duration fits in
+    uint64_t nTotal = 0;
+    for (int i = 0; i < RPC_LATENCY_BUCKETS; i++) {
+        nTotal += statsB.vHistogram[i];
+        if (statsB.vHistogram[i]) {
+            BOOST_CHECK(i == RPC_LATENCY_BUCKETS - 1 || statsB.nTotalMicros <= RPC_LATENCY_BOUNDS[i]);
+            BOOST_CHECK(i == 0 || statsB.nTotalMicros > RPC_LATENCY_BOUNDS[i - 1]);
+        }
+    }
+    BOOST_CHECK_EQUAL(nTotal, 1U);
+
+    // Calls refused before PreCommand are not counted
+    metrics.PostCommand(cmdA, false);
+    BOOST_CHECK_EQUAL(metrics.GetStats()["a"].nCalls, 2U);
+    BOOST_CHECK_EQUAL(metrics.GetStats()["a"].nInFlight, 0);
+}
+
+static void HoldLock(CCriticalSection* cs, boost::mutex* mutexStarted, boost::condition_variable* condStarted, bool* fStarted)
+{
+    LOCK(*cs);
+    {
+        boost::unique_lock<boost::mutex> lock(*mutexStarted);
+        *fStarted = true;
+        condStarted->notify_all();
+    }
+    MilliSleep(50);
+}
+
+static int64_t MeasureContendedCall(CRPCMetrics& metrics, const CRPCCommand& cmd)
+{
+    CCriticalSection cs;
+    boost::mutex mutexStarted;
+    boost::condition_variable condStarted;
+    bool fStarted = false;
+    boost::thread thread(boost::bind(&HoldLock, &cs, &mutexStarted, &condStarted, &fStarted));
+    {
+        boost::unique_lock<boost::mutex> lock(mutexStarted);
+        while (!fStarted)
+            condStarted.wait(lock);
+    }
+
+    int64_t nBefore = metrics.GetStats()[cmd.name].nLockWaitMicros;
+    metrics.PreCommand(cmd);
+    {
+        LOCK(cs);
+    }
+    metrics.PostCommand(cmd, true);
+    thread.join();
+    return metrics.GetStats()[cmd.name].nLockWaitMicros - nBefore;
+}
+
+BOOST_AUTO_TEST_CASE(rpcmetrics_lock_wait)
+{
+    CRPCMetrics metrics;
+    CRPCCommand cmd = MakeCommand("a");
+
+    // Only measured with -debug=lock
+    fMeasureLockWait = false;
+    BOOST_CHECK_EQUAL(MeasureContendedCall(metrics, cmd), 0);
+    fMeasureLockWait = true;
+    BOOST_CHECK(MeasureContendedCall(metrics, cmd) >= 10000);
+    fMeasureLockWait = false;
+}
+
+BOOST_AUTO_TEST_CASE(rpcmetrics_text)
+{
+    CRPCMetrics metrics;
+    BOOST_CHECK(metrics.ToText().find("# TYPE bitcoind_rpc_calls_total counter\n") != std::string::npos);
+
+    CRPCCommand cmd = MakeCommand("getinfo");
+    metrics.PreCommand(cmd);
+    metrics.PostCommand(cmd, false);
+    metrics.PreCommand(cmd);
+
+    // What /metrics serves: one sample per line, with cumulative histogram buckets
+    std::string strText = metrics.ToText();
+    BOOST_CHECK(strText.find("bitcoind_rpc_calls_total{method=\"getinfo\"} 1\n") != std::string::npos);
+    BOOST_CHECK(strText.find("bitcoind_rpc_errors_total{method=\"getinfo\"} 1\n") != std::string::npos);
+    BOOST_CHECK(strText.find("bitcoind_rpc_in_flight{method=\"getinfo\"} 1\n") != std::string::npos);
+    BOOST_CHECK(strText.find("bitcoind_rpc_lock_wait_seconds_total{method=\"getinfo\"} 0.000000\n") != std::string::npos);
+    BOOST_CHECK(strText.find("bitcoind_rpc_duration_seconds_bucket{method=\"getinfo\",le=\"10.000000\"} 1\n") != std::string::npos);
+    BOOST_CHECK(strText.find("bitcoind_rpc_duration_seconds_bucket{method=\"getinfo\",le=\"+Inf\"} 1\n") != std::string::npos);
+    BOOST_CHECK(strText.find("bitcoind_rpc_duration_seconds_count{method=\"getinfo\"} 1\n") != std::string::npos);
+    BOOST_CHECK(strText.find("bitcoind_rpc_duration_seconds_bucket{method=\"getinfo\",le=\"0.000100\"}") != std::string::npos);
+    metrics.PostCommand(cmd, true);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,170 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "rpcnotify.h"
+
+#include "chainparams.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "rpcserver.h"
+#include "txmempool.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validationinterface.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "univalue/univalue.h"
+
+extern UniValue CallRPC(std::string args);
+
+/** A notifier registered for validation signals during a test */
+struct NotifierSetup : public TestingSetup {
+    CRPCNotifier notifier;
+
+    NotifierSetup() : notifier(3)
+    {
+        RegisterValidationInterface(&notifier);
+        pRPCNotifier = &notifier;
+    }
+    ~NotifierSetup()
+    {
+        pRPCNotifier = NULL;
+        UnregisterValidationInterface(&notifier);
+        mapArgs.erase("-rpcservertimeout");
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(rpcnotify_tests, NotifierSetup)
+
+static CBlock MakeBlock(unsigned int nNonce)
+{
+    CBlock block = Params().GenesisBlock();
+    block.nNonce = nNonce;
+    return block;
+}
+
+static std::vector<CRPCNotification> WaitFor(CRPCNotifier& notifier, uint64_t nSequence, bool fExpectComplete = true)
+{
+    std::vector<CRPCNotification> vEvents;
+    BOOST_CHECK_EQUAL(notifier.Wait(nSequence, boost::get_system_time(), vEvents, 10), fExpectComplete);
+    return vEvents;
+}
+
+BOOST_AUTO_TEST_CASE(notifier_events)
+{
+    BOOST_CHECK_EQUAL(notifier.GetSequence(), 0U);
+    BOOST_CHECK(WaitFor(notifier, 0).empty());
+
+    // A connected block is reported once, not for each of its transactions
+    CBlock block = MakeBlock(1);
+    CMutableTransaction txSpend;
+    txSpend.vin.resize(1);
+    txSpend.vin[0].prevout = COutPoint(block.vtx[0].GetHash(), 0);
+    txSpend.vout.resize(1);
+    block.vtx.push_back(txSpend);
+    SyncWithWallets(block.vtx[0], &block);
+    SyncWithWallets(block.vtx[1], &block);
+    GetMainSignals().BlockDisconnected(block);
+
+    std::vector<CRPCNotification> vEvents = WaitFor(notifier, 0);
+    BOOST_REQUIRE_EQUAL(vEvents.size(), 2U);
+    BOOST_CHECK_EQUAL(vEvents[0].nSequence, 1U);
+    BOOST_CHECK(vEvents[0].type == CRPCNotification::BLOCK);
+    BOOST_CHECK(vEvents[0].hash == block.GetHash());
+    BOOST_CHECK(vEvents[0].hashPrevBlock == block.hashPrevBlock);
+    BOOST_CHECK_EQUAL(vEvents[1].nSequence, 2U);
+    BOOST_CHECK(vEvents[1].type == CRPCNotification::BLOCK_DISCONNECTED);
+    BOOST_CHECK(vEvents[1].hash == block.GetHash());
+    BOOST_CHECK_EQUAL(vEvents[1].ToJSON()["type"].get_str(), "blockdisconnected");
+    BOOST_CHECK_EQUAL(WaitFor(notifier, 1).size(), 1U);
+
+    // Transactions are reported when they are in the mempool, and only once
+    CTransaction tx(txSpend);
+    SyncWithWallets(tx);
+    BOOST_CHECK(WaitFor(notifier, 2).empty());
+    mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 0, 0, 0.0, 1));
+    SyncWithWallets(tx);
+    SyncWithWallets(tx);
+    vEvents = WaitFor(notifier, 2);
+    BOOST_REQUIRE_EQUAL(vEvents.size(), 1U);
+    BOOST_CHECK(vEvents[0].type == CRPCNotification::TX);
+    BOOST_CHECK(vEvents[0].hash == tx.GetHash());
+    BOOST_CHECK(!vEvents[0].strHex.empty());
+    mempool.clear();
+
+    // Only the last three events are kept; asking for older ones says some were missed
+    CBlock block2 = MakeBlock(2);
+    SyncWithWallets(block2.vtx[0], &block2);
+    vEvents = WaitFor(notifier, 0, false);
+    BOOST_REQUIRE_EQUAL(vEvents.size(), 3U);
+    BOOST_CHECK_EQUAL(vEvents[0].nSequence, 2U);
+    BOOST_CHECK_EQUAL(vEvents[2].nSequence, 4U);
+    BOOST_CHECK(WaitFor(notifier, 4).empty());
+    // A sequence from the future, from before a restart
+    BOOST_CHECK(WaitFor(notifier, 5, false).empty());
+}
+
+BOOST_AUTO_TEST_CASE(notifier_wait)
+{
+    // Waiting gives up at the deadline
+    std::vector<CRPCNotification> vEvents;
+    int64_t nStart = GetTimeMillis();
+    BOOST_CHECK(notifier.Wait(0, boost::get_system_time() + boost::posix_time::milliseconds(100), vEvents, 10));
+    BOOST_CHECK(vEvents.empty());
+    BOOST_CHECK(GetTimeMillis() - nStart >= 90);
+
+    // Interrupting wakes up waiters for good
+    notifier.Interrupt();
+    nStart = GetTimeMillis();
+    BOOST_CHECK(notifier.Wait(0, boost::get_system_time() + boost::posix_time::seconds(60), vEvents, 10));
+    BOOST_CHECK(GetTimeMillis() - nStart < 30 * 1000);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_waitfornotifications)
+{
+    CBlock block = MakeBlock(1);
+    SyncWithWallets(block.vtx[0], &block);
+
+    UniValue result = CallRPC("waitfornotifications 0 0");
+    BOOST_CHECK_EQUAL(result["sequence"].get_int64(), 1);
+    BOOST_CHECK(!result["missed"].get_bool());
+    BOOST_REQUIRE_EQUAL(result["events"].size(), 1U);
+    BOOST_CHECK_EQUAL(result["events"][0]["type"].get_str(), "block");
+    BOOST_CHECK_EQUAL(result["events"][0]["hash"].get_str(), block.GetHash().GetHex());
+
+    // Nothing new: the same sequence comes back
+    result = CallRPC("waitfornotifications 1 0");
+    BOOST_CHECK_EQUAL(result["sequence"].get_int64(), 1);
+    BOOST_CHECK(result["events"].empty());
+
+    // The timeout is capped to -rpcservertimeout
+    mapArgs["-rpcservertimeout"] = "1";
+    int64_t nStart = GetTimeMillis();
+    result = CallRPC("waitfornotifications 1 3600");
+    BOOST_CHECK(GetTimeMillis() - nStart < 30 * 1000);
+    BOOST_CHECK(result["events"].empty());
+
+    BOOST_CHECK_THROW(CallRPC("waitfornotifications 1 -1"), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(wait_slots)
+{
+    // One worker is always left for other requests
+    mapArgs["-rpcthreads"] = "3";
+    {
+        CNotifyWaitSlot slot1, slot2, slot3;
+        BOOST_CHECK(slot1.Acquire());
+        BOOST_CHECK(slot2.Acquire());
+        BOOST_CHECK(!slot3.Acquire());
+    }
+    CNotifyWaitSlot slot;
+    BOOST_CHECK(slot.Acquire());
+    mapArgs.erase("-rpcthreads");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -274,6 +274,40 @@ BOOST_AUTO_TEST_CASE(insert_delete)
     CSerializeData d;
     ss.GetAndClear(d);
     BOOST_CHECK_EQUAL(ss.size(), 0);
+
+    // SwapAndClear moves only the unread part and replaces the old contents
+    ss.write("\x01\x02\x03", 3);
+    ss >> c;
+    ss.SwapAndClear(d);
+    BOOST_CHECK_EQUAL(ss.size(), 0);
+    BOOST_CHECK_EQUAL(d.size(), 2);
+    BOOST_CHECK_EQUAL(d[0], 2);
+    BOOST_CHECK_EQUAL(d[1], 3);
+}
+
+BOOST_AUTO_TEST_CASE(span_reader)
+{
+    CDataStream ss(SER_DISK, 0);
+    uint32_t a = 0x12345678;
+    std::string str = "span";
+    ss << a << str << VARINT(1000000);
+
+    // Reads the same data in place, up to the end of the span only
+    CSpanReader span(&ss[0], &ss[0] + ss.size(), SER_DISK, 0);
+    uint32_t a2;
+    std::string str2;
+    int n;
+    span >> a2 >> str2 >> VARINT(n);
+    BOOST_CHECK_EQUAL(a2, a);
+    BOOST_CHECK_EQUAL(str2, str);
+    BOOST_CHECK_EQUAL(n, 1000000);
+    BOOST_CHECK(span.empty());
+    BOOST_CHECK_THROW(span >> a2, std::ios_base::failure);
+
+    CSpanReader truncated(&ss[0], &ss[0] + 6, SER_DISK, 0);
+    truncated >> a2;
+    BOOST_CHECK_EQUAL(truncated.size(), 2);
+    BOOST_CHECK_THROW(truncated >> str2, std::ios_base::failure);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
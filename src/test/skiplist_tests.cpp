@@ -100,4 +100,38 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(blockindex_arena)
+{
+    CBlockIndexArena arena;
+    std::vector<CBlockIndex*> vIndex;
+    for (size_t i = 0; i < CBlockIndexArena::CHUNK_SIZE + 10; i++) {
+        CBlockIndex index;
+        index.nHeight = i;
+        vIndex.push_back(arena.Allocate(index));
+    }
+    // Entries within a chunk are adjacent, and all keep their values
+    BOOST_CHECK(vIndex[1] == vIndex[0] + 1);
+    for (size_t i = 0; i < vIndex.size(); i++)
+        BOOST_CHECK_EQUAL(vIndex[i]->nHeight, (int)i);
+
+    CBlockIndex* parray = arena.AllocateArray(CBlockIndexArena::CHUNK_SIZE * 2);
+    BOOST_CHECK(parray[CBlockIndexArena::CHUNK_SIZE * 2 - 1].pprev == NULL);
+    CBlockIndex* psmall = arena.AllocateArray(5);
+    BOOST_CHECK(psmall == vIndex.back() + 1);
+    BOOST_CHECK_EQUAL(arena.Size(), CBlockIndexArena::CHUNK_SIZE * 3 + 15);
+    BOOST_CHECK(vIndex.back()->nHeight == (int)vIndex.size() - 1);
+
+    // Swapping hands over the entries without moving them
+    CBlockIndexArena arena2;
+    arena2.swap(arena);
+    BOOST_CHECK_EQUAL(arena.Size(), 0U);
+    BOOST_CHECK_EQUAL(arena2.Size(), CBlockIndexArena::CHUNK_SIZE * 3 + 15);
+    BOOST_CHECK_EQUAL(vIndex[5]->nHeight, 5);
+    BOOST_CHECK(arena.Allocate() != psmall + 5);
+    BOOST_CHECK(arena2.Allocate() == psmall + 5);
+
+    arena2.Clear();
+    BOOST_CHECK_EQUAL(arena2.Size(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
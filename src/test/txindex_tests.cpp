@@ -0,0 +1,97 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txindex.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "main.h"
+#include "txdb.h"
+#include "utiltime.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txindex_tests, TestingSetup)
+
+/** Write an entry of the transaction index the way older versions did */
+static void WriteLegacyEntry(const uint256& txid, const CDiskTxPos& pos)
+{
+    pblocktree->Write(std::make_pair('t', txid), pos);
+}
+
+static bool WaitForSync(CTxIndex& txindex)
+{
+    for (int i = 0; i < 500; i++) {
+        {
+            LOCK(cs_main);
+            if (txindex.IsSynced())
+                return true;
+        }
+        MilliSleep(10);
+    }
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(txindex_sync)
+{
+    CTxIndex txindex(1 << 20, true, NULL);
+    CDiskTxPos pos;
+    const CTransaction& tx = Params().GenesisBlock().vtx[0];
+    BOOST_CHECK(!txindex.FindTx(tx.GetHash(), pos));
+
+    boost::thread thread(boost::bind(&CChainIndex::ThreadSync, &txindex));
+    BOOST_CHECK(WaitForSync(txindex));
+    thread.interrupt();
+    thread.join();
+
+    BOOST_CHECK(txindex.GetBestBlock() == chainActive.Genesis());
+    BOOST_CHECK(txindex.GetError().empty());
+    BOOST_REQUIRE(txindex.FindTx(tx.GetHash(), pos));
+    BOOST_CHECK(pos.nFile == chainActive.Genesis()->GetBlockPos().nFile);
+    BOOST_CHECK(pos.nPos == chainActive.Genesis()->GetBlockPos().nPos);
+}
+
+BOOST_AUTO_TEST_CASE(txindex_legacy_move)
+{
+    uint256 txid = GetRandHash();
+    CDiskTxPos posLegacy(CDiskBlockPos(1, 2), 3);
+    WriteLegacyEntry(txid, posLegacy);
+    BOOST_CHECK(pblocktree->HaveLegacyTxIndex());
+
+    // The entries of an older version are used while they are moved over
+    CTxIndex txindex(1 << 20, true, chainActive.Tip());
+    CDiskTxPos pos;
+    BOOST_REQUIRE(txindex.FindTx(txid, pos));
+    BOOST_CHECK(pos.nFile == 1 && pos.nPos == 2 && pos.nTxOffset == 3);
+
+    boost::thread thread(boost::bind(&CChainIndex::ThreadSync, &txindex));
+    BOOST_CHECK(WaitForSync(txindex));
+    thread.interrupt();
+    thread.join();
+
+    // They are complete up to the tip, so the blocks are not indexed again
+    BOOST_CHECK(!pblocktree->HaveLegacyTxIndex());
+    BOOST_CHECK(txindex.GetBestBlock() == chainActive.Tip());
+    BOOST_REQUIRE(txindex.FindTx(txid, pos));
+    BOOST_CHECK(pos.nFile == 1 && pos.nPos == 2 && pos.nTxOffset == 3);
+    BOOST_CHECK(!txindex.FindTx(Params().GenesisBlock().vtx[0].GetHash(), pos));
+}
+
+BOOST_AUTO_TEST_CASE(txindex_legacy_erase)
+{
+    pblocktree->WriteFlag("txindex", true);
+    for (unsigned int i = 0; i < LEGACY_TXINDEX_BATCH + 1; i++)
+        WriteLegacyEntry(GetRandHash(), CDiskTxPos(CDiskBlockPos(0, i), 0));
+    BOOST_CHECK(pblocktree->HaveLegacyTxIndex());
+    ThreadEraseLegacyTxIndex();
+    BOOST_CHECK(!pblocktree->HaveLegacyTxIndex());
+
+    // Other entries of the block index database are kept
+    bool fValue = false;
+    BOOST_CHECK(pblocktree->ReadFlag("txindex", fValue) && fValue);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
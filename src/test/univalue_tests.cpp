@@ -8,6 +8,7 @@
 #include <map>
 #include "univalue/univalue.h"
 #include "test/test_bitcoin.h"
+#include "utilstrencodings.h"
 
 #include <boost/test/unit_test.hpp>
 
@@ -316,5 +317,105 @@ BOOST_AUTO_TEST_CASE(univalue_readwrite)
     BOOST_CHECK_EQUAL(strJson1, v.write());
 }
 
+BOOST_AUTO_TEST_CASE(univalue_escape)
+{
+    // Exercise the word-at-a-time scanner with specials at every offset
+    for (unsigned int pos = 0; pos < 20; pos++) {
+        const char specials[] = { '"', '\\', '\n', '\x01', '\x7f', '\xe9' };
+        for (unsigned int i = 0; i < sizeof(specials); i++) {
+            string str(20, 'a');
+            str[pos] = specials[i];
+            UniValue v(str);
+            string json = v.write();
+            BOOST_CHECK_EQUAL(json.size(), 22 + (i < 3 ? 1 : 5));
+
+            if ((unsigned char)specials[i] < 0x80) {
+                UniValue v2;
+                BOOST_CHECK(v2.read("[" + json + "]"));
+                BOOST_CHECK_EQUAL(v2[0].get_str(), str);
+            }
+        }
+    }
+    BOOST_CHECK_EQUAL(UniValue("tab\there").write(), "\"tab\\there\"");
+    BOOST_CHECK_EQUAL(UniValue("\x1f").write(), "\"\\u001f\"");
+}
+
+BOOST_AUTO_TEST_CASE(univalue_largeobject)
+{
+    // Build something shaped like a verbose getrawmempool reply
+    const unsigned int nEntries = 2000;
+    UniValue obj(UniValue::VOBJ);
+    for (unsigned int i = 0; i < nEntries; i++) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("size", (int)(200 + i)));
+        entry.push_back(Pair("fee", 0.0001 * i));
+        entry.push_back(Pair("time", (int64_t)1440000000 + i));
+        entry.push_back(Pair("height", (int)i));
+        entry.push_back(Pair("startingpriority", 1e10 / (i + 1)));
+        entry.push_back(Pair("currentpriority", -1.5 * i));
+        UniValue depends(UniValue::VARR);
+        depends.push_back(strprintf("%064x", i + 1));
+        entry.push_back(Pair("depends", depends));
+        obj.push_back(Pair(strprintf("%064x", i), entry));
+    }
+    // Duplicate key: the first occurrence must win, also when hashed
+    obj.push_back(Pair(strprintf("%064x", 7), 0));
+
+    string strJson = obj.write();
+    UniValue parsed;
+    BOOST_CHECK(parsed.read(strJson));
+    BOOST_CHECK(parsed.isObject());
+    BOOST_CHECK_EQUAL(parsed.size(), nEntries + 1);
+
+    for (unsigned int i = 0; i < nEntries; i++) {
+        string strKey = strprintf("%064x", i);
+        BOOST_CHECK(parsed.exists(strKey));
+        const UniValue& entry = parsed[strKey];
+        BOOST_CHECK(entry.isObject());
+        BOOST_CHECK_EQUAL(entry["size"].get_int(), (int)(200 + i));
+        BOOST_CHECK_EQUAL(entry["time"].get_int64(), (int64_t)1440000000 + i);
+        BOOST_CHECK_EQUAL(entry["height"].get_int(), (int)i);
+        BOOST_CHECK_EQUAL(entry["depends"].size(), 1);
+        BOOST_CHECK_EQUAL(entry["depends"][0].get_str(), strprintf("%064x", i + 1));
+    }
+    BOOST_CHECK(!parsed.exists(strprintf("%064x", nEntries)));
+    BOOST_CHECK(parsed[strprintf("%064x", 7)].isObject());
+    BOOST_CHECK_EQUAL(find_value(parsed, strprintf("%064x", 9))["height"].get_int(), 9);
+    BOOST_CHECK_EQUAL(parsed.write(), strJson);
+
+    // Modifying a parsed object must keep lookups correct
+    parsed.push_back(Pair("extra", true));
+    BOOST_CHECK(parsed["extra"].get_bool());
+    BOOST_CHECK(parsed[strprintf("%064x", 7)].isObject());
+
+    // Appending an element of the same array must survive reallocation
+    UniValue arr(UniValue::VARR);
+    arr.push_back("first");
+    for (unsigned int i = 0; i < 20; i++)
+        arr.push_back(arr[0]);
+    BOOST_CHECK_EQUAL(arr.size(), 21);
+    BOOST_CHECK_EQUAL(arr[20].get_str(), "first");
+}
+
+BOOST_AUTO_TEST_CASE(univalue_stringtokens)
+{
+    // A string token never starts from the previous token's value
+    string tokenVal = "stale";
+    unsigned int consumed;
+    BOOST_CHECK_EQUAL(getJsonToken(tokenVal, consumed, "\"fresh\""), JTOK_STRING);
+    BOOST_CHECK_EQUAL(tokenVal, "fresh");
+    BOOST_CHECK_EQUAL(consumed, 7);
+
+    // Consecutive keys and string values each parse to their own text
+    UniValue v;
+    BOOST_CHECK(v.read("{\"a\":\"x\",\"bb\":\"yy\",\"ccc\":[\"z\",\"\"],\"d\":\"\\u0041\"}"));
+    BOOST_CHECK_EQUAL(v["a"].get_str(), "x");
+    BOOST_CHECK_EQUAL(v["bb"].get_str(), "yy");
+    BOOST_CHECK_EQUAL(v["ccc"][0].get_str(), "z");
+    BOOST_CHECK_EQUAL(v["ccc"][1].get_str(), "");
+    BOOST_CHECK_EQUAL(v["d"].get_str(), "A");
+    BOOST_CHECK_EQUAL(v.getKeys()[2], "ccc");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
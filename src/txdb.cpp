@@ -27,6 +27,7 @@ static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_INDEX_SNAPSHOT = 'S';
 
 
 void static BatchWriteCoins(CLevelDBBatch &batch, const uint256 &hash, const CCoins &coins) {
@@ -40,7 +41,7 @@ void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash) {
     batch.Write(DB_BEST_BLOCK, hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe) {
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, const CLevelDBOptions& dbOptions) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, dbOptions) {
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
@@ -78,7 +79,7 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe, const CLevelDBOptions& dbOptions) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, dbOptions) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -97,6 +98,18 @@ bool CBlockTreeDB::ReadReindexing(bool &fReindexing) {
     return true;
 }
 
+bool CBlockTreeDB::WriteIndexSnapshotId(const uint256 &id) {
+    return Write(DB_INDEX_SNAPSHOT, id, true);
+}
+
+bool CBlockTreeDB::ReadIndexSnapshotId(uint256 &id) {
+    return Read(DB_INDEX_SNAPSHOT, id);
+}
+
+bool CBlockTreeDB::EraseIndexSnapshotId() {
+    return Erase(DB_INDEX_SNAPSHOT, true);
+}
+
 bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
@@ -166,20 +179,12 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
         batch.Write(make_pair(DB_BLOCK_INDEX, (*it)->GetBlockHash()), CDiskBlockIndex(*it));
     }
+    // Any block index snapshot no longer matches the database
+    if (!blockinfo.empty())
+        batch.Erase(DB_INDEX_SNAPSHOT);
     return WriteBatch(batch, true);
 }
 
-bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
-    return Read(make_pair(DB_TXINDEX, txid), pos);
-}
-
-bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
-    CLevelDBBatch batch;
-    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(make_pair(DB_TXINDEX, it->first), it->second);
-    return WriteBatch(batch);
-}
-
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -192,6 +197,56 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+bool CBlockTreeDB::ReadLegacyTxIndex(const uint256 &txid, CDiskTxPos &pos) {
+    return Read(make_pair(DB_TXINDEX, txid), pos);
+}
+
+bool CBlockTreeDB::HaveLegacyTxIndex() {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair(DB_TXINDEX, uint256());
+    pcursor->Seek(ssKeySet.str());
+    return pcursor->Valid() && pcursor->key().size() > 0 && pcursor->key()[0] == DB_TXINDEX;
+}
+
+bool CBlockTreeDB::MoveLegacyTxIndex(CLevelDBWrapper* pdbTo, size_t nMax, size_t &nMoved) {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair(DB_TXINDEX, uint256());
+    pcursor->Seek(ssKeySet.str());
+
+    CLevelDBBatch batchTo, batchErase;
+    nMoved = 0;
+    for (; pcursor->Valid() && nMoved < nMax; pcursor->Next()) {
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            uint256 txid;
+            ssKey >> chType;
+            if (chType != DB_TXINDEX)
+                break;
+            ssKey >> txid;
+            if (pdbTo) {
+                leveldb::Slice slValue = pcursor->value();
+                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+                CDiskTxPos pos;
+                ssValue >> pos;
+                batchTo.Write(make_pair(DB_TXINDEX, txid), pos);
+            }
+            batchErase.Erase(make_pair(DB_TXINDEX, txid));
+            nMoved++;
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    pcursor.reset();
+    // Write the new entries first, so that none are lost if we crash in between
+    if (pdbTo && nMoved > 0)
+        pdbTo->WriteBatch(batchTo);
+    return nMoved == 0 || WriteBatch(batchErase);
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
@@ -32,20 +32,22 @@ class CCoinsViewDB : public CCoinsView
 protected:
     CLevelDBWrapper db;
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CLevelDBOptions& dbOptions = CLevelDBOptions());
 
     bool GetCoins(const uint256 &txid, CCoins &coins) const;
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+
+    const CLevelDBWrapper& GetDB() const { return db; }
 };
 
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CLevelDBWrapper
 {
 public:
-    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CBlockTreeDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CLevelDBOptions& dbOptions = CLevelDBOptions());
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
@@ -55,11 +57,18 @@ public:
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
-    bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
-    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    bool WriteIndexSnapshotId(const uint256 &id);
+    bool ReadIndexSnapshotId(uint256 &id);
+    bool EraseIndexSnapshotId();
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts();
+
+    /** Transaction index entries of older versions, which are moved over to CTxIndex */
+    bool ReadLegacyTxIndex(const uint256 &txid, CDiskTxPos &pos);
+    bool HaveLegacyTxIndex();
+    /** Move up to nMax of them to another database, or just erase them if pdbTo is NULL */
+    bool MoveLegacyTxIndex(CLevelDBWrapper* pdbTo, size_t nMax, size_t &nMoved);
 };
 
 #endif // BITCOIN_TXDB_H
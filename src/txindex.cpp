@@ -0,0 +1,103 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txindex.h"
+
+#include "chain.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <boost/thread.hpp>
+
+static const char DB_TXINDEX = 't';
+static const char DB_LEGACY_TIP = 'L';
+
+CTxIndex* ptxindex = NULL;
+
+CTxIndex::CTxIndex(size_t nCacheSize, bool fWipe, const CBlockIndex* pindexLegacyIn) :
+    CChainIndex("tx", "1", nCacheSize, fWipe), pindexLegacy(NULL)
+{
+    // Remember what is being moved over, so that an interrupted move carries on
+    if (pindexLegacyIn && GetBestBlock() == NULL)
+        pdb->Write(DB_LEGACY_TIP, pindexLegacyIn->GetBlockHash(), true);
+    uint256 hashLegacy;
+    if (pdb->Read(DB_LEGACY_TIP, hashLegacy)) {
+        pindexLegacy = LookupBlockIndex(hashLegacy);
+        if (pindexLegacy == NULL || GetBestBlock() != NULL)
+            pdb->Erase(DB_LEGACY_TIP);
+        else
+            LogPrintf("tx index: moving the entries of an older version over, up to height %d\n", pindexLegacy->nHeight);
+    }
+}
+
+/** Move the entries of older versions over to pdbTo, or erase them if pdbTo is NULL */
+static bool MoveLegacyTxIndex(CLevelDBWrapper* pdbTo)
+{
+    size_t nTotal = 0, nMoved = 0;
+    try {
+        do {
+            boost::this_thread::interruption_point();
+            if (!pblocktree->MoveLegacyTxIndex(pdbTo, LEGACY_TXINDEX_BATCH, nMoved))
+                return false;
+            nTotal += nMoved;
+        } while (nMoved > 0);
+    } catch (const leveldb_error& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+    if (nTotal > 0)
+        LogPrintf("tx index: %s %u entries of an older version\n", pdbTo ? "moved" : "erased", nTotal);
+    return true;
+}
+
+void CTxIndex::Prepare()
+{
+    const CBlockIndex* pindex;
+    {
+        boost::unique_lock<boost::mutex> lock(csLegacy);
+        pindex = pindexLegacy;
+    }
+    if (pindex == NULL) {
+        MoveLegacyTxIndex(NULL);
+        return;
+    }
+
+    // Once moved, the entries are complete up to the tip the older version left
+    CLevelDBBatch batch;
+    batch.Erase(DB_LEGACY_TIP);
+    if (!MoveLegacyTxIndex(pdb.get()) || !WriteBestBlock(batch, pindex))
+        LogPrintf("tx index: failed to move the entries of an older version, rebuilding\n");
+
+    boost::unique_lock<boost::mutex> lock(csLegacy);
+    pindexLegacy = NULL;
+}
+
+bool CTxIndex::WriteBlock(CLevelDBBatch& batch, const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect)
+{
+    // Offsets are relative to the end of the block header, as ConnectBlock used to record them
+    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        if (fConnect)
+            batch.Write(std::make_pair(DB_TXINDEX, tx.GetHash()), pos);
+        else
+            batch.Erase(std::make_pair(DB_TXINDEX, tx.GetHash()));
+        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+    }
+    return true;
+}
+
+bool CTxIndex::FindTx(const uint256& txid, CDiskTxPos& pos)
+{
+    if (pdb->Read(std::make_pair(DB_TXINDEX, txid), pos))
+        return true;
+    boost::unique_lock<boost::mutex> lock(csLegacy);
+    return pindexLegacy && pblocktree->ReadLegacyTxIndex(txid, pos);
+}
+
+void ThreadEraseLegacyTxIndex()
+{
+    MoveLegacyTxIndex(NULL);
+}
@@ -0,0 +1,53 @@
+// Copyright (c) 2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TXINDEX_H
+#define BITCOIN_TXINDEX_H
+
+#include "chainindex.h"
+
+#include <boost/thread/mutex.hpp>
+
+struct CDiskTxPos;
+class uint256;
+
+/** Default for -txindex */
+static const bool DEFAULT_TXINDEX = false;
+/** Number of entries of an older version's transaction index moved per batch */
+static const size_t LEGACY_TXINDEX_BATCH = 10000;
+
+/**
+ * Optional index of the position on disk of every transaction in the active
+ * chain, used to look up transactions that are no longer in the UTXO set.
+ *
+ * Older versions kept this index in the block index database. When the
+ * index is empty, their entries are moved over in the background instead of
+ * building it again from the blocks, and are looked up there meanwhile.
+ */
+class CTxIndex : public CChainIndex
+{
+public:
+    /** pindexLegacyIn is the tip the block index database holds the entries of an older version up to, if any */
+    CTxIndex(size_t nCacheSize, bool fWipe, const CBlockIndex* pindexLegacyIn);
+
+    /** Look up the position of a transaction in the block files */
+    bool FindTx(const uint256& txid, CDiskTxPos& pos);
+
+protected:
+    bool WriteBlock(CLevelDBBatch& batch, const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, bool fConnect);
+    bool NeedsUndo() const { return false; }
+    void Prepare();
+
+private:
+    boost::mutex csLegacy;
+    //! While the entries of an older version are moved over, the tip they are complete up to
+    const CBlockIndex* pindexLegacy;
+};
+
+/** Erase the transaction index entries of older versions, when -txindex is off */
+void ThreadEraseLegacyTxIndex();
+
+extern CTxIndex* ptxindex;
+
+#endif // BITCOIN_TXINDEX_H
@@ -18,7 +18,7 @@
 using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry():
-    nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0), hadNoDependencies(false)
+    nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0), hadNoDependencies(false), nSequence(0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
@@ -27,7 +27,7 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
                                  int64_t _nTime, double _dPriority,
                                  unsigned int _nHeight, bool poolHasNoInputsOf):
     tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight),
-    hadNoDependencies(poolHasNoInputsOf)
+    hadNoDependencies(poolHasNoInputsOf), nSequence(0)
 {
     nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
     nModSize = tx.CalculateModifiedSize(nTxSize);
@@ -49,7 +49,7 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
 }
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), nSequence(0), nRemovedLogStart(0)
 {
     // Sanity checks off by default for performance, because otherwise
     // accepting transactions becomes O(N^2) where N is the number
@@ -96,8 +96,11 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // Used by main.cpp AcceptToMemoryPool(), which DOES do
     // all the appropriate checks.
     LOCK(cs);
-    mapTx[hash] = entry;
-    const CTransaction& tx = mapTx[hash].GetTx();
+    CTxMemPoolEntry& newEntry = mapTx[hash];
+    newEntry = entry;
+    newEntry.nSequence = ++nSequence;
+    mapSequence[newEntry.nSequence] = hash;
+    const CTransaction& tx = newEntry.GetTx();
     for (unsigned int i = 0; i < tx.vin.size(); i++)
         mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
     nTransactionsUpdated++;
@@ -147,8 +150,15 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
                 mapNextTx.erase(txin.prevout);
 
             removed.push_back(tx);
-            totalTxSize -= mapTx[hash].GetTxSize();
-            cachedInnerUsage -= mapTx[hash].DynamicMemoryUsage();
+            const CTxMemPoolEntry& entry = mapTx[hash];
+            totalTxSize -= entry.GetTxSize();
+            cachedInnerUsage -= entry.DynamicMemoryUsage();
+            mapSequence.erase(entry.GetSequence());
+            logRemoved.push_back(std::make_pair(++nSequence, hash));
+            if (logRemoved.size() > MEMPOOL_REMOVED_LOG_SIZE) {
+                nRemovedLogStart = logRemoved.front().first;
+                logRemoved.pop_front();
+            }
             mapTx.erase(hash);
             nTransactionsUpdated++;
             minerPolicyEstimator->removeTx(hash);
@@ -228,6 +238,9 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    mapSequence.clear();
+    logRemoved.clear();
+    nRemovedLogStart = ++nSequence;
     totalTxSize = 0;
     cachedInnerUsage = 0;
     ++nTransactionsUpdated;
@@ -318,6 +331,99 @@ void CTxMemPool::queryHashes(vector<uint256>& vtxid)
         vtxid.push_back((*mi).first);
 }
 
+static bool SequenceBefore(uint64_t nSequence, const std::pair<uint64_t, uint256>& removal)
+{
+    return nSequence < removal.first;
+}
+
+bool CTxMemPool::GetChangesSince(uint64_t nSince, uint64_t nRemovedSince, size_t nMax, vector<uint256>& vAdded, vector<uint256>& vRemoved, uint64_t& nLast, uint64_t& nRemovedLast, bool& fComplete) const
+{
+    LOCK(cs);
+    // A new full listing: everything in the pool now, and the removals
+    // from now on for the pages that follow
+    if (nSince == 0 && nRemovedSince == 0)
+        nRemovedSince = nSequence;
+    if (nRemovedSince < nSince || nRemovedSince > nSequence || nRemovedSince < nRemovedLogStart)
+        return false;
+
+    // Merge both lists by sequence number, so that a page ends at a single
+    // sequence number that covers everything before it.
+    std::map<uint64_t, uint256>::const_iterator itAdded = mapSequence.upper_bound(nSince);
+    std::deque<std::pair<uint64_t, uint256> >::const_iterator itRemoved = std::upper_bound(logRemoved.begin(), logRemoved.end(), nRemovedSince, SequenceBefore);
+    nLast = nSince;
+    nRemovedLast = nRemovedSince;
+    while (vAdded.size() + vRemoved.size() < nMax) {
+        bool fHaveAdded = itAdded != mapSequence.end();
+        bool fHaveRemoved = itRemoved != logRemoved.end();
+        if (fHaveAdded && (!fHaveRemoved || itAdded->first < itRemoved->first)) {
+            vAdded.push_back(itAdded->second);
+            nLast = itAdded->first;
+            nRemovedLast = std::max(nRemovedLast, nLast);
+            itAdded++;
+        } else if (fHaveRemoved) {
+            vRemoved.push_back(itRemoved->second);
+            nLast = nRemovedLast = itRemoved->first;
+            itRemoved++;
+        } else {
+            break;
+        }
+    }
+    fComplete = itAdded == mapSequence.end() && itRemoved == logRemoved.end();
+    if (fComplete)
+        nLast = nRemovedLast = nSequence;
+    return true;
+}
+
+uint64_t CTxMemPool::GetSequence() const
+{
+    LOCK(cs);
+    return nSequence;
+}
+
+void CTxMemPool::SortForRelay(vector<uint256>& vHashes) const
+{
+    LOCK(cs);
+    vector<pair<CFeeRate, uint256> > vByFeeRate;
+    vByFeeRate.reserve(vHashes.size());
+    BOOST_FOREACH(const uint256& hash, vHashes) {
+        map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.find(hash);
+        if (it != mapTx.end())
+            vByFeeRate.push_back(make_pair(CFeeRate(it->second.GetFee(), it->second.GetTxSize()), hash));
+    }
+    sort(vByFeeRate.begin(), vByFeeRate.end(), greater<pair<CFeeRate, uint256> >());
+
+    set<uint256> setPending;
+    for (unsigned int i = 0; i < vByFeeRate.size(); i++)
+        setPending.insert(vByFeeRate[i].second);
+
+    // Walk the candidates by fee rate; whenever one still has a listed parent
+    // waiting, emit that parent (recursively) first.
+    vHashes.clear();
+    vector<uint256> vStack;
+    for (unsigned int i = 0; i < vByFeeRate.size(); i++) {
+        if (!setPending.count(vByFeeRate[i].second))
+            continue;
+        vStack.push_back(vByFeeRate[i].second);
+        while (!vStack.empty()) {
+            const uint256 hash = vStack.back();
+            const CTransaction& tx = mapTx.find(hash)->second.GetTx();
+            bool fParentPending = false;
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                if (setPending.count(txin.prevout.hash)) {
+                    vStack.push_back(txin.prevout.hash);
+                    fParentPending = true;
+                    break;
+                }
+            }
+            if (!fParentPending) {
+                setPending.erase(hash);
+                vHashes.push_back(hash);
+                vStack.pop_back();
+            }
+        }
+    }
+}
+
 bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
 {
     LOCK(cs);
@@ -429,5 +535,6 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
-    return memusage::DynamicUsage(mapTx) + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + cachedInnerUsage;
+    return memusage::DynamicUsage(mapTx) + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + cachedInnerUsage +
+           memusage::DynamicUsage(mapSequence) + logRemoved.size() * sizeof(logRemoved.front());
 }
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <deque>
 #include <list>
 
 #include "amount.h"
@@ -29,6 +30,8 @@ inline bool AllowFree(double dPriority)
 
 /** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
+/** Number of recent removals remembered for GetChangesSince */
+static const size_t MEMPOOL_REMOVED_LOG_SIZE = 50000;
 
 /**
  * CTxMemPool stores these:
@@ -45,6 +48,9 @@ private:
     double dPriority; //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
     bool hadNoDependencies; //! Not dependent on any other txs when it entered the mempool
+    uint64_t nSequence; //! Pool sequence number of the addition, set by CTxMemPool
+
+    friend class CTxMemPool;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
@@ -59,6 +65,7 @@ public:
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
     bool WasClearAtEntry() const { return hadNoDependencies; }
+    uint64_t GetSequence() const { return nSequence; }
     size_t DynamicMemoryUsage() const { return nUsageSize; }
 };
 
@@ -98,6 +105,11 @@ private:
     uint64_t totalTxSize; //! sum of all mempool tx' byte sizes
     uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
 
+    uint64_t nSequence; //! Incremented for every transaction added or removed
+    std::map<uint64_t, uint256> mapSequence; //! Transactions in the pool, by the sequence number of their addition
+    std::deque<std::pair<uint64_t, uint256> > logRemoved; //! Most recent removals, oldest first
+    uint64_t nRemovedLogStart; //! logRemoved lists all removals after this sequence number
+
 public:
     mutable CCriticalSection cs;
     std::map<uint256, CTxMemPoolEntry> mapTx;
@@ -124,6 +136,27 @@ public:
                         std::list<CTransaction>& conflicts, bool fCurrentEstimate = true);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
+    /**
+     * Order transaction ids for announcement to peers: highest fee rate
+     * first, except that a transaction never precedes any of its in-pool
+     * parents that are also listed. Ids not in the pool are dropped.
+     */
+    void SortForRelay(std::vector<uint256>& vHashes) const;
+    /**
+     * Collect up to nMax changes, oldest first: transactions added after
+     * sequence number nSince and still in the pool, and transactions
+     * removed after nRemovedSince (which may include ones that were added
+     * after nSince, too). Re-added transactions are listed in both.
+     * nRemovedSince is nSince, except while paging through a full listing:
+     * nSince 0 lists the whole pool as of the current sequence number, and
+     * later pages only need the removals after that. Returns false if the
+     * removals since nRemovedSince are no longer known, or either is out of
+     * range. nLast and nRemovedLast are set to the values to pass for the
+     * next page, and fComplete to whether the results are up to date with
+     * the pool; then both are the current sequence number.
+     */
+    bool GetChangesSince(uint64_t nSince, uint64_t nRemovedSince, size_t nMax, std::vector<uint256>& vAdded, std::vector<uint256>& vRemoved, uint64_t& nLast, uint64_t& nRemovedLast, bool& fComplete) const;
+    uint64_t GetSequence() const;
     void pruneSpent(const uint256& hash, CCoins &coins);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <algorithm>      // std::swap
 #include <stdint.h>
 #include <ctype.h>
 #include <iomanip>
@@ -16,12 +17,25 @@ using namespace std;
 
 const UniValue NullUniValue;
 
+/** Objects with fewer keys than this are searched linearly */
+static const size_t MIN_INDEXED_KEYS = 16;
+
 void UniValue::clear()
 {
     typ = VNULL;
     val.clear();
     keys.clear();
     values.clear();
+    keyTable.clear();
+}
+
+void UniValue::swap(UniValue& other)
+{
+    std::swap(typ, other.typ);
+    val.swap(other.val);
+    keys.swap(other.keys);
+    values.swap(other.values);
+    keyTable.swap(other.keyTable);
 }
 
 bool UniValue::setNull()
@@ -58,24 +72,39 @@ bool UniValue::setNumStr(const string& val_)
     return true;
 }
 
-bool UniValue::setInt(uint64_t val)
+// Integers are always valid JSON numbers, so format them directly rather
+// than going through ostringstream and re-validating the result.
+static void formatInt(uint64_t n, bool fNegative, string& out)
 {
-    string s;
-    ostringstream oss;
-
-    oss << val;
-
-    return setNumStr(oss.str());
+    char buf[24];
+    char *end = buf + sizeof(buf);
+    char *p = end;
+    do {
+        *--p = '0' + (n % 10);
+        n /= 10;
+    } while (n);
+    if (fNegative)
+        *--p = '-';
+    out.assign(p, end);
 }
 
-bool UniValue::setInt(int64_t val)
+bool UniValue::setInt(uint64_t val_)
 {
-    string s;
-    ostringstream oss;
-
-    oss << val;
+    clear();
+    typ = VNUM;
+    formatInt(val_, false, val);
+    return true;
+}
 
-    return setNumStr(oss.str());
+bool UniValue::setInt(int64_t val_)
+{
+    clear();
+    typ = VNUM;
+    if (val_ < 0)
+        formatInt(~(uint64_t)val_ + 1, true, val);
+    else
+        formatInt(val_, false, val);
+    return true;
 }
 
 bool UniValue::setFloat(double val)
@@ -112,12 +141,31 @@ bool UniValue::setObject()
     return true;
 }
 
+/**
+ * Append a copy of val to vec. When vec has to grow, existing elements are
+ * swapped into the new storage instead of being copied, which would
+ * otherwise deep-copy every nested value on each reallocation.
+ */
+void UniValue::appendValue(vector<UniValue>& vec, const UniValue& val)
+{
+    bool fAliased = !vec.empty() && &val >= &vec.front() && &val <= &vec.back();
+    if (vec.size() == vec.capacity() && !fAliased) {
+        vector<UniValue> grown;
+        grown.reserve(vec.empty() ? 4 : vec.size() * 2);
+        grown.resize(vec.size());
+        for (unsigned int i = 0; i < vec.size(); i++)
+            grown[i].swap(vec[i]);
+        vec.swap(grown);
+    }
+    vec.push_back(val);
+}
+
 bool UniValue::push_back(const UniValue& val)
 {
     if (typ != VARR)
         return false;
 
-    values.push_back(val);
+    appendValue(values, val);
     return true;
 }
 
@@ -137,7 +185,8 @@ bool UniValue::pushKV(const std::string& key, const UniValue& val)
         return false;
 
     keys.push_back(key);
-    values.push_back(val);
+    appendValue(values, val);
+    keyTable.clear();
     return true;
 }
 
@@ -148,14 +197,70 @@ bool UniValue::pushKVs(const UniValue& obj)
 
     for (unsigned int i = 0; i < obj.keys.size(); i++) {
         keys.push_back(obj.keys[i]);
-        values.push_back(obj.values[i]);
+        appendValue(values, obj.values[i]);
     }
+    keyTable.clear();
 
     return true;
 }
 
+// FNV-1a
+static uint32_t hashKey(const std::string& key)
+{
+    uint32_t h = 2166136261U;
+    for (unsigned int i = 0; i < key.size(); i++) {
+        h ^= (unsigned char)key[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+/**
+ * Build the key hash table for a large object. Only done by read(), when the
+ * object is complete; any later modification drops the table and lookups
+ * fall back to a linear scan. Const accessors never build it, so a shared
+ * const UniValue stays safe to read from multiple threads.
+ */
+void UniValue::indexKeys()
+{
+    keyTable.clear();
+    if (keys.size() < MIN_INDEXED_KEYS)
+        return;
+
+    size_t nSize = 1;
+    while (nSize < keys.size() * 2)
+        nSize <<= 1;
+    keyTable.assign(nSize, 0);
+    const size_t mask = nSize - 1;
+
+    for (unsigned int i = 0; i < keys.size(); i++) {
+        size_t pos = hashKey(keys[i]) & mask;
+        bool fDuplicate = false;
+        while (keyTable[pos]) {
+            // Like the linear scan, the first of several duplicate keys wins
+            if (keys[keyTable[pos] - 1] == keys[i]) {
+                fDuplicate = true;
+                break;
+            }
+            pos = (pos + 1) & mask;
+        }
+        if (!fDuplicate)
+            keyTable[pos] = i + 1;
+    }
+}
+
 int UniValue::findKey(const std::string& key) const
 {
+    if (!keyTable.empty()) {
+        const size_t mask = keyTable.size() - 1;
+        for (size_t pos = hashKey(key) & mask; keyTable[pos]; pos = (pos + 1) & mask) {
+            unsigned int i = keyTable[pos] - 1;
+            if (keys[i] == key)
+                return (int) i;
+        }
+        return -1;
+    }
+
     for (unsigned int i = 0; i < keys.size(); i++) {
         if (keys[i] == key)
             return (int) i;
@@ -218,15 +323,11 @@ const char *uvTypeName(UniValue::VType t)
 
 const UniValue& find_value( const UniValue& obj, const std::string& name)
 {
-    for (unsigned int i = 0; i < obj.keys.size(); i++)
-    {
-        if( obj.keys[i] == name )
-        {
-            return obj.values[i];
-        }
-    }
+    int index = obj.findKey(name);
+    if (index < 0)
+        return NullUniValue;
 
-    return NullUniValue;
+    return obj.values[index];
 }
 
 std::vector<std::string> UniValue::getKeys() const
@@ -48,6 +48,7 @@ public:
     ~UniValue() {}
 
     void clear();
+    void swap(UniValue& other);
 
     bool setNull();
     bool setBool(bool val);
@@ -132,8 +133,12 @@ private:
     std::string val;                       // numbers are stored as C++ strings
     std::vector<std::string> keys;
     std::vector<UniValue> values;
+    std::vector<uint32_t> keyTable;        // open-addressed hash of keys (index+1), large parsed objects only
 
     int findKey(const std::string& key) const;
+    void indexKeys();
+    static void appendValue(std::vector<UniValue>& vec, const UniValue& val);
+    void writeValue(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
     void writeArray(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
     void writeObject(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
 
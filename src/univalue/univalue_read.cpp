@@ -108,8 +108,6 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
     case '8':
     case '9': {
         // part 1: int
-        string numStr;
-
         const char *first = raw;
 
         const char *firstDigit = first;
@@ -118,49 +116,39 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
         if ((*firstDigit == '0') && isdigit(firstDigit[1]))
             return JTOK_ERR;
 
-        numStr += *raw;                       // copy first char
-        raw++;
+        raw++;                                // skip first char
 
         if ((*first == '-') && (!isdigit(*raw)))
             return JTOK_ERR;
 
-        while ((*raw) && isdigit(*raw)) {     // copy digits
-            numStr += *raw;
+        while ((*raw) && isdigit(*raw))       // skip digits
             raw++;
-        }
 
         // part 2: frac
         if (*raw == '.') {
-            numStr += *raw;                   // copy .
-            raw++;
+            raw++;                            // skip .
 
             if (!isdigit(*raw))
                 return JTOK_ERR;
-            while ((*raw) && isdigit(*raw)) { // copy digits
-                numStr += *raw;
+            while ((*raw) && isdigit(*raw))   // skip digits
                 raw++;
-            }
         }
 
         // part 3: exp
         if (*raw == 'e' || *raw == 'E') {
-            numStr += *raw;                   // copy E
-            raw++;
+            raw++;                            // skip E
 
-            if (*raw == '-' || *raw == '+') { // copy +/-
-                numStr += *raw;
+            if (*raw == '-' || *raw == '+')   // skip +/-
                 raw++;
-            }
 
             if (!isdigit(*raw))
                 return JTOK_ERR;
-            while ((*raw) && isdigit(*raw)) { // copy digits
-                numStr += *raw;
+            while ((*raw) && isdigit(*raw))   // skip digits
                 raw++;
-            }
         }
 
-        tokenVal = numStr;
+        // the token is copied once, as a whole
+        tokenVal.assign(first, raw);
         consumed = (raw - rawStart);
         return JTOK_NUMBER;
         }
@@ -168,9 +156,19 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
     case '"': {
         raw++;                                // skip "
 
-        string valStr;
+        string& valStr = tokenVal;
+        valStr.clear();                       // the string is appended to below
 
         while (*raw) {
+            // copy runs of unescaped characters in one go
+            const char *run = raw;
+            while (*raw >= 0x20 && *raw != '\\' && *raw != '"')
+                raw++;
+            if (raw != run)
+                valStr.append(run, raw);
+            if (!*raw)
+                break;
+
             if (*raw < 0x20)
                 return JTOK_ERR;
 
@@ -219,14 +217,8 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
                 raw++;                        // skip "
                 break;                        // stop scanning
             }
-
-            else {
-                valStr += *raw;
-                raw++;
-            }
         }
 
-        tokenVal = valStr;
         consumed = (raw - rawStart);
         return JTOK_STRING;
         }
@@ -246,10 +238,10 @@ bool UniValue::read(const char *raw)
 
     enum jtokentype tok = JTOK_NONE;
     enum jtokentype last_tok = JTOK_NONE;
+    string tokenVal;
     while (1) {
         last_tok = tok;
 
-        string tokenVal;
         unsigned int consumed;
         tok = getJsonToken(tokenVal, consumed, raw);
         if (tok == JTOK_NONE || tok == JTOK_ERR)
@@ -268,11 +260,11 @@ bool UniValue::read(const char *raw)
                     setArray();
                 stack.push_back(this);
             } else {
-                UniValue tmpVal(utyp);
                 UniValue *top = stack.back();
-                top->values.push_back(tmpVal);
-
+                appendValue(top->values, NullUniValue);
                 UniValue *newTop = &(top->values.back());
+                newTop->typ = utyp;
+
                 stack.push_back(newTop);
             }
 
@@ -291,6 +283,8 @@ bool UniValue::read(const char *raw)
             if (utyp != top->getType())
                 return false;
 
+            if (utyp == VOBJ)
+                top->indexKeys();
             stack.pop_back();
             expectName = false;
             break;
@@ -325,23 +319,22 @@ bool UniValue::read(const char *raw)
             if (!stack.size() || expectName || expectColon)
                 return false;
 
-            UniValue tmpVal;
+            UniValue *top = stack.back();
+            appendValue(top->values, NullUniValue);
+            UniValue& newVal = top->values.back();
             switch (tok) {
             case JTOK_KW_NULL:
                 // do nothing more
                 break;
             case JTOK_KW_TRUE:
-                tmpVal.setBool(true);
+                newVal.setBool(true);
                 break;
             case JTOK_KW_FALSE:
-                tmpVal.setBool(false);
+                newVal.setBool(false);
                 break;
             default: /* impossible */ break;
             }
 
-            UniValue *top = stack.back();
-            top->values.push_back(tmpVal);
-
             break;
             }
 
@@ -349,9 +342,12 @@ bool UniValue::read(const char *raw)
             if (!stack.size() || expectName || expectColon)
                 return false;
 
-            UniValue tmpVal(VNUM, tokenVal);
+            // swap the token in rather than copying it
             UniValue *top = stack.back();
-            top->values.push_back(tmpVal);
+            appendValue(top->values, NullUniValue);
+            UniValue& newVal = top->values.back();
+            newVal.typ = VNUM;
+            newVal.val.swap(tokenVal);
 
             break;
             }
@@ -363,12 +359,15 @@ bool UniValue::read(const char *raw)
             UniValue *top = stack.back();
 
             if (expectName) {
-                top->keys.push_back(tokenVal);
+                top->keys.push_back(string());
+                top->keys.back().swap(tokenVal);
                 expectName = false;
                 expectColon = true;
             } else {
-                UniValue tmpVal(VSTR, tokenVal);
-                top->values.push_back(tmpVal);
+                appendValue(top->values, NullUniValue);
+                UniValue& newVal = top->values.back();
+                newVal.typ = VSTR;
+                newVal.val.swap(tokenVal);
             }
 
             break;
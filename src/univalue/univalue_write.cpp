@@ -6,6 +6,7 @@
 #include <iomanip>
 #include <sstream>
 #include <stdio.h>
+#include <string.h>
 #include "univalue.h"
 #include "univalue_escapes.h"
 
@@ -13,13 +14,51 @@
 
 using namespace std;
 
-static string json_escape(const string& inS)
+// Eight bytes at a time, test whether any byte of x is a control character,
+// '"', '\\' or outside printable ASCII. May report false positives for bytes
+// following one that matches, never false negatives.
+static inline bool needsEscape8(uint64_t x)
 {
-    string outS;
-    outS.reserve(inS.size() * 2);
+    static const uint64_t ones = 0x0101010101010101ULL;
+    static const uint64_t highs = 0x8080808080808080ULL;
+    uint64_t quote = x ^ (ones * '"');
+    uint64_t backslash = x ^ (ones * '\\');
+    uint64_t del = x ^ (ones * 0x7f);
+    return (((x - ones * 0x20) & ~x) |
+            ((quote - ones) & ~quote) |
+            ((backslash - ones) & ~backslash) |
+            ((del - ones) & ~del) |
+            x) & highs;
+}
+
+static inline bool needsEscape(unsigned char ch)
+{
+    return ch < 0x20 || ch >= 0x7f || ch == '"' || ch == '\\';
+}
 
-    for (unsigned int i = 0; i < inS.size(); i++) {
-        unsigned char ch = inS[i];
+static void json_escape(const string& inS, string& outS)
+{
+    const char *p = inS.data();
+    const char *end = p + inS.size();
+
+    while (p < end) {
+        // copy the longest run that needs no escaping in one go
+        const char *run = p;
+        while (end - p >= 8) {
+            uint64_t x;
+            memcpy(&x, p, 8);
+            if (needsEscape8(x))
+                break;
+            p += 8;
+        }
+        while (p < end && !needsEscape((unsigned char)*p))
+            p++;
+        if (p != run)
+            outS.append(run, p);
+        if (p == end)
+            break;
+
+        unsigned char ch = *p++;
         const char *escStr = escapes[ch];
 
         if (escStr)
@@ -34,8 +73,6 @@ static string json_escape(const string& inS)
             outS += tmpesc;
         }
     }
-
-    return outS;
 }
 
 string UniValue::write(unsigned int prettyIndent,
@@ -44,6 +81,13 @@ string UniValue::write(unsigned int prettyIndent,
     string s;
     s.reserve(1024);
 
+    writeValue(prettyIndent, indentLevel, s);
+
+    return s;
+}
+
+void UniValue::writeValue(unsigned int prettyIndent, unsigned int indentLevel, string& s) const
+{
     unsigned int modIndent = indentLevel;
     if (modIndent == 0)
         modIndent = 1;
@@ -59,7 +103,9 @@ string UniValue::write(unsigned int prettyIndent,
         writeArray(prettyIndent, modIndent, s);
         break;
     case VSTR:
-        s += "\"" + json_escape(val) + "\"";
+        s += '"';
+        json_escape(val, s);
+        s += '"';
         break;
     case VNUM:
         s += val;
@@ -68,8 +114,6 @@ string UniValue::write(unsigned int prettyIndent,
         s += (val == "1" ? "true" : "false");
         break;
     }
-
-    return s;
 }
 
 static void indentStr(unsigned int prettyIndent, unsigned int indentLevel, string& s)
@@ -86,7 +130,7 @@ void UniValue::writeArray(unsigned int prettyIndent, unsigned int indentLevel, s
     for (unsigned int i = 0; i < values.size(); i++) {
         if (prettyIndent)
             indentStr(prettyIndent, indentLevel, s);
-        s += values[i].write(prettyIndent, indentLevel + 1);
+        values[i].writeValue(prettyIndent, indentLevel + 1, s);
         if (i != (values.size() - 1)) {
             s += ",";
             if (prettyIndent)
@@ -110,10 +154,12 @@ void UniValue::writeObject(unsigned int prettyIndent, unsigned int indentLevel,
     for (unsigned int i = 0; i < keys.size(); i++) {
         if (prettyIndent)
             indentStr(prettyIndent, indentLevel, s);
-        s += "\"" + json_escape(keys[i]) + "\":";
+        s += '"';
+        json_escape(keys[i], s);
+        s += "\":";
         if (prettyIndent)
             s += " ";
-        s += values[i].write(prettyIndent, indentLevel + 1);
+        values[i].writeValue(prettyIndent, indentLevel + 1, s);
         if (i != (values.size() - 1))
             s += ",";
         if (prettyIndent)
@@ -10,6 +10,7 @@
 #include <boost/shared_ptr.hpp>
 
 class CBlock;
+class CBlockIndex;
 struct CBlockLocator;
 class CReserveScript;
 class CTransaction;
@@ -29,8 +30,12 @@ void UnregisterAllValidationInterfaces();
 void SyncWithWallets(const CTransaction& tx, const CBlock* pblock = NULL);
 
 class CValidationInterface {
+public:
+    virtual ~CValidationInterface() {}
 protected:
     virtual void SyncTransaction(const CTransaction &tx, const CBlock *pblock) {}
+    virtual void BlockDisconnected(const CBlock &block) {}
+    virtual void UpdatedBlockTip(const CBlockIndex *pindex) {}
     virtual void SetBestChain(const CBlockLocator &locator) {}
     virtual void UpdatedTransaction(const uint256 &hash) {}
     virtual void Inventory(const uint256 &hash) {}
@@ -46,6 +51,10 @@ protected:
 struct CMainSignals {
     /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
     boost::signals2::signal<void (const CTransaction &, const CBlock *)> SyncTransaction;
+    /** Notifies listeners of a block disconnected from the tip of the active chain, before its transactions are synced again (called with cs_main held). */
+    boost::signals2::signal<void (const CBlock &)> BlockDisconnected;
+    /** Notifies listeners of a block connected to or disconnected from the tip of the active chain (called with cs_main held). */
+    boost::signals2::signal<void (const CBlockIndex *)> UpdatedBlockTip;
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
     boost::signals2::signal<void (const uint256 &)> UpdatedTransaction;
     /** Notifies listeners of a new active block chain. */